@@ -82,7 +82,7 @@ int main(int argc, char** argv)
 
     while ( exit_fut.wait_for(std::chrono::milliseconds(500)) != std::future_status::ready )
     {
-      wamp_args args({{coin_sides[distr(engine)]}});
+      wamp_args args{{coin_sides[distr(engine)]}};
       session->publish("coin_toss", {}, std::move(args)); // publish to topic "coin_toss"
     }
 
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/kernel.h"
+#include "wampcc/io_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+/*
+  Measure the throughput of io_loop::push_fn, which is the path taken by every
+  tcp_socket::write, when it is called concurrently from several user threads.
+  Each producer pushes a fixed number of small functions, and the time taken
+  is from the start of pushing until the IO thread has invoked all of them.
+
+  Usage: io_loop_push_bench [PUSHES_PER_THREAD]
+*/
+
+using namespace wampcc;
+
+static double run(kernel& k, int nthreads, size_t per_thread)
+{
+  io_loop* loop = k.get_io();
+
+  const size_t total = nthreads * per_thread;
+  size_t invoked = 0; /* only modified on the IO thread */
+  std::promise<void> done;
+
+  std::atomic<bool> go(false);
+  std::vector<std::thread> producers;
+  for (int i = 0; i < nthreads; i++)
+    producers.emplace_back([&]() {
+      while (!go)
+        std::this_thread::yield();
+      for (size_t j = 0; j < per_thread; j++)
+        loop->push_fn([&invoked, &done, total]() {
+          if (++invoked == total)
+            done.set_value();
+        });
+    });
+
+  auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (auto& t : producers)
+    t.join();
+  done.get_future().wait();
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv)
+{
+  size_t per_thread = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  kernel the_kernel({}, logger::nolog());
+
+  std::cout << std::setw(10) << "producers" << std::setw(14) << "pushes"
+            << std::setw(12) << "seconds" << std::setw(16) << "pushes/sec"
+            << std::endl;
+
+  for (int nthreads : {1, 2, 4, 8, 16}) {
+    double secs = run(the_kernel, nthreads, per_thread);
+    size_t total = nthreads * per_thread;
+    std::cout << std::setw(10) << nthreads << std::setw(14) << total
+              << std::setw(12) << std::fixed << std::setprecision(3) << secs
+              << std::setw(16) << std::setprecision(0) << (total / secs)
+              << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+/*
+  Count the allocations made when decoding a stream of WAMP messages, as a
+  session does for its inbound messages.  Each message is decoded either into
+  a new json_value, or over the value holding the previous message, whose
+  storage is then reused.  Reports allocations and nanoseconds per message.
+
+  Usage: json_decode_alloc_bench [MESSAGES]
+*/
+
+static size_t alloc_count = 0;
+
+void* operator new(size_t n)
+{
+  alloc_count++;
+  if (void* p = malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+using namespace wampcc;
+
+/* A mix of messages seen by a router: CALL, YIELD, PUBLISH and EVENT */
+static std::vector<json_value> message_stream()
+{
+  std::vector<json_value> msgs;
+  for (int i = 0; i < 100; i++) {
+    msgs.push_back(json_array{48, 1000 + i,
+                              json_object{{"disclose_me", true},
+                                          {"receive_progress", false}},
+                              "com.myapp.procedure.add_user",
+                              json_array{"johnny", i},
+                              json_object{{"firstname", "John"},
+                                          {"surname", "Doe"}}});
+    msgs.push_back(json_array{70, 2000 + i, json_object{},
+                              json_array{json_object{{"user_id", i},
+                                                     {"status", "created"}}}});
+    msgs.push_back(json_array{16, 3000 + i,
+                              json_object{{"acknowledge", true},
+                                          {"exclude_me", false}},
+                              "com.myapp.topic.instrument_prices",
+                              json_array{100.25 + i, 100.5 + i}});
+    msgs.push_back(json_array{36, 5512315355, 4000 + i,
+                              json_object{{"publisher", 1234}},
+                              json_array{100.25 + i, 100.5 + i}});
+  }
+  return msgs;
+}
+
+typedef std::function<void(json_value&, const std::vector<char>&)> decode_fn;
+
+static void run(const char* name, const std::vector<std::vector<char>>& stream,
+                size_t count, bool reuse, decode_fn decode)
+{
+  json_value msg;
+  size_t allocs_before = alloc_count;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < count; i++) {
+    if (!reuse)
+      msg = json_value();
+    decode(msg, stream[i % stream.size()]);
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(end - start).count();
+  double allocs = double(alloc_count - allocs_before) / count;
+
+  std::cout << std::setw(28) << std::left << name << std::right
+            << std::setw(10) << (reuse ? "reused" : "new")
+            << std::setw(14) << std::fixed << std::setprecision(2) << allocs
+            << std::setw(12) << std::setprecision(1) << (secs * 1e9 / count)
+            << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  std::vector<std::vector<char>> text, packed;
+  for (auto& msg : message_stream()) {
+    text.emplace_back();
+    json_encode(msg, text.back());
+    packed.emplace_back();
+    json_msgpack_encode(msg, packed.back());
+  }
+
+  decode_fn json_fn = [](json_value& dest, const std::vector<char>& src) {
+    json_decode(dest, src.data(), src.size());
+  };
+  decode_fn msgpack_fn = [](json_value& dest, const std::vector<char>& src) {
+    json_msgpack_decode(dest, src.data(), src.size());
+  };
+
+  std::cout << std::setw(28) << std::left << "decoder" << std::right
+            << std::setw(10) << "dest" << std::setw(14) << "allocs/msg"
+            << std::setw(12) << "ns/msg" << std::endl;
+
+  run("json", text, count, false, json_fn);
+  run("json", text, count, true, json_fn);
+  run("msgpack", packed, count, false, msgpack_fn);
+  run("msgpack", packed, count, true, msgpack_fn);
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+/*
+  Measure the cost of json_object in the operations a router performs on it:
+  decoding and encoding messages which carry option dicts, and looking up
+  option keys.  Decode and encode use json_object, so compare a build with
+  and without WAMPCC_JSON_FLAT_OBJECT.  Lookups are timed for both std::map and
+  json_flat_map in the same run.  Results are nanoseconds per operation.
+
+  Usage: json_object_bench [ITERATIONS]
+*/
+
+using namespace wampcc;
+
+/* PUBLISH message with a typical options dict */
+static const char* small_text =
+    "[16, 239714735, {\"acknowledge\": true, \"disclose_me\": true, "
+    "\"exclude_me\": false, \"_p\": 1}, \"com.myapp.mytopic1\", "
+    "[\"Hello, world!\"], {\"colour\": \"orange\", \"sizes\": [23, 42, 7]}]";
+
+static std::vector<std::string> small_keys()
+{
+  return {"acknowledge", "disclose_me", "exclude_me", "_p"};
+}
+
+static std::vector<std::string> large_keys()
+{
+  std::vector<std::string> keys;
+  for (int i = 0; i < 64; i++)
+    keys.push_back("field_" + std::to_string(i));
+  return keys;
+}
+
+/* EVENT message whose argument is an object of 'keys' */
+static std::string large_text()
+{
+  json_object kwargs;
+  int i = 0;
+  for (auto& key : large_keys())
+    kwargs[key] = i++;
+  return json_encode(json_array{36, 5512315355, 4429313566, json_object{},
+                                json_array{}, kwargs});
+}
+
+static double run(size_t iterations, const std::function<void()>& fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+static void report(const char* name, size_t iterations, double secs)
+{
+  std::cout << std::setw(28) << std::left << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(1)
+            << (secs * 1e9 / iterations) << std::endl;
+}
+
+template <typename M>
+static double time_lookups(const std::vector<std::string>& keys,
+                           size_t iterations)
+{
+  M obj;
+  for (auto& key : keys)
+    obj[key] = true;
+  std::string missing = "missing_key";
+
+  size_t found = 0;
+  double secs = run(iterations, [&]() {
+    for (auto& key : keys)
+      found += obj.find(key) != obj.end();
+    found += obj.find(missing) != obj.end();
+  });
+
+  if (found != iterations * keys.size())
+    std::cout << "unexpected lookup result" << std::endl;
+
+  /* per lookup */
+  return secs / (keys.size() + 1);
+}
+
+static void bench(const char* title, const std::string& text,
+                  const std::vector<std::string>& keys, size_t iterations)
+{
+  std::cout << title << ": " << text.size() << " bytes json, " << keys.size()
+            << " keys" << std::endl;
+  std::cout << std::setw(28) << std::left << "operation" << std::right
+            << std::setw(12) << "ns/op" << std::endl;
+
+  json_value msg;
+  std::vector<char> out;
+
+  report("json decode", iterations, run(iterations, [&]() {
+           json_decode(msg, text.data(), text.size());
+         }));
+
+  report("json encode", iterations, run(iterations, [&]() {
+           out.clear();
+           json_encode(msg, out);
+         }));
+
+  std::vector<char> packed;
+  json_msgpack_encode(msg, packed);
+
+  report("msgpack decode", iterations, run(iterations, [&]() {
+           json_msgpack_decode(msg, packed.data(), packed.size());
+         }));
+
+  report("msgpack encode", iterations, run(iterations, [&]() {
+           out.clear();
+           json_msgpack_encode(msg, out);
+         }));
+
+  report("lookup std::map", iterations,
+         time_lookups<std::map<std::string, json_value>>(keys, iterations));
+
+  report("lookup json_flat_map", iterations,
+         time_lookups<json_flat_map<json_value>>(keys, iterations));
+
+  std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t iterations = (argc > 1) ? atoi(argv[1]) : 500000;
+
+#ifdef WAMPCC_JSON_FLAT_OBJECT
+  std::cout << "json_object: json_flat_map" << std::endl << std::endl;
+#else
+  std::cout << "json_object: std::map" << std::endl << std::endl;
+#endif
+
+  bench("small message", small_text, small_keys(), iterations);
+  bench("large message", large_text(), large_keys(), iterations / 10 + 1);
+
+  return 0;
+}
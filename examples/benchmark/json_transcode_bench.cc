@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+/*
+  Measure the throughput of converting messages between JSON and msgpack, as a
+  router does when forwarding between sessions using different serialisers.
+  The direct transcoders are compared against decoding into a json_value and
+  encoding that with the other serialiser.  Throughput is in megabytes of
+  input per second.
+
+  Usage: json_transcode_bench [ITERATIONS]
+*/
+
+using namespace wampcc;
+
+/* CALL message with a few small arguments */
+static json_value small_message()
+{
+  return json_array{48, 7814135, json_object{},
+                    "com.myapp.user.new",
+                    json_array{"johnny"},
+                    json_object{{"firstname", "John"}, {"surname", "Doe"}}};
+}
+
+/* EVENT message with an argument holding a list of records */
+static json_value large_message()
+{
+  json_array rows;
+  for (int i = 0; i < 500; i++)
+    rows.push_back(json_object{{"id", i},
+                               {"name", "instrument " + std::to_string(i)},
+                               {"bid", 100.25 + i},
+                               {"ask", 100.5 + i},
+                               {"active", (i % 3) != 0},
+                               {"tags", json_array{"a", "b\tc", "d\"e"}}});
+  return json_array{36, 5512315355, 4429313566, json_object{},
+                    json_array{rows}};
+}
+
+static double run(size_t iterations, const std::function<void()>& fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+static void report(const char* name, size_t iterations, size_t bytes,
+                   double secs)
+{
+  std::cout << std::setw(28) << std::left << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(3) << secs
+            << std::setw(14) << std::setprecision(1)
+            << (iterations * bytes / secs / 1e6) << std::endl;
+}
+
+static void bench(const char* title, const json_value& msg, size_t iterations)
+{
+  std::vector<char> text;
+  json_encode(msg, text);
+  std::vector<char> packed;
+  json_msgpack_encode(msg, packed);
+
+  std::cout << title << ": " << text.size() << " bytes json, "
+            << packed.size() << " bytes msgpack" << std::endl;
+  std::cout << std::setw(28) << std::left << "method" << std::right
+            << std::setw(12) << "seconds" << std::setw(14) << "MB/sec"
+            << std::endl;
+
+  std::vector<char> out;
+  json_value tree;
+
+  report("json->msgpack via tree", iterations, text.size(),
+         run(iterations, [&]() {
+           json_decode(tree, text.data(), text.size());
+           out.clear();
+           json_msgpack_encode(tree, out);
+         }));
+
+  report("json->msgpack direct", iterations, text.size(),
+         run(iterations, [&]() {
+           out.clear();
+           json_to_msgpack(text.data(), text.size(), out);
+         }));
+
+  report("msgpack->json via tree", iterations, packed.size(),
+         run(iterations, [&]() {
+           json_msgpack_decode(tree, packed.data(), packed.size());
+           out.clear();
+           json_encode(tree, out);
+         }));
+
+  report("msgpack->json direct", iterations, packed.size(),
+         run(iterations, [&]() {
+           out.clear();
+           msgpack_to_json(packed.data(), packed.size(), out);
+         }));
+
+  std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t iterations = (argc > 1) ? atoi(argv[1]) : 200000;
+
+  bench("small message", small_message(), iterations);
+  bench("large message", large_message(), iterations / 1000 + 1);
+
+  return 0;
+}
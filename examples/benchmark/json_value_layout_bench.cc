@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+/*
+  Measure what the layout of json_value costs and saves.  Strings and arrays
+  are held inside the value, so WAMP messages, made of short strings and small
+  arrays, need fewer allocations; the price is a larger value, which shows in
+  bulk arrays of numbers.  Reports, for each case, allocations, bytes
+  allocated and nanoseconds per operation.
+
+  Usage: json_value_layout_bench [MESSAGES]
+*/
+
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+void* operator new(size_t n)
+{
+  alloc_count++;
+  alloc_bytes += n;
+  if (void* p = malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+using namespace wampcc;
+
+/* A CALL and an EVENT, as handled by a router */
+static std::vector<json_value> message_stream()
+{
+  std::vector<json_value> msgs;
+  for (int i = 0; i < 100; i++) {
+    msgs.push_back(json_array{48, 1000 + i,
+                              json_object{{"disclose_me", true},
+                                          {"receive_progress", false}},
+                              "com.myapp.procedure.add_user",
+                              json_array{"johnny", i},
+                              json_object{{"firstname", "John"},
+                                          {"surname", "Doe"}}});
+    msgs.push_back(json_array{36, 5512315355, 4000 + i,
+                              json_object{{"publisher", 1234}},
+                              json_array{100.25 + i, 100.5 + i, "EURUSD"}});
+  }
+  return msgs;
+}
+
+template <typename F> static void run(const char* name, size_t count, F fn)
+{
+  size_t allocs_before = alloc_count;
+  size_t bytes_before = alloc_bytes;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < count; i++)
+    fn(i);
+
+  auto end = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(end - start).count();
+
+  std::cout << std::setw(26) << std::left << name << std::right << std::fixed
+            << std::setw(12) << std::setprecision(2)
+            << double(alloc_count - allocs_before) / count << std::setw(12)
+            << std::setprecision(0) << double(alloc_bytes - bytes_before) / count
+            << std::setw(14) << std::setprecision(1) << (secs * 1e9 / count)
+            << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = (argc > 1) ? atoi(argv[1]) : 400000;
+  const size_t bulk = 100000;
+
+  std::vector<json_value> msgs = message_stream();
+  std::vector<std::vector<char>> text, packed;
+  for (auto& msg : msgs) {
+    text.emplace_back();
+    json_encode(msg, text.back());
+    packed.emplace_back();
+    json_msgpack_encode(msg, packed.back());
+  }
+
+  json_array numbers, strings;
+  for (size_t i = 0; i < bulk; i++) {
+    numbers.push_back(i * 1.5);
+    strings.push_back("sym" + std::to_string(i));
+  }
+
+  std::cout << "sizeof(json_value) " << sizeof(json_value) << std::endl;
+  std::cout << std::setw(26) << std::left << "operation" << std::right
+            << std::setw(12) << "allocs/op" << std::setw(12) << "bytes/op"
+            << std::setw(14) << "ns/op" << std::endl;
+
+  run("json decode message", count, [&](size_t i) {
+    const std::vector<char>& src = text[i % text.size()];
+    json_value msg = json_decode(src.data(), src.size());
+  });
+  run("msgpack decode message", count, [&](size_t i) {
+    const std::vector<char>& src = packed[i % packed.size()];
+    json_value msg;
+    json_msgpack_decode(msg, src.data(), src.size());
+  });
+  run("copy message", count, [&](size_t i) {
+    json_value copy(msgs[i % msgs.size()]);
+  });
+  run("copy 100k numbers", 20, [&](size_t) { json_array copy(numbers); });
+  run("copy 100k short strings", 20, [&](size_t) { json_array copy(strings); });
+
+  return 0;
+}
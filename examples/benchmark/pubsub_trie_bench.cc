@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/uri_trie.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+/*
+  Measure the cost of finding the pattern-based subscriptions which match a
+  published topic, as the broker does for each publish.  The uri_trie is
+  compared against testing each pattern in turn.  Patterns are half prefix,
+  like "md.quote.SYM123", and half wildcard, like "md..SYM123.bid".
+
+  Usage: pubsub_trie_bench [PATTERNS]
+*/
+
+using namespace wampcc;
+
+struct pattern
+{
+  std::string uri;
+  bool wildcard;
+};
+
+static bool matches_prefix(const std::string& pattern, const std::string& uri)
+{
+  return uri.compare(0, pattern.size(), pattern) == 0;
+}
+
+static bool matches_wildcard(const std::string& pattern, const std::string& uri)
+{
+  size_t p = 0, u = 0;
+  while (true) {
+    size_t pdot = pattern.find('.', p);
+    size_t udot = uri.find('.', u);
+    size_t plen = (pdot == std::string::npos) ? pattern.size() - p : pdot - p;
+    size_t ulen = (udot == std::string::npos) ? uri.size() - u : udot - u;
+    if (plen && (plen != ulen || pattern.compare(p, plen, uri, u, ulen) != 0))
+      return false;
+    if (pdot == std::string::npos || udot == std::string::npos)
+      return pdot == udot;
+    p = pdot + 1;
+    u = udot + 1;
+  }
+}
+
+static double run(size_t iterations, const std::function<void(size_t)>& fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    fn(i);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+static void report(const char* name, size_t iterations, size_t matches,
+                   double secs)
+{
+  std::cout << std::setw(16) << std::left << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(3) << secs
+            << std::setw(14) << std::setprecision(1)
+            << (secs / iterations * 1e9) << std::setw(10) << matches
+            << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = (argc > 1) ? atoi(argv[1]) : 100000;
+
+  std::vector<pattern> patterns;
+  uri_trie<pattern> trie;
+  for (size_t i = 0; i < count / 2; i++)
+    patterns.push_back({"md.quote.SYM" + std::to_string(i), false});
+  for (size_t i = 0; i < count - count / 2; i++)
+    patterns.push_back({"md..SYM" + std::to_string(i) + ".bid", true});
+  for (auto& p : patterns) {
+    if (p.wildcard)
+      trie.insert_wildcard(p.uri, &p);
+    else
+      trie.insert_prefix(p.uri, &p);
+  }
+
+  /* topics matching a prefix pattern, some also a wildcard pattern */
+  std::vector<std::string> topics;
+  for (size_t i = 0; i < 1000; i++) {
+    std::string sym = "SYM" + std::to_string((i * 7919) % (count / 2));
+    topics.push_back("md.quote." + sym + ((i % 2) ? ".bid" : ".ask"));
+  }
+
+  std::cout << patterns.size() << " patterns" << std::endl;
+  std::cout << std::setw(16) << std::left << "method" << std::right
+            << std::setw(12) << "seconds" << std::setw(14) << "ns/publish"
+            << std::setw(10) << "matches" << std::endl;
+
+  size_t found = 0;
+  size_t iterations = 200000;
+  double secs = run(iterations, [&](size_t i) {
+    trie.match(topics[i % topics.size()], [&](pattern*) { found++; });
+  });
+  report("uri_trie", iterations, found / iterations, secs);
+
+  found = 0;
+  iterations = 200;
+  secs = run(iterations, [&](size_t i) {
+    const std::string& topic = topics[i % topics.size()];
+    for (auto& p : patterns)
+      if (p.wildcard ? matches_wildcard(p.uri, topic)
+                     : matches_prefix(p.uri, topic))
+        found++;
+  });
+  report("linear scan", iterations, found / iterations, secs);
+
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/protocol.h"
+#include "wampcc/json.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  Count the allocations made when framing a stream of outbound messages, as a
+  protocol does for each message it sends.  Each message is encoded into an
+  output_sink, a four byte header is prepended and the frame is released.  A
+  number of frames are held, as if waiting for their writes to complete, before
+  being dropped.  The sink's buffer is either new for each message, or taken
+  from a sink_pool.  Reports allocations and nanoseconds per message.
+
+  Usage: sink_pool_bench [MESSAGES] [FRAMES_IN_FLIGHT]
+*/
+
+static size_t alloc_count = 0;
+
+void* operator new(size_t n)
+{
+  alloc_count++;
+  if (void* p = malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+using namespace wampcc;
+
+typedef std::function<void(const json_array&, std::vector<char>&)> encode_fn;
+
+static void run(const char* name, const json_array& msg, size_t count,
+                size_t in_flight, sink_pool* pool, encode_fn encode)
+{
+  std::vector<shared_buffer> pending(in_flight);
+  size_t allocs_before = alloc_count;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < count; i++) {
+    output_sink sink(4, pool);
+    encode(msg, sink.bytes());
+    uint32_t len = sink.payload_size();
+    memcpy(sink.prepend(4), &len, 4);
+
+    /* replacing the oldest frame drops it, as when its write completes */
+    pending[i % in_flight] = sink.release();
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(end - start).count();
+  double allocs = double(alloc_count - allocs_before) / count;
+
+  std::cout << std::setw(12) << std::left << name << std::right
+            << std::setw(12) << (pool ? "sink_pool" : "new")
+            << std::setw(14) << std::fixed << std::setprecision(2) << allocs
+            << std::setw(12) << std::setprecision(1) << (secs * 1e9 / count)
+            << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t count = (argc > 1) ? atoi(argv[1]) : 1000000;
+  size_t in_flight = (argc > 2) ? atoi(argv[2]) : 8;
+
+  /* an EVENT, as sent by a router to each subscriber */
+  json_array msg{36, 5512315355, 4000, json_object{{"publisher", 1234}},
+                 json_array{"com.myapp.topic.instrument_prices", 100.25,
+                            100.5}};
+
+  /* encode as the codecs do, writing the array without copying it */
+  encode_fn json_fn = [](const json_array& src, std::vector<char>& dest) {
+    json_encode_spliced(src, nullptr, 0, dest);
+  };
+  encode_fn msgpack_fn = [](const json_array& src, std::vector<char>& dest) {
+    json_msgpack_encode_spliced(src, nullptr, 0, 0, dest);
+  };
+
+  std::cout << in_flight << " frames in flight" << std::endl;
+  std::cout << std::setw(12) << std::left << "encoder" << std::right
+            << std::setw(12) << "buffer" << std::setw(14) << "allocs/msg"
+            << std::setw(12) << "ns/msg" << std::endl;
+
+  sink_pool pool;
+  run("json", msg, count, in_flight, nullptr, json_fn);
+  run("json", msg, count, in_flight, &pool, json_fn);
+  run("msgpack", msg, count, in_flight, nullptr, msgpack_fn);
+  run("msgpack", msg, count, in_flight, &pool, msgpack_fn);
+
+  return 0;
+}
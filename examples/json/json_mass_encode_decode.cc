@@ -1,69 +1,228 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
 #include "wampcc/json.h"
 
+#include "jansson.h" // place after json.h, else MSVC++ complains
+
+#include <chrono>
 #include <iostream>
-#include <stdint.h>
+#include <iomanip>
+#include <vector>
 
-#include <limits>
-#include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
+
+/*
+  Compare the cost of JSON encoding and decoding using the native encoder and
+  decoder against the earlier paths via jansson.  Encoding previously converted
+  the json_value into a jansson tree, dumped that to a string, and then copied
+  the string into the vector handed to the socket.  Decoding parsed into a
+  jansson tree which was then converted node by node into a json_value.  Both
+  paths are checked to produce the same results before being timed.
+
+  Usage: json_mass_encode_decode [ITERATIONS]
+*/
+
+/* The json_value to jansson conversion, as previously used by json_encode. */
+static json_t* to_jansson(const wampcc::json_value& src)
+{
+  switch (src.type()) {
+    case wampcc::eOBJECT: {
+      json_t* jobj = json_object();
+      for (auto& item : src.as_object())
+        json_object_set_new(jobj, item.first.c_str(), to_jansson(item.second));
+      return jobj;
+    }
+    case wampcc::eARRAY: {
+      json_t* jarray = json_array();
+      for (auto& item : src.as_array())
+        json_array_append_new(jarray, to_jansson(item));
+      return jarray;
+    }
+    case wampcc::eSTRING:
+      return json_stringn(src.as_string().c_str(), src.as_string().size());
+    case wampcc::eREAL:
+      return json_real(src.as_real());
+    case wampcc::eINTEGER:
+      return json_integer(src.is_int() ? src.as_int()
+                                       : (json_int_t)src.as_uint());
+    case wampcc::eBOOL:
+      return src.as_bool() ? json_true() : json_false();
+    default:
+      return json_null();
+  }
+}
+
+static std::vector<char> jansson_encode(const wampcc::json_value& src)
+{
+  json_t* json = to_jansson(src);
+  char* str = json_dumps(json, 0);
+  json_decref(json);
+  size_t len = strlen(str);
+  std::vector<char> retval(len);
+  memcpy(retval.data(), str, len);
+  free(str);
+  return retval;
+}
+
+/* The jansson to json_value conversion, as previously used by json_decode. */
+static wampcc::json_value from_jansson(json_t* j)
+{
+  switch (json_typeof(j)) {
+    case JSON_OBJECT: {
+      wampcc::json_value rv = wampcc::json_value::make_object();
+      const char* key;
+      json_t* value;
+      json_object_foreach(j, key, value)
+        rv.as_object()[key] = from_jansson(value);
+      return rv;
+    }
+    case JSON_ARRAY: {
+      wampcc::json_value rv = wampcc::json_value::make_array();
+      size_t index;
+      json_t* value;
+      json_array_foreach(j, index, value)
+        rv.as_array().push_back(from_jansson(value));
+      return rv;
+    }
+    case JSON_STRING:
+      return wampcc::json_value(json_string_value(j), json_string_length(j));
+    case JSON_INTEGER:
+      return wampcc::json_value(json_integer_value(j));
+    case JSON_REAL:
+      return wampcc::json_value(json_real_value(j));
+    case JSON_TRUE:
+      return wampcc::json_value(true);
+    case JSON_FALSE:
+      return wampcc::json_value(false);
+    default:
+      return wampcc::json_value();
+  }
+}
+
+static wampcc::json_value jansson_decode(const std::vector<char>& src)
+{
+  json_error_t error;
+  json_t* json = json_loadb(src.data(), src.size(), 0, &error);
+  wampcc::json_value retval = from_jansson(json);
+  json_decref(json);
+  return retval;
+}
+
+/* A message typical of WAMP traffic: an EVENT with a small payload. */
+static wampcc::json_value build_event()
+{
+  wampcc::json_array msg;
+  msg.push_back(36);
+  msg.push_back(5512315355);
+  msg.push_back(4429313566);
+  wampcc::json_object details;
+  details["topic"] = "com.myapp.mytopic1";
+  msg.push_back(std::move(details));
+  msg.push_back(wampcc::json_array({"Hello, world!", 23, 0.25, true}));
+  wampcc::json_object kwargs;
+  kwargs["color"] = "orange";
+  kwargs["sizes"] = wampcc::json_array({23, 42, 7});
+  kwargs["note"] = "line one\nline \"two\"\t\\ end";
+  kwargs["price"] = 1234.5;
+  msg.push_back(std::move(kwargs));
+  return msg;
+}
 
-wampcc::json_value build_json()
+/* A larger, nested document. */
+static wampcc::json_value build_nested()
 {
   wampcc::json_value v = wampcc::json_value::make_array();
-  v.as<wampcc::json_array>().push_back( 1 );
-  v.as<wampcc::json_array>().push_back( 1.1 );
-  v.as<wampcc::json_array>().push_back( "this is a string" );
-  v.as<wampcc::json_array>().push_back( wampcc::json_object() );
-  v.as<wampcc::json_array>().push_back( v );
-  v.as<wampcc::json_array>().push_back( v );
-  v.as<wampcc::json_array>().push_back( v );
-  v.as<wampcc::json_array>().push_back( v );
-
-  wampcc::json_object & obj = v.append_object();
+  v.as_array().push_back(1);
+  v.as_array().push_back(1.5);
+  v.as_array().push_back("this is a string");
+  v.as_array().push_back(wampcc::json_object());
+  for (int i = 0; i < 4; i++)
+    v.as_array().push_back(v);
+  wampcc::json_object& obj = v.append_object();
   obj["one"] = v;
   obj["two"] = v;
-  v.as<wampcc::json_array>().push_back( v );
-
+  v.as_array().push_back(v);
   return v;
 }
 
+template <typename F> static double time_it(size_t iterations, F fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
 
-int strlen_total  = 0;
+static void report(const char* name, size_t bytes, size_t iterations,
+                   double t_jansson, double t_native)
+{
+  double mb = double(bytes) * iterations / (1024 * 1024);
+  std::cout << std::setw(14) << name << std::setw(10) << bytes << std::fixed
+            << std::setprecision(1) << std::setw(14) << (mb / t_jansson)
+            << std::setw(14) << (mb / t_native) << std::setw(10)
+            << std::setprecision(2) << (t_jansson / t_native) << "x"
+            << std::endl;
+}
 
-wampcc::json_value test()
+static void compare(const char* name, const wampcc::json_value& v,
+                    size_t iterations)
 {
-  wampcc::json_value v = build_json();
-  std::string enc = wampcc::json_encode(v.as<wampcc::json_array>()  );
-  std::cout << enc << "\n";
+  std::vector<char> reference = jansson_encode(v);
+  std::vector<char> native;
+  wampcc::json_encode(v, native);
 
-  int count = 0;
-  wampcc::json_value rv;
+  if (native != reference || jansson_decode(native) != v ||
+      wampcc::json_decode(native.data(), native.size()) != v) {
+    std::cout << name << ": results differ" << std::endl;
+    exit(1);
+  }
 
-  while (count < 100)
-  {
-    // encode
-    wampcc::json_value v = build_json();
-    wampcc::json_encode(v.as<wampcc::json_array>()  );
+  size_t total = 0;
+  double t_jansson = time_it(iterations, [&]() {
+    total += jansson_encode(v).size();
+  });
 
-    // decode
-    wampcc::json_decode(rv, enc.c_str());
+  std::vector<char> buf;
+  double t_native = time_it(iterations, [&]() {
+    buf.clear();
+    wampcc::json_encode(v, buf);
+    total += buf.size();
+  });
 
-    std::string s =  wampcc::json_encode( v );
-    strlen_total += s.size();
+  report((std::string(name) + " encode").c_str(), native.size(), iterations,
+         t_jansson, t_native);
 
-    std::cout << "loop #" << count++ << "\n";
-    usleep(10000);
-  }
+  t_jansson = time_it(iterations, [&]() {
+    total += jansson_decode(native).is_array();
+  });
 
-  return rv;
+  wampcc::json_value decoded;
+  t_native = time_it(iterations, [&]() {
+    wampcc::json_decode(decoded, native.data(), native.size());
+    total += decoded.is_array();
+  });
+
+  report((std::string(name) + " decode").c_str(), native.size(), iterations,
+         t_jansson, t_native);
 }
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
-  wampcc::json_value v = test();
-  std::string enc = wampcc::json_encode(v.as<wampcc::json_array>());
-  std::cout << enc << "\n";
-  std::cout << strlen_total << "\n";
+  size_t iterations = (argc > 1) ? atoi(argv[1]) : 200000;
+
+  std::cout << std::setw(14) << "message" << std::setw(10) << "bytes"
+            << std::setw(14) << "jansson MB/s" << std::setw(14)
+            << "native MB/s" << std::setw(11) << "speedup" << std::endl;
+
+  compare("event", build_event(), iterations);
+  compare("nested", build_nested(), iterations / 100);
+
   return 0;
 }
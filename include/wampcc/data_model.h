@@ -201,6 +201,37 @@ private:
 };
 
 
+/* A model of an arbitrary JSON document.  Each change is published as the
+ * JSON Patch generated by json_diff, so a small edit of a large document
+ * sends only what changed.  Can be followed with a jmodel_subscription. */
+class json_model : public data_model
+{
+public:
+  json_model() = default;
+  json_model(json_value);
+  json_model(const json_model&);
+
+  /** Get a copy of the document.  The document is held shared (see
+   * json_value::share), so this does not copy its content. */
+  json_value value() const;
+
+  json_value snapshot() const override;
+
+  // Rich API for modifying model state
+  void assign(json_value);
+
+  /** Apply 'fn' to a copy of the document, then assign the result.  Only the
+   * parts of the document which 'fn' writes to are copied. */
+  void modify(std::function<void(json_value&)> fn);
+
+private:
+  void assign_impl(json_value);
+
+  json_value         m_value;
+  mutable std::mutex m_value_mutex;
+};
+
+
 /* */
 class list_model : public data_model
 {
@@ -9,22 +9,116 @@
 #define WAMPCC_EVENT_LOOP_H
 
 #include "wampcc/utils.h"
+#include "wampcc/task.h"
+#include "wampcc/kernel.h"
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <thread>
-#include <list>
-#include <map>
+#include <vector>
+
+#include <stdint.h>
 
 namespace wampcc
 {
 
 class kernel;
-struct event;
 struct logger;
 
+/** Hierarchical timer wheel, with a resolution of one tick.  Each level has
+ * 256 slots, with each slot of a level spanning a full revolution of the level
+ * below; timers are placed in the lowest level that can hold them, and are
+ * moved down a level each time the level below completes a revolution.
+ * Scheduling and cancelling a timer is O(1).  Timers are stored in a slab of
+ * nodes, addressed by slot & generation, so that stale identifiers are
+ * detected.  Not thread safe. */
+class timer_wheel
+{
+public:
+  typedef std::function<std::chrono::milliseconds()> timer_fn;
+  typedef uint64_t tick_type;
+
+  struct timer_id
+  {
+    uint32_t slot;
+    uint32_t generation;
+  };
+
+  static const unsigned level_bits = 8;
+  static const unsigned level_count = 4;
+  static const uint32_t slots_per_level = 1u << level_bits;
+
+  timer_wheel();
+
+  /** Number of timers scheduled or awaiting invocation. */
+  size_t size() const { return m_active; }
+
+  /** Add a timer due at the given tick; due ticks which are not in the future
+   * are treated as due at the next tick. */
+  timer_id schedule(tick_type due, timer_fn fn);
+
+  /** Cancel a timer.  A timer which has expired but not yet begun running is
+   * discarded; a timer which is running is prevented from rescheduling. */
+  bool cancel(timer_id);
+
+  /** Advance the wheel to tick 'now', appending the expired timers to
+   * 'expired'.  Expired timers must later be run via begin_run. */
+  void advance(tick_type now, std::vector<timer_id>& expired);
+
+  /** Earliest tick at which advance() should next be called; only valid when
+   * size() is non zero. */
+  tick_type next_wakeup() const;
+
+  /** Take the function of an expired timer, prior to invoking it.  Returns
+   * false if the timer was cancelled after it expired. */
+  bool begin_run(timer_id, timer_fn&);
+
+  /** Conclude a run of a timer, either releasing it, or rescheduling it with
+   * the function to invoke upon the next expiry. */
+  void complete(timer_id);
+  void reschedule(timer_id, timer_fn, tick_type due);
+
+private:
+  static const uint32_t npos = 0xFFFFFFFF;
+
+  enum class node_state { unused, scheduled, expired, running, cancelled };
+
+  struct node
+  {
+    timer_fn fn;
+    tick_type due;
+    uint32_t generation;
+    uint32_t prev;
+    uint32_t next; /* next in bucket or in free list */
+    uint32_t bucket;
+    node_state state;
+  };
+
+  node* lookup(timer_id);
+  uint32_t allocate();
+  void release(uint32_t);
+  void link(uint32_t);
+  void unlink(uint32_t);
+  void cascade(unsigned level);
+
+  struct bucket
+  {
+    uint32_t head;
+    uint32_t tail;
+  };
+
+  std::vector<node> m_nodes;
+  std::vector<bucket> m_buckets;
+  uint32_t m_free;
+  size_t m_active;
+  size_t m_linked;
+  tick_type m_now;
+};
+
+
 /** Event thread */
 class event_loop
 {
@@ -39,41 +133,87 @@ public:
   event_loop& operator=(const event_loop&) = delete;
   ~event_loop();
 
-  /** Perform synchronous stop of the event loop.  On return, the EV thread will
-   * have been joined. */
+  /** Perform synchronous stop of the event loop.  On return, the EV threads
+   * will have been joined. */
   void sync_stop();
 
-  /** Post a function object that is later invoked on the event thread. */
-  void dispatch(std::function<void()> fn);
+  /** Post a function object that is later invoked on an event thread.  The
+   * function object need only be move constructible.  When the loop has
+   * several threads, functions may run concurrently and out of order; use a
+   * strand where ordering is required. */
+  void dispatch(task fn);
+
+  /** Post a timer function which is invoked after the elapsed time.  The
+   * returned handle can be used to cancel the timer. */
+  timer_handle dispatch(std::chrono::milliseconds, timer_fn fn);
 
-  /** Post a timer function which is invoked after the elapsed time. */
-  void dispatch(std::chrono::milliseconds, timer_fn fn);
+  /** Cancel a timer; see timer_handle::cancel. */
+  bool cancel(const timer_handle&);
 
-  /** Determine whether the current thread is the EV thread. */
+  /** Determine whether the current thread is an EV thread of this loop. */
   bool this_thread_is_ev() const;
 
+  /** Number of EV worker threads. */
+  size_t thread_count() const { return m_thread_count; }
+
 private:
+  friend class strand;
+
+  void run_task(task&);
 
   void handle_exception(const char* stage);
   void eventloop();
   void eventmain();
-
-  void dispatch(std::chrono::milliseconds, std::shared_ptr<event>);
+  void run_timer(timer_wheel::timer_id);
+  timer_wheel::tick_type to_tick(std::chrono::steady_clock::time_point) const;
 
   kernel* m_kernel;
   logger& __logger; /* name chosen for log macros */
 
-  bool m_continue;
+  const size_t m_thread_count;
+  std::atomic<bool> m_continue;
 
-  std::list<std::shared_ptr<event>> m_queue;
+  task_ring m_queue;
   std::mutex m_mutex;
   std::condition_variable m_condvar;
-  std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<event>>
-      m_schedule;
+  const std::chrono::steady_clock::time_point m_epoch; /* tick zero */
+  timer_wheel m_timers;
+  std::vector<timer_wheel::timer_id> m_expired;
+  timer_wheel::tick_type m_wakeup; /* while EV thread sleeps, its wake tick */
 
-  synchronized_optional<std::thread::id> m_thread_id;
+  std::vector<std::thread> m_threads;
+};
 
-  std::thread m_thread; // prefer as final member, avoid race conditions
+
+/** Sequence of tasks to run on an event_loop, such that tasks posted to the
+ * same strand are invoked in the order posted and never concurrently, while
+ * tasks on different strands can run in parallel on the EV worker threads.
+ * Tasks still outstanding when the strand is deleted are still invoked.  For a
+ * single threaded event_loop a strand simply posts directly to the loop. */
+class strand
+{
+public:
+  explicit strand(event_loop*);
+
+  strand(const strand&) = delete;
+  strand& operator=(const strand&) = delete;
+
+  void dispatch(task fn);
+
+private:
+  struct state
+  {
+    event_loop* loop;
+    std::mutex lock;
+    task_ring pending;
+    task_ring running;
+    bool scheduled;
+  };
+
+  static void run(std::shared_ptr<state>);
+
+  event_loop* m_loop;
+  std::shared_ptr<state> m_state; /* only used for multi threaded loop */
 };
 
 } // namespace wampcc
@@ -10,6 +10,7 @@
 
 #include "wampcc/utils.h"
 #include "wampcc/error.h"
+#include "wampcc/task.h"
 
 #include <thread>
 #include <vector>
@@ -67,8 +68,8 @@ public:
 };
 
 
-/* Encapsulate the IO services.  Currently this provides a single instance of
- * the libuv even loop and IO thread. */
+/* Encapsulate the IO services.  Each instance provides a single libuv event
+ * loop and the IO thread that runs it; a kernel owns one or more io_loops. */
 class io_loop
 {
 public:
@@ -84,9 +85,10 @@ public:
   void cancel_connect(uv_tcp_t*);
 
   /** Push a function for later invocation on the IO thread.  Throws
-   * io_loop_closed if the IO loop is closing or closed.
+   * io_loop_closed if the IO loop is closing or closed.  Functions are invoked
+   * in the order they were pushed.
    */
-  void push_fn(std::function<void()>);
+  void push_fn(task);
 
   uv_loop_t* uv_loop() { return m_uv_loop; }
 
@@ -96,6 +98,11 @@ public:
   /** Test whether current thread is the IO thread */
   bool this_thread_is_io() const;
 
+  /** Return memory into which a socket serviced by this loop can read inbound
+   * bytes.  The memory is shared by all sockets of the loop, and so is only
+   * valid until the read callback has returned.  IO thread only. */
+  uv_buf_t read_buffer(size_t suggested_size);
+
 private:
   void run_loop();
 
@@ -108,12 +115,22 @@ private:
   uv_loop_t* m_uv_loop;
   std::unique_ptr<uv_async_t> m_async;
 
-  enum state { open, closing, closed } m_pending_requests_state;
-  std::vector<std::unique_ptr<io_request>> m_pending_requests;
-  std::mutex m_pending_requests_lock;
+  enum state { open, closing, closed };
+  std::atomic<int> m_pending_requests_state;
+
+  /* Requests pushed by any thread, held as a lock-free stack (most recent
+   * first) which the IO thread takes as a whole. Only a push onto an empty
+   * stack needs to wake the IO thread. */
+  std::atomic<io_request*> m_pending_requests;
+
+  /* Number of threads inside push_request, so that the IO thread can wait for
+   * requests that were accepted while the loop was being closed. */
+  std::atomic<int> m_pushers;
 
   synchronized_optional<std::thread::id> m_io_thread_id;
 
+  std::vector<char> m_read_buffer;
+
   std::thread m_thread; // prefer as final member, avoid race condition
 };
 
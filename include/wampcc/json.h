@@ -8,6 +8,7 @@
 #ifndef __WAMPCC_JALSON_H__
 #define __WAMPCC_JALSON_H__
 
+#include <atomic>
 #include <limits>
 #include <map>
 #include <stdexcept>
@@ -25,6 +26,8 @@
 
 #include <stdint.h>
 
+#include "wampcc/json_flat_map.h"
+
 namespace wampcc
 {
 
@@ -149,13 +152,19 @@ public:
 //
 // Container types
 //
-// JSON container types are just the usual STL types.
+// JSON container types are just the usual STL types, except that json_object
+// can instead be built as the flat map of json_flat_map.h, by defining
+// WAMPCC_JSON_FLAT_OBJECT for the library and every program using it.
 //
 // ======================================================================
 
 class json_value;
 typedef std::vector<json_value> json_array;
+#ifdef WAMPCC_JSON_FLAT_OBJECT
+typedef json_flat_map<json_value> json_object;
+#else
 typedef std::map<std::string, json_value> json_object;
+#endif
 typedef std::string json_string;
 
 // integer types used internally within jalson - platform widest
@@ -195,6 +204,9 @@ public:
   json_value(const std::string&);
   json_value(const json_array&);
   json_value(const json_object&);
+  json_value(std::string&&);
+  json_value(json_array&&);
+  json_value(json_object&&);
 
   /* equality */
 
@@ -309,9 +321,29 @@ public:
   void swap(json_value&);
   void swap(json_value&&);
 
+  /* Copy-on-write sharing.  share() moves the strings, arrays and objects
+   * within this value into reference counted nodes, after which copying the
+   * value, or any part of it, is a count increment rather than a deep copy.
+   * Shared values are immutable: any non-const access (as_object(),
+   * operator[], etc) first detaches the value being accessed, copying just
+   * that one level, or taking it when no other copy remains.  make_unique()
+   * detaches explicitly.  Like assignment, share() invalidates references
+   * previously obtained into the value.  Copies may be used and released from
+   * different threads. */
+  void share();
+  void make_unique();
+  bool is_shared() const { return m_impl.is_shared(); }
+
   /* Apply a JSON Patch (IETF RFC 6902). Can throw bad_pointer and
-   * bad_patch. Returns true if patch successfully applied. */
+   * bad_patch. Returns true if patch successfully applied, else the value is
+   * left unchanged.  The patch is applied in place.  For a patch of several
+   * operations the value is shared (see share()), so that the state to roll
+   * back to costs no deep copy, which invalidates references into the
+   * value.  The rvalue overload moves
+   * the values out of the patch rather than copying them, leaving the patch
+   * in an unspecified state. */
   bool patch(const json_array&);
+  bool patch(json_array&&);
 
   /* Evaulate a JSON Pointer (IETF RFC 6902). Return a pointer to the value
    * identified by the JSON Pointer, or null if not found. If the JSON Pointer
@@ -350,6 +382,38 @@ private:
 
 std::ostream& operator<<(std::ostream&, const json_value&);
 
+/* A JSON Pointer (IETF RFC 6901) parsed once into its reference tokens, so
+ * that it can be evaluated repeatedly in O(depth) without allocation.  The
+ * constructor throws bad_pointer if the pointer has illegal syntax. */
+class compiled_json_pointer
+{
+public:
+  struct reference_token
+  {
+    std::string name; /* unescaped */
+    size_t index;     /* array index denoted, else one of the values below */
+  };
+
+  static const size_t npos = static_cast<size_t>(-1); /* not an index */
+  static const size_t end_index = npos - 1;           /* the token "-" */
+
+  explicit compiled_json_pointer(const std::string& json_pointer);
+  explicit compiled_json_pointer(const char* json_pointer);
+
+  /* Return a pointer to the value identified, or null if not found.  Throws
+   * bad_pointer if a token that is not an index is applied to an array. */
+  const json_value* eval(const json_value& doc) const;
+  json_value* eval(json_value& doc) const;
+
+  const std::string& str() const { return m_str; }
+  size_t size() const { return m_tokens.size(); }
+  const reference_token& operator[](size_t i) const { return m_tokens[i]; }
+
+private:
+  std::string m_str;
+  std::vector<reference_token> m_tokens;
+};
+
 /** Make a copy of 'src' and add to the array, returning a reference to the
  * newly created json_value. */
 template <typename T> json_value& json_append(json_array& arr, const T& src)
@@ -410,6 +474,15 @@ json_value json_get_copy(
     const json_array&, size_t i,
     const json_value& default_value_ref = json_value::make_null());
 
+/* Generate a JSON Patch (IETF RFC 6902) which, applied to 'before', gives
+ * 'after'.  Only the members and elements which differ are in the patch;
+ * arrays are compared by longest common subsequence, so an element inserted
+ * into or removed from a list is a single operation.  A container mostly
+ * changed is replaced whole.  'path' is a JSON Pointer prefixed to each
+ * operation's path, for when the values lie within a larger document. */
+json_array json_diff(const json_value& before, const json_value& after,
+                     const std::string& path = "");
+
 /* Encode & decode functions */
 
 /* Encode a JSON value into a JSON-text serialised representation. The JSON
@@ -419,8 +492,18 @@ json_value json_get_copy(
 std::string json_encode(const json_value& src);
 std::string json_encode_any(const json_value& src);
 
+/* Encode a JSON value, appending the JSON-text to 'dest'.  The text is written
+ * directly into the destination buffer, so reusing a buffer across calls avoids
+ * any allocation once it has grown large enough. */
+void json_encode(const json_value& src, std::vector<char>& dest);
+void json_encode(const json_value& src, std::string& dest);
+
 /* Decode into 'dest' out parameters, which on legacy C++ reduces the amount of
- * memory being copied.
+ * memory being copied.  The decoded value is written over what 'dest' already
+ * holds, keeping the storage of strings, arrays and object members where the
+ * old value has the same type and is not shared; so decoding a stream of
+ * similar messages into the same json_value makes few allocations.  If
+ * decoding fails 'dest' is left holding an unspecified value.
  */
 void json_decode(json_value& dest, const char*, size_t);
 void json_decode(json_value& dest, const char*);
@@ -428,6 +511,31 @@ void json_decode(json_value& dest, const char*);
 json_value json_decode(const char*, size_t);
 json_value json_decode(const char*);
 
+/* Partial decoding, so that the trailing elements of an array can be forwarded
+ * in their serialised form.  Only the leading elements of the top-level array
+ * are decoded into 'dest'; how many is obtained by passing the first element
+ * to the head-size function.  Remaining elements are fully validated but not
+ * built, and are located by the returned json_array_tail.  Elements already in
+ * 'dest' are decoded over, as for json_decode, and any extra are removed. */
+struct json_array_tail
+{
+  size_t offset; /* start of the first undecoded element */
+  size_t length; /* from offset to the end of the last undecoded element */
+  size_t count;  /* number of undecoded elements */
+  JSONType first_type; /* types of the first & last undecoded elements */
+  JSONType last_type;
+};
+
+typedef size_t (*json_head_size_fn)(const json_value& first);
+
+json_array_tail json_decode_head(json_array& dest, const char*, size_t,
+                                 json_head_size_fn);
+
+/* Encode an array made of the elements of 'head' followed by the 'len' bytes
+ * of already serialised elements at 'tail', as located by json_decode_head. */
+void json_encode_spliced(const json_array& head, const char* tail, size_t len,
+                         std::vector<char>& dest);
+
 // implementation of inline methods
 inline json_array& json_value::append_array()
 {
@@ -449,14 +557,39 @@ inline json_array& json_value::insert_array(const std::string& key)
   return json_insert<json_array>(this->as<json_object>(), key);
 }
 
-/* Decode a msgpack byte stream */
+/* Decode a msgpack byte stream.  As for json_decode, decoding into 'dest'
+ * reuses the storage of the value it holds. */
 json_value json_msgpack_decode(const char*, size_t);
+void json_msgpack_decode(json_value& dest, const char*, size_t);
 
 /* Encode to msgpack.  Returned memory region is managed by unique_ptr. */
 typedef std::pair<char*, size_t> region;
 std::unique_ptr<region, void (*)(region*)> json_msgpack_encode(
     const json_value& src);
 
+/* Encode to msgpack, appending the bytes to 'dest'.  Reusing a buffer across
+ * calls avoids any allocation once it has grown large enough. */
+void json_msgpack_encode(const json_value& src, std::vector<char>& dest);
+
+/* msgpack equivalents of json_decode_head & json_encode_spliced; for msgpack
+ * the count of serialised tail elements must also be given. */
+json_array_tail json_msgpack_decode_head(json_array& dest, const char*, size_t,
+                                         json_head_size_fn);
+void json_msgpack_encode_spliced(const json_array& head, const char* tail,
+                                 size_t len, size_t count,
+                                 std::vector<char>& dest);
+
+/* Transcode between JSON text and msgpack in a single pass, without building a
+ * json_value, appending the output to 'dest'.  The output is as if decoded and
+ * encoded again, except that object members keep their order of arrival.  The
+ * tail variants convert the undecoded elements of an array, as located by
+ * json_decode_head or json_msgpack_decode_head, for splicing into a message
+ * of the other format. */
+void json_to_msgpack(const char*, size_t, std::vector<char>& dest);
+void msgpack_to_json(const char*, size_t, std::vector<char>& dest);
+void json_to_msgpack_tail(const char*, size_t, std::vector<char>& dest);
+void msgpack_to_json_tail(const char*, size_t, std::vector<char>& dest);
+
 } // namespace
 
 #endif
@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef __WAMPCC_JSON_FLAT_MAP_H__
+#define __WAMPCC_JSON_FLAT_MAP_H__
+
+// ======================================================================
+//
+// Alternative json_object container
+// ---------------------------------
+//
+// This file should not be directly included in any files (other than json.h)
+//
+// ======================================================================
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+namespace wampcc
+{
+
+/* Map of string keys to values, held as a vector of entries sorted by key.
+ * Most JSON objects exchanged in WAMP are option dicts with only a handful of
+ * keys, and for these a short scan of contiguous memory is faster than the
+ * node-per-key tree of std::map, and costs one allocation rather than one per
+ * key.
+ *
+ * Once the size exceeds hash_threshold the entries stop moving: each keeps
+ * the position it was given, its id, and the key order is held instead as a
+ * vector of ids.  An open-addressing hash index maps keys to ids, so lookups
+ * in large objects stay constant time, and the index is not disturbed by
+ * other entries coming and going.  Inserting out of order shifts only the
+ * ids after it, and erasing moves the last entry into the hole.
+ *
+ * The interface is the subset of std::map used for json_object, and
+ * iteration is in key order, as for std::map.  Unlike std::map, inserting or
+ * erasing invalidates iterators and references to the other entries. */
+template <typename T> class json_flat_map
+{
+public:
+  typedef std::string key_type;
+  typedef T mapped_type;
+  typedef std::pair<std::string, T> value_type;
+  typedef typename std::vector<value_type>::size_type size_type;
+  typedef typename std::vector<value_type>::difference_type difference_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+
+  /* Iterator in key order, over the entries directly, or through the ids
+   * when the order is held separately */
+  template <typename V> class basic_iterator
+  {
+  public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef typename std::remove_const<V>::type value_type;
+    typedef typename json_flat_map::difference_type difference_type;
+    typedef V* pointer;
+    typedef V& reference;
+
+    basic_iterator() : m_items(nullptr), m_order(nullptr), m_pos(0) {}
+
+    basic_iterator(V* items, const uint32_t* order, difference_type pos)
+      : m_items(items), m_order(order), m_pos(pos) {}
+
+    /* iterator converts to const_iterator */
+    template <typename U,
+              typename = typename std::enable_if<
+                  std::is_convertible<U*, V*>::value>::type>
+    basic_iterator(const basic_iterator<U>& other)
+      : m_items(other.m_items), m_order(other.m_order), m_pos(other.m_pos) {}
+
+    reference operator*() const
+    {
+      return m_items[m_order ? m_order[m_pos] : m_pos];
+    }
+    pointer operator->() const { return &**this; }
+    reference operator[](difference_type n) const { return *(*this + n); }
+
+    basic_iterator& operator++() { ++m_pos; return *this; }
+    basic_iterator& operator--() { --m_pos; return *this; }
+    basic_iterator operator++(int) { basic_iterator r(*this); ++m_pos; return r; }
+    basic_iterator operator--(int) { basic_iterator r(*this); --m_pos; return r; }
+    basic_iterator& operator+=(difference_type n) { m_pos += n; return *this; }
+    basic_iterator& operator-=(difference_type n) { m_pos -= n; return *this; }
+
+    basic_iterator operator+(difference_type n) const
+    {
+      return basic_iterator(m_items, m_order, m_pos + n);
+    }
+    basic_iterator operator-(difference_type n) const
+    {
+      return basic_iterator(m_items, m_order, m_pos - n);
+    }
+    friend basic_iterator operator+(difference_type n, const basic_iterator& it)
+    {
+      return it + n;
+    }
+    difference_type operator-(const basic_iterator& rhs) const
+    {
+      return m_pos - rhs.m_pos;
+    }
+
+    bool operator==(const basic_iterator& rhs) const { return m_pos == rhs.m_pos; }
+    bool operator!=(const basic_iterator& rhs) const { return m_pos != rhs.m_pos; }
+    bool operator<(const basic_iterator& rhs) const { return m_pos < rhs.m_pos; }
+    bool operator>(const basic_iterator& rhs) const { return m_pos > rhs.m_pos; }
+    bool operator<=(const basic_iterator& rhs) const { return m_pos <= rhs.m_pos; }
+    bool operator>=(const basic_iterator& rhs) const { return m_pos >= rhs.m_pos; }
+
+  private:
+    template <typename> friend class basic_iterator;
+    friend class json_flat_map;
+
+    V* m_items;
+    const uint32_t* m_order; // null if the entries are in key order
+    difference_type m_pos;   // position in key order
+  };
+
+  typedef basic_iterator<value_type> iterator;
+  typedef basic_iterator<const value_type> const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  /* Size above which lookups use the hash index */
+  static const size_type hash_threshold = 16;
+
+  json_flat_map() {}
+
+  json_flat_map(std::initializer_list<value_type> il) { insert(il); }
+
+  template <typename InputIt> json_flat_map(InputIt first, InputIt last)
+  {
+    insert(first, last);
+  }
+
+  iterator begin() { return make_iterator(0); }
+  iterator end() { return make_iterator(m_items.size()); }
+  const_iterator begin() const { return make_iterator(0); }
+  const_iterator end() const { return make_iterator(m_items.size()); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  bool empty() const { return m_items.empty(); }
+  size_type size() const { return m_items.size(); }
+
+  void clear()
+  {
+    m_items.clear();
+    m_order.clear();
+    m_index.clear();
+  }
+
+  void reserve(size_type n) { m_items.reserve(n); }
+
+  iterator find(const std::string& key)
+  {
+    return make_iterator(position_of(key));
+  }
+
+  const_iterator find(const std::string& key) const
+  {
+    return make_iterator(position_of(key));
+  }
+
+  size_type count(const std::string& key) const
+  {
+    return id_of(key, hash_for(key)) != m_items.size();
+  }
+
+  T& at(const std::string& key)
+  {
+    size_type id = id_of(key, hash_for(key));
+    if (id == m_items.size())
+      throw std::out_of_range("json_flat_map::at");
+    return m_items[id].second;
+  }
+
+  const T& at(const std::string& key) const
+  {
+    size_type id = id_of(key, hash_for(key));
+    if (id == m_items.size())
+      throw std::out_of_range("json_flat_map::at");
+    return m_items[id].second;
+  }
+
+  T& operator[](const std::string& key)
+  {
+    size_type id = id_of(key, hash_for(key));
+    if (id != m_items.size())
+      return m_items[id].second;
+    return try_insert(value_type(key, T())).first->second;
+  }
+
+  T& operator[](std::string&& key)
+  {
+    size_type id = id_of(key, hash_for(key));
+    if (id != m_items.size())
+      return m_items[id].second;
+    return try_insert(value_type(std::move(key), T())).first->second;
+  }
+
+  std::pair<iterator, bool> insert(const value_type& v)
+  {
+    return try_insert(value_type(v));
+  }
+
+  std::pair<iterator, bool> insert(value_type&& v)
+  {
+    return try_insert(std::move(v));
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_constructible<value_type, P&&>::value>::type>
+  std::pair<iterator, bool> insert(P&& v)
+  {
+    return try_insert(value_type(std::forward<P>(v)));
+  }
+
+  template <typename InputIt> void insert(InputIt first, InputIt last)
+  {
+    for (; first != last; ++first)
+      try_insert(value_type(*first));
+  }
+
+  void insert(std::initializer_list<value_type> il)
+  {
+    insert(il.begin(), il.end());
+  }
+
+  template <typename... Args> std::pair<iterator, bool> emplace(Args&&... args)
+  {
+    return try_insert(value_type(std::forward<Args>(args)...));
+  }
+
+  template <typename... Args>
+  iterator emplace_hint(const_iterator, Args&&... args)
+  {
+    return try_insert(value_type(std::forward<Args>(args)...)).first;
+  }
+
+  iterator erase(const_iterator pos)
+  {
+    size_type at = pos.m_pos;
+    erase_at(at);
+    return make_iterator(at);
+  }
+
+  iterator erase(const_iterator first, const_iterator last)
+  {
+    size_type at = first.m_pos;
+    for (difference_type n = last - first; n > 0; n--)
+      erase_at(at);
+    return make_iterator(at);
+  }
+
+  size_type erase(const std::string& key)
+  {
+    size_type pos = position_of(key);
+    if (pos == m_items.size())
+      return 0;
+    erase_at(pos);
+    return 1;
+  }
+
+  void swap(json_flat_map& other)
+  {
+    m_items.swap(other.m_items);
+    m_order.swap(other.m_order);
+    m_index.swap(other.m_index);
+  }
+
+  bool operator==(const json_flat_map& rhs) const
+  {
+    return size() == rhs.size() && std::equal(begin(), end(), rhs.begin());
+  }
+
+  bool operator!=(const json_flat_map& rhs) const { return !(*this == rhs); }
+
+private:
+  /* The entries.  Sorted by key while the index is absent; otherwise each
+   * stays at its id until erased. */
+  std::vector<value_type> m_items;
+
+  /* Ids of the entries in key order, only present with the index */
+  std::vector<uint32_t> m_order;
+
+  /* Hash index, only present above hash_threshold.  Each slot holds one plus
+   * the id of an entry, or zero when free; the size is a power of two, at
+   * least twice the number of entries. */
+  std::vector<uint32_t> m_index;
+
+  static size_t hash_of(const std::string& key)
+  {
+    return std::hash<std::string>()(key);
+  }
+
+  /* Hash of key, if the index is in use */
+  size_t hash_for(const std::string& key) const
+  {
+    return m_index.empty() ? 0 : hash_of(key);
+  }
+
+  /* Capacity of the first allocation, enough for most option dicts */
+  static const size_type initial_capacity = 4;
+
+  iterator make_iterator(size_type pos)
+  {
+    return iterator(m_items.data(), m_order.empty() ? nullptr : m_order.data(),
+                    pos);
+  }
+
+  const_iterator make_iterator(size_type pos) const
+  {
+    return const_iterator(m_items.data(),
+                          m_order.empty() ? nullptr : m_order.data(), pos);
+  }
+
+  const std::string& key_at(size_type pos) const
+  {
+    return m_items[m_order.empty() ? pos : m_order[pos]].first;
+  }
+
+  /* Position in key order of the first key not less than 'key' */
+  size_type lower_bound(const std::string& key) const
+  {
+    size_type lo = 0, hi = m_items.size();
+    while (lo < hi) {
+      size_type mid = lo + (hi - lo) / 2;
+      if (key_at(mid) < key)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  }
+
+  /* Id of key, or size() if not present */
+  size_type id_of(const std::string& key, size_t hash) const
+  {
+    if (m_index.empty()) {
+      for (size_type i = 0; i < m_items.size(); i++) {
+        const std::string& k = m_items[i].first;
+        if (k.size() == key.size() && k == key)
+          return i;
+      }
+      return m_items.size();
+    }
+
+    size_t mask = m_index.size() - 1;
+    for (size_t slot = hash & mask; m_index[slot]; slot = (slot + 1) & mask) {
+      size_type id = m_index[slot] - 1;
+      if (m_items[id].first == key)
+        return id;
+    }
+    return m_items.size();
+  }
+
+  /* Position in key order of key, or size() if not present */
+  size_type position_of(const std::string& key) const
+  {
+    size_type id = id_of(key, hash_for(key));
+    if (id == m_items.size() || m_order.empty())
+      return id;
+    return lower_bound(key);
+  }
+
+  std::pair<iterator, bool> try_insert(value_type&& v)
+  {
+    /* keys usually arrive in order, when decoding what was encoded from a
+     * json_object, so check for an append before searching */
+    size_type pos = m_items.size();
+    if (pos && !(key_at(pos - 1) < v.first)) {
+      if (m_index.empty()) {
+        pos = lower_bound(v.first);
+        if (m_items[pos].first == v.first)
+          return {make_iterator(pos), false};
+      }
+      else {
+        if (id_of(v.first, hash_of(v.first)) != m_items.size())
+          return {make_iterator(lower_bound(v.first)), false};
+        pos = lower_bound(v.first);
+      }
+    }
+
+    if (m_items.capacity() == 0)
+      m_items.reserve(initial_capacity);
+
+    if (m_order.empty()) {
+      if (pos == m_items.size())
+        m_items.push_back(std::move(v));
+      else
+        m_items.insert(m_items.begin() + pos, std::move(v));
+      if (m_items.size() > hash_threshold)
+        build_index();
+    }
+    else {
+      uint32_t id = static_cast<uint32_t>(m_items.size());
+      size_t hash = hash_of(v.first);
+      m_items.push_back(std::move(v));
+      m_order.insert(m_order.begin() + pos, id);
+      if (2 * m_items.size() > m_index.size())
+        build_index();
+      else
+        index_entry(id, hash);
+    }
+    return {make_iterator(pos), true};
+  }
+
+  /* Erase the entry at position 'pos' in key order */
+  void erase_at(size_type pos)
+  {
+    if (m_order.empty()) {
+      m_items.erase(m_items.begin() + pos);
+      return;
+    }
+
+    size_type id = m_order[pos];
+    m_order.erase(m_order.begin() + pos);
+    unindex_entry(id);
+
+    /* move the last entry into the hole, and refer to it by its new id */
+    size_type last = m_items.size() - 1;
+    if (id != last) {
+      const std::string& key = m_items[last].first;
+      m_order[lower_bound(key)] = static_cast<uint32_t>(id);
+      m_index[slot_of(last)] = static_cast<uint32_t>(id + 1);
+      m_items[id] = std::move(m_items[last]);
+    }
+    m_items.pop_back();
+
+    if (m_items.size() <= hash_threshold)
+      drop_index();
+  }
+
+  /* Build the index and order for entries which are in key order */
+  void build_index()
+  {
+    if (m_order.empty()) {
+      m_order.resize(m_items.size());
+      for (size_type i = 0; i < m_items.size(); i++)
+        m_order[i] = static_cast<uint32_t>(i);
+    }
+
+    size_t slots = 64;
+    while (slots < 2 * m_items.size())
+      slots *= 2;
+
+    m_index.assign(slots, 0);
+    for (size_type i = 0; i < m_items.size(); i++)
+      index_entry(i, hash_of(m_items[i].first));
+  }
+
+  /* Put the entries back in key order, and drop the index and order */
+  void drop_index()
+  {
+    std::vector<value_type> sorted;
+    sorted.reserve(m_items.capacity());
+    for (uint32_t id : m_order)
+      sorted.push_back(std::move(m_items[id]));
+    m_items.swap(sorted);
+    m_order.clear();
+    m_order.shrink_to_fit();
+    m_index.clear();
+    m_index.shrink_to_fit();
+  }
+
+  void index_entry(size_type id, size_t hash)
+  {
+    size_t mask = m_index.size() - 1;
+    size_t slot = hash & mask;
+    while (m_index[slot])
+      slot = (slot + 1) & mask;
+    m_index[slot] = static_cast<uint32_t>(id + 1);
+  }
+
+  /* Slot of the index holding 'id' */
+  size_t slot_of(size_type id) const
+  {
+    size_t mask = m_index.size() - 1;
+    size_t slot = hash_of(m_items[id].first) & mask;
+    while (m_index[slot] != id + 1)
+      slot = (slot + 1) & mask;
+    return slot;
+  }
+
+  /* Free the slot holding 'id', moving back any later entry of the probe
+   * sequence which would otherwise no longer be found */
+  void unindex_entry(size_type id)
+  {
+    size_t mask = m_index.size() - 1;
+    size_t hole = slot_of(id);
+    for (size_t slot = (hole + 1) & mask; m_index[slot];
+         slot = (slot + 1) & mask) {
+      size_t home = hash_of(m_items[m_index[slot] - 1].first) & mask;
+      /* move the entry if its home is not within (hole, slot] */
+      if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+        m_index[hole] = m_index[slot];
+        hole = slot;
+      }
+    }
+    m_index[hole] = 0;
+  }
+};
+
+template <typename T>
+inline void swap(json_flat_map<T>& lhs, json_flat_map<T>& rhs)
+{
+  lhs.swap(rhs);
+}
+
+}
+
+#endif
@@ -14,6 +14,10 @@
 #include <string>
 #include <mutex>
 #include <functional>
+#include <vector>
+#include <atomic>
+
+#include <stdint.h>
 
 namespace wampcc
 {
@@ -23,6 +27,36 @@ class event_loop;
 class uri_regex;
 class ssl_context;
 
+/** Handle to a timer scheduled on an event_loop, which can be used to cancel
+ * the timer.  Handles can be freely copied, and a handle which outlives its
+ * timer is harmless, however a handle must not be used after its kernel has
+ * been deleted. */
+class timer_handle
+{
+public:
+  timer_handle() : m_loop(nullptr), m_slot(0), m_generation(0) {}
+
+  /** Cancel the timer, so that it is not invoked again.  Returns true if the
+   * timer was still active.  If the timer function is executing concurrently
+   * on the EV thread, that invocation is allowed to complete. */
+  bool cancel();
+
+  explicit operator bool() const { return m_loop != nullptr; }
+
+private:
+  friend class event_loop;
+
+  timer_handle(event_loop* loop, uint32_t slot, uint32_t generation)
+    : m_loop(loop), m_slot(slot), m_generation(generation)
+  {
+  }
+
+  event_loop* m_loop;
+  uint32_t m_slot;
+  uint32_t m_generation;
+};
+
+
 /* Run-time name & version */
 const char* package_name();    // 'wampcc'
 const char* package_version(); // version, major.minor.patch
@@ -128,6 +162,19 @@ struct config
 
   ssl_config ssl;
 
+  /** Number of IO loops to run, each on its own IO thread. Sockets are
+   * distributed across the loops, and a router listen socket is bound once per
+   * loop (using SO_REUSEPORT) so that accepted connections are spread over all
+   * IO threads. Values less than one are treated as one. */
+  size_t io_loop_count;
+
+  /** Number of threads on which the event loop runs WAMP message processing
+   * and user callbacks.  With more than one, messages for any one session are
+   * still processed in order, but different sessions are processed in
+   * parallel, so user callbacks must then be thread safe.  Values less than one
+   * are treated as one. */
+  size_t event_loop_thread_count;
+
   config();
 };
 
@@ -144,7 +191,19 @@ public:
   kernel& operator=(const kernel&) = delete;
 
   logger& get_logger() { return __logger; }
+
+  /** Return the primary IO loop. */
   io_loop* get_io();
+
+  /** Return the IO loop at index i, where i is less than io_loop_count(). */
+  io_loop* get_io(size_t i);
+
+  /** Number of IO loops owned by the kernel. */
+  size_t io_loop_count() const { return m_io_loops.size(); }
+
+  /** Select an IO loop for a new socket, rotating through all loops. */
+  io_loop* next_io();
+
   event_loop* get_event_loop();
 
   /* SSL context associated with the kernel. Will only be present if ssl config
@@ -156,7 +215,8 @@ public:
 private:
   config m_config;
   logger __logger; /* name chosen for log macros */
-  std::unique_ptr<io_loop> m_io_loop;
+  std::vector<std::unique_ptr<io_loop>> m_io_loops;
+  std::atomic<size_t> m_next_io;
   std::unique_ptr<event_loop> m_evl;
   std::unique_ptr<ssl_context> m_ssl;
 };
@@ -9,10 +9,12 @@
 #define WAMPCC_PROTOCOL_H
 
 #include "wampcc/types.h"
+#include "wampcc/shared_buffer.h"
 
 #include <vector>
 #include <cstddef>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 
 namespace wampcc {
@@ -68,13 +70,21 @@ public:
   size_t capacity() const { return m_mem.size(); }
 
   /** pointer to data */
-  char* data() { return m_mem.data(); }
+  char* data() { return m_mem.data() + m_offset; }
 
-  /** copy in new bytes, growing internal space if necessary */
+  /** copy in new bytes, growing internal space if necessary; bytes that were
+   * read directly into the region returned by prepare() are not copied */
   size_t consume(const char* src, size_t len);
 
+  /** Obtain the free region at the end of the data, into which up to 'len'
+   * new bytes can be read directly.  The buffer is compacted or grown (within
+   * its max size) if necessary, so this invalidates any read_pointer.  Bytes
+   * written to the region are added to the buffer by a subsequent call of
+   * consume() using the region address. */
+  std::pair<char*, size_t> prepare(size_t len);
+
   /** obtain a read pointer */
-  read_pointer read_ptr() { return {m_mem.data(), m_bytes_avail}; }
+  read_pointer read_ptr() { return {data(), m_bytes_avail}; }
 
   /** Update buffer to remove bytes that have be read via the read pointer. */
   void discard_read(read_pointer);
@@ -83,11 +93,16 @@ public:
 
 private:
 
+  /* space available after the data, without compaction */
+  size_t tail_space() const { return m_mem.size() - m_offset - m_bytes_avail; }
+
   void grow_by(size_t len);
+  void compact();
 
   std::vector<char> m_mem;
   size_t m_max_size;
   size_t m_bytes_avail;
+  size_t m_offset; /* start of data within m_mem */
 };
 
 
@@ -123,16 +138,137 @@ public:
 };
 
 
+/** Buffers for an output_sink to encode into, which are reused once the frames
+ * released from them have been written.  The pool keeps a reference to each
+ * of its buffers, so a buffer is free again once the pool's reference is the
+ * only one left, which is when the socket drops the last frame referring to it
+ * after the write completes.  Can be used from any thread. */
+class sink_pool
+{
+public:
+  /** Most buffers kept by the pool; beyond this, buffers are not reused. */
+  static const size_t max_buffers = 64;
+
+  /** Buffers which have grown beyond this capacity are freed when reused. */
+  static const size_t max_retained_capacity = 64 * 1024;
+
+  /** Obtain an empty buffer, reusing a free one if there is one. */
+  std::shared_ptr<std::vector<char>> acquire();
+
+  /** Number of buffers kept by the pool, free or in use. */
+  size_t size() const;
+
+private:
+  mutable std::mutex m_mutex;
+  std::vector<std::shared_ptr<std::vector<char>>> m_buffers;
+  size_t m_next = 0; /* where to start the search for a free buffer */
+};
+
+
+/** Growable buffer that a codec encodes a message into, with space reserved at
+ * the front for the protocol's frame header.  After encoding, the protocol
+ * writes its header into the reserved space directly ahead of the payload, so
+ * that the complete frame is a single contiguous region that can be passed to
+ * the socket without further copying. */
+class output_sink
+{
+public:
+  /** Reserve 'headroom' bytes ahead of the payload, which must be at least the
+   * largest header the protocol will prepend.  If a pool is given, the buffer
+   * is taken from it, and is returned to it once the released frame has been
+   * written. */
+  explicit output_sink(size_t headroom, sink_pool* pool = nullptr);
+
+  /** Buffer to which the payload is appended.  Only bytes may be appended;
+   * the headroom at the front must not be modified. */
+  std::vector<char>& bytes() { return *m_bytes; }
+
+  char* payload() { return m_bytes->data() + m_headroom; }
+  size_t payload_size() const { return m_bytes->size() - m_headroom; }
+
+  /** Claim 'len' bytes of headroom immediately ahead of the payload (or ahead
+   * of the previously claimed region), returning its start. */
+  char* prepend(size_t len);
+
+  /** Hand over the frame, from the first prepended byte to the end of the
+   * payload.  The sink must not be used afterwards. */
+  shared_buffer release();
+
+private:
+  std::shared_ptr<std::vector<char>> m_bytes;
+  size_t m_headroom;
+  size_t m_start; /* start of frame within m_bytes */
+};
+
+
 class codec
 {
 public:
   virtual ~codec() {}
   virtual json_value decode(const char* ptr, size_t msglen) = 0;
   virtual std::vector<char> encode(const json_array&) = 0;
+
+  /** Encode a message, appending to the sink's payload.  The default
+   * implementation copies the result of encode(). */
+  virtual void encode_into(const json_array&, output_sink&);
+
+  /** Encode a message made of the 'head' elements followed by the arguments
+   * in 'args'.  Arguments already serialised by this codec are copied without
+   * decoding; the default implementation always decodes them. */
+  virtual void encode_into(const json_array& head, const raw_args& args,
+                           output_sink&);
+
+  /** Decode only the leading elements of a message, as counted by the head
+   * size function, leaving the remainder serialised.  The default
+   * implementation decodes every element. */
+  virtual json_array_tail decode_head(json_array& dest, const char* ptr,
+                                      size_t msglen, json_head_size_fn);
+
   virtual serialiser_type type() const = 0;
   virtual const char* name() const = 0;
 };
 
+/** Message sent to many sessions, such as a broker EVENT.  Protocols store the
+ * encoded and framed bytes of the message here, so that it is serialised only
+ * once for each combination of protocol and serialiser, and the same bytes are
+ * shared by all the sockets it is written to.  Not thread safe. */
+class outbound_message
+{
+public:
+  explicit outbound_message(json_array msg, raw_args args = {})
+    : m_msg(std::move(msg)), m_args(std::move(args))
+  {
+  }
+
+  /** Elements of the message, which are followed by any raw arguments. */
+  const json_array& msg() const { return m_msg; }
+  const raw_args& args() const { return m_args; }
+
+  /** Return the framed bytes stored for a protocol & serialiser, or nullptr if
+   * none yet stored. */
+  const std::vector<shared_buffer>* find(const char* protocol,
+                                         serialiser_type) const;
+
+  const std::vector<shared_buffer>& store(const char* protocol,
+                                          serialiser_type,
+                                          std::vector<shared_buffer>);
+
+private:
+  struct entry
+  {
+    const char* protocol;
+    serialiser_type serialiser;
+    std::vector<shared_buffer> bufs;
+  };
+
+  json_array m_msg;
+  raw_args m_args;
+  std::vector<entry> m_frames;
+};
+
+/** Decode any arguments held in raw form into args_list & args_dict. */
+void decode_args(wamp_args&);
+
 namespace protocol_constants {
   /* Keep default interval under 1 minute, which is a typical timeout period
      chosen by load balancers etc. */
@@ -164,11 +300,19 @@ public:
      * or other control frame instead of a pong. */
     int max_missed_pings;
 
+    /* Leave the arguments of inbound CALL, YIELD, PUBLISH and ERROR messages
+     * in their serialised form (see wamp_args::raw), so that they can be
+     * forwarded without being decoded and re-encoded.  For use by a router;
+     * any handler of these messages must call decode_args() before reading
+     * the arguments. */
+    bool lazy_args;
+
     options()
       : serialisers(wampcc::all_serialisers),
         ping_interval(protocol_constants::default_ping_interval_ms),
         pong_min_interval(protocol_constants::default_pong_min_interval_ms),
-        max_missed_pings(protocol_constants::default_max_missed_pings)
+        max_missed_pings(protocol_constants::default_max_missed_pings),
+        lazy_args(false)
     {
       if (ping_interval.count() == 0 && max_missed_pings != 0)
         throw std::runtime_error("cannot have non-zero max_missed_pings with zero ping_interval");
@@ -180,9 +324,14 @@ public:
     std::function<void(std::unique_ptr<protocol>&)> upgrade_protocol;
     std::function<void(std::chrono::milliseconds)>  request_timer;
     std::function<void(std::chrono::milliseconds)> protocol_closed;
+
+    /* Optionally provide a message which has finished being processed, for
+     * the next inbound message to be decoded over. */
+    std::function<void(json_array&)> spare_message;
   };
 
-  typedef std::function<void(json_array msg,  json_uint_t msgtype)> t_msg_cb;
+  typedef std::function<void(json_array msg, json_uint_t msgtype,
+                             raw_args args)> t_msg_cb;
   typedef std::function<void()> t_initiate_cb;
 
   protocol(kernel*, tcp_socket*, t_msg_cb, protocol_callbacks, connect_mode m,
@@ -200,10 +349,18 @@ public:
   virtual void on_timer() {}
   virtual void io_on_read(char*, size_t) = 0;
   virtual void initiate(t_initiate_cb) = 0;
+
+  /* Provide memory for the next socket read, which is the free region of the
+   * protocol buffer, so that inbound bytes are parsed where they land. */
+  std::pair<char*, size_t> io_alloc_buffer(size_t);
   virtual const char* name() const = 0;
 
   virtual void send_msg(const json_array& j) = 0;
 
+  /* Send a message that is also sent to other sessions, reusing any bytes
+   * already framed for this protocol & serialiser. */
+  virtual void send_shared_msg(outbound_message& msg) { send_msg(msg.msg()); }
+
   connect_mode mode() const { return m_mode; }
 
 protected:
@@ -214,7 +371,8 @@ protected:
   std::string fd() const;
 
   void decode(const char* ptr, size_t msglen);
-  std::vector<char> encode(const json_array&);
+  void encode_into(const json_array&, output_sink&);
+  void encode_into(const json_array&, const raw_args&, output_sink&);
 
   kernel* m_kernel;
   logger& __logger;
@@ -223,6 +381,8 @@ protected:
   protocol_callbacks m_callbacks;
   buffer m_buf;
   std::shared_ptr<codec> m_codec;
+  bool m_lazy_args;
+  sink_pool m_sink_pool; /* buffers for outbound frames */
 
 private:
   connect_mode m_mode;
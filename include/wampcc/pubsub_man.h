@@ -12,14 +12,20 @@
 #include "wampcc/utils.h"
 #include "wampcc/json.h"
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace wampcc
 {
 
 struct logger;
 class managed_topic;
+struct realm_topics;
 class wamp_session;
 class kernel;
 
@@ -38,7 +44,7 @@ public:
 
   void unsubscribe(wamp_session*, t_request_id, t_subscription_id);
 
-  void session_closed(session_handle sh);
+  void session_closed(std::shared_ptr<wamp_session>&);
 
   json_array get_topics(const std::string& realm) const;
 
@@ -46,23 +52,44 @@ private:
   pubsub_man(const pubsub_man&);            // no copy
   pubsub_man& operator=(const pubsub_man&); // no assignment
 
+  realm_topics* find_realm(const std::string& realm, bool allow_create);
+
   managed_topic* find_topic(const std::string& topic, const std::string& realm,
-                            bool allow_create);
+                            bool allow_create,
+                            std::vector<managed_topic*>* patterns = nullptr);
+
+  managed_topic* find_pattern_topic(const std::string& pattern,
+                                    const std::string& realm, bool wildcard);
 
+  managed_topic* create_topic(
+      std::map<std::string, std::unique_ptr<managed_topic>>& topics,
+      const std::string& uri);
 
-  t_publication_id update_topic(const std::string& topic, const std::string& realm,
+  static void send_event(managed_topic*, t_publication_id, json_object details,
+                         wamp_args);
+
+  t_publication_id update_topic(managed_topic*, const std::string& topic,
+                                const std::vector<managed_topic*>& patterns,
                                 json_object options, wamp_args args);
 
   logger& __logger; /* name chosen for log macros */
 
+  /* Guards the realm map, the subscription index and the topics of each
+   * session, and is held only to look up or change entries in them.  See the
+   * notes on thread safety in pubsub_man.cc for the other locks. */
   mutable std::mutex m_lock;
 
-  typedef std::map<std::string, std::unique_ptr<managed_topic>> topic_registry;
-  typedef std::map<std::string, topic_registry> realm_to_topicreg;
+  typedef std::map<std::string, std::unique_ptr<realm_topics>>
+      realm_to_topicreg;
   typedef std::map<t_subscription_id, managed_topic*> subscriptionid_registry;
   realm_to_topicreg m_topics;
-  t_subscription_id m_next_subscription_id;
+  std::atomic<t_subscription_id> m_next_subscription_id;
   subscriptionid_registry m_subscription_registry;
+
+  // topics each session is subscribed to, so that closing a session need not
+  // search every topic
+  std::unordered_map<t_session_id, std::unordered_set<managed_topic*>>
+      m_session_topics;
 };
 
 } // namespace wampcc
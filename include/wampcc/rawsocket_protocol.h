@@ -86,8 +86,11 @@ public:
   bool initiate_close() override { return false; }
   const char* name() const override { return NAME; }
   void send_msg(const json_array& j) override;
+  void send_shared_msg(outbound_message&) override;
 
 private:
+  shared_buffer encode_frame(const json_array&, const raw_args& = {});
+
   static const int FRAME_MSG_LEN_MASK       = 0x00FFFFFF;
   static const int FRAME_RESERVED_MASK      = 0xF8000000;
   static const int FRAME_MSG_TYPE_MASK      = 0x07000000;
@@ -13,12 +13,14 @@
 #include "wampcc/wamp_router.h"
 #include "wampcc/json.h"
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <string>
 #include <mutex>
 #include <memory>
 #include <list>
+#include <vector>
 
 namespace wampcc
 {
@@ -34,6 +36,7 @@ class rpc_man
 {
 public:
   rpc_man(kernel*, rpc_added_cb, rpc_removed_cb);
+  ~rpc_man();
 
   void handle_inbound_register(wamp_session&, t_request_id, const std::string&, const json_object& options);
 
@@ -44,8 +47,20 @@ public:
                                  const std::string& uri, on_call_fn,
                                  void* user);
 
-  rpc_details get_rpc_details(const std::string& rpcname,
-                              const std::string& realm);
+  /* Find the procedure registered under a URI, or null if there is none.
+   * Where the procedure is a shared registration, one of its callees is
+   * selected according to the registration's invoke policy.  Does not take
+   * the registration lock, so is not delayed by concurrent register &
+   * unregister requests.  The returned details are immutable, and remain
+   * valid after the procedure is unregistered.
+   *
+   * If 'pending' is provided, and the policy is least_outstanding, it is set
+   * to a token which counts an invocation as outstanding on the selected
+   * callee until the token, and all copies of it, are destroyed; the caller
+   * should hold it until the invocation completes. */
+  std::shared_ptr<const rpc_details> get_rpc_details(
+      const std::string& rpcname, const std::string& realm,
+      std::shared_ptr<void>* pending = nullptr) const;
 
   void session_closed(std::shared_ptr<wamp_session>&);
 
@@ -61,16 +76,98 @@ private:
   rpc_added_cb m_rpc_added_cb;
   rpc_removed_cb m_rpc_removed_cb;
 
+  /* Serialises the writers: register, unregister and session close */
   mutable std::mutex m_rpc_map_lock;
 
   uint64_t m_next_regid;
 
-  typedef std::map<t_registration_id, std::shared_ptr<rpc_details>>
+  /* How a call is routed when several callees share a registration; set by
+   * the 'invoke' option of REGISTER */
+  enum class invoke_policy
+  {
+    single,
+    roundrobin,
+    random,
+    first,
+    last,
+    least_outstanding
+  };
+
+  /* A callee of a procedure, with its count of invocations not yet answered */
+  struct callee
+  {
+    std::shared_ptr<const rpc_details> rpc;
+    mutable std::atomic<unsigned> outstanding;
+    callee(std::shared_ptr<const rpc_details> r)
+      : rpc(std::move(r)), outstanding(0) {}
+  };
+
+  /* A procedure and its callees, in order of registration; there is more
+   * than one only for a shared registration, all sharing one registration
+   * id.  Immutable once published, except for the counters, which are shared
+   * with the procedure in successive snapshots. */
+  struct procedure
+  {
+    invoke_policy invoke;
+    t_registration_id registration_id;
+    std::vector<std::shared_ptr<const callee>> callees;
+    std::shared_ptr<std::atomic<size_t>> next; // roundrobin position
+  };
+
+  static const std::shared_ptr<const callee>& select_callee(const procedure&);
+
+  typedef std::map<t_registration_id, std::shared_ptr<const rpc_details>>
       map_id_to_rpc;
-  typedef std::map<std::string, std::shared_ptr<rpc_details>> map_uri_to_rpc;
-
-  // map from realm to rpc-by-uri map
-  std::map<std::string, map_uri_to_rpc> m_realm_registry;
+  /* The registrations of all realms, as a hash table keyed on realm & URI,
+   * which is read without a lock.  Writers hold m_rpc_map_lock.  A node is
+   * never changed once reachable, other than its link to the next; a change
+   * of procedure replaces the node, and a removal unlinks it, each with a
+   * single pointer store.  Growing the table builds a new table of new nodes
+   * and swaps it in.  Unlinked nodes and old tables are retired, and deleted
+   * once no reader can still be looking at them, see synchronize(). */
+  struct registry_node
+  {
+    std::string realm;
+    std::string uri;
+    size_t hash;
+    std::shared_ptr<const procedure> proc;
+    std::atomic<registry_node*> next;
+
+    registry_node(std::string r, std::string u, size_t h,
+                  std::shared_ptr<const procedure> p, registry_node* n)
+      : realm(std::move(r)), uri(std::move(u)), hash(h), proc(std::move(p)),
+        next(n) {}
+  };
+
+  struct registry_table
+  {
+    std::vector<std::atomic<registry_node*>> buckets; // size a power of two
+    size_t size;
+
+    explicit registry_table(size_t n) : buckets(n), size(0) {}
+  };
+
+  std::atomic<registry_table*> m_table;
+  std::vector<registry_node*> m_retired_nodes;
+  std::vector<registry_table*> m_retired_tables;
+
+  /* Readers count themselves in one of two counters, chosen by the parity of
+   * m_epoch, for as long as they use the table. */
+  std::atomic<unsigned> m_epoch;
+  mutable std::atomic<unsigned> m_readers[2];
+
+  class read_guard;
+
+  static size_t hash_of(const std::string& realm, const std::string& uri);
+  const registry_node* find_node(const registry_table&,
+                                 const std::string& realm,
+                                 const std::string& uri) const;
+  void put_procedure(const std::string& realm, const std::string& uri,
+                     std::shared_ptr<const procedure>);
+  void remove_callee(const std::string& realm, const rpc_details&);
+  void grow_table();
+  void synchronize();
+  void reclaim();
 
   // map from session to rpc-by-id map
   std::map<session_handle, map_id_to_rpc, std::owner_less<session_handle>>
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_SHARED_BUFFER_H
+#define WAMPCC_SHARED_BUFFER_H
+
+#include <memory>
+#include <vector>
+
+namespace wampcc
+{
+
+/** Immutable region of bytes with shared ownership, used to pass data to a
+ * tcp_socket for writing without copying.  The region may alias any object
+ * kept alive by the owning shared_ptr (e.g. a vector or a websocket message),
+ * so a buffer can be handed off to the IO thread and released once the write
+ * has completed. */
+class shared_buffer
+{
+public:
+  shared_buffer() : m_len(0) {}
+
+  /** Take ownership of the bytes held in a vector. */
+  explicit shared_buffer(std::vector<char>&& bytes)
+  {
+    auto sp = std::make_shared<std::vector<char>>(std::move(bytes));
+    m_len = sp->size();
+    m_data = std::shared_ptr<const char>(sp, sp->data());
+  }
+
+  /** Refer to 'len' bytes at 'data', which must remain valid for as long as
+   * 'data' has an owner. */
+  shared_buffer(std::shared_ptr<const char> data, size_t len)
+    : m_data(std::move(data)), m_len(len)
+  {
+  }
+
+  /** Create a buffer holding a copy of the source bytes. */
+  static shared_buffer copy(const char* src, size_t len)
+  {
+    std::vector<char> bytes(src, src + len);
+    return shared_buffer(std::move(bytes));
+  }
+
+  /** Return a buffer that refers to a sub-region of this buffer; the bytes are
+   * not copied. */
+  shared_buffer slice(size_t offset, size_t len) const
+  {
+    return shared_buffer(std::shared_ptr<const char>(m_data, m_data.get() + offset),
+                         len);
+  }
+
+  const char* data() const { return m_data.get(); }
+  size_t size() const { return m_len; }
+  bool empty() const { return m_len == 0; }
+
+private:
+  std::shared_ptr<const char> m_data;
+  size_t m_len;
+};
+
+} // namespace wampcc
+
+#endif
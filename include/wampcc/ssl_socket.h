@@ -29,6 +29,7 @@ public:
       ssl_on_accept_cb;
 
   ssl_socket(kernel* k, tcp_socket::options = {});
+  ssl_socket(kernel* k, tcp_socket::options, io_loop*);
   ~ssl_socket();
   ssl_socket(const ssl_socket&) = delete;
   ssl_socket& operator=(const ssl_socket&) = delete;
@@ -56,10 +57,11 @@ private:
   ssl_socket(kernel* k, uv_tcp_t*, socket_state ss, tcp_socket::options);
 
   void handle_read_bytes(ssize_t, const uv_buf_t*) override;
+  void alloc_read_buffer(size_t, uv_buf_t*) override;
   void service_pending_write() override;
   ssl_socket* create(kernel*, uv_tcp_t*, tcp_socket::socket_state, tcp_socket::options) override;
 
-  std::pair<int, size_t> do_encrypt_and_write(char*, size_t);
+  std::pair<int, size_t> do_encrypt_and_write(const char*, size_t);
   sslstatus do_handshake();
   void write_encrypted_bytes(const char* src, size_t len);
   int ssl_do_read(char* src, size_t len);
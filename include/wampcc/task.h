@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_TASK_H
+#define WAMPCC_TASK_H
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+namespace wampcc
+{
+
+/** Move-only wrapper of a callable with no arguments, used for work queued to
+ * the IO and EV threads.  Unlike std::function, the callable need not be
+ * copyable, and callables up to inline_size bytes (e.g. a lambda capturing a
+ * few pointers and a shared_ptr) are stored within the task, so that creating
+ * a task does not allocate. */
+class task
+{
+public:
+  static constexpr size_t inline_size = 6 * sizeof(void*);
+
+  task() noexcept : m_ops(nullptr) {}
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type, task>::value>::type>
+  task(F&& fn) : m_ops(nullptr)
+  {
+    typedef typename std::decay<F>::type fn_type;
+    emplace<fn_type>(std::forward<F>(fn), is_inline<fn_type>());
+  }
+
+  task(task&& other) noexcept : m_ops(other.m_ops)
+  {
+    if (m_ops) {
+      m_ops->move(&m_storage, &other.m_storage);
+      other.m_ops = nullptr;
+    }
+  }
+
+  task& operator=(task&& other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      if (other.m_ops) {
+        other.m_ops->move(&m_storage, &other.m_storage);
+        m_ops = other.m_ops;
+        other.m_ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+
+  ~task() { reset(); }
+
+  /** Invoke the callable.  The task must not be empty. */
+  void operator()() { m_ops->invoke(&m_storage); }
+
+  explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+  void reset() noexcept
+  {
+    if (m_ops) {
+      m_ops->destroy(&m_storage);
+      m_ops = nullptr;
+    }
+  }
+
+private:
+  typedef typename std::aligned_storage<inline_size,
+                                        alignof(std::max_align_t)>::type storage;
+
+  struct ops
+  {
+    void (*invoke)(void*);
+    void (*move)(void* dest, void* src);
+    void (*destroy)(void*);
+  };
+
+  template <typename T>
+  using is_inline = std::integral_constant<
+      bool, sizeof(T) <= inline_size &&
+                alignof(std::max_align_t) % alignof(T) == 0 &&
+                std::is_nothrow_move_constructible<T>::value>;
+
+  /* callable stored within the task */
+  template <typename T> struct inline_ops
+  {
+    static void invoke(void* p) { (*static_cast<T*>(p))(); }
+    static void move(void* dest, void* src)
+    {
+      ::new (dest) T(std::move(*static_cast<T*>(src)));
+      static_cast<T*>(src)->~T();
+    }
+    static void destroy(void* p) { static_cast<T*>(p)->~T(); }
+    static const ops table;
+  };
+
+  /* callable too large, so stored on the heap */
+  template <typename T> struct heap_ops
+  {
+    static T*& ptr(void* p) { return *static_cast<T**>(p); }
+    static void invoke(void* p) { (*ptr(p))(); }
+    static void move(void* dest, void* src) { ::new (dest) T*(ptr(src)); }
+    static void destroy(void* p) { delete ptr(p); }
+    static const ops table;
+  };
+
+  template <typename T, typename F> void emplace(F&& fn, std::true_type)
+  {
+    ::new (&m_storage) T(std::forward<F>(fn));
+    m_ops = &inline_ops<T>::table;
+  }
+
+  template <typename T, typename F> void emplace(F&& fn, std::false_type)
+  {
+    ::new (&m_storage) T*(new T(std::forward<F>(fn)));
+    m_ops = &heap_ops<T>::table;
+  }
+
+  storage m_storage;
+  const ops* m_ops;
+};
+
+template <typename T>
+const task::ops task::inline_ops<T>::table = {&task::inline_ops<T>::invoke,
+                                              &task::inline_ops<T>::move,
+                                              &task::inline_ops<T>::destroy};
+
+template <typename T>
+const task::ops task::heap_ops<T>::table = {&task::heap_ops<T>::invoke,
+                                            &task::heap_ops<T>::move,
+                                            &task::heap_ops<T>::destroy};
+
+
+/** Queue of tasks held in a contiguous circular buffer.  The buffer doubles in
+ * size when full and is never shrunk, so once a steady state is reached, queue
+ * operations do not allocate.  Not thread safe. */
+class task_ring
+{
+public:
+  task_ring() : m_head(0), m_size(0) {}
+
+  task_ring(const task_ring&) = delete;
+  task_ring& operator=(const task_ring&) = delete;
+
+  bool empty() const noexcept { return m_size == 0; }
+  size_t size() const noexcept { return m_size; }
+
+  void push_back(task t)
+  {
+    if (m_size == m_slots.size())
+      grow();
+    m_slots[(m_head + m_size) & (m_slots.size() - 1)] = std::move(t);
+    m_size++;
+  }
+
+  /** Remove and return the oldest task.  The queue must not be empty. */
+  task pop_front()
+  {
+    task t(std::move(m_slots[m_head]));
+    m_head = (m_head + 1) & (m_slots.size() - 1);
+    m_size--;
+    return t;
+  }
+
+  void clear() noexcept
+  {
+    while (m_size) {
+      m_slots[m_head].reset();
+      m_head = (m_head + 1) & (m_slots.size() - 1);
+      m_size--;
+    }
+    m_head = 0;
+  }
+
+  void swap(task_ring& other) noexcept
+  {
+    m_slots.swap(other.m_slots);
+    std::swap(m_head, other.m_head);
+    std::swap(m_size, other.m_size);
+  }
+
+private:
+  void grow()
+  {
+    std::vector<task> slots(m_slots.empty() ? 16 : m_slots.size() * 2);
+    for (size_t i = 0; i < m_size; i++)
+      slots[i] = std::move(m_slots[(m_head + i) & (m_slots.size() - 1)]);
+    m_slots.swap(slots);
+    m_head = 0;
+  }
+
+  std::vector<task> m_slots; /* size is zero or a power of two */
+  size_t m_head;
+  size_t m_size;
+};
+
+} // namespace wampcc
+
+#endif
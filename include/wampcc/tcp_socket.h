@@ -10,6 +10,7 @@
 
 #include "wampcc/kernel.h"
 #include "wampcc/error.h"
+#include "wampcc/shared_buffer.h"
 
 #include <string>
 #include <future>
@@ -131,6 +132,7 @@ public:
     static constexpr bool default_tcp_no_delay_enable = true;
     static constexpr bool default_keep_alive_enable = true;
     static constexpr std::chrono::seconds default_keep_alive_delay = std::chrono::seconds(60);
+    static constexpr bool default_reuse_port_enable = false;
 
     /* Individual options */
     bool tcp_no_delay_enable;
@@ -138,15 +140,25 @@ public:
     bool keep_alive_enable;
     std::chrono::seconds keep_alive_delay;
 
+    /* Set SO_REUSEPORT on a listen socket before it is bound, allowing several
+     * sockets (typically one per IO loop) to listen on the same address. */
+    bool reuse_port_enable;
+
     options();
   };
 
   typedef std::function<void(char*, size_t)> io_on_read;
   typedef std::function<void(uverr)> io_on_error;
+  typedef std::function<std::pair<char*, size_t>(size_t)> io_on_alloc;
   typedef std::function<void()> on_close_cb;
   typedef std::function<void(std::unique_ptr<tcp_socket>&,uverr)> on_accept_cb;
 
   tcp_socket(kernel* k, options = {});
+
+  /** Create a socket that is serviced by a specific IO loop of the kernel. If
+   * the loop is null, one is selected by the kernel. */
+  tcp_socket(kernel* k, options, io_loop*);
+
   virtual ~tcp_socket();
 
   tcp_socket(const tcp_socket&) = delete;
@@ -164,8 +176,13 @@ public:
                              bool resolve_addr = true);
 
   /** Request socket begins reading inbound data, with callbacks make on the IO
-   * thread. */
-  virtual std::future<uverr> start_read(io_on_read, io_on_error);
+   * thread. If an allocation callback is provided, it is asked for the memory
+   * that inbound bytes are read into (given a suggested size), so that the
+   * subsequent io_on_read refers to that memory and no copy is required.
+   * Otherwise, or if it provides no space, bytes are read into memory owned
+   * by the IO loop, which is valid only during the io_on_read callback. */
+  virtual std::future<uverr> start_read(io_on_read, io_on_error,
+                                        io_on_alloc = nullptr);
 
   /** Reset IO callbacks */
   void reset_listener();
@@ -182,6 +199,11 @@ public:
   void write(std::pair<const char*, size_t>* srcbuf, size_t count);
   void write(const char*, size_t);
 
+  /** Request a write of buffers without copying their bytes.  The socket
+   * shares ownership of each buffer until the IO thread has completed the
+   * write, so the caller must not modify the underlying bytes afterwards. */
+  void write(const shared_buffer* bufs, size_t count);
+
   /** Request asynchronous socket close. To detect when close has occurred, the
    * caller can wait upon the returned future.  Throws io_loop_closed if IO loop
    * has already been closed. */
@@ -243,6 +265,9 @@ public:
   const kernel* get_kernel() const { return m_kernel; }
   kernel* get_kernel() { return m_kernel; }
 
+  /** Return the IO loop which services this socket. */
+  io_loop* get_io_loop() const { return m_io_loop; }
+
 protected:
 
   enum class socket_state {
@@ -258,27 +283,33 @@ protected:
   tcp_socket(kernel* k, uv_tcp_t*, socket_state ss, options);
 
   virtual void handle_read_bytes(ssize_t, const uv_buf_t*);
+  virtual void alloc_read_buffer(size_t, uv_buf_t*);
   virtual void service_pending_write();
   virtual tcp_socket* create(kernel*, uv_tcp_t*, socket_state, options);
 
   typedef std::function<std::unique_ptr<tcp_socket>(uverr ec,  uv_tcp_t* h)> acceptor_fn_t;
-  void do_write(std::vector<uv_buf_t>&);
+  void do_write(std::vector<shared_buffer>&);
   std::future<uverr> listen_impl(const std::string&,const std::string&,
                                  addr_family, acceptor_fn_t);
 
   kernel* m_kernel;
   logger& __logger;
 
+  /* IO loop that owns the underlying handle; all IO for this socket is
+   * performed on this loop's thread. */
+  io_loop* m_io_loop;
+
   options m_sockopts;
 
   /* Store of user requests to write bytes. These are queued until serviced by
    * the IO thread, via service_pending_write(). */
-  std::vector<uv_buf_t> m_pending_write;
+  std::vector<shared_buffer> m_pending_write;
   std::mutex            m_pending_write_lock;
 
   /* User callbacks. */
   io_on_read m_io_on_read;
   io_on_error m_io_on_error;
+  io_on_alloc m_io_on_alloc;
 
   socket_state m_state;
   mutable std::mutex m_state_lock;
@@ -293,9 +324,11 @@ private:
   static const char * to_string(tcp_socket::socket_state);
 
   void on_read_cb(ssize_t, const uv_buf_t*);
+  void on_alloc_cb(size_t, uv_buf_t*);
   void on_write_cb(uv_write_t*, int);
   void close_once_on_io();
   void do_write();
+  void enqueue_write(std::vector<shared_buffer>&);
   void begin_close(bool no_linger = false);
   void do_listen(const std::string&, const std::string&, addr_family,
                  std::shared_ptr<std::promise<uverr>>);
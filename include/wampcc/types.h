@@ -9,6 +9,7 @@
 #define WAMPCC_WAMPTYPES_H
 
 #include "wampcc/json.h"
+#include "wampcc/shared_buffer.h"
 
 #include <functional>
 #include <mutex>
@@ -100,11 +101,49 @@ typedef uint64_t t_registration_id;
 class wamp_session;
 typedef std::weak_ptr<wamp_session> session_handle;
 
+/* Bit-flags for message serialisation types supported by WAMP */
+enum class serialiser_type
+{
+  none = 0x00,
+  json = 0x01,
+  msgpack = 0x02
+};
+
+constexpr int all_serialisers =
+  static_cast<int>(serialiser_type::json) |
+  static_cast<int>(serialiser_type::msgpack);
+
+/* The args_list & args_dict elements of a message, kept in the serialised form
+ * in which they were received, so that a router can forward them to another
+ * peer without decoding and re-encoding them. */
+struct raw_args
+{
+  serialiser_type serialiser;
+  size_t count;        /* elements held: 0, 1 (args_list) or 2 (and args_dict) */
+  shared_buffer bytes; /* the serialised elements, without enclosing array */
+
+  raw_args() : serialiser(serialiser_type::none), count(0) {}
+
+  bool empty() const { return count == 0; }
+};
+
 struct wamp_args
 {
   json_array  args_list;
   json_object args_dict;
 
+  /* When not empty, holds the arguments instead of args_list & args_dict,
+   * which are then unused.  Only present in messages received by a session
+   * that uses lazy argument decoding; see decode_args(). */
+  raw_args raw;
+
+  wamp_args() {}
+
+  wamp_args(json_array list, json_object dict = json_object())
+    : args_list(std::move(list)),
+      args_dict(std::move(dict))
+  {}
+
   bool operator==(const wamp_args& rhs) const {
     return (args_list == rhs.args_list) && (args_dict == rhs.args_dict);
   }
@@ -121,18 +160,6 @@ enum class connect_mode
   passive
 };
 
-/* Bit-flags for message serialisation types supported by WAMP */
-enum class serialiser_type
-{
-  none = 0x00,
-  json = 0x01,
-  msgpack = 0x02
-};
-
-constexpr int all_serialisers =
-  static_cast<int>(serialiser_type::json) |
-  static_cast<int>(serialiser_type::msgpack);
-
 /* Bit-flags for supported protocols */
 enum class protocol_type
 {
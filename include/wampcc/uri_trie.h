@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_URI_TRIE_H
+#define WAMPCC_URI_TRIE_H
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace wampcc
+{
+
+/* Index of pattern-based subscription URIs (WAMP advanced profile), mapping
+ * each pattern to a value of type T*.  URIs are split into their '.'
+ * separated components, each of which is a level of the trie, so finding the
+ * patterns which match a URI takes time proportional to the number of
+ * components, regardless of the number of patterns.
+ *
+ * A prefix pattern matches any URI which begins with it, as a string; so
+ * "com.myapp.topic.emergency" matches "com.myapp.topic.emergency.11" and
+ * "com.myapp.topic.emergency-low".  A wildcard pattern matches any URI with
+ * the same number of components, where an empty component of the pattern
+ * matches any component; so "com.myapp..userevent" matches
+ * "com.myapp.foo.userevent". */
+template <typename T> class uri_trie
+{
+public:
+  uri_trie() : m_size(0) {}
+
+  uri_trie(const uri_trie&) = delete;
+  uri_trie& operator=(const uri_trie&) = delete;
+
+  /** Add a prefix pattern.  Returns false, leaving the trie unchanged, if the
+   * pattern is already present. */
+  bool insert_prefix(const std::string& pattern, T* value)
+  {
+    /* The components up to the last are nodes; the last, which might be a
+     * partial component of a matched URI, is held by the node it follows. */
+    node* n = &m_prefix_root;
+    size_t start = 0;
+    size_t dot;
+    while ((dot = pattern.find('.', start)) != std::string::npos) {
+      n = n->child(pattern.substr(start, dot - start));
+      start = dot + 1;
+    }
+
+    std::string last = pattern.substr(start);
+    if (!n->prefixes.insert(std::make_pair(last, value)).second)
+      return false;
+    if (last.size() > n->longest_prefix)
+      n->longest_prefix = last.size();
+    m_size++;
+    return true;
+  }
+
+  /** Add a wildcard pattern.  Returns false, leaving the trie unchanged, if
+   * the pattern is already present. */
+  bool insert_wildcard(const std::string& pattern, T* value)
+  {
+    node* n = &m_wildcard_root;
+    size_t start = 0;
+    while (true) {
+      size_t dot = pattern.find('.', start);
+      size_t len = (dot == std::string::npos) ? std::string::npos : dot - start;
+      n = n->child(pattern.substr(start, len));
+      if (dot == std::string::npos)
+        break;
+      start = dot + 1;
+    }
+
+    if (n->value)
+      return false;
+    n->value = value;
+    m_size++;
+    return true;
+  }
+
+  /** Invoke 'fn' with the value of each pattern which matches 'uri' */
+  template <typename F> void match(const std::string& uri, F&& fn) const
+  {
+    if (m_size == 0)
+      return;
+
+    std::string key;
+    match_prefix(uri, key, fn);
+    match_wildcard(&m_wildcard_root, uri, 0, key, fn);
+  }
+
+  /** Number of patterns */
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+private:
+  struct node
+  {
+    std::unordered_map<std::string, std::unique_ptr<node>> children;
+
+    // prefix trie: patterns ending with a component which follows this node
+    std::unordered_map<std::string, T*> prefixes;
+    size_t longest_prefix = 0;
+
+    // wildcard trie: pattern ending at this node; an empty component is the
+    // child which matches any component
+    T* value = nullptr;
+
+    node* child(const std::string& component)
+    {
+      std::unique_ptr<node>& ptr = children[component];
+      if (!ptr)
+        ptr.reset(new node());
+      return ptr.get();
+    }
+
+    const node* find(const std::string& component) const
+    {
+      auto it = children.find(component);
+      return (it == children.end()) ? nullptr : it->second.get();
+    }
+  };
+
+  template <typename F>
+  void match_prefix(const std::string& uri, std::string& key, F& fn) const
+  {
+    const node* n = &m_prefix_root;
+    size_t start = 0;
+    while (n) {
+      size_t dot = uri.find('.', start);
+      size_t len = (dot == std::string::npos) ? uri.size() - start : dot - start;
+
+      /* patterns whose last component is a leading part of this one */
+      if (!n->prefixes.empty()) {
+        size_t longest = std::min(len, n->longest_prefix);
+        for (size_t i = 0; i <= longest; i++) {
+          key.assign(uri, start, i);
+          auto it = n->prefixes.find(key);
+          if (it != n->prefixes.end())
+            fn(it->second);
+        }
+      }
+
+      if (dot == std::string::npos || n->children.empty())
+        break;
+      key.assign(uri, start, len);
+      n = n->find(key);
+      start = dot + 1;
+    }
+  }
+
+  template <typename F>
+  void match_wildcard(const node* n, const std::string& uri, size_t start,
+                      std::string& key, F& fn) const
+  {
+    size_t dot = uri.find('.', start);
+    size_t len = (dot == std::string::npos) ? uri.size() - start : dot - start;
+
+    key.assign(uri, start, len);
+    const node* exact = n->find(key);
+    const node* any = len ? n->find(std::string()) : nullptr;
+
+    for (const node* next : {exact, any}) {
+      if (!next)
+        continue;
+      if (dot == std::string::npos) {
+        if (next->value)
+          fn(next->value);
+      }
+      else if (!next->children.empty())
+        match_wildcard(next, uri, dot + 1, key, fn);
+    }
+  }
+
+  node m_prefix_root;
+  node m_wildcard_root;
+  size_t m_size;
+};
+
+} // namespace wampcc
+
+#endif
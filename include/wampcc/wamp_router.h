@@ -22,6 +22,7 @@ namespace wampcc
 class kernel;
 class pubsub_man;
 class rpc_man;
+class strand;
 class wamp_router;
 struct rpc_details;
 
@@ -85,11 +86,19 @@ public:
     // socket options
     tcp_socket::options sockopts;
 
+    /* if true, the arguments of calls, results and publications are
+     * forwarded in the serialised form in which they arrived, and are only
+     * decoded when needed by the router itself, e.g. for an internal
+     * procedure, or when the peers use different serialisers.  Off by
+     * default; a listener must opt in. */
+    bool lazy_args;
+
     listen_options()
       : ssl(false),
         protocols(all_protocols),
         serialisers(all_serialisers),
-        af(tcp_socket::addr_family::unspec)
+        af(tcp_socket::addr_family::unspec),
+        lazy_args(false)
     {}
 
     listen_options(bool ssl_, int protocols_, int serialisers_, std::string node_,
@@ -101,7 +110,8 @@ public:
         node(node_),
         service(svc_),
         af(af_),
-        sockopts(sockopts_)
+        sockopts(sockopts_),
+        lazy_args(false)
     {}
   };
 
@@ -150,6 +160,10 @@ private:
 
   void check_has_closed();
 
+  void listen_sharded(std::vector<tcp_socket*>, size_t, std::string,
+                      const listen_options&, tcp_socket::on_accept_cb,
+                      std::shared_ptr<std::promise<uverr>>);
+
   wamp_router(const wamp_router&) = delete;
   wamp_router& operator=(const wamp_router&) = delete;
 
@@ -161,6 +175,9 @@ private:
   std::unique_ptr<rpc_man> m_rpcman;
   std::unique_ptr<pubsub_man> m_pubsub;
 
+  /* preserves order of publications made via the router's publish() */
+  std::unique_ptr<strand> m_publish_strand;
+
   std::mutex m_sessions_lock;
   std::map<t_session_id, std::shared_ptr<wamp_session>> m_sessions;
 
@@ -26,6 +26,7 @@ class protocol;
 class wamp_session;
 class kernel;
 class pubsub_man;
+class strand;
 struct logger;
 
 
@@ -625,7 +626,11 @@ public:
    * REGISTER message is sent to the connected dealer to request registration of
    * the procedure `uri`.  The success or failure of the registration attempt,
    * and requests for procedure invocation, are delivered via the callback
-   * function arguments. */
+   * function arguments.
+   *
+   * Several callees can share a registration by each giving the same
+   * `invoke` option, one of "roundrobin", "random", "first", "last" or
+   * "least_outstanding"; the dealer then chooses a callee for each call. */
   t_request_id provide(const std::string& uri,
                        json_object options,
                        on_registered_fn,
@@ -689,7 +694,9 @@ public:
    * procedure. An INVOCATION message will be send to the connected callee, to
    * request execution of a procedure identified with the
    * `registration_id`. The response from the request will be delivered via
-   * the callback function argument. */
+   * the callback function argument.  Arguments held in raw form are forwarded
+   * without being decoded; likewise, for a session using lazy argument
+   * decoding, the response arguments may be raw (see decode_args()). */
   t_request_id invocation(t_registration_id registration_id,
                           const json_object& options,
                           wamp_args args,
@@ -761,6 +768,7 @@ public:
   void result(t_request_id, json_object details);
   void result(t_request_id, json_object details, json_array);
   void result(t_request_id, json_object details, json_array, json_object);
+  void result(t_request_id, json_object details, wamp_args);
   //@}
 
   //@{
@@ -771,6 +779,7 @@ public:
   void call_error(t_request_id, std::string error, json_object details);
   void call_error(t_request_id, std::string error, json_object details, json_array);
   void call_error(t_request_id, std::string error, json_object details, json_array, json_object);
+  void call_error(t_request_id, std::string error, json_object details, wamp_args);
   //@}
 
   //@{
@@ -873,12 +882,16 @@ private:
   void io_on_read(char*, size_t);
   void io_on_error(uverr);
   void decode_and_process(char*, size_t len);
-  void process_message(json_array&, json_uint_t);
+  void process_message(json_array&, json_uint_t, raw_args&);
+  void recycle_message(json_array&);
+  void take_spare_message(json_array&);
   void handle_exception();
 
   void update_state_for_outbound(const json_array& msg);
 
   void send_msg(const json_array&);
+  void send_msg(json_array, wamp_args);
+  void send_msg(outbound_message&);
 
   void upgrade_protocol(std::unique_ptr<protocol>&);
 
@@ -908,6 +921,10 @@ private:
   void change_state(state expecte1, state expecte2, state next);
   void terminate(std::lock_guard<std::mutex>&);
   void transition_to_closed();
+  void track_timer(timer_handle);
+  void schedule_timer(std::chrono::milliseconds delay,
+                      std::chrono::milliseconds interval,
+                      std::function<void(wamp_session&)>);
 
   void handle_HELLO(json_array& ja);
   void handle_CHALLENGE(json_array& ja);
@@ -925,11 +942,19 @@ private:
   std::string m_log_prefix;
   std::unique_ptr<tcp_socket> m_socket;
 
+  /* EV thread work for this session, ensuring messages are handled in order */
+  std::unique_ptr<strand> m_strand;
+
   mode m_session_mode;
 
   std::promise<void> m_has_closed;
   std::shared_future<void> m_shfut_has_closed;
 
+  /* timers scheduled for this session, which are cancelled upon closure */
+  std::mutex m_timers_lock;
+  std::vector<timer_handle> m_timers;
+  bool m_timers_cancelled;
+
   time_t m_time_create;
   time_t m_time_last_msg_recv;
 
@@ -968,10 +993,10 @@ private:
   void process_inbound_published(json_array &);
   void process_inbound_event(json_array &);
   void process_inbound_result(json_array &);
-  void process_inbound_error(json_array &);
-  void process_inbound_call(json_array &);
-  void process_inbound_yield(json_array &);
-  void process_inbound_publish(json_array &);
+  void process_inbound_error(json_array &, raw_args &);
+  void process_inbound_call(json_array &, raw_args &);
+  void process_inbound_yield(json_array &, raw_args &);
+  void process_inbound_publish(json_array &, raw_args &);
   void process_inbound_subscribe(json_array &);
   void process_inbound_unsubscribe(json_array &);
   void process_inbound_goodbye(json_array &);
@@ -1031,6 +1056,12 @@ private:
 
   std::unique_ptr<protocol> m_proto;
 
+  /* Inbound message which has been processed, kept so that the next inbound
+   * message can be decoded over it, reusing its storage.  Passed from the EV
+   * thread back to the IO thread. */
+  std::mutex m_spare_msg_lock;
+  json_array m_spare_msg;
+
   std::promise< void > m_promise_on_open;
 
   /* Track if session has been WELCOMEd. */
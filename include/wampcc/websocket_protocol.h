@@ -51,6 +51,9 @@ public:
   static constexpr const char* NAME = "websocket";
 
   static constexpr const int    HEADER_SIZE = 4; /* "GET " */
+
+  /* Limit of the inbound byte buffer, which is also the largest socket read. */
+  static constexpr const size_t BUFFER_MAX_SIZE = 64 * 1024;
   static constexpr const char*  MAGIC = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
   static constexpr const char* WAMPV2_JSON_SUBPROTOCOL = "wamp.2.json";
@@ -67,10 +70,12 @@ public:
 
   const char* name() const override { return NAME; }
   void send_msg(const json_array& j) override;
+  void send_shared_msg(outbound_message&) override;
 
 private:
 
   void process_frame_bytes(buffer::read_pointer&);
+  shared_buffer encode_frame(const json_array&, const raw_args& = {});
 
   const std::string& header_field(const char*) const;
 
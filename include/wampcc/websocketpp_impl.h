@@ -81,6 +81,9 @@ public:
 
   websocketpp::processor::hybi13<websocket_config>::msg_manager_ptr& msg_manager() { return m_msg_manager; }
 
+  /* Key for masking a frame sent by a client. */
+  uint32_t masking_key() { return m_rng_mgr(); }
+
 
   /* Get the frame details of the a message as a string, for logging. */
   static std::string frame_to_string(const websocket_config::message_type::ptr&);
@@ -3,10 +3,12 @@
 #include "json_pointer.h"
 
 #include <iostream>
+#include <new>
 #include <sstream>
 #include <limits>
 
 #include <string.h>
+#include <stdlib.h>
 
 namespace wampcc {
 
@@ -68,10 +70,31 @@ valueimpl::Details valueimpl::init_details(JSONDetailedType t)
 }
 
 
+static_assert(sizeof(json_array) <= sizeof(valueimpl::inline_storage) &&
+              alignof(json_array) <= alignof(valueimpl::inline_storage),
+              "json_array does not fit the inline storage of valueimpl");
+static_assert(sizeof(json_string) <= sizeof(valueimpl::inline_storage) &&
+              alignof(json_string) <= alignof(valueimpl::inline_storage),
+              "json_string does not fit the inline storage of valueimpl");
+
+/* Drop a reference to a shared node, deleting it with the last */
+static void release_node(shared_node* node)
+{
+  if (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete node;
+}
+
 void valueimpl::dispose_details(valueimpl::Details& d)
 {
   switch(d.type)
   {
+    case e_shared_object:
+    case e_shared_array:
+    case e_shared_string:
+    {
+      release_node(d.data.shared);
+      break;
+    }
     case e_object :
     {
       delete d.data.object;
@@ -79,12 +102,12 @@ void valueimpl::dispose_details(valueimpl::Details& d)
     }
     case e_array:
     {
-      delete d.data.array;
+      reinterpret_cast<json_array*>(&d.data.storage)->~json_array();
       break;
     }
     case e_string :
     {
-      delete d.data.string;
+      reinterpret_cast<json_string*>(&d.data.storage)->~json_string();
       break;
     }
     default: break;
@@ -92,20 +115,48 @@ void valueimpl::dispose_details(valueimpl::Details& d)
   d = init_details();
 }
 
+void valueimpl::relocate_details(Details& dest, Details& src) noexcept
+{
+  switch(src.type)
+  {
+    case e_array:
+    {
+      json_array& from = *reinterpret_cast<json_array*>(&src.data.storage);
+      dest.type = e_array;
+      new (&dest.data.storage) json_array(std::move(from));
+      from.~json_array();
+      break;
+    }
+    case e_string:
+    {
+      json_string& from = *reinterpret_cast<json_string*>(&src.data.storage);
+      dest.type = e_string;
+      new (&dest.data.storage) json_string(std::move(from));
+      from.~json_string();
+      break;
+    }
+    default:
+    {
+      dest = src; // bitwise
+      break;
+    }
+  }
+  src = init_details();
+}
+
 valueimpl::valueimpl()
   : details( init_details() )
 {
 }
 
 valueimpl::valueimpl(valueimpl&& rhs) noexcept
-  : details(rhs.details)
 {
-  rhs.details = init_details();
+  relocate_details(details, rhs.details);
 }
 
 valueimpl::valueimpl(const valueimpl& rhs)
-  : details( rhs.clone_details() )
 {
+  rhs.clone_details(details);
 }
 
 valueimpl::valueimpl(bool b, BoolConstructor)
@@ -132,40 +183,43 @@ valueimpl::valueimpl(double n)
   details.data.real = n;
 }
 
-valueimpl::valueimpl(json_array* a)
+valueimpl::valueimpl(json_array a)
   : details( init_details(valueimpl::e_array) )
 {
-  details.data.array = a;
+  new (&details.data.storage) json_array(std::move(a));
 }
 
-valueimpl::valueimpl(json_object* a)
+valueimpl::valueimpl(json_object a)
   : details( init_details(valueimpl::e_object) )
 {
-  details.data.object = a;
+  details.data.object = new json_object(std::move(a));
 }
 
 
-valueimpl::valueimpl(json_string* a)
+valueimpl::valueimpl(json_string a)
   : details( init_details(valueimpl::e_string) )
 {
-  details.data.string = a;
+  new (&details.data.storage) json_string(std::move(a));
 }
 
 valueimpl& valueimpl::operator=(valueimpl&& rhs) noexcept
 {
-  this->details = rhs.details;  // bitwise
-  rhs.details = init_details();
+  // take rhs before disposing, since it might be owned by this value
+  Details tmp;
+  relocate_details(tmp, rhs.details);
+  dispose_details(this->details);
+  relocate_details(this->details, tmp);
   return *this;
 }
 
 valueimpl& valueimpl::operator=(const valueimpl& rhs)
 {
-  Details copy = rhs.clone_details();
+  valueimpl copy(rhs);
 
   // delete our own data
   dispose_details(this->details);
 
-  this->details = copy;  // bitwise
+  relocate_details(this->details, copy.details);
 
   return *this;
 }
@@ -177,41 +231,95 @@ valueimpl::~valueimpl()
 
 void valueimpl::swap(valueimpl& other)
 {
-  Details tmp   = other.details;
-  other.details = this->details;
-  this->details = tmp;
+  Details tmp;
+  relocate_details(tmp, other.details);
+  relocate_details(other.details, this->details);
+  relocate_details(this->details, tmp);
 }
 
-valueimpl::Details valueimpl::clone_details() const
+void valueimpl::clone_details(Details& dest) const
 {
-  // basic bitwise copy is sufficent for value-types
-  valueimpl::Details retval = this->details;
-
-  // ... now handle pointer types
   switch(this->details.type)
   {
+    case valueimpl::e_shared_object:
+    case valueimpl::e_shared_array:
+    case valueimpl::e_shared_string:
+    {
+      details.data.shared->refs.fetch_add(1, std::memory_order_relaxed);
+      dest.data = details.data;
+      break;
+    }
     case valueimpl::e_object :
     {
-      retval.data.object = new json_object(*details.data.object);
+      dest.data.object = new json_object(*details.data.object);
       break;
     }
     case valueimpl::e_array:
     {
-      retval.data.array = new json_array(*details.data.array);
+      new (&dest.data.storage) json_array(as_type((json_array*) nullptr));
       break;
     }
     case valueimpl::e_string:
     {
-      retval.data.string = new json_string(*details.data.string);
+      new (&dest.data.storage) json_string(as_type((json_string*) nullptr));
+      break;
+    }
+    default:
+    {
+      // basic bitwise copy is sufficent for value-types
+      dest.data = details.data;
       break;
     }
-    default: break;
   }
-  return retval;
+  dest.type = this->details.type;
+}
+
+void valueimpl::share()
+{
+  JSONDetailedType shared_type;
+  switch(details.type)
+  {
+    case e_object: shared_type = e_shared_object; break;
+    case e_array:  shared_type = e_shared_array;  break;
+    case e_string: shared_type = e_shared_string; break;
+    default: return; /* value-types, or already shared */
+  }
+
+  shared_node* node = new shared_node();
+  relocate_details(node->value.details, details);
+  details.type = shared_type;
+  details.data.shared = node;
+}
+
+void valueimpl::make_unique()
+{
+  if (!is_shared())
+    return;
+
+  shared_node* node = details.data.shared;
+  Details tmp;
+
+  /* If this is the only reference then no other thread can be using the node,
+   * so its value can be taken rather than copied */
+  if (node->refs.load(std::memory_order_acquire) == 1)
+    relocate_details(tmp, node->value.details);
+  else
+    node->value.clone_details(tmp);
+
+  release_node(node);
+  relocate_details(details, tmp);
 }
 
 bool valueimpl::operator==(const valueimpl& rhs) const
 {
+  if (this->is_shared() || rhs.is_shared())
+  {
+    if (this->details.type == rhs.details.type &&
+        this->details.data.shared == rhs.details.data.shared)
+      return true;
+    return this->resolved() == rhs.resolved();
+  }
+
   if (this->details.type == rhs.details.type)
   {
     switch(this->details.type)
@@ -226,11 +334,13 @@ bool valueimpl::operator==(const valueimpl& rhs) const
       }
       case valueimpl::e_array:
       {
-        return *this->details.data.array == *rhs.details.data.array;
+        return as_type((json_array*) nullptr) ==
+               rhs.as_type((json_array*) nullptr);
       }
       case valueimpl::e_string:
       {
-        return *(this->details.data.string) ==  *rhs.details.data.string;
+        return as_type((json_string*) nullptr) ==
+               rhs.as_type((json_string*) nullptr);
       }
       case valueimpl::e_bool:
       {
@@ -385,27 +495,42 @@ json_value::json_value()
 }
 
 json_value::json_value(const std::string& s)
-  : m_impl(new json_string(s))
+  : m_impl(json_string(s))
 {
 }
 
 json_value::json_value(const char* s)
-  : m_impl(s? new json_string(s) : new json_string())
+  : m_impl(s? json_string(s) : json_string())
 {
 }
 
 json_value::json_value(const char* s, size_t  n)
-  : m_impl(s? new json_string(s, n) : new json_string())
+  : m_impl(s? json_string(s, n) : json_string())
 {
 }
 
 json_value::json_value(const json_array& rhs)
-  : m_impl(new json_array(rhs))
+  : m_impl(json_array(rhs))
 {
 }
 
 json_value::json_value(const json_object& rhs)
-  : m_impl( new json_object(rhs) )
+  : m_impl(json_object(rhs))
+{
+}
+
+json_value::json_value(std::string&& s)
+  : m_impl(json_string(std::move(s)))
+{
+}
+
+json_value::json_value(json_array&& rhs)
+  : m_impl(json_array(std::move(rhs)))
+{
+}
+
+json_value::json_value(json_object&& rhs)
+  : m_impl(json_object(std::move(rhs)))
 {
 }
 
@@ -450,6 +575,28 @@ json_value::json_value(unsigned long long i)
 {
 }
 
+void json_value::share()
+{
+  if (m_impl.is_shared())
+    return;
+
+  /* share the elements first, so that detaching this value later copies only
+   * this level */
+  if (is_array())
+    for (auto& item : m_impl.as<json_array>())
+      item.share();
+  else if (is_object())
+    for (auto& item : m_impl.as<json_object>())
+      item.second.share();
+
+  m_impl.share();
+}
+
+void json_value::make_unique()
+{
+  m_impl.make_unique();
+}
+
 void json_value::swap(json_value& other)
 {
   this->m_impl.swap(other.m_impl);
@@ -467,22 +614,12 @@ json_value json_value::make_null()
 
 json_value json_value::make_array()
 {
-  internals::valueimpl vimpl( new json_array() );
-
-  json_value v;
-  v.m_impl.swap( vimpl );
-
-  return v;
+  return json_value(json_array());
 }
 
 json_value json_value::make_object()
 {
-  internals::valueimpl vimpl( new json_object() );
-
-  json_value v;
-  v.m_impl.swap( vimpl );
-
-  return v;
+  return json_value(json_object());
 }
 
 json_value json_value::make_string(const char* s)
@@ -655,6 +792,11 @@ bool json_value::patch(const json_array& patch)
   return apply_patch(*this, patch);
 }
 
+bool json_value::patch(json_array&& patch)
+{
+  return apply_patch(*this, std::move(patch));
+}
+
 const json_value * json_value::eval(const char* path) const
 {
   return eval_json_pointer(*this, path);
@@ -748,20 +890,64 @@ json_value json_get_copy(const json_array& ar, size_t i,
 }
 
 
+static void free_msgpack_bytes(region* ptr)
+{
+  if (ptr)
+    ::free(ptr->first);
+
+  delete ptr;
+}
+
+void json_msgpack_decode(json_value& dest, const char* p, size_t l)
+{
+  msgpack_decoder(p, l).decode(dest);
+}
+
 json_value json_msgpack_decode(const char* p , size_t l)
 {
-  msgpack_decoder decoder;
-  if (decoder.decode(p, l))
-    return std::move(decoder.result);
-  else
-    throw msgpack_error("msgpack deocde failed");
+  json_value dest;
+  msgpack_decoder(p, l).decode(dest);
+  return dest;
+}
+
+void json_msgpack_encode(const json_value& src, std::vector<char>& dest)
+{
+  msgpack_encoder(dest).encode(src);
+}
+
+json_array_tail json_msgpack_decode_head(json_array& dest, const char* p,
+                                         size_t l, json_head_size_fn head_size)
+{
+  return msgpack_decoder(p, l).decode_head(dest, head_size);
+}
+
+void json_msgpack_encode_spliced(const json_array& head, const char* tail,
+                                 size_t len, size_t count,
+                                 std::vector<char>& dest)
+{
+  msgpack_encoder(dest).encode_spliced(head, tail, len, count);
+}
+
+void msgpack_to_json(const char* src, size_t len, std::vector<char>& dest)
+{
+  msgpack_decoder(src, len).transcode_json(dest);
+}
+
+void msgpack_to_json_tail(const char* src, size_t len, std::vector<char>& dest)
+{
+  msgpack_decoder(src, len).transcode_json_tail(dest);
 }
 
 std::unique_ptr<region, void(*)(region*)> json_msgpack_encode(const json_value& src)
 {
-  msgpack_encoder encoder;
+  std::vector<char> bytes;
+  msgpack_encoder(bytes).encode(src);
 
-  return encoder.encode(src);
+  char* mem = static_cast<char*>(::malloc(bytes.size() ? bytes.size() : 1));
+  if (!mem)
+    throw std::bad_alloc();
+  memcpy(mem, bytes.data(), bytes.size());
+  return {new region(mem, bytes.size()), free_msgpack_bytes};
 }
 
 
@@ -0,0 +1,1094 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "json_reuse.h"
+#include "json_simd.h"
+#include "msgpack_serialiser.h"
+
+#include <cerrno>
+#include <clocale>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <sstream>
+
+#include <stdlib.h>
+
+#if defined(WAMPCC_JSON_X86) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define WAMPCC_JSON_AVX2 1
+#endif
+
+/*
+  Native JSON decoder, in two stages.
+
+  Stage one classifies the input 64 bytes at a time, producing bitmasks of the
+  quotes, backslashes, structural characters ({}[]:,) and whitespace.  This is
+  the part done with SIMD instructions, chosen at runtime from the CPU's
+  capabilities.  The masks are then combined, using only 64-bit integer
+  operations, into an index of the offset of every structural character and
+  every token start that is not inside a string.
+
+  Stage two walks that index building the json_value tree directly, parsing
+  strings, numbers and literals from their start offsets.  Objects and arrays
+  have their members constructed in place, and object members are inserted
+  with a hint, since keys commonly arrive already sorted.
+
+  Stage two can instead transcode the input to msgpack.  Since a msgpack array
+  or map header carries its element count, the counts of all containers are
+  first obtained in one walk of the index, which has an entry for every comma
+  and bracket; scalars are then parsed from the source and packed directly,
+  and strings without escapes are copied straight from the input.
+
+  The grammar accepted is that of jansson with default flags (which this
+  replaces), i.e. the top level value must be an object or array, and strings
+  must be valid UTF-8.  Unlike jansson, integers between INT64_MAX and
+  UINT64_MAX are accepted, as unsigned integers, and "\u0000" is accepted.
+*/
+
+namespace wampcc
+{
+
+namespace
+{
+
+const int max_depth = 2048;
+
+/* Bitmasks of the character classes within a 64 byte block. */
+struct block_masks
+{
+  uint64_t backslash;
+  uint64_t quote;
+  uint64_t op; /* {}[]:, */
+  uint64_t space;
+};
+
+typedef void (*classify_fn)(const char*, block_masks*);
+
+
+/* Stage one, portable implementation */
+
+enum { c_backslash = 1, c_quote = 2, c_op = 4, c_space = 8 };
+
+/* character class of each byte, constant initialised so usable at any time */
+const unsigned char char_classes[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, c_space, c_space, 0, 0, c_space, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  c_space, 0, c_quote, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, c_op, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, c_op, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, c_op, c_backslash, c_op, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, c_op, 0, c_op, 0, 0,
+  /* 0x80 to 0xFF are zero */
+};
+
+void classify_scalar(const char* block, block_masks* m)
+{
+  uint64_t backslash = 0, quote = 0, op = 0, space = 0;
+  for (int i = 0; i < 64; i++) {
+    uint64_t bit = uint64_t(1) << i;
+    switch (char_classes[static_cast<unsigned char>(block[i])]) {
+      case c_backslash: backslash |= bit; break;
+      case c_quote: quote |= bit; break;
+      case c_op: op |= bit; break;
+      case c_space: space |= bit; break;
+    }
+  }
+  m->backslash = backslash;
+  m->quote = quote;
+  m->op = op;
+  m->space = space;
+}
+
+
+/* Stage one, SSE2 implementation */
+
+#ifdef WAMPCC_JSON_SSE2
+void classify_sse2(const char* block, block_masks* m)
+{
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i lower = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');  /* '[' | 0x20 */
+  const __m128i close = _mm_set1_epi8('}'); /* ']' | 0x20 */
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+
+  m->backslash = m->quote = m->op = m->space = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+    __m128i v_lower = _mm_or_si128(v, lower);
+    __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v_lower, open),
+                     _mm_cmpeq_epi8(v_lower, close)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    __m128i space =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+    int shift = 16 * i;
+    m->backslash |= uint64_t(static_cast<uint16_t>(
+                        _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash))))
+                    << shift;
+    m->quote |= uint64_t(static_cast<uint16_t>(
+                    _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote))))
+                << shift;
+    m->op |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(op))) << shift;
+    m->space |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(space)))
+                << shift;
+  }
+}
+#endif
+
+
+/* Stage one, AVX2 implementation, only called if the CPU supports it */
+
+#ifdef WAMPCC_JSON_AVX2
+__attribute__((target("avx2"))) void classify_avx2(const char* block,
+                                                   block_masks* m)
+{
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  const __m256i open = _mm256_set1_epi8('{');
+  const __m256i close = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i sp = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+
+  m->backslash = m->quote = m->op = m->space = 0;
+  for (int i = 0; i < 2; i++) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+    __m256i v_lower = _mm256_or_si256(v, lower);
+    __m256i op = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v_lower, open),
+                        _mm256_cmpeq_epi8(v_lower, close)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                        _mm256_cmpeq_epi8(v, comma)));
+    __m256i space = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+    int shift = 32 * i;
+    m->backslash |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(v, backslash))))
+                    << shift;
+    m->quote |= uint64_t(static_cast<uint32_t>(
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote))))
+                << shift;
+    m->op |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(op)))
+             << shift;
+    m->space |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(space)))
+                << shift;
+  }
+}
+#endif
+
+
+classify_fn classifier(json_simd level)
+{
+  switch (level) {
+#ifdef WAMPCC_JSON_AVX2
+    case json_simd::avx2:
+      return classify_avx2;
+#endif
+#ifdef WAMPCC_JSON_SSE2
+    case json_simd::sse2:
+      return classify_sse2;
+#endif
+    default:
+      return classify_scalar;
+  }
+}
+
+
+/* Bit i of the result is the parity of bits 0 to i of 'x', so for a mask of
+ * quotes it marks the bytes from each opening quote up to its closing quote. */
+inline uint64_t prefix_xor(uint64_t x)
+{
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+
+/* Reusable storage for the structural index. */
+struct index_buffer
+{
+  std::unique_ptr<uint32_t[]> data;
+  size_t capacity = 0;
+
+  uint32_t* reserve(size_t n)
+  {
+    if (n > capacity) {
+      data.reset(new uint32_t[n]);
+      capacity = n;
+    }
+    return data.get();
+  }
+
+  /* avoid holding on to a large allocation after an unusually large message */
+  void trim()
+  {
+    if (capacity > (1u << 20)) {
+      data.reset();
+      capacity = 0;
+    }
+  }
+};
+
+
+/* Stage one: fill 'index' with the offsets of structural characters and token
+ * starts, returning the number of offsets written. */
+size_t build_index(const char* src, size_t len, classify_fn classify,
+                   uint32_t* index)
+{
+  const uint64_t even_bits = 0x5555555555555555ULL;
+
+  uint32_t* out = index;
+  uint64_t prev_escaped = 0;   /* first byte of next block is escaped */
+  uint64_t prev_in_string = 0; /* all ones if next block starts in a string */
+  uint64_t prev_scalar = 0;    /* last byte of block was part of a scalar */
+
+  char tail[64];
+  for (size_t base = 0; base < len; base += 64) {
+    const char* block = src + base;
+    if (len - base < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, block, len - base);
+      block = tail;
+    }
+
+    block_masks m;
+    classify(block, &m);
+
+    /* Find the escaped characters, i.e. those following an odd length run of
+     * backslashes.  Runs starting on an odd bit have the carry of their
+     * addition land on the byte after the run when of odd length. */
+    uint64_t escaped;
+    if (m.backslash == 0) {
+      escaped = prev_escaped;
+      prev_escaped = 0;
+    } else {
+      uint64_t backslash = m.backslash & ~prev_escaped;
+      uint64_t follows_escape = (backslash << 1) | prev_escaped;
+      uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+      uint64_t even_sequences = odd_starts + backslash;
+      prev_escaped = even_sequences < odd_starts;
+      escaped = (even_bits ^ (even_sequences << 1)) & follows_escape;
+    }
+
+    /* in_string includes the opening quote but not the closing one */
+    uint64_t quote = m.quote & ~escaped;
+    uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+    /* a token starts at each structural character, and at each non-space byte
+     * that follows a structural character or space */
+    uint64_t scalar = ~(m.op | m.space);
+    uint64_t nonquote_scalar = scalar & ~quote;
+    uint64_t follows_scalar = (nonquote_scalar << 1) | prev_scalar;
+    prev_scalar = nonquote_scalar >> 63;
+
+    uint64_t starts = (m.op | (scalar & ~follows_scalar)) & ~(in_string ^ quote);
+
+    /* discard anything picked up from the padding of the final block */
+    if (len - base < 64)
+      starts &= (uint64_t(1) << (len - base)) - 1;
+
+    while (starts) {
+      *out++ = static_cast<uint32_t>(base + json_lowest_bit(starts));
+      starts &= starts - 1;
+    }
+  }
+
+  return out - index;
+}
+
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+inline bool is_delimiter(char c)
+{
+  return char_classes[static_cast<unsigned char>(c)] & (c_op | c_space);
+}
+
+int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+void append_utf8(std::string& out, uint32_t cp)
+{
+  if (cp < 0x80)
+    out += static_cast<char>(cp);
+  else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+/* Reusable storage for transcoding. */
+struct transcode_buffers
+{
+  std::vector<uint32_t> counts; /* members of each container, in order */
+  std::vector<uint32_t> open;   /* containers not yet closed */
+  std::string text;             /* unescaped string */
+
+  /* as for index_buffer, release storage grown for an unusual message */
+  void trim()
+  {
+    if (counts.capacity() > (1u << 16)) {
+      std::vector<uint32_t>().swap(counts);
+      std::vector<uint32_t>().swap(open);
+    }
+    if (text.capacity() > (1u << 20))
+      std::string().swap(text);
+  }
+};
+
+
+/* Stage two: build the json_value tree by walking the index.  Where the
+ * destination is null, the value is validated but not built. */
+class parser
+{
+public:
+  parser(const char* src, size_t len, const uint32_t* index, size_t count)
+    : m_src(src), m_len(len), m_index(index), m_count(count), m_next(0),
+      m_depth(0), m_buffers(nullptr), m_next_container(0)
+  {
+  }
+
+  void parse_document(json_value& dest)
+  {
+    if (m_count == 0)
+      fail("'[' or '{' expected", m_len);
+    size_t pos = m_index[m_next++];
+    if (m_src[pos] != '[' && m_src[pos] != '{')
+      fail("'[' or '{' expected", pos);
+    parse_value(&dest, pos);
+    if (m_next != m_count)
+      fail("end of file expected", m_index[m_next]);
+  }
+
+  /* Parse a top-level array, building only its leading elements, the number
+   * of which is obtained from the first element. */
+  json_array_tail parse_head(json_array& dest, json_head_size_fn head_size)
+  {
+    if (m_count == 0)
+      fail("'[' expected", m_len);
+    size_t pos = m_index[m_next++];
+    if (m_src[pos] != '[')
+      fail("'[' expected", pos);
+    m_depth++;
+
+    json_array_tail tail{0, 0, 0, eNULL, eNULL};
+    size_t head = 1;
+    size_t n = 0;
+
+    pos = next_token();
+    if (m_src[pos] != ']') {
+      while (true) {
+        if (n < head) {
+          if (n == dest.size())
+            dest.emplace_back();
+          parse_value(&dest[n], pos);
+          if (n++ == 0)
+            head = head_size(dest[0]);
+        } else {
+          tail.last_type = parse_value(nullptr, pos);
+          if (tail.count++ == 0) {
+            tail.offset = pos;
+            tail.first_type = tail.last_type;
+          }
+        }
+
+        pos = next_token();
+        if (m_src[pos] == ']')
+          break;
+        if (m_src[pos] != ',')
+          fail("']' expected", pos);
+        pos = next_token();
+      }
+    }
+
+    dest.erase(dest.begin() + n, dest.end());
+
+    if (tail.count) {
+      size_t end = pos;
+      while (char_classes[static_cast<unsigned char>(m_src[end - 1])] & c_space)
+        end--;
+      tail.length = end - tail.offset;
+    }
+
+    if (m_next != m_count)
+      fail("end of file expected", m_index[m_next]);
+    return tail;
+  }
+
+  /* Transcode the document to msgpack, or if 'tail' is set, the comma
+   * separated values of an array tail. */
+  void transcode(msgpack_encoder& out, transcode_buffers& buffers, bool tail)
+  {
+    m_buffers = &buffers;
+    count_members();
+
+    if (tail) {
+      if (m_count == 0)
+        return;
+      transcode_value(out, next_token());
+      while (m_next != m_count) {
+        size_t pos = next_token();
+        if (m_src[pos] != ',')
+          fail("',' expected", pos);
+        transcode_value(out, next_token());
+      }
+      return;
+    }
+
+    if (m_count == 0)
+      fail("'[' or '{' expected", m_len);
+    size_t pos = m_index[m_next++];
+    if (m_src[pos] != '[' && m_src[pos] != '{')
+      fail("'[' or '{' expected", pos);
+    transcode_value(out, pos);
+    if (m_next != m_count)
+      fail("end of file expected", m_index[m_next]);
+  }
+
+private:
+  /* Count the members of every container, in order of their opening bracket.
+   * Malformed input can make the counts wrong, but it is then rejected by the
+   * transcoding that follows. */
+  void count_members()
+  {
+    std::vector<uint32_t>& counts = m_buffers->counts;
+    std::vector<uint32_t>& open = m_buffers->open;
+    counts.clear();
+    open.clear();
+
+    char prev = 0;
+    for (size_t i = m_next; i < m_count; i++) {
+      char c = m_src[m_index[i]];
+      switch (c) {
+        case '[':
+        case '{':
+          open.push_back(static_cast<uint32_t>(counts.size()));
+          counts.push_back(0);
+          break;
+        case ',':
+          if (!open.empty())
+            counts[open.back()]++;
+          break;
+        case ']':
+        case '}':
+          if (!open.empty()) {
+            if (prev != '[' && prev != '{')
+              counts[open.back()]++; /* one more member than commas */
+            open.pop_back();
+          }
+          break;
+      }
+      prev = c;
+    }
+  }
+
+  size_t next_count()
+  {
+    return m_buffers->counts[m_next_container++];
+  }
+
+  void transcode_value(msgpack_encoder& out, size_t pos)
+  {
+    switch (m_src[pos]) {
+      case '{':
+        transcode_object(out, pos);
+        break;
+      case '[':
+        transcode_array(out, pos);
+        break;
+      case '"':
+        transcode_string(out, pos);
+        break;
+      default: {
+        json_value scalar;
+        parse_value(&scalar, pos);
+        out.encode(scalar);
+      }
+    }
+  }
+
+  void transcode_object(msgpack_encoder& out, size_t pos)
+  {
+    if (++m_depth > max_depth)
+      fail("maximum parsing depth reached", pos);
+    out.put_map_header(next_count());
+
+    pos = next_token();
+    if (m_src[pos] != '}') {
+      while (true) {
+        if (m_src[pos] != '"')
+          fail("string or '}' expected", pos);
+        transcode_string(out, pos);
+
+        pos = next_token();
+        if (m_src[pos] != ':')
+          fail("':' expected", pos);
+        transcode_value(out, next_token());
+
+        pos = next_token();
+        if (m_src[pos] == '}')
+          break;
+        if (m_src[pos] != ',')
+          fail("'}' expected", pos);
+        pos = next_token();
+      }
+    }
+    m_depth--;
+  }
+
+  void transcode_array(msgpack_encoder& out, size_t pos)
+  {
+    if (++m_depth > max_depth)
+      fail("maximum parsing depth reached", pos);
+    out.put_array_header(next_count());
+
+    pos = next_token();
+    if (m_src[pos] != ']') {
+      while (true) {
+        transcode_value(out, pos);
+
+        pos = next_token();
+        if (m_src[pos] == ']')
+          break;
+        if (m_src[pos] != ',')
+          fail("']' expected", pos);
+        pos = next_token();
+      }
+    }
+    m_depth--;
+  }
+
+  void transcode_string(msgpack_encoder& out, size_t pos)
+  {
+    /* most strings have no escapes, so can be copied from the input */
+    size_t p = pos + 1;
+    size_t plain = json_unescaped_prefix(m_src + p, m_len - p);
+    if (p + plain < m_len && m_src[p + plain] == '"') {
+      size_t valid = json_utf8_valid_prefix(
+          reinterpret_cast<const unsigned char*>(m_src + p), plain);
+      if (valid != plain)
+        fail("unable to decode byte as UTF-8", p + valid);
+      out.put_string(m_src + p, plain);
+      return;
+    }
+
+    std::string& text = m_buffers->text;
+    text.clear();
+    parse_string(&text, pos);
+    out.put_string(text.data(), text.size());
+  }
+
+  size_t next_token()
+  {
+    if (m_next == m_count)
+      fail("unexpected end of input", m_len);
+    return m_index[m_next++];
+  }
+
+  JSONType parse_value(json_value* dest, size_t pos)
+  {
+    switch (m_src[pos]) {
+      case '{':
+        parse_object(dest, pos);
+        return eOBJECT;
+      case '[':
+        parse_array(dest, pos);
+        return eARRAY;
+      case '"':
+        if (dest)
+          parse_string(&reuse_string(*dest), pos);
+        else
+          parse_string(nullptr, pos);
+        return eSTRING;
+      case 't':
+        parse_literal(pos, "true", 4);
+        if (dest)
+          *dest = json_value(true);
+        return eBOOL;
+      case 'f':
+        parse_literal(pos, "false", 5);
+        if (dest)
+          *dest = json_value(false);
+        return eBOOL;
+      case 'n':
+        parse_literal(pos, "null", 4);
+        if (dest)
+          *dest = json_value();
+        return eNULL;
+      default:
+        return parse_number(dest, pos);
+    }
+  }
+
+  void parse_object(json_value* dest, size_t pos)
+  {
+    if (++m_depth > max_depth)
+      fail("maximum parsing depth reached", pos);
+
+    object_reuse obj(dest);
+
+    pos = next_token();
+    if (m_src[pos] != '}') {
+      while (true) {
+        if (m_src[pos] != '"')
+          fail("string or '}' expected", pos);
+        parse_string(obj ? &obj.next_key() : nullptr, pos);
+
+        pos = next_token();
+        if (m_src[pos] != ':')
+          fail("':' expected", pos);
+
+        parse_value(obj ? &obj.member() : nullptr, next_token());
+
+        pos = next_token();
+        if (m_src[pos] == '}')
+          break;
+        if (m_src[pos] != ',')
+          fail("'}' expected", pos);
+        pos = next_token();
+      }
+    }
+    obj.finish();
+    m_depth--;
+  }
+
+  void parse_array(json_value* dest, size_t pos)
+  {
+    if (++m_depth > max_depth)
+      fail("maximum parsing depth reached", pos);
+
+    json_array* arr = dest ? &reuse_array(*dest) : nullptr;
+    size_t n = 0;
+
+    pos = next_token();
+    if (m_src[pos] != ']') {
+      while (true) {
+        if (arr) {
+          if (n == arr->size())
+            arr->emplace_back();
+          parse_value(&(*arr)[n++], pos);
+        } else
+          parse_value(nullptr, pos);
+
+        pos = next_token();
+        if (m_src[pos] == ']')
+          break;
+        if (m_src[pos] != ',')
+          fail("']' expected", pos);
+        pos = next_token();
+      }
+    }
+    if (arr)
+      arr->erase(arr->begin() + n, arr->end());
+    m_depth--;
+  }
+
+  /* Parse the string whose opening quote is at 'pos'.  The index holds no
+   * entries for its content, so the closing quote is found by scanning. */
+  void parse_string(std::string* out, size_t pos)
+  {
+    size_t p = pos + 1;
+    while (true) {
+      size_t plain = json_unescaped_prefix(m_src + p, m_len - p);
+      size_t valid = json_utf8_valid_prefix(
+          reinterpret_cast<const unsigned char*>(m_src + p), plain);
+      if (valid != plain)
+        fail("unable to decode byte as UTF-8", p + valid);
+      if (out)
+        out->append(m_src + p, plain);
+      p += plain;
+
+      if (p == m_len)
+        fail("premature end of input", p);
+
+      char c = m_src[p];
+      if (c == '"')
+        return;
+      if (c != '\\')
+        fail("control character in string", p);
+
+      if (++p == m_len)
+        fail("premature end of input", p);
+      char decoded;
+      switch (m_src[p++]) {
+        case '"': decoded = '"'; break;
+        case '\\': decoded = '\\'; break;
+        case '/': decoded = '/'; break;
+        case 'b': decoded = '\b'; break;
+        case 'f': decoded = '\f'; break;
+        case 'n': decoded = '\n'; break;
+        case 'r': decoded = '\r'; break;
+        case 't': decoded = '\t'; break;
+        case 'u': {
+          uint32_t cp = parse_hex4(p);
+          p += 4;
+          if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (p + 1 >= m_len || m_src[p] != '\\' || m_src[p + 1] != 'u')
+              fail("invalid Unicode, missing low surrogate", p);
+            uint32_t low = parse_hex4(p + 2);
+            if (low < 0xDC00 || low > 0xDFFF)
+              fail("invalid Unicode low surrogate", p);
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            p += 6;
+          } else if (cp >= 0xDC00 && cp <= 0xDFFF)
+            fail("invalid Unicode, unexpected low surrogate", p - 6);
+          if (out)
+            append_utf8(*out, cp);
+          continue;
+        }
+        default:
+          fail("invalid escape", p - 2);
+      }
+      if (out)
+        *out += decoded;
+    }
+  }
+
+  uint32_t parse_hex4(size_t p)
+  {
+    if (m_len - p < 4)
+      fail("invalid escape", p);
+    uint32_t cp = 0;
+    for (size_t i = p; i < p + 4; i++) {
+      int h = hex_value(m_src[i]);
+      if (h < 0)
+        fail("invalid escape", p);
+      cp = (cp << 4) | h;
+    }
+    return cp;
+  }
+
+  void parse_literal(size_t pos, const char* text, size_t n)
+  {
+    if (m_len - pos < n || memcmp(m_src + pos, text, n) != 0 ||
+        !at_token_end(pos + n))
+      fail("invalid token", pos);
+  }
+
+  JSONType parse_number(json_value* dest, size_t pos)
+  {
+    size_t p = pos;
+    bool negative = (m_src[p] == '-');
+    if (negative)
+      p++;
+    if (p == m_len || !is_digit(m_src[p]))
+      fail("invalid token", pos);
+
+    if (m_src[p] == '0')
+      p++;
+    else
+      while (p < m_len && is_digit(m_src[p]))
+        p++;
+    const size_t int_end = p;
+
+    bool is_real = false;
+    if (p < m_len && m_src[p] == '.') {
+      is_real = true;
+      if (++p == m_len || !is_digit(m_src[p]))
+        fail("invalid token", pos);
+      while (p < m_len && is_digit(m_src[p]))
+        p++;
+    }
+    if (p < m_len && (m_src[p] == 'e' || m_src[p] == 'E')) {
+      is_real = true;
+      p++;
+      if (p < m_len && (m_src[p] == '+' || m_src[p] == '-'))
+        p++;
+      if (p == m_len || !is_digit(m_src[p]))
+        fail("invalid token", pos);
+      while (p < m_len && is_digit(m_src[p]))
+        p++;
+    }
+    if (!at_token_end(p))
+      fail("invalid token", pos);
+
+    if (!is_real) {
+      const uint64_t max = std::numeric_limits<uint64_t>::max();
+      uint64_t v = 0;
+      for (size_t i = negative ? pos + 1 : pos; i < int_end; i++) {
+        unsigned d = m_src[i] - '0';
+        if (v > (max - d) / 10)
+          fail("too big integer", pos);
+        v = v * 10 + d;
+      }
+      const uint64_t int_max = std::numeric_limits<json_int_t>::max();
+      if (negative && v > int_max + 1)
+        fail("too big negative integer", pos);
+      if (!dest)
+        return eINTEGER;
+      if (negative)
+        *dest = json_value::make_int(static_cast<json_int_t>(0 - v));
+      else if (v <= int_max)
+        *dest = json_value::make_int(static_cast<json_int_t>(v));
+      else
+        *dest = json_value::make_uint(v);
+      return eINTEGER;
+    }
+
+    /* strtod needs a terminated string, using the locale decimal point */
+    char local[64];
+    std::string heap;
+    char* text = local;
+    size_t n = p - pos;
+    if (n >= sizeof(local)) {
+      heap.resize(n + 1);
+      text = &heap[0];
+    }
+    memcpy(text, m_src + pos, n);
+    text[n] = '\0';
+    const char point = *localeconv()->decimal_point;
+    if (point != '.')
+      for (size_t i = 0; i < n; i++)
+        if (text[i] == '.')
+          text[i] = point;
+
+    errno = 0;
+    double d = strtod(text, nullptr);
+    if (errno == ERANGE && std::isinf(d))
+      fail("real number overflow", pos);
+    if (dest)
+      *dest = json_value::make_double(d);
+    return eREAL;
+  }
+
+  bool at_token_end(size_t p) const
+  {
+    return p == m_len || is_delimiter(m_src[p]);
+  }
+
+  [[noreturn]] void fail(const char* text, size_t pos) const
+  {
+    int line = 1;
+    size_t line_start = 0;
+    for (size_t i = 0; i < pos && i < m_len; i++)
+      if (m_src[i] == '\n') {
+        line++;
+        line_start = i + 1;
+      }
+    int column = static_cast<int>(pos - line_start) + 1;
+
+    std::ostringstream os;
+    os << "error=" << text << " "
+       << "line=" << line << " "
+       << "column=" << column << " "
+       << "position=" << pos;
+
+    parse_error perr(os.str());
+    perr.error = text;
+    perr.source = "<buffer>";
+    perr.line = line;
+    perr.column = column;
+    perr.position = static_cast<int>(pos);
+    throw perr;
+  }
+
+  const char* m_src;
+  size_t m_len;
+  const uint32_t* m_index;
+  size_t m_count;
+  size_t m_next;
+  int m_depth;
+  transcode_buffers* m_buffers;
+  size_t m_next_container;
+};
+
+
+/* The index is at most one entry per byte, so one allocation suffices; it is
+ * kept for reuse by later decodes on the same thread. */
+index_buffer& thread_index()
+{
+  static thread_local index_buffer index;
+  return index;
+}
+
+
+transcode_buffers& thread_transcode_buffers()
+{
+  static thread_local transcode_buffers buffers;
+  return buffers;
+}
+
+
+void transcode_to_msgpack(const char* src, size_t len, std::vector<char>& dest,
+                          bool tail)
+{
+  if (len >= std::numeric_limits<uint32_t>::max())
+    throw parse_error("input too large");
+
+  index_buffer& index = thread_index();
+  uint32_t* offsets = index.reserve(len);
+  size_t count = build_index(src, len, classifier(json_simd_available()),
+                             offsets);
+
+  transcode_buffers& buffers = thread_transcode_buffers();
+  const size_t orig_size = dest.size();
+  try {
+    msgpack_encoder out(dest);
+    parser(src, len, offsets, count).transcode(out, buffers, tail);
+  } catch (...) {
+    dest.resize(orig_size);
+    index.trim();
+    buffers.trim();
+    throw;
+  }
+  index.trim();
+  buffers.trim();
+}
+
+
+json_simd detect_simd()
+{
+#ifdef WAMPCC_JSON_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return json_simd::avx2;
+#endif
+#ifdef WAMPCC_JSON_SSE2
+  return json_simd::sse2;
+#else
+  return json_simd::scalar;
+#endif
+}
+
+} // namespace
+
+
+json_simd json_simd_available()
+{
+  static const json_simd level = detect_simd();
+  return level;
+}
+
+
+void json_decode(json_value& dest, const char* src, size_t len,
+                 json_simd level)
+{
+  if (len >= std::numeric_limits<uint32_t>::max())
+    throw parse_error("input too large");
+
+  index_buffer& index = thread_index();
+  uint32_t* offsets = index.reserve(len);
+  size_t count = build_index(src, len, classifier(level), offsets);
+
+  try {
+    parser(src, len, offsets, count).parse_document(dest);
+  } catch (...) {
+    index.trim();
+    throw;
+  }
+  index.trim();
+}
+
+
+void json_decode(json_value& dest, const char* src, size_t len)
+{
+  json_decode(dest, src, len, json_simd_available());
+}
+
+
+void json_decode(json_value& dest, const char* src)
+{
+  json_decode(dest, src, strlen(src), json_simd_available());
+}
+
+
+json_value json_decode(const char* src, size_t len)
+{
+  json_value dest;
+  json_decode(dest, src, len, json_simd_available());
+  return dest;
+}
+
+
+json_value json_decode(const char* src)
+{
+  json_value dest;
+  json_decode(dest, src, strlen(src), json_simd_available());
+  return dest;
+}
+
+
+json_array_tail json_decode_head(json_array& dest, const char* src,
+                                 size_t len, json_head_size_fn head_size)
+{
+  if (len >= std::numeric_limits<uint32_t>::max())
+    throw parse_error("input too large");
+
+  index_buffer& index = thread_index();
+  uint32_t* offsets = index.reserve(len);
+  size_t count = build_index(src, len, classifier(json_simd_available()),
+                             offsets);
+  try {
+    json_array_tail tail =
+        parser(src, len, offsets, count).parse_head(dest, head_size);
+    index.trim();
+    return tail;
+  } catch (...) {
+    index.trim();
+    throw;
+  }
+}
+
+void json_to_msgpack(const char* src, size_t len, std::vector<char>& dest)
+{
+  transcode_to_msgpack(src, len, dest, false);
+}
+
+
+void json_to_msgpack_tail(const char* src, size_t len,
+                          std::vector<char>& dest)
+{
+  transcode_to_msgpack(src, len, dest, true);
+}
+
+} // namespace wampcc
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+
+Generation of a JavaScript Object Notation (JSON) Patch (IETF RFC 6902) which
+transforms one JSON value into another.
+
+Objects are compared member by member.  Arrays are compared by finding the
+shortest sequence of element insertions and removals between them (Myers'
+algorithm, which takes time proportional to the array length times the number
+of edits, so is fast for the small edits typical of an update), after
+removing the common leading and trailing elements.  Where an element is
+removed and another added in its place, the pair are compared in turn.  So a
+small edit deep within a large document gives a small patch.
+
+ */
+
+namespace wampcc {
+
+/* Limit on the work, as element comparisons, spent searching for the shortest
+ * edit of an array.  Beyond this, the elements which differ are instead
+ * paired by position. */
+static const size_t max_edit_work = 1 << 24;
+
+static bool diff_value(const json_value& before, const json_value& after,
+                       std::string& path, json_array& patch);
+
+
+/* Append a reference token to a JSON Pointer, escaping '~' and '/' */
+static void append_token(std::string& path, const std::string& token)
+{
+  path += '/';
+  for (char c : token)
+  {
+    if (c == '~')
+      path += "~0";
+    else if (c == '/')
+      path += "~1";
+    else
+      path += c;
+  }
+}
+
+
+static void append_op(json_array& patch, const char* op,
+                      const std::string& path, const json_value* value)
+{
+  json_object& operation = json_append<json_object>(patch);
+  operation["op"] = op;
+  operation["path"] = path;
+  if (value)
+    operation["value"] = *value;
+}
+
+
+/* Returns the number of members added, removed or changed */
+static size_t diff_object(const json_object& before, const json_object& after,
+                          std::string& path, json_array& patch)
+{
+  const size_t path_len = path.size();
+  size_t changed = 0;
+
+  /* members of both are ordered by key, so can be merged in one pass */
+  auto b = before.begin();
+  auto a = after.begin();
+  while (b != before.end() || a != after.end())
+  {
+    if (a == after.end() || (b != before.end() && b->first < a->first))
+    {
+      append_token(path, b->first);
+      append_op(patch, "remove", path, nullptr);
+      changed++;
+      ++b;
+    }
+    else if (b == before.end() || a->first < b->first)
+    {
+      append_token(path, a->first);
+      append_op(patch, "add", path, &a->second);
+      changed++;
+      ++a;
+    }
+    else
+    {
+      append_token(path, a->first);
+      changed += diff_value(b->second, a->second, path, patch);
+      ++a;
+      ++b;
+    }
+    path.resize(path_len);
+  }
+
+  return changed;
+}
+
+
+namespace {
+enum edit { e_keep, e_delete, e_insert };
+}
+
+
+/* Find the shortest edit turning before[0,n) into after[0,m), by Myers'
+ * algorithm.  Returns false if the search exceeds max_edit_work. */
+static bool shortest_edit(const json_value* before, size_t n,
+                          const json_value* after, size_t m,
+                          std::vector<edit>& edits)
+{
+  typedef long index_t;
+  const index_t N = n, M = m;
+
+  /* For each number of edits d, the furthest x reached along each diagonal
+   * k = x - y, for k in [-d,d]; kept for tracing back the path.  The entries
+   * for d begin at offset d*d. */
+  std::vector<index_t> trace;
+  auto furthest = [&](index_t d, index_t k) -> index_t& {
+    return trace[d * d + (k + d)];
+  };
+
+  index_t D = 0;
+  for (;; D++)
+  {
+    if (D > 0 && size_t(D) * (n + m) > max_edit_work)
+      return false;
+
+    trace.resize((D + 1) * (D + 1));
+    bool done = false;
+    for (index_t k = -D; k <= D; k += 2)
+    {
+      index_t x;
+      if (D == 0)
+        x = 0;
+      else if (k == -D || (k != D && furthest(D - 1, k - 1) <
+                                         furthest(D - 1, k + 1)))
+        x = furthest(D - 1, k + 1); // insertion
+      else
+        x = furthest(D - 1, k - 1) + 1; // removal
+
+      index_t y = x - k;
+      while (x < N && y < M && before[x] == after[y]) {
+        x++;
+        y++;
+      }
+      furthest(D, k) = x;
+      if (x >= N && y >= M) {
+        done = true;
+        break;
+      }
+    }
+    if (done)
+      break;
+  }
+
+  /* trace back from (n,m), collecting the edits in reverse */
+  index_t x = N, y = M;
+  for (index_t d = D; d > 0; d--)
+  {
+    index_t k = x - y;
+    bool insertion = (k == -d || (k != d && furthest(d - 1, k - 1) <
+                                                furthest(d - 1, k + 1)));
+    index_t prev_k = insertion ? k + 1 : k - 1;
+    index_t prev_x = furthest(d - 1, prev_k);
+    index_t prev_y = prev_x - prev_k;
+    index_t mid_x = insertion ? prev_x : prev_x + 1;
+
+    for (; x > mid_x; x--, y--)
+      edits.push_back(e_keep);
+    edits.push_back(insertion ? e_insert : e_delete);
+    x = prev_x;
+    y = prev_y;
+  }
+  for (; x > 0; x--)
+    edits.push_back(e_keep);
+
+  std::reverse(edits.begin(), edits.end());
+  return true;
+}
+
+
+/* Returns the number of elements added, removed or changed */
+static size_t diff_array(const json_array& before, const json_array& after,
+                         std::string& path, json_array& patch)
+{
+  size_t prefix = 0;
+  while (prefix < before.size() && prefix < after.size() &&
+         before[prefix] == after[prefix])
+    prefix++;
+
+  size_t before_end = before.size();
+  size_t after_end = after.size();
+  while (before_end > prefix && after_end > prefix &&
+         before[before_end - 1] == after[after_end - 1]) {
+    before_end--;
+    after_end--;
+  }
+
+  const size_t n = before_end - prefix;
+  const size_t m = after_end - prefix;
+  if (n == 0 && m == 0)
+    return 0;
+
+  std::vector<edit> edits;
+  if (!n || !m ||
+      !shortest_edit(before.data() + prefix, n, after.data() + prefix, m, edits))
+  {
+    edits.clear();
+    edits.insert(edits.end(), n, e_delete);
+    edits.insert(edits.end(), m, e_insert);
+  }
+
+  /* Apply the edits in runs between kept elements.  'index' tracks the
+   * position in the array as it is when each operation is applied. */
+  const size_t path_len = path.size();
+  size_t changed = 0;
+  size_t index = prefix;
+  size_t bi = prefix;
+  size_t ai = prefix;
+  size_t pos = 0;
+
+  while (pos < edits.size())
+  {
+    if (edits[pos] == e_keep)
+    {
+      index++;
+      bi++;
+      ai++;
+      pos++;
+      continue;
+    }
+
+    size_t deletes = 0;
+    size_t inserts = 0;
+    for (; pos < edits.size() && edits[pos] != e_keep; pos++)
+      (edits[pos] == e_delete) ? deletes++ : inserts++;
+
+    /* an element replaced by another is compared with it */
+    size_t pairs = std::min(deletes, inserts);
+    for (size_t k = 0; k < pairs; k++)
+    {
+      path += '/';
+      path += std::to_string(index);
+      changed += diff_value(before[bi++], after[ai++], path, patch);
+      path.resize(path_len);
+      index++;
+    }
+
+    for (size_t k = pairs; k < deletes; k++)
+    {
+      path += '/';
+      path += std::to_string(index);
+      append_op(patch, "remove", path, nullptr);
+      path.resize(path_len);
+      changed++;
+      bi++;
+    }
+
+    for (size_t k = pairs; k < inserts; k++)
+    {
+      path += '/';
+      path += std::to_string(index);
+      append_op(patch, "add", path, &after[ai++]);
+      path.resize(path_len);
+      changed++;
+      index++;
+    }
+  }
+
+  return changed;
+}
+
+
+/* Returns whether any operations were added to the patch */
+static bool diff_value(const json_value& before, const json_value& after,
+                       std::string& path, json_array& patch)
+{
+  if (before.type() == after.type() && before.is_container())
+  {
+    const size_t start = patch.size();
+    size_t changed, size;
+    if (after.is_object())
+    {
+      /* copies of a shared value refer to the same content, which need not be
+       * walked; json_model::modify leaves unchanged parts shared so */
+      if (&before.as_object() == &after.as_object())
+        return false;
+      changed = diff_object(before.as_object(), after.as_object(), path, patch);
+      size = after.as_object().size();
+    }
+    else
+    {
+      if (&before.as_array() == &after.as_array())
+        return false;
+      changed = diff_array(before.as_array(), after.as_array(), path, patch);
+      size = after.as_array().size();
+    }
+
+    /* Changes to most of the container are sent as a single replace */
+    if (changed <= 1 || 4 * changed < 3 * size)
+      return changed > 0;
+    patch.erase(patch.begin() + start, patch.end());
+  }
+  else if (before == after)
+    return false;
+
+  append_op(patch, "replace", path, &after);
+  return true;
+}
+
+
+json_array json_diff(const json_value& before, const json_value& after,
+                     const std::string& path)
+{
+  json_array patch;
+  std::string current = path;
+  diff_value(before, after, current, patch);
+  return patch;
+}
+
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "json_writer.h"
+
+/*
+  Native JSON encoder.  The json_value tree is written straight into the
+  caller's buffer, without first being converted into a vendor representation.
+  The output is byte compatible with that previously produced via jansson (with
+  no flags), i.e. ", " and ": " separators, reals having a fractional part or
+  exponent, and only the characters RFC 7159 requires escaped being escaped.
+  As with jansson, a string which is not valid UTF-8 cannot be encoded, and
+  json_error is thrown.  Three differences exist: reals are written with the
+  fewest digits that round-trip (jansson always used 17 significant digits),
+  NaN and infinity are written as null (jansson could not represent them), and
+  unsigned integers above INT64_MAX are written as unsigned (jansson wrapped
+  them to negative).
+*/
+
+namespace wampcc
+{
+
+namespace
+{
+
+template <typename C> void encode_into(const json_value& src, C& dest)
+{
+  const size_t orig_size = dest.size();
+  try {
+    json_writer<C> w(dest);
+    w.put_value(src);
+    w.finish();
+  } catch (...) {
+    dest.resize(orig_size);
+    throw;
+  }
+}
+
+} // namespace
+
+
+void json_encode(const json_value& src, std::vector<char>& dest)
+{
+  encode_into(src, dest);
+}
+
+
+void json_encode(const json_value& src, std::string& dest)
+{
+  encode_into(src, dest);
+}
+
+
+void json_encode_spliced(const json_array& head, const char* tail, size_t len,
+                         std::vector<char>& dest)
+{
+  const size_t orig_size = dest.size();
+  try {
+    json_writer<std::vector<char>> w(dest);
+    w.put_spliced_array(head, tail, len);
+    w.finish();
+  } catch (...) {
+    dest.resize(orig_size);
+    throw;
+  }
+}
+
+
+std::string json_encode(const json_value& src)
+{
+  std::string retval;
+  encode_into(src, retval);
+  return retval;
+}
+
+
+std::string json_encode_any(const json_value& src) { return json_encode(src); }
+
+} // namespace wampcc
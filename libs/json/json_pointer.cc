@@ -8,6 +8,7 @@
 #include "wampcc/json.h"
 
 #include <limits>
+#include <unordered_map>
 
 #include <string.h>
 #include <stdlib.h>
@@ -131,18 +132,6 @@ static T string_to_unsigned(const char* p, str_to_num_error* errptr)
 }
 
 
-static size_t json_pointer_str_to_index(const char* p, size_t path_index)
-{
-  str_to_num_error errptr;
-  size_t result = string_to_unsigned<size_t>(p, &errptr);
-
-  if (errptr==eSuccess)
-    return result;
-  else
-    throw bad_pointer("cannot convert string to integer", path_index);
-}
-
-
 static const char* has_escape_seq(const char* p, const char* end)
 {
   for (; p < end; p++)
@@ -574,6 +563,78 @@ const json_value * get_value(const json_object& cur_operation, int patch_index)
 //   }
 // }
 
+const size_t compiled_json_pointer::npos;
+const size_t compiled_json_pointer::end_index;
+
+compiled_json_pointer::compiled_json_pointer(const std::string& json_pointer)
+  : m_str(json_pointer)
+{
+  const char* p = m_str.c_str();
+  const char* end = p + m_str.size();
+
+  if (p == end)
+    return; /* whole document */
+
+  if (*p != JPDELIM)
+    throw bad_pointer("invalid pointer syntax", 0);
+
+  while (p < end)
+  {
+    const char* start = p + 1;
+    const char* next_delim = static_cast<const char*>(
+      memchr(start, JPDELIM, end - start));
+    if (!next_delim)
+      next_delim = end;
+
+    reference_token token;
+    if (has_escape_seq(start, next_delim))
+    {
+      char* copy = expand_str(start, next_delim);
+      token.name = copy;
+      delete [] copy;
+    }
+    else
+      token.name.assign(start, next_delim);
+
+    if (token.name == "-")
+      token.index = end_index;
+    else
+    {
+      str_to_num_error err;
+      token.index = string_to_unsigned<size_t>(token.name.c_str(), &err);
+      if (err != eSuccess || token.index >= end_index)
+        token.index = npos;
+    }
+
+    m_tokens.push_back(std::move(token));
+    p = next_delim;
+  }
+}
+
+
+compiled_json_pointer::compiled_json_pointer(const char* json_pointer)
+  : compiled_json_pointer(std::string(json_pointer))
+{
+}
+
+
+const compiled_json_pointer& cached_json_pointer(const std::string& path)
+{
+  static thread_local std::unordered_map<std::string, compiled_json_pointer> cache;
+
+  auto it = cache.find(path);
+  if (it != cache.end())
+    return it->second;
+
+  /* bound the cache for callers which use many distinct paths */
+  if (cache.size() >= 256)
+    cache.clear();
+
+  compiled_json_pointer ptr(path);
+  return cache.insert(std::make_pair(path, std::move(ptr))).first->second;
+}
+
+
 struct read_operation
 {
   template<typename T>
@@ -631,7 +692,10 @@ struct patch_operation
       }
       case opcode::eReplace :
       {
-        target = *(op->read_only);
+        if (op->read_only)
+          target = *(op->read_only);  // create a copy
+        else
+          target.swap( op->temp );
         break;
       }
       case opcode::eRemove :
@@ -756,107 +820,73 @@ private:
 
 
 
-// forward references
-template <typename F, typename T>
-static bool resolve_path_on_object(typename T::object_type & refvalue,
-                                   const char* path,
-                                   operation<T>* op);
-template <typename F, typename T>
-static bool resolve_path_on_array(typename T::array_type & refvalue,
-                                  const char* path,
-                                  operation<T>* op);
-
-template <typename F, typename T>
-static bool resolve_path_on_object(typename T::object_type & refvalue,
-                                   const char* path,
-                                   operation<T>* op)
+/* Index into an array of 'size' elements denoted by a reference token */
+static size_t token_to_index(const compiled_json_pointer::reference_token& token,
+                             size_t size, size_t path_index)
 {
-  op->path_index++;
-  const char* next_delim = strchr(path, JPDELIM);
-
-  // TODO: improve memory usage here
-  std::string token = next_delim? std::string(path, next_delim-path) : path;
-  const char * escaped = has_escape_seq(path, (next_delim)? next_delim : path+strlen(path));
-
-  if (escaped)
-  {
-    // TODO: improve memory usage here
-    char *  copy = expand_str( path, (next_delim)? next_delim : path+strlen(path));
-    token = copy;
-    delete [] copy;
-  }
-
-  if (next_delim)
-  {
-    typename T::iterator it = refvalue.find( token );
-    if (it != refvalue.end())
-    {
-      if (it->second.is_array())
-        return resolve_path_on_array<F>(it->second.as_array(), next_delim+1, op);
-      else if (it->second.is_object())
-        return resolve_path_on_object<F>(it->second.as_object(), next_delim+1, op);
-    }
-  }
+  if (token.index == compiled_json_pointer::end_index)
+    return size;
+  else if (token.index == compiled_json_pointer::npos)
+    throw bad_pointer("cannot convert string to integer", path_index);
   else
-  {
-    return F::operate_on_object(refvalue, token, op);
-  }
-
-  return false;
+    return token.index;
 }
 
 
+/* Walk the tokens of 'ptr' from 'root' down to the container of the target,
+ * then apply the operation to the final token. */
 template <typename F, typename T>
-static bool resolve_path_on_array(typename T::array_type & refvalue,
-                                  const char* path,
-                                  operation<T>* op)
+static bool resolve_path_from_root(typename T::value_type& root,
+                                   const compiled_json_pointer& ptr,
+                                   operation<T>* op)
 {
-  op->path_index++;
-  const char* next_delim = strchr(path, JPDELIM);
+  if (ptr.size() == 0)
+    return F::operate_on_target(root, op);
 
-  std::string token = next_delim? std::string(path, next_delim-path) : path;
-  size_t index = (token=="-")? refvalue.size() : json_pointer_str_to_index(token.c_str(), op->path_index);
+  typename T::value_type* current = &root;
 
-  if (next_delim)
+  for (size_t i = 0; i < ptr.size(); i++)
   {
-    if (index < refvalue.size() )
+    const compiled_json_pointer::reference_token& token = ptr[i];
+    const bool last = (i + 1 == ptr.size());
+    op->path_index++;
+
+    if (current->is_object())
     {
-      if (refvalue[index].is_array())
-        return resolve_path_on_array<F>(refvalue[index].as_array(), next_delim+1, op);
-      if (refvalue[index].is_object())
-        return resolve_path_on_object<F>(refvalue[index].as_object(), next_delim+1, op);
+      typename T::object_type& container = current->as_object();
+      if (last)
+        return F::operate_on_object(container, token.name, op);
+
+      typename T::iterator it = container.find(token.name);
+      if (it == container.end())
+        return false;
+      current = &it->second;
     }
-  }
-  else
-  {
-    return F::operate_on_array(refvalue, index, op);
+    else if (current->is_array())
+    {
+      typename T::array_type& container = current->as_array();
+      size_t index = token_to_index(token, container.size(), op->path_index);
+      if (last)
+        return F::operate_on_array(container, index, op);
+
+      if (index >= container.size())
+        return false;
+      current = &container[index];
+    }
+    else
+      return false;
   }
 
   return false;
 }
 
+
 template <typename F, typename T>
 static bool resolve_path_from_root(typename T::value_type& root,
-                                   const std::string& __path,
+                                   const std::string& path,
                                    operation<T>* op)
 {
-  const char* path = __path.c_str();
-
-  if (*path == '\0')
-  {
-    return F::operate_on_target(root, op);
-  }
-  else if (*path == JPDELIM )
-  {
-    if (root.is_array())
-      return resolve_path_on_array<F>(root.as_array(),  path+1 , op);
-    if (root.is_object())
-     return resolve_path_on_object<F>(root.as_object(), path+1, op);
-  }
-  else
-    throw bad_pointer("invalid pointer syntax", 0);
-
-  return false;
+  return resolve_path_from_root<F>(root, cached_json_pointer(path), op);
 }
 
 
@@ -899,36 +929,88 @@ json_value * eval_json_pointer(json_value& doc,
 }
 
 
+const json_value* compiled_json_pointer::eval(const json_value& doc) const
+{
+  operation< const_variant > op(opcode::eRead);
+  resolve_path_from_root<read_operation>(doc, *this, &op);
+  return op.output;
+}
 
-bool apply_patch(json_value& doc,
-                 const json_array& patch)
+
+json_value* compiled_json_pointer::eval(json_value& doc) const
+{
+  operation< nonconst_variant > op(opcode::eRead);
+  resolve_path_from_root<read_operation>(doc, *this, &op);
+  return op.output;
+}
+
+
+/* Set the operation's value from the 'value' member of the patch operation.
+ * When the patch is being consumed the value is moved into the operation,
+ * otherwise it is referred to, and copied into the document. */
+static void take_value(const json_object& cur_operation, int patch_index,
+                       operation<nonconst_variant>& op)
+{
+  op.read_only = get_value(cur_operation, patch_index);
+}
+
+static void take_value(json_object& cur_operation, int patch_index,
+                       operation<nonconst_variant>& op)
+{
+  json_object::iterator it = cur_operation.find( "value" );
+  if (it == cur_operation.end())
+    throw bad_patch("missing 'value'", patch_index);
+  op.temp.swap(it->second);
+}
+
+
+/* Whether applying 'patch' might fail after altering the document.  Each
+ * operation alone either applies in full or leaves the document unchanged,
+ * except move, which is a cut followed by an add. */
+static bool needs_rollback(const json_array& patch)
+{
+  if (patch.size() != 1)
+    return patch.size() > 1;
+
+  const json_value* op = patch[0].is_object()
+    ? json_get_ptr(patch[0].as_object(), "op") : nullptr;
+  return op && op->is_string() && op->as_string() == "move";
+}
+
+
+template <typename A>
+static bool apply_patch_ops(json_value& doc, A& patch)
 {
-  // Take a copy, which we will use to restore the source document if there is
-  // an error when applying the patch.  There are more efficient approaches that
-  // we could use here, e.g., copy on write, or accumulation of reverse patches.
-  json_value copy = doc;
+  // Keep the original document, to restore if there is an error when applying
+  // the patch.  The document is shared, so that this is not a deep copy, and
+  // the patch operations detach just the parts of the document they alter.
+  const bool rollback = needs_rollback(patch);
+  json_value copy;
+  if (rollback)
+  {
+    doc.share();
+    copy = doc;
+  }
   size_t patch_index = 0;
   bool patch_ok = true;
 
   try
   {
-    for (json_array::const_iterator it = patch.begin();
+    for (auto it = patch.begin();
          it != patch.end() && patch_ok; ++it, ++patch_index)
     {
       if (!it->is_object())
         throw bad_patch("operation must be a JSON object", patch_index);
 
-      const json_object & cur_operation = it->as_object();
+      auto & cur_operation = it->as_object();
 
       const json_string& op = get_field_str(cur_operation, "op", patch_index);
       const json_string& path = get_field_str(cur_operation, "path", patch_index);
 
       if (op == "add")
       {
-        // TODO: if source patch is non-const, use the temp variable
-        // new item, MOVE possible, otherwise copy
         operation<nonconst_variant> op(opcode::eAdd);
-        op.read_only = get_value(cur_operation, patch_index);
+        take_value(cur_operation, patch_index, op);
         patch_ok = apply_single_patch(doc, path, &op);
       }
       else if (op == "remove")
@@ -938,9 +1020,8 @@ bool apply_patch(json_value& doc,
       }
       else if (op == "replace")
       {
-        // TODO: can MOVE if a non-const was passed in
         operation<nonconst_variant> op(opcode::eReplace);
-        op.read_only = get_value(cur_operation, patch_index);
+        take_value(cur_operation, patch_index, op);
         patch_ok =  apply_single_patch(doc, path, &op);
       }
       else if (op == "move")
@@ -988,14 +1069,28 @@ bool apply_patch(json_value& doc,
       }
     } // for
 
-    if (!patch_ok) doc.swap(copy); // roll back change
+    if (!patch_ok && rollback) doc.swap(copy); // roll back change
     return patch_ok;
   }
   catch (...)
   {
-    doc.swap(copy); // roll back changes
+    if (rollback) doc.swap(copy); // roll back changes
     throw;
   }
 }
 
+
+bool apply_patch(json_value& doc,
+                 const json_array& patch)
+{
+  return apply_patch_ops(doc, patch);
+}
+
+
+bool apply_patch(json_value& doc,
+                 json_array&& patch)
+{
+  return apply_patch_ops(doc, patch);
+}
+
 }
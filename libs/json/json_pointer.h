@@ -15,6 +15,13 @@ namespace wampcc
 
 bool apply_patch(json_value& doc, const json_array& patch);
 
+/* As above, moving the values out of the patch rather than copying them */
+bool apply_patch(json_value& doc, json_array&& patch);
+
+/* Compiled form of 'path', cached per thread since the paths of patch
+ * operations tend to recur */
+const compiled_json_pointer& cached_json_pointer(const std::string& path);
+
 const json_value * eval_json_pointer(const json_value& doc,
                                      const char* path);
 
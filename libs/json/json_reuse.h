@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef __WAMPCC_JSON_REUSE_H__
+#define __WAMPCC_JSON_REUSE_H__
+
+#include "wampcc/json.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace wampcc
+{
+
+/* Helpers for the decoders, which write each value over whatever the
+ * destination already holds.  Where the old value is of the same type its
+ * storage is kept, so decoding a stream of similar messages into the same
+ * json_value settles into making few allocations. */
+
+/* Whether 'dest' holds a value of type 't' which can be decoded over.  A
+ * shared value cannot, since writing to it would first copy it; it is replaced
+ * instead, leaving the other copies untouched. */
+inline bool reusable(const json_value& dest, JSONType t)
+{
+  return dest.type() == t && !dest.is_shared();
+}
+
+/* Make 'dest' an empty string, keeping its capacity if already a string */
+inline std::string& reuse_string(json_value& dest)
+{
+  if (reusable(dest, eSTRING))
+    dest.as_string().clear();
+  else
+    dest = json_value::make_string();
+  return dest.as_string();
+}
+
+/* Make 'dest' an array, keeping its elements if already an array; the caller
+ * overwrites the elements it needs and removes the rest. */
+inline json_array& reuse_array(json_value& dest)
+{
+  if (!reusable(dest, eARRAY))
+    dest = json_value::make_array();
+  return dest.as_array();
+}
+
+/* Decodes the members of an object into 'dest'.  If 'dest' is already a
+ * non-empty object, the members whose keys recur are decoded over in place,
+ * and the others are removed by finish().  A null 'dest' is for an object
+ * which is only being validated. */
+class object_reuse
+{
+public:
+  explicit object_reuse(json_value* dest)
+    : m_keys((dest && reusable(*dest, eOBJECT) && !dest->as_object().empty())
+                 ? &key_stack()
+                 : nullptr),
+      m_start(m_keys ? m_keys->used : 0),
+      m_obj(nullptr)
+  {
+    if (dest) {
+      if (!reusable(*dest, eOBJECT))
+        *dest = json_value::make_object();
+      m_obj = &dest->as_object();
+    }
+  }
+
+  explicit operator bool() const { return m_obj != nullptr; }
+
+  ~object_reuse()
+  {
+    if (m_keys)
+      m_keys->used = m_start;
+  }
+
+  object_reuse(const object_reuse&) = delete;
+  object_reuse& operator=(const object_reuse&) = delete;
+
+  /* Buffer for reading the next key, valid until member() is called */
+  std::string& next_key()
+  {
+    if (!m_keys) {
+      m_key.clear();
+      return m_key;
+    }
+    if (m_keys->used == m_keys->keys.size())
+      m_keys->keys.emplace_back();
+    std::string& key = m_keys->keys[m_keys->used++];
+    key.clear();
+    return key;
+  }
+
+  /* The member for the key just read, to be decoded into.  A repeated key
+   * replaces the earlier value, as per jansson. */
+  json_value& member()
+  {
+    if (!m_keys)
+      return m_obj->emplace_hint(m_obj->end(), std::move(m_key), json_value())
+          ->second;
+
+    const std::string& key = m_keys->keys[m_keys->used - 1];
+    auto it = m_obj->find(key);
+    if (it == m_obj->end())
+      it = m_obj->emplace_hint(m_obj->end(), key, json_value());
+    return it->second;
+  }
+
+  /* Remove the members of the earlier object which were not decoded */
+  void finish()
+  {
+    if (!m_keys)
+      return;
+
+    auto first = m_keys->keys.begin() + m_start;
+    auto last = m_keys->keys.begin() + m_keys->used;
+    bool sorted = (last - first) > 16;
+    if (sorted)
+      std::sort(first, last);
+
+    /* erase backwards, since erasing from a flat map only moves the entries
+     * after the one erased */
+    for (auto it = m_obj->end(); it != m_obj->begin();) {
+      --it;
+      bool decoded = sorted ? std::binary_search(first, last, it->first)
+                            : std::find(first, last, it->first) != last;
+      if (!decoded)
+        it = m_obj->erase(it);
+    }
+  }
+
+private:
+  /* Keys decoded into objects being reused, for each level of nesting, kept
+   * between calls so the strings keep their capacity. */
+  struct key_buffer
+  {
+    std::vector<std::string> keys;
+    size_t used = 0;
+  };
+
+  static key_buffer& key_stack()
+  {
+    static thread_local key_buffer buf;
+    return buf;
+  }
+
+  key_buffer* m_keys;
+  size_t m_start;
+  json_object* m_obj;
+  std::string m_key;
+};
+
+}
+
+#endif
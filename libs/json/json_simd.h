@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_JSON_SIMD_H
+#define WAMPCC_JSON_SIMD_H
+
+#include "wampcc/json.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+#define WAMPCC_JSON_X86 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WAMPCC_JSON_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Helpers shared by the native JSON encoder and decoder. */
+
+namespace wampcc
+{
+
+/* Instruction set used by the decoder to classify input bytes. */
+enum class json_simd { scalar, sse2, avx2 };
+
+/* Best instruction set supported by the running CPU. */
+json_simd json_simd_available();
+
+/* Decode using a particular instruction set, which must be supported by the
+ * running CPU.  Used to test each implementation against the others. */
+void json_decode(json_value& dest, const char*, size_t, json_simd);
+
+inline unsigned json_lowest_bit(uint64_t mask)
+{
+#ifdef _MSC_VER
+  unsigned long i;
+#ifdef _M_X64
+  _BitScanForward64(&i, mask);
+#else
+  if (!_BitScanForward(&i, static_cast<unsigned long>(mask))) {
+    _BitScanForward(&i, static_cast<unsigned long>(mask >> 32));
+    i += 32;
+  }
+#endif
+  return i;
+#else
+  return __builtin_ctzll(mask);
+#endif
+}
+
+inline bool json_needs_escape(unsigned char c)
+{
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+/* Return the length of the leading run of 's' containing no quote, backslash
+ * or control character, i.e. the bytes which can be copied as they are when
+ * encoding a string, or when decoding one.  Bytes are tested sixteen at a time
+ * with SSE2 where available, else eight at a time within a 64-bit word. */
+inline size_t json_unescaped_prefix(const char* s, size_t n)
+{
+  size_t i = 0;
+
+#ifdef WAMPCC_JSON_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i max_ctrl = _mm_set1_epi8(0x1F);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, max_ctrl), v)); /* v <= 0x1F */
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+    if (mask)
+      return i + json_lowest_bit(mask);
+  }
+#else
+  const uint64_t ones = ~uint64_t(0) / 255;
+  const uint64_t highs = ones * 0x80;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    uint64_t q = w ^ (ones * '"');
+    uint64_t bs = w ^ (ones * '\\');
+    uint64_t hits =
+        ((w - ones * 0x20) & ~w) | ((q - ones) & ~q) | ((bs - ones) & ~bs);
+    if (hits & highs)
+      break; /* locate it below */
+  }
+#endif
+
+  while (i < n && !json_needs_escape(static_cast<unsigned char>(s[i])))
+    i++;
+  return i;
+}
+
+/* Return offset of first byte of 's' which is not part of valid UTF-8, or 'n'
+ * if all valid. */
+inline size_t json_utf8_valid_prefix(const unsigned char* s, size_t n)
+{
+  size_t i = 0;
+  while (i < n) {
+    /* skip ASCII a word at a time */
+    uint64_t w;
+    while (i + 8 <= n && (memcpy(&w, s + i, 8), (w & 0x8080808080808080ULL) == 0))
+      i += 8;
+    if (i == n)
+      break;
+
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    size_t count;
+    uint32_t cp, min;
+    if (c >= 0xC2 && c <= 0xDF) {
+      count = 1; cp = c & 0x1F; min = 0x80;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      count = 2; cp = c & 0x0F; min = 0x800;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      count = 3; cp = c & 0x07; min = 0x10000;
+    } else
+      return i;
+
+    if (n - i <= count)
+      return i;
+    for (size_t j = 1; j <= count; j++) {
+      if ((s[i + j] & 0xC0) != 0x80)
+        return i;
+      cp = (cp << 6) | (s[i + j] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+      return i;
+    i += count + 1;
+  }
+  return n;
+}
+
+} // namespace wampcc
+
+#endif
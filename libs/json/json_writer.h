@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_JSON_WRITER_H
+#define WAMPCC_JSON_WRITER_H
+
+#include "json_simd.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <clocale>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* JSON text writer, used by the native encoder and by the msgpack to JSON
+ * transcoder, so that both produce identical output. */
+
+namespace wampcc
+{
+
+const char json_digit_pairs[] = "00010203040506070809"
+                           "10111213141516171819"
+                           "20212223242526272829"
+                           "30313233343536373839"
+                           "40414243444546474849"
+                           "50515253545556575859"
+                           "60616263646566676869"
+                           "70717273747576777879"
+                           "80818283848586878889"
+                           "90919293949596979899";
+
+/* Write the decimal digits of 'v' so that they end just before 'end', and
+ * return a pointer to the first digit. */
+inline char* json_format_uint(uint64_t v, char* end)
+{
+  while (v >= 100) {
+    unsigned i = static_cast<unsigned>(v % 100) * 2;
+    v /= 100;
+    *--end = json_digit_pairs[i + 1];
+    *--end = json_digit_pairs[i];
+  }
+  if (v < 10) {
+    *--end = static_cast<char>('0' + v);
+  } else {
+    unsigned i = static_cast<unsigned>(v) * 2;
+    *--end = json_digit_pairs[i + 1];
+    *--end = json_digit_pairs[i];
+  }
+  return end;
+}
+
+/* Writes JSON text directly into a growable contiguous container, which is
+ * only resized to the exact output length at the end. */
+template <typename C> class json_writer
+{
+public:
+  explicit json_writer(C& dest) : m_dest(dest), m_pos(dest.size()) {}
+
+  void finish() { m_dest.resize(m_pos); }
+
+  void put(char c)
+  {
+    *reserve(1) = c;
+    m_pos++;
+  }
+
+  void put(const char* s, size_t n)
+  {
+    if (n) {
+      memcpy(reserve(n), s, n);
+      m_pos += n;
+    }
+  }
+
+  template <size_t N> void put_literal(const char (&s)[N]) { put(s, N - 1); }
+
+  void put_value(const json_value& src)
+  {
+    switch (src.type()) {
+      case eOBJECT:
+        put_object(src.as_object());
+        break;
+      case eARRAY:
+        put_array(src.as_array());
+        break;
+      case eSTRING:
+        put_string(src.as_string().data(), src.as_string().size());
+        break;
+      case eREAL:
+        put_real(src.as_real());
+        break;
+      case eINTEGER:
+        if (src.is_uint())
+          put_uint(src.as_uint(), false);
+        else
+          put_int(src.as_int());
+        break;
+      case eBOOL:
+        if (src.as_bool())
+          put_literal("true");
+        else
+          put_literal("false");
+        break;
+      default:
+        put_literal("null");
+    }
+  }
+
+  /* Write an array of the elements of 'head' followed by 'len' bytes of
+   * elements that are already JSON text. */
+  void put_spliced_array(const json_array& head, const char* tail, size_t len)
+  {
+    put('[');
+    bool first = true;
+    for (auto& item : head) {
+      if (!first)
+        put_literal(", ");
+      first = false;
+      put_value(item);
+    }
+    if (len) {
+      if (!first)
+        put_literal(", ");
+      put(tail, len);
+    }
+    put(']');
+  }
+
+  void put_string(const char* s, size_t n)
+  {
+    put('"');
+    while (n) {
+      size_t plain = json_unescaped_prefix(s, n);
+      if (json_utf8_valid_prefix(reinterpret_cast<const unsigned char*>(s),
+                                 plain) != plain)
+        throw json_error("unable to encode string which is not valid UTF-8");
+      put(s, plain);
+      s += plain;
+      n -= plain;
+      if (n == 0)
+        break;
+      put_escaped(static_cast<unsigned char>(*s));
+      s++;
+      n--;
+    }
+    put('"');
+  }
+
+  void put_uint(uint64_t v, bool negative)
+  {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* begin = json_format_uint(v, end);
+    if (negative)
+      *--begin = '-';
+    put(begin, end - begin);
+  }
+
+  void put_int(int64_t v)
+  {
+    put_uint(v < 0 ? 0 - static_cast<uint64_t>(v) : v, v < 0);
+  }
+
+  void put_real(double v)
+  {
+    /* JSON has no representation of NaN or infinity */
+    if (!std::isfinite(v)) {
+      put_literal("null");
+      return;
+    }
+
+    /* integral values are common (e.g. timestamps), and are exactly
+     * representable with integer formatting */
+    if (std::fabs(v) < 1e15 && v == std::trunc(v)) {
+      if (std::signbit(v))
+        put('-');
+      put_uint(static_cast<uint64_t>(std::fabs(v)), false);
+      put_literal(".0");
+      return;
+    }
+
+    /* otherwise use the shortest precision that parses back to the same value */
+    char buf[32];
+    int len = 0;
+    for (int precision = 15; precision <= 17; precision++) {
+      len = snprintf(buf, sizeof(buf), "%.*g", precision, v);
+      if (precision == 17 || strtod(buf, nullptr) == v)
+        break;
+    }
+
+    /* undo any locale specific decimal point, and ensure the text cannot be
+     * mistaken for an integer */
+    const char point = *localeconv()->decimal_point;
+    bool is_real = false;
+    for (int i = 0; i < len; i++) {
+      if (buf[i] == point)
+        buf[i] = '.';
+      if (buf[i] == '.' || buf[i] == 'e')
+        is_real = true;
+    }
+    put(buf, len);
+    if (!is_real)
+      put_literal(".0");
+  }
+
+private:
+  char* reserve(size_t n)
+  {
+    if (m_dest.size() - m_pos < n) {
+      size_t want = m_dest.size() * 2;
+      if (want < m_pos + n)
+        want = m_pos + n;
+      if (want < 64)
+        want = 64;
+      m_dest.resize(want);
+    }
+    return &m_dest[0] + m_pos;
+  }
+
+  void put_object(const json_object& obj)
+  {
+    put('{');
+    bool first = true;
+    for (auto& item : obj) {
+      if (!first)
+        put_literal(", ");
+      first = false;
+      put_string(item.first.data(), item.first.size());
+      put_literal(": ");
+      put_value(item.second);
+    }
+    put('}');
+  }
+
+  void put_array(const json_array& arr) { put_spliced_array(arr, nullptr, 0); }
+
+  void put_escaped(unsigned char c)
+  {
+    char* p = reserve(6);
+    p[0] = '\\';
+    switch (c) {
+      case '"':  p[1] = '"';  break;
+      case '\\': p[1] = '\\'; break;
+      case '\b': p[1] = 'b';  break;
+      case '\f': p[1] = 'f';  break;
+      case '\n': p[1] = 'n';  break;
+      case '\r': p[1] = 'r';  break;
+      case '\t': p[1] = 't';  break;
+      default: {
+        static const char hex[] = "0123456789ABCDEF";
+        p[1] = 'u';
+        p[2] = '0';
+        p[3] = '0';
+        p[4] = hex[c >> 4];
+        p[5] = hex[c & 0xF];
+        m_pos += 6;
+        return;
+      }
+    }
+    m_pos += 2;
+  }
+
+  C& m_dest;
+  size_t m_pos;
+};
+
+} // namespace wampcc
+
+#endif
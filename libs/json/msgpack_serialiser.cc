@@ -6,426 +6,653 @@
  */
 
 #include "msgpack_serialiser.h"
+#include "json_reuse.h"
 
-#include <iostream>
-#include <stack>
-#include <sstream>
-
-//#define WAMPCC_TRACE_MSGPACK
+#include <cstring>
+#include <limits>
 
 namespace wampcc
 {
 
-static void free_msgpack_bytes(region* ptr)
+typedef uint32_t t_msgpack_size;
+
+/* Limit on nesting of arrays and maps, to bound the decoder's recursion. */
+static const int max_depth = 2048;
+
+
+msgpack_encoder::msgpack_encoder(std::vector<char>& dest) : m_dest(dest) {}
+
+
+void msgpack_encoder::encode(const json_value& src)
 {
-  if (ptr)
-    ::free(ptr->first);
+  const size_t orig_size = m_dest.size();
+  try {
+    pack_value(src);
+  } catch (...) {
+    m_dest.resize(orig_size);
+    throw;
+  }
+}
 
-  delete ptr;
+
+void msgpack_encoder::encode_spliced(const json_array& head, const char* tail,
+                                     size_t len, size_t count)
+{
+  const size_t orig_size = m_dest.size();
+  try {
+    put_array_header(head.size() + count);
+    for (auto& item : head)
+      pack_value(item);
+    m_dest.insert(m_dest.end(), tail, tail + len);
+  } catch (...) {
+    m_dest.resize(orig_size);
+    throw;
+  }
 }
 
-msgpack_encoder::msgpack_encoder() : m_packer(m_sbuf) {}
 
-typedef uint32_t t_msgpack_size;
+void msgpack_encoder::put_byte(unsigned char c)
+{
+  m_dest.push_back(static_cast<char>(c));
+}
 
-std::unique_ptr<region, void (*)(region*)> msgpack_encoder::encode(
-    const json_value& src)
+
+/* Write a type byte followed by 'value' in big-endian order over 'width'
+ * bytes. */
+void msgpack_encoder::put_header(unsigned char type, uint64_t value,
+                                 size_t width)
 {
-  pack_value(src);
-  size_t len = m_sbuf.size(); // size() must be called before release()
-  return {new region(m_sbuf.release(), len), free_msgpack_bytes};
+  char buf[9];
+  buf[0] = static_cast<char>(type);
+  for (size_t i = width; i > 0; i--) {
+    buf[i] = static_cast<char>(value & 0xFF);
+    value >>= 8;
+  }
+  m_dest.insert(m_dest.end(), buf, buf + 1 + width);
 }
 
-void msgpack_encoder::pack_string(const std::string& s)
+
+void msgpack_encoder::put_string(const char* s, size_t len)
 {
-  if (s.size() > (std::numeric_limits<t_msgpack_size>::max)())
+  if (len > (std::numeric_limits<t_msgpack_size>::max)())
     throw msgpack_error("string exceeds msgpack max size");
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_str (len " << s.size() << ")" << std::endl;
-#endif
-  m_packer.pack_str(s.size());
+  if (len < 32)
+    put_byte(0xa0 | static_cast<unsigned char>(len));
+  else if (len < 0x100)
+    put_header(0xd9, len, 1);
+  else if (len < 0x10000)
+    put_header(0xda, len, 2);
+  else
+    put_header(0xdb, len, 4);
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_str_body" << std::endl;
-#endif
-  m_packer.pack_str_body(s.c_str(), s.size());
+  m_dest.insert(m_dest.end(), s, s + len);
 }
 
-void msgpack_encoder::pack_object(const json_object& jobject)
+
+void msgpack_encoder::pack_string(const std::string& s)
+{
+  put_string(s.data(), s.size());
+}
+
+
+void msgpack_encoder::put_map_header(size_t n)
 {
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_map(items " << jobject.size() << ")" << std::endl;
-#endif
-  m_packer.pack_map(jobject.size());
+  if (n > (std::numeric_limits<t_msgpack_size>::max)())
+    throw msgpack_error("json_object exceeds msgpack max size");
+
+  if (n < 16)
+    put_byte(0x80 | static_cast<unsigned char>(n));
+  else if (n < 0x10000)
+    put_header(0xde, n, 2);
+  else
+    put_header(0xdf, n, 4);
+}
 
+
+void msgpack_encoder::pack_object(const json_object& jobject)
+{
+  put_map_header(jobject.size());
   for (auto& item : jobject) {
     pack_string(item.first);
     pack_value(item.second);
   }
 }
 
-void msgpack_encoder::pack_array(const json_array& ja)
+
+void msgpack_encoder::put_array_header(size_t n)
 {
-  if (ja.size() > (std::numeric_limits<t_msgpack_size>::max)())
+  if (n > (std::numeric_limits<t_msgpack_size>::max)())
     throw msgpack_error("json_array exceeds msgpack max size");
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_array(items " << ja.size() << ")" << std::endl;
-#endif
-  m_packer.pack_array(ja.size());
+  if (n < 16)
+    put_byte(0x90 | static_cast<unsigned char>(n));
+  else if (n < 0x10000)
+    put_header(0xdc, n, 2);
+  else
+    put_header(0xdd, n, 4);
+}
+
+
+void msgpack_encoder::pack_array(const json_array& ja)
+{
+  put_array_header(ja.size());
   for (auto& item : ja)
     pack_value(item);
 }
 
+
 void msgpack_encoder::pack_value(const json_value& jv)
 {
   switch (jv.type()) {
-    case wampcc::eNULL: {
-#ifdef WAMPCC_TRACE_MSGPACK
-      std::cout << "pack_nil" << std::endl;
-#endif
-      m_packer.pack_nil();
+    case wampcc::eNULL:
+      put_byte(0xc0);
       break;
-    }
-    case wampcc::eOBJECT: {
+    case wampcc::eOBJECT:
       pack_object(jv.as_object());
       break;
-    }
-    case wampcc::eARRAY: {
+    case wampcc::eARRAY:
       pack_array(jv.as_array());
       break;
-    }
-    case wampcc::eSTRING: {
+    case wampcc::eSTRING:
       pack_string(jv.as_string());
       break;
-    }
-    case wampcc::eBOOL: {
-      if (jv.as_bool() == true) {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_true" << std::endl;
-#endif
-        m_packer.pack_true();
-      } else {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_false" << std::endl;
-#endif
-        m_packer.pack_false();
-      }
+    case wampcc::eBOOL:
+      put_byte(jv.as_bool() ? 0xc3 : 0xc2);
       break;
-    }
     case wampcc::eREAL: {
-#ifdef WAMPCC_TRACE_MSGPACK
-      std::cout << "pack_double" << std::endl;
-#endif
-      m_packer.pack_double(jv.as_real());
+      double d = jv.as_real();
+      uint64_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      put_header(0xcb, bits, 8);
       break;
     }
     case wampcc::eINTEGER: {
-      if (jv.is_int()) {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_long_long" << std::endl;
-#endif
-        m_packer.pack_long_long(jv.as_int());
+      if (jv.is_uint()) {
+        uint64_t v = jv.as_uint();
+        if (v < 0x80)
+          put_byte(static_cast<unsigned char>(v));
+        else if (v < 0x100)
+          put_header(0xcc, v, 1);
+        else if (v < 0x10000)
+          put_header(0xcd, v, 2);
+        else if (v < 0x100000000ULL)
+          put_header(0xce, v, 4);
+        else
+          put_header(0xcf, v, 8);
       } else {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_unsigned_long_long" << std::endl;
-#endif
-        m_packer.pack_unsigned_long_long(jv.as_uint());
+        int64_t v = jv.as_int(); /* negative, else would be uint */
+        if (v >= -32)
+          put_byte(static_cast<unsigned char>(v));
+        else if (v >= -128)
+          put_header(0xd0, static_cast<uint64_t>(v), 1);
+        else if (v >= -32768)
+          put_header(0xd1, static_cast<uint64_t>(v), 2);
+        else if (v >= -2147483648LL)
+          put_header(0xd2, static_cast<uint64_t>(v), 4);
+        else
+          put_header(0xd3, static_cast<uint64_t>(v), 8);
       }
       break;
     }
   }
 }
 
-class msgpack_visitor
+
+msgpack_decoder::msgpack_decoder(const char* src, size_t len)
+  : m_src(reinterpret_cast<const unsigned char*>(src)),
+    m_len(len),
+    m_pos(0),
+    m_depth(0)
 {
-public:
-  /* Add the currently parsed json_value into the json document, which means we
-   * either add it to a parent array, or to a parent object, or if we are
-   * parsing a map-key, we use it for a mapkey. */
-  json_value* add(json_value&& jv)
-  {
-    switch (m_parse_mode) {
-      case parse_mode::init: {
-        m_root = std::move(jv);
-        m_parse_mode = parse_mode::undef;
-        return &m_root;
-      }
-      case parse_mode::undef: {
-        throw msgpack_error("add json_value called for undefied parse_mode");
-      }
-      case parse_mode::array: {
-        if (m_containers.empty())
-          throw msgpack_error(
-              "add array-item attempted without parent container");
-
-        json_array& arr = m_containers.top()->as_array();
-        arr.push_back(std::move(jv));
-        return &arr.back();
-      }
-      case parse_mode::object: {
-        if (m_containers.empty())
-          throw msgpack_error(
-              "add object-item attempted without parent container");
-        if (!m_have_map_key)
-          throw msgpack_error("add object-item attempted without map-key");
-
-        m_have_map_key = false;
-        json_object& obj = m_containers.top()->as_object();
-        auto ins = obj.insert({std::move(m_map_key), std::move(jv)});
-        return &(ins.first->second);
-      }
-      case parse_mode::mapkey: {
-        if (m_have_map_key)
-          throw msgpack_error("map-key assigned attempted when map_key already available");
+}
+
+
+void msgpack_decoder::decode(json_value& dest)
+{
+  if (m_len == 0)
+    throw msgpack_error("insufficient bytes when parsing msgpack", 0, 0);
+  read_value(dest);
+  if (m_pos != m_len)
+    throw msgpack_error("extra bytes when parsing msgpack", m_pos, m_pos);
+}
+
+
+json_array_tail msgpack_decoder::decode_head(json_array& dest,
+                                             json_head_size_fn head_size)
+{
+  size_t n;
+  unsigned char type = *take(1);
+  if ((type & 0xf0) == 0x90)
+    n = type & 0x0f;
+  else if (type == 0xdc)
+    n = read_count(2);
+  else if (type == 0xdd)
+    n = read_count(4);
+  else {
+    m_pos--;
+    fail("msgpack array expected");
+  }
 
-        m_map_key = std::move(jv.as_string());
-        m_have_map_key = true;
-        return nullptr;
+  json_array_tail tail{0, 0, 0, eNULL, eNULL};
+  m_depth++;
+  if (n) {
+    if (dest.empty())
+      dest.emplace_back();
+    read_value(dest[0]);
+    size_t head = head_size(dest[0]);
+    dest.resize(std::max<size_t>(1, std::min(n, head)));
+    for (size_t i = 1; i < dest.size(); i++)
+      read_value(dest[i]);
+    if (n > head) {
+      tail.offset = m_pos;
+      tail.count = n - head;
+      for (size_t i = 0; i < tail.count; i++) {
+        tail.last_type = skip_value();
+        if (i == 0)
+          tail.first_type = tail.last_type;
       }
+      tail.length = m_pos - tail.offset;
     }
-    return nullptr;
   }
+  else
+    dest.clear();
+  m_depth--;
 
-  bool visit_boolean(bool v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_bool(v));
-    return true;
-  }
+  if (m_pos != m_len)
+    throw msgpack_error("extra bytes when parsing msgpack", m_pos, m_pos);
+  return tail;
+}
 
-  bool visit_nil()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    add(json_value::make_null());
-    return true;
-  }
 
-  bool visit_float(double v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_double(v));
-    return true;
-  }
+void msgpack_decoder::fail(const char* msg)
+{
+  throw msgpack_error(msg, m_pos, m_pos);
+}
 
-  bool visit_negative_integer(int64_t v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_int(v));
-    return true;
-  }
 
-  bool visit_positive_integer(uint64_t v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_uint(v));
-    return true;
-  }
+/* Consume and return 'n' bytes, which must be available. */
+const unsigned char* msgpack_decoder::take(size_t n)
+{
+  if (m_len - m_pos < n)
+    throw msgpack_error("insufficient bytes when parsing msgpack", m_pos,
+                        m_len);
+  const unsigned char* p = m_src + m_pos;
+  m_pos += n;
+  return p;
+}
 
-  bool visit_str(const char* v, uint32_t size)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << std::string(v, size)
-              << std::endl;
-#endif
-    add(json_value::make_string(v, size));
-    return true;
-  }
 
-  bool start_map_key()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::mapkey;
-    return true;
-  }
+uint64_t msgpack_decoder::read_uint(size_t width)
+{
+  const unsigned char* p = take(width);
+  uint64_t v = 0;
+  for (size_t i = 0; i < width; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
 
-  bool end_map_key()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::undef;
-    return true;
-  }
 
-  bool start_map(uint32_t pairs)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ": items " << pairs
-              << std::endl;
-    m_indent += "  ";
-#endif
-    add_container(json_object());
-    return true;
-  }
+/* Read an element count, checking it is plausible for the bytes remaining,
+ * since every element occupies at least one byte. */
+size_t msgpack_decoder::read_count(size_t width)
+{
+  uint64_t n = read_uint(width);
+  if (n > m_len - m_pos)
+    throw msgpack_error("insufficient bytes when parsing msgpack", m_pos,
+                        m_len);
+  return static_cast<size_t>(n);
+}
 
-  bool end_map()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    m_indent = m_indent.substr(0, m_indent.size() - 2);
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_containers.pop();
-    return true;
-  }
 
-  bool start_map_value()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::object;
-    return true;
-  }
+void msgpack_decoder::read_string(std::string& dest, size_t len)
+{
+  const unsigned char* p = take(len);
+  dest.assign(reinterpret_cast<const char*>(p), len);
+}
 
-  bool end_map_value()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::undef;
-    return true;
-  }
 
-  bool start_array(uint32_t num_elements)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ": size " << num_elements
-              << std::endl;
-    m_indent += "  ";
-#endif
-    json_array array;
-    array.reserve(num_elements);
-    add_container(std::move(array));
-    return true;
-  }
+void msgpack_decoder::read_array(json_value& dest, size_t n)
+{
+  if (++m_depth > max_depth)
+    fail("maximum msgpack nesting depth reached");
+
+  json_array& arr = reuse_array(dest);
+  arr.resize(n);
+  for (size_t i = 0; i < n; i++)
+    read_value(arr[i]);
+  m_depth--;
+}
 
-  bool end_array()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    m_indent = m_indent.substr(0, m_indent.size() - 2);
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_containers.pop();
-    return true;
-  }
 
-  bool start_array_item()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::array;
-    return true;
-  }
+/* Only the flat map can be sized in advance */
+static inline void reserve_members(std::map<std::string, json_value>&, size_t) {}
+static inline void reserve_members(json_flat_map<json_value>& obj, size_t n)
+{
+  obj.reserve(n);
+}
 
-  bool end_array_item()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::undef;
-    return true;
-  }
 
-  [[ noreturn ]] void parse_error(size_t parsed_offset, size_t error_offset)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    throw msgpack_error("parse error when parsing msgpack", parsed_offset,
-                        error_offset);
+void msgpack_decoder::read_object(json_value& dest, size_t n)
+{
+  if (++m_depth > max_depth)
+    fail("maximum msgpack nesting depth reached");
+
+  object_reuse obj(&dest);
+  reserve_members(dest.as_object(), n);
+  for (size_t i = 0; i < n; i++) {
+    read_string(obj.next_key(), read_key_length());
+    read_value(obj.member());
   }
+  obj.finish();
+  m_depth--;
+}
 
-  [[ noreturn ]] void insufficient_bytes(size_t parsed_offset, size_t error_offset)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    throw msgpack_error("insufficient bytes when parsing msgpack",
-                        parsed_offset, error_offset);
-  }
 
-  bool visit_bin(const char* /*v*/, uint32_t /*size*/)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    return true;
+/* Read the header of a map key, which must be a string, returning its
+ * length. */
+size_t msgpack_decoder::read_key_length()
+{
+  unsigned char type = *take(1);
+  if ((type & 0xe0) == 0xa0)
+    return type & 0x1f;
+  if (type == 0xd9)
+    return read_count(1);
+  if (type == 0xda)
+    return read_count(2);
+  if (type == 0xdb)
+    return read_count(4);
+  m_pos--;
+  fail("msgpack map key is not a string");
+}
+
+
+void msgpack_decoder::transcode_json(std::vector<char>& dest)
+{
+  const size_t orig_size = dest.size();
+  try {
+    if (m_len == 0)
+      throw msgpack_error("insufficient bytes when parsing msgpack", 0, 0);
+    json_writer<std::vector<char>> w(dest);
+    write_json(w);
+    if (m_pos != m_len)
+      throw msgpack_error("extra bytes when parsing msgpack", m_pos, m_pos);
+    w.finish();
+  } catch (...) {
+    dest.resize(orig_size);
+    throw;
   }
-  bool visit_ext(const char* /*v*/, uint32_t /*size*/)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    return true;
+}
+
+
+void msgpack_decoder::transcode_json_tail(std::vector<char>& dest)
+{
+  const size_t orig_size = dest.size();
+  try {
+    json_writer<std::vector<char>> w(dest);
+    for (bool first = true; m_pos != m_len; first = false) {
+      if (!first)
+        w.put_literal(", ");
+      write_json(w);
+    }
+    w.finish();
+  } catch (...) {
+    dest.resize(orig_size);
+    throw;
   }
+}
 
-  json_value& root() { return m_root; }
-  const json_value& root() const { return m_root; }
 
-  bool is_good() const {
-    return m_containers.empty() &&
-      (m_have_map_key == false) &&
-      (m_parse_mode == parse_mode::undef);
+/* As read_value, but writing JSON text rather than building a json_value. */
+void msgpack_decoder::write_json(json_writer<std::vector<char>>& w)
+{
+  unsigned char type = *take(1);
+  size_t items;
+  bool is_map;
+
+  if (type < 0x80) { /* positive fixint */
+    w.put_uint(type, false);
+    return;
+  }
+  if (type >= 0xe0) { /* negative fixint */
+    w.put_int(static_cast<int8_t>(type));
+    return;
+  }
+  if (type < 0xa0) {
+    items = type & 0x0f;
+    is_map = type < 0x90;
+  } else if (type < 0xc0) {
+    write_json_string(w, type & 0x1f);
+    return;
+  } else {
+    switch (type) {
+      case 0xc0: w.put_literal("null"); return;
+      case 0xc2: w.put_literal("false"); return;
+      case 0xc3: w.put_literal("true"); return;
+      case 0xc4: case 0xd9: write_json_string(w, read_count(1)); return;
+      case 0xc5: case 0xda: write_json_string(w, read_count(2)); return;
+      case 0xc6: case 0xdb: write_json_string(w, read_count(4)); return;
+      case 0xca: {
+        uint32_t bits = static_cast<uint32_t>(read_uint(4));
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        w.put_real(f);
+        return;
+      }
+      case 0xcb: {
+        uint64_t bits = read_uint(8);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        w.put_real(d);
+        return;
+      }
+      case 0xcc: w.put_uint(read_uint(1), false); return;
+      case 0xcd: w.put_uint(read_uint(2), false); return;
+      case 0xce: w.put_uint(read_uint(4), false); return;
+      case 0xcf: w.put_uint(read_uint(8), false); return;
+      case 0xd0: w.put_int(static_cast<int8_t>(read_uint(1))); return;
+      case 0xd1: w.put_int(static_cast<int16_t>(read_uint(2))); return;
+      case 0xd2: w.put_int(static_cast<int32_t>(read_uint(4))); return;
+      case 0xd3: w.put_int(static_cast<int64_t>(read_uint(8))); return;
+      case 0xdc: items = read_count(2); is_map = false; break;
+      case 0xdd: items = read_count(4); is_map = false; break;
+      case 0xde: items = read_count(2); is_map = true; break;
+      case 0xdf: items = read_count(4); is_map = true; break;
+      default:
+        m_pos--;
+        if (type == 0xc1)
+          fail("parse error when parsing msgpack");
+        fail("msgpack ext types are not supported");
+    }
   }
 
-private:
-  /* Here 'container' is a univeral reference, however we want to restrict this
-   * template to accepting only rvalue references. */
-  template <typename T, class = typename std::enable_if<
-                            !std::is_lvalue_reference<T>::value>::type>
-  void add_container(T&& container)
-  {
-    json_value* p = add(json_value(std::move(container)));
-    m_containers.push(p);
+  if (++m_depth > max_depth)
+    fail("maximum msgpack nesting depth reached");
+  w.put(is_map ? '{' : '[');
+  for (size_t i = 0; i < items; i++) {
+    if (i)
+      w.put_literal(", ");
+    if (is_map) {
+      write_json_string(w, read_key_length());
+      w.put_literal(": ");
+    }
+    write_json(w);
   }
+  w.put(is_map ? '}' : ']');
+  m_depth--;
+}
 
-  json_value m_root;
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::string m_indent;
-#endif
+void msgpack_decoder::write_json_string(json_writer<std::vector<char>>& w,
+                                        size_t len)
+{
+  w.put_string(reinterpret_cast<const char*>(take(len)), len);
+}
 
-  std::stack<json_value*> m_containers;
 
-  std::string m_map_key;
+/* Step over a value, with the same checks as read_value, but without building
+ * anything. */
+JSONType msgpack_decoder::skip_value()
+{
+  unsigned char type = *take(1);
+  size_t items = 0; /* values contained, for arrays & maps */
+
+  if (type < 0x80 || type >= 0xe0)
+    return eINTEGER;
+  if (type < 0x90)
+    items = 2 * static_cast<size_t>(type & 0x0f);
+  else if (type < 0xa0)
+    items = type & 0x0f;
+  else if (type < 0xc0) {
+    take(type & 0x1f);
+    return eSTRING;
+  } else {
+    switch (type) {
+      case 0xc0: return eNULL;
+      case 0xc2: case 0xc3: return eBOOL;
+      case 0xc4: case 0xd9: take(read_count(1)); return eSTRING;
+      case 0xc5: case 0xda: take(read_count(2)); return eSTRING;
+      case 0xc6: case 0xdb: take(read_count(4)); return eSTRING;
+      case 0xcc: case 0xd0: take(1); return eINTEGER;
+      case 0xcd: case 0xd1: take(2); return eINTEGER;
+      case 0xce: case 0xd2: take(4); return eINTEGER;
+      case 0xcf: case 0xd3: take(8); return eINTEGER;
+      case 0xca: take(4); return eREAL;
+      case 0xcb: take(8); return eREAL;
+      case 0xdc: items = read_count(2); break;
+      case 0xdd: items = read_count(4); break;
+      case 0xde: items = 2 * read_count(2); break;
+      case 0xdf: items = 2 * read_count(4); break;
+      default:
+        m_pos--;
+        if (type == 0xc1)
+          fail("parse error when parsing msgpack");
+        fail("msgpack ext types are not supported");
+    }
+  }
 
-  /* Do we have a map-key? */
-  bool m_have_map_key = false;
+  if (++m_depth > max_depth)
+    fail("maximum msgpack nesting depth reached");
+  const bool is_map = (type & 0xf0) == 0x80 || type == 0xde || type == 0xdf;
+  for (size_t i = 0; i < items; i++) {
+    if (is_map && i % 2 == 0) {
+      /* keys must be strings */
+      if (m_pos == m_len)
+        take(1);
+      unsigned char key = m_src[m_pos];
+      if ((key & 0xe0) != 0xa0 && key != 0xd9 && key != 0xda && key != 0xdb)
+        fail("msgpack map key is not a string");
+    }
+    skip_value();
+  }
+  m_depth--;
+  return is_map ? eOBJECT : eARRAY;
+}
 
-  /* What kind of value is currently being parsed and added to the documet? */
-  enum class parse_mode {
-    undef,  /* nothing */
-    init,   /* the first item */
-    array,  /* an array-cell */
-    object, /* an object-item (value) */
-    mapkey  /* an object-item (key) */
-  } m_parse_mode = parse_mode::init;
-};
 
-bool msgpack_decoder::decode(const char* src, size_t len)
+void msgpack_decoder::read_value(json_value& dest)
 {
-  msgpack_visitor visitor;
+  unsigned char type = *take(1);
 
-  bool success = msgpack::parse<msgpack_visitor>(src, len, visitor);
+  if (type < 0x80) { /* positive fixint */
+    dest = json_value::make_uint(type);
+    return;
+  }
+  if (type >= 0xe0) { /* negative fixint */
+    dest = json_value::make_int(static_cast<int8_t>(type));
+    return;
+  }
+  if (type < 0x90) {
+    read_object(dest, type & 0x0f);
+    return;
+  }
+  if (type < 0xa0) {
+    read_array(dest, type & 0x0f);
+    return;
+  }
+  if (type < 0xc0) {
+    read_string(reuse_string(dest), type & 0x1f);
+    return;
+  }
 
-  if (success && visitor.is_good())
-    this->result = std::move(visitor.root());
+  switch (type) {
+    case 0xc0:
+      dest = json_value::make_null();
+      return;
+    case 0xc2:
+      dest = json_value::make_bool(false);
+      return;
+    case 0xc3:
+      dest = json_value::make_bool(true);
+      return;
+    case 0xc4: /* bin, which JSON lacks, so map to string */
+    case 0xd9:
+      read_string(reuse_string(dest), read_count(1));
+      return;
+    case 0xc5:
+    case 0xda:
+      read_string(reuse_string(dest), read_count(2));
+      return;
+    case 0xc6:
+    case 0xdb:
+      read_string(reuse_string(dest), read_count(4));
+      return;
+    case 0xca: {
+      uint32_t bits = static_cast<uint32_t>(read_uint(4));
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      dest = json_value::make_double(f);
+      return;
+    }
+    case 0xcb: {
+      uint64_t bits = read_uint(8);
+      double d;
+      memcpy(&d, &bits, sizeof(d));
+      dest = json_value::make_double(d);
+      return;
+    }
+    case 0xcc:
+      dest = json_value::make_uint(read_uint(1));
+      return;
+    case 0xcd:
+      dest = json_value::make_uint(read_uint(2));
+      return;
+    case 0xce:
+      dest = json_value::make_uint(read_uint(4));
+      return;
+    case 0xcf:
+      dest = json_value::make_uint(read_uint(8));
+      return;
+    case 0xd0:
+      dest = json_value::make_int(static_cast<int8_t>(read_uint(1)));
+      return;
+    case 0xd1:
+      dest = json_value::make_int(static_cast<int16_t>(read_uint(2)));
+      return;
+    case 0xd2:
+      dest = json_value::make_int(static_cast<int32_t>(read_uint(4)));
+      return;
+    case 0xd3:
+      dest = json_value::make_int(static_cast<int64_t>(read_uint(8)));
+      return;
+    case 0xdc:
+      read_array(dest, read_count(2));
+      return;
+    case 0xdd:
+      read_array(dest, read_count(4));
+      return;
+    case 0xde:
+      read_object(dest, read_count(2));
+      return;
+    case 0xdf:
+      read_object(dest, read_count(4));
+      return;
+  }
 
-  return success && visitor.is_good();
+  m_pos--;
+  if (type == 0xc1)
+    fail("parse error when parsing msgpack");
+  fail("msgpack ext types are not supported");
 }
+
 }
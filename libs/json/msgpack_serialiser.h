@@ -9,21 +9,37 @@
 #define __JALSON_MSGPACK_H__
 
 #include "wampcc/json.h"
-
-#include "msgpack.hpp"
+#include "json_writer.h"
 
 namespace wampcc
 {
 
+/* Packs json_value as msgpack, appending the bytes to the destination buffer.
+ * The encoding chosen for each value is the smallest available, as per the
+ * msgpack-c packer. */
 class msgpack_encoder
 {
 public:
-  msgpack_encoder();
-  std::unique_ptr<region, void(*)(region*)> encode(const json_value &);
+  explicit msgpack_encoder(std::vector<char>& dest);
+
+  void encode(const json_value&);
+
+  /* Encode an array of the elements of 'head' followed by 'count' elements
+   * already packed into the 'len' bytes at 'tail'. */
+  void encode_spliced(const json_array& head, const char* tail, size_t len,
+                      size_t count);
+
+  /* Write the headers of an array or map, which must be followed by their
+   * elements, and write a string; for use when transcoding. */
+  void put_array_header(size_t);
+  void put_map_header(size_t);
+  void put_string(const char*, size_t);
 
 private:
-  msgpack::sbuffer m_sbuf;
-  msgpack::packer<msgpack::sbuffer> m_packer;
+  std::vector<char>& m_dest;
+
+  void put_byte(unsigned char);
+  void put_header(unsigned char type, uint64_t value, size_t width);
 
   void pack_array(const json_array &);
   void pack_object(const json_object &);
@@ -32,16 +48,46 @@ private:
 };
 
 
+/* Reads a msgpack byte stream, building the json_value directly from the
+ * bytes, without any intermediate representation.  Throws msgpack_error if
+ * the bytes are not a single, complete msgpack value. */
 class msgpack_decoder
 {
 public:
-  json_value result;
+  msgpack_decoder(const char *, size_t);
 
-  bool decode(const char *, size_t);
-};
+  void decode(json_value& dest);
+
+  /* Decode only the leading elements of a top-level array, checking that the
+   * remaining elements are well formed. */
+  json_array_tail decode_head(json_array& dest, json_head_size_fn);
 
+  /* Write the value as JSON text, appended to 'dest', without building a
+   * json_value.  The tail variant writes every value up to the end of the
+   * input, separated by ", ", as for the elements of an array. */
+  void transcode_json(std::vector<char>& dest);
+  void transcode_json_tail(std::vector<char>& dest);
 
+private:
+  const unsigned char* m_src;
+  size_t m_len;
+  size_t m_pos;
+  int m_depth;
 
+  void read_value(json_value&);
+  JSONType skip_value();
+  void write_json(json_writer<std::vector<char>>&);
+  void write_json_string(json_writer<std::vector<char>>&, size_t);
+  size_t read_key_length();
+  void read_array(json_value&, size_t);
+  void read_object(json_value&, size_t);
+  void read_string(std::string&, size_t);
+  uint64_t read_uint(size_t width);
+  size_t read_count(size_t width);
+  const unsigned char* take(size_t);
+
+  [[noreturn]] void fail(const char*);
+};
 
 }
 
@@ -242,6 +242,96 @@ json_value string_model::snapshot() const
 
 //======================================================================
 
+json_model::json_model(json_value v)
+  : m_value( std::move(v) )
+{
+  m_value.share();
+}
+
+
+json_model::json_model(const json_model& src)
+  : data_model(src),
+    m_value(src.value())
+{
+}
+
+
+json_value json_model::value() const
+{
+  std::lock_guard<std::mutex> guard(m_value_mutex);
+  return m_value;
+}
+
+
+void json_model::assign(json_value v)
+{
+  /* Lock convention: the model_topics_mutex must be taken and held before the
+   * value mutex is taken (the value mutex is take during the snapshot). */
+  std::lock_guard<std::mutex> publisher_guard(m_model_topics_mutex);
+  assign_impl(std::move(v));
+}
+
+
+void json_model::modify(std::function<void(json_value&)> fn)
+{
+  /* The model_topics_mutex is held throughout, so that concurrent calls each
+   * see the result of the previous */
+  std::lock_guard<std::mutex> publisher_guard(m_model_topics_mutex);
+
+  json_value tmp;
+  {
+    std::lock_guard<std::mutex> value_guard(m_value_mutex);
+    tmp = m_value;
+  }
+
+  fn(tmp);
+  assign_impl(std::move(tmp));
+}
+
+
+void json_model::assign_impl(json_value v)
+{
+  /* Sharing the new value makes the copy kept as the previous state for the
+   * next diff, and the copies taken by value() and snapshot(), cheap. */
+  v.share();
+
+  json_value old;
+  {
+    std::lock_guard<std::mutex> value_guard(m_value_mutex);
+    old = m_value;
+    m_value = v;
+  }
+
+  if (!m_model_topics.empty())
+  {
+    json_array patch = json_diff(old, v, "/body/value");
+    if (patch.empty())
+      return;
+
+    // changes are fully described by the json-model patch
+    json_array rich_event;
+
+    publish(patch, rich_event);
+  }
+}
+
+
+json_value json_model::snapshot() const
+{
+  json_value tmp = value();
+
+  json_value jmodel = json_value::make_object();
+  json_object & head = json_insert<json_object>(jmodel.as_object(), "head");
+  json_object & body = json_insert<json_object>(jmodel.as_object(), "body");
+  head.emplace("type",   "json_model");
+  head.emplace("version", 0);
+  body.insert({"value",std::move(tmp)});
+
+  return jmodel;
+}
+
+//======================================================================
+
 model_sub_base::model_sub_base(std::shared_ptr<wampcc::wamp_session>& ws,
                                std::string topic_uri)
   : m_uri(topic_uri),
@@ -274,10 +364,10 @@ void jmodel_subscription::on_update(json_object options,
     auto & patchset = args.args_list[0].as_array();
     {
       std::lock_guard<std::mutex> guard(m_value_mutex);
-      m_value.patch(patchset);
+      m_value.patch(std::move(patchset));
       std::cout << "model is now: " << m_value << std::endl;
     }
-    //m_observer.on_change();
+    m_observer.on_change(*this);
   }
   else
   {
@@ -12,49 +12,265 @@
 #include "wampcc/log_macros.h"
 #include "wampcc/utils.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
 namespace wampcc
 {
 
-struct event
+timer_wheel::timer_wheel()
+  : m_buckets(level_count * slots_per_level, bucket{npos, npos}),
+    m_free(npos),
+    m_active(0),
+    m_linked(0),
+    m_now(0)
 {
-  enum event_type { kill = 0, function_dispatch, timer_dispatch } type;
+}
 
-  event(event_type t) : type(t) {}
 
-  virtual ~event() {}
-};
+timer_wheel::node* timer_wheel::lookup(timer_id id)
+{
+  if (id.slot < m_nodes.size() && m_nodes[id.slot].generation == id.generation)
+    return &m_nodes[id.slot];
+  else
+    return nullptr;
+}
 
 
-struct ev_function_dispatch : event
+uint32_t timer_wheel::allocate()
 {
-  ev_function_dispatch(std::function<void()> fn_)
-    : event(event::function_dispatch), fn(std::move(fn_))
-  {
+  uint32_t i = m_free;
+  if (i != npos)
+    m_free = m_nodes[i].next;
+  else {
+    i = m_nodes.size();
+    m_nodes.push_back(node());
+    m_nodes[i].generation = 0;
   }
+  m_active++;
+  return i;
+}
+
+
+void timer_wheel::release(uint32_t i)
+{
+  node& n = m_nodes[i];
+  n.fn = nullptr;
+  n.generation++; /* invalidates outstanding identifiers */
+  n.state = node_state::unused;
+  n.next = m_free;
+  m_free = i;
+  m_active--;
+}
+
 
-  std::function<void()> fn;
-};
+void timer_wheel::link(uint32_t i)
+{
+  node& n = m_nodes[i];
+
+  /* Find the lowest level which spans the delay, or the top level if none do;
+   * timers beyond the range of the wheel are placed one revolution of the top
+   * level away, and then re-linked when cascaded. */
+  tick_type delta = (n.due > m_now) ? n.due - m_now : 0;
+  tick_type slot_tick = n.due;
+  unsigned level = 0;
+  while (level < level_count - 1 &&
+         delta >= (tick_type(1) << (level_bits * (level + 1))))
+    level++;
+  if (delta >= (tick_type(1) << (level_bits * level_count)))
+    slot_tick = m_now + (tick_type(1) << (level_bits * level_count)) - 1;
+
+  uint32_t slot = (slot_tick >> (level_bits * level)) & (slots_per_level - 1);
+  n.bucket = level * slots_per_level + slot;
+
+  /* append, so that timers due on the same tick expire in order scheduled */
+  bucket& b = m_buckets[n.bucket];
+  n.prev = b.tail;
+  n.next = npos;
+  if (b.tail != npos)
+    m_nodes[b.tail].next = i;
+  else
+    b.head = i;
+  b.tail = i;
+  m_linked++;
+}
 
 
-struct ev_timer_dispatch : event
+void timer_wheel::unlink(uint32_t i)
 {
-  ev_timer_dispatch(event_loop::timer_fn fn_)
-    : event(event::timer_dispatch), fn(std::move(fn_))
-  {
+  node& n = m_nodes[i];
+  bucket& b = m_buckets[n.bucket];
+  if (n.prev != npos)
+    m_nodes[n.prev].next = n.next;
+  else
+    b.head = n.next;
+  if (n.next != npos)
+    m_nodes[n.next].prev = n.prev;
+  else
+    b.tail = n.prev;
+  m_linked--;
+}
+
+
+timer_wheel::timer_id timer_wheel::schedule(tick_type due, timer_fn fn)
+{
+  uint32_t i = allocate();
+  node& n = m_nodes[i];
+  n.fn = std::move(fn);
+  n.due = std::max(due, m_now + 1);
+  n.state = node_state::scheduled;
+  link(i);
+  return {i, n.generation};
+}
+
+
+bool timer_wheel::cancel(timer_id id)
+{
+  node* n = lookup(id);
+  if (!n)
+    return false;
+
+  switch (n->state) {
+    case node_state::scheduled:
+      unlink(id.slot);
+      release(id.slot);
+      return true;
+    case node_state::expired:
+      release(id.slot);
+      return true;
+    case node_state::running:
+      n->state = node_state::cancelled;
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+void timer_wheel::cascade(unsigned level)
+{
+  bucket& b = m_buckets[level * slots_per_level +
+                        ((m_now >> (level_bits * level)) & (slots_per_level - 1))];
+
+  uint32_t i = b.head;
+  b.head = b.tail = npos;
+  while (i != npos) {
+    uint32_t next = m_nodes[i].next;
+    m_linked--;
+    link(i);
+    i = next;
+  }
+}
+
+
+void timer_wheel::advance(tick_type now, std::vector<timer_id>& expired)
+{
+  if (m_linked == 0) {
+    m_now = std::max(m_now, now);
+    return;
   }
 
-  event_loop::timer_fn fn;
-};
+  while (m_now < now) {
+    m_now++;
+
+    /* when a level completes a revolution, move the timers of the current
+     * slot of each higher level down into the lower levels */
+    unsigned top = 0;
+    while (top < level_count - 1 &&
+           (m_now & ((tick_type(1) << (level_bits * (top + 1))) - 1)) == 0)
+      top++;
+    for (unsigned level = top; level > 0; level--)
+      cascade(level);
+
+    bucket& b = m_buckets[m_now & (slots_per_level - 1)];
+    uint32_t i = b.head;
+    b.head = b.tail = npos;
+    while (i != npos) {
+      node& n = m_nodes[i];
+      uint32_t next = n.next;
+      m_linked--;
+      n.state = node_state::expired;
+      expired.push_back({i, n.generation});
+      i = next;
+    }
+
+    if (m_linked == 0) {
+      m_now = now;
+      break;
+    }
+  }
+}
+
+
+timer_wheel::tick_type timer_wheel::next_wakeup() const
+{
+  /* search the lowest level up to its next revolution, at which point timers
+   * on higher levels may need to be cascaded */
+  tick_type end = (m_now | (slots_per_level - 1)) + 1;
+  for (tick_type t = m_now + 1; t < end; t++)
+    if (m_buckets[t & (slots_per_level - 1)].head != npos)
+      return t;
+  return end;
+}
+
+
+bool timer_wheel::begin_run(timer_id id, timer_fn& fn)
+{
+  node* n = lookup(id);
+  if (!n || n->state != node_state::expired)
+    return false;
+
+  fn = std::move(n->fn);
+  n->state = node_state::running;
+  return true;
+}
+
+
+void timer_wheel::complete(timer_id id)
+{
+  if (lookup(id))
+    release(id.slot);
+}
+
+
+void timer_wheel::reschedule(timer_id id, timer_fn fn, tick_type due)
+{
+  node* n = lookup(id);
+  if (!n)
+    return;
+
+  if (n->state == node_state::running) {
+    n->fn = std::move(fn);
+    n->due = std::max(due, m_now + 1);
+    n->state = node_state::scheduled;
+    link(id.slot);
+  } else
+    release(id.slot);
+}
+
+
+bool timer_handle::cancel()
+{
+  return m_loop ? m_loop->cancel(*this) : false;
+}
+
+
+/* Event loop which the current thread is a worker of, if any */
+static thread_local const event_loop* tls_event_loop = nullptr;
 
 
 event_loop::event_loop(kernel* k)
   : m_kernel(k),
     __logger(k->get_logger()),
+    m_thread_count(std::max<size_t>(k->get_config().event_loop_thread_count, 1)),
     m_continue(true),
-    m_thread(&event_loop::eventmain, this)
+    m_epoch(std::chrono::steady_clock::now()),
+    m_wakeup(0)
 {
+  // threads are started last, once all other members have been constructed
+  for (size_t i = 0; i < m_thread_count; i++)
+    m_threads.emplace_back(&event_loop::eventmain, this);
 }
 
 
@@ -63,114 +279,162 @@ event_loop::~event_loop() { sync_stop(); }
 
 void event_loop::sync_stop()
 {
-  auto kill_event = std::make_shared<event>(event::kill);
-
   {
     std::lock_guard<std::mutex> guard(m_mutex);
-    m_queue.push_back(std::move(kill_event));
+    m_queue.push_back([this]() {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      m_continue = false;
+      m_condvar.notify_all();
+    });
     m_condvar.notify_one();
   }
 
-  if (m_thread.joinable())
-    m_thread.join();
+  for (auto& t : m_threads)
+    if (t.joinable())
+      t.join();
 }
 
 
-void event_loop::dispatch(std::function<void()> fn)
+void event_loop::dispatch(task fn)
 {
-  auto event = std::make_shared<ev_function_dispatch>(std::move(fn));
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_queue.push_back(std::move(fn));
+  m_condvar.notify_one();
+}
 
-  {
-    std::lock_guard<std::mutex> guard(m_mutex);
-    m_queue.push_back(std::move(event));
-    m_condvar.notify_one();
-  }
+
+timer_wheel::tick_type event_loop::to_tick(
+    std::chrono::steady_clock::time_point tp) const
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(tp - m_epoch)
+      .count();
 }
 
 
-void event_loop::dispatch(std::chrono::milliseconds delay, timer_fn fn)
+timer_handle event_loop::dispatch(std::chrono::milliseconds delay, timer_fn fn)
 {
-  dispatch(delay, std::make_shared<ev_timer_dispatch>(std::move(fn)));
+  /* round up, so that a timer is never invoked early */
+  auto due = to_tick(std::chrono::steady_clock::now()) + delay.count() + 1;
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  auto id = m_timers.schedule(due, std::move(fn));
+
+  /* only need to wake the EV thread if it is sleeping past the new due time;
+   * with several threads, which are sleeping is not tracked */
+  if (due < m_wakeup || m_thread_count > 1)
+    m_condvar.notify_one();
+  return timer_handle(this, id.slot, id.generation);
 }
 
 
-void event_loop::dispatch(std::chrono::milliseconds delay,
-                          std::shared_ptr<event> sp)
+bool event_loop::cancel(const timer_handle& h)
 {
-  auto tp_due = std::chrono::steady_clock::now() + delay;
-  auto event = std::make_pair(tp_due, std::move(sp));
+  std::lock_guard<std::mutex> guard(m_mutex);
+  return m_timers.cancel({h.m_slot, h.m_generation});
+}
+
 
+void event_loop::run_timer(timer_wheel::timer_id id)
+{
+  timer_fn fn;
   {
     std::lock_guard<std::mutex> guard(m_mutex);
-    m_schedule.insert(std::move(event));
-    m_condvar.notify_one();
+    if (!m_timers.begin_run(id, fn))
+      return;
+  }
+
+  std::chrono::milliseconds repeat_ms(0);
+  try {
+    repeat_ms = fn();
+  } catch (const std::exception& ex) {
+    LOG_ERROR("exception during timer callback : " << ex.what());
+  } catch (...) {
+    LOG_ERROR("unknown exception during timer callback");
+  }
+
+  auto due = to_tick(std::chrono::steady_clock::now()) + repeat_ms.count() + 1;
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (repeat_ms.count() > 0)
+    m_timers.reschedule(id, std::move(fn), due);
+  else
+    m_timers.complete(id);
+}
+
+
+void event_loop::run_task(task& fn)
+{
+  try {
+    fn();
+  } catch (const std::exception& ex) {
+    LOG_ERROR("exception during process_event : " << ex.what());
+  } catch (...) {
+    LOG_ERROR("unknown exception during process_event");
   }
 }
 
 
 void event_loop::eventloop()
 {
-  /* A note on memory management of the event objects.  Once they are pushed,
-   * they are stored as shared pointers.  This allows other parts of the code to
-   * take ownership of the resource, if they so wish.
-   */
-  std::list<std::shared_ptr<event>> to_process;
+  /* Tasks are moved out of the shared queue into a local ring, so that they
+   * can be invoked without holding the lock.  The rings retain their capacity,
+   * so in a steady state no allocation occurs here.  Expired timers are handled
+   * similarly. */
+  task_ring to_process;
+  std::vector<timer_wheel::timer_id> to_expire;
   while (m_continue) {
-    to_process.clear();
     {
       std::unique_lock<std::mutex> guard(m_mutex);
 
-      while (m_continue && m_queue.empty()) {
-
-        // identify range of scheduled events which are now due
-        const auto tp_now = std::chrono::steady_clock::now();
-        const auto upper_iter = m_schedule.upper_bound(tp_now);
-
-        if (upper_iter == m_schedule.begin()) {
-          // no events due now so need to sleep, which is either indefinitely or
-          // until the next scheduled item
-          if (m_schedule.empty())
-            m_condvar.wait(guard);
-          else {
-            auto sleep_for = m_schedule.begin()->first - tp_now;
-            m_condvar.wait_for(guard, sleep_for);
-          }
+      while (true) {
+        m_timers.advance(to_tick(std::chrono::steady_clock::now()), m_expired);
+
+        if (!m_continue || !m_queue.empty() || !m_expired.empty())
+          break;
+
+        // nothing due now so need to sleep, which is either indefinitely or
+        // until the next timer wheel tick of interest
+        if (m_timers.size() == 0) {
+          m_wakeup = std::numeric_limits<timer_wheel::tick_type>::max();
+          m_condvar.wait(guard);
         } else {
-          for (auto iter = m_schedule.begin(); iter != upper_iter; ++iter)
-            m_queue.push_back(std::move(iter->second));
-          m_schedule.erase(m_schedule.begin(), upper_iter);
+          m_wakeup = m_timers.next_wakeup();
+          m_condvar.wait_until(guard,
+                               m_epoch + std::chrono::milliseconds(m_wakeup));
         }
+        m_wakeup = 0;
       }
-      to_process.swap(m_queue);
+
+      if (!m_continue)
+        return;
+
+      if (m_thread_count == 1)
+        to_process.swap(m_queue);
+      else {
+        /* take a share of the queue, leaving the rest for other threads */
+        size_t n = (m_queue.size() + m_thread_count - 1) / m_thread_count;
+        while (n--)
+          to_process.push_back(m_queue.pop_front());
+        if (!m_queue.empty())
+          m_condvar.notify_one();
+      }
+      to_expire.swap(m_expired);
     }
 
-    for (auto& ev : to_process) {
-      try {
-        switch (ev->type) {
-          case event::function_dispatch: {
-            ev_function_dispatch* ev2 =
-                dynamic_cast<ev_function_dispatch*>(ev.get());
-            ev2->fn();
-            break;
-          }
-          case event::timer_dispatch: {
-            ev_timer_dispatch* ev2 = dynamic_cast<ev_timer_dispatch*>(ev.get());
-            auto repeat_ms = ev2->fn();
-            if (repeat_ms.count() > 0)
-              dispatch(repeat_ms, std::move(ev));
-            break;
-          }
-          case event::kill: {
-            m_continue = false;
-            return;
-          }
-        }
-      } catch (const std::exception& ex) {
-        LOG_ERROR("exception during process_event : " << ex.what());
-      } catch (...) {
-        LOG_ERROR("unknown exception during process_event");
+    while (!to_process.empty()) {
+      task fn = to_process.pop_front();
+      run_task(fn);
+
+      /* stop requested, so discard any remaining tasks */
+      if (!m_continue) {
+        to_process.clear();
+        return;
       }
-    } // loop end
+    }
+
+    for (auto id : to_expire)
+      run_timer(id);
+    to_expire.clear();
   }
 }
 
@@ -190,9 +454,9 @@ void event_loop::handle_exception(const char* stage)
 /* Entry point for the kernel's EV thread */
 void event_loop::eventmain()
 {
-  scope_guard undo_thread_id([this]() { m_thread_id.release(); });
+  scope_guard undo_thread_id([]() { tls_event_loop = nullptr; });
 
-  m_thread_id.set_value(std::this_thread::get_id());
+  tls_event_loop = this;
 
   if (m_kernel->get_config().event_loop_start_fn)
     try {
@@ -220,7 +484,66 @@ void event_loop::eventmain()
 
 bool event_loop::this_thread_is_ev() const
 {
-  return m_thread_id.compare(std::this_thread::get_id());
+  return tls_event_loop == this;
+}
+
+
+strand::strand(event_loop* loop)
+  : m_loop(loop)
+{
+  if (loop->thread_count() > 1) {
+    m_state = std::make_shared<state>();
+    m_state->loop = loop;
+    m_state->scheduled = false;
+  }
+}
+
+
+void strand::dispatch(task fn)
+{
+  if (!m_state) {
+    m_loop->dispatch(std::move(fn));
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(m_state->lock);
+    m_state->pending.push_back(std::move(fn));
+    if (m_state->scheduled)
+      return;
+    m_state->scheduled = true;
+  }
+
+  std::shared_ptr<state> sp = m_state;
+  m_loop->dispatch([sp]() { run(sp); });
+}
+
+
+void strand::run(std::shared_ptr<state> sp)
+{
+  /* EV thread */
+
+  {
+    std::lock_guard<std::mutex> guard(sp->lock);
+    sp->running.swap(sp->pending);
+  }
+
+  while (!sp->running.empty()) {
+    task fn = sp->running.pop_front();
+    sp->loop->run_task(fn);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(sp->lock);
+    if (sp->pending.empty()) {
+      sp->scheduled = false;
+      return;
+    }
+  }
+
+  /* more tasks arrived; requeue rather than loop, so that other strands and
+   * tasks get a turn */
+  sp->loop->dispatch([sp]() { run(sp); });
 }
 
 } // namespace wampcc
@@ -39,7 +39,8 @@ struct io_request
 
   logger& logptr;
   uv_tcp_t* tcp_handle = nullptr;
-  std::function<void()> user_fn;
+  task user_fn;
+  io_request* next = nullptr;
 
   io_request(request_type __type, logger& __logger)
     : type(__type), logptr(__logger)
@@ -48,12 +49,62 @@ struct io_request
 };
 
 
+/* Owner of a chain of requests, which deletes any not yet released. */
+struct io_request_list
+{
+  io_request* head;
+
+  explicit io_request_list(io_request* p = nullptr) : head(p) {}
+
+  ~io_request_list()
+  {
+    while (head) {
+      io_request* next = head->next;
+      delete head;
+      head = next;
+    }
+  }
+
+  /* Reverse the chain; the pending stack is taken most-recent first. */
+  void reverse()
+  {
+    io_request* prev = nullptr;
+    while (head) {
+      io_request* next = head->next;
+      head->next = prev;
+      prev = head;
+      head = next;
+    }
+    head = prev;
+  }
+
+  /* Append another chain, which must already be in order. */
+  void append(io_request* p)
+  {
+    io_request** tail = &head;
+    while (*tail)
+      tail = &(*tail)->next;
+    *tail = p;
+  }
+
+  std::unique_ptr<io_request> pop()
+  {
+    io_request* p = head;
+    head = p->next;
+    p->next = nullptr;
+    return std::unique_ptr<io_request>(p);
+  }
+};
+
+
 io_loop::io_loop(kernel& k, std::function<void()> io_started_cb)
   : m_kernel(k),
     __logger(k.get_logger()),
     m_uv_loop(new uv_loop_t()),
     m_async(new uv_async_t()),
-    m_pending_requests_state(state::open)
+    m_pending_requests_state(state::open),
+    m_pending_requests(nullptr),
+    m_pushers(0)
 {
   uv_loop_init(m_uv_loop);
   m_uv_loop->data = this;
@@ -108,6 +159,8 @@ void io_loop::sync_stop()
 
 io_loop::~io_loop()
 {
+  io_request_list unused(m_pending_requests.exchange(nullptr));
+
   uv_loop_close(m_uv_loop);
   delete m_uv_loop;
 }
@@ -116,16 +169,25 @@ io_loop::~io_loop()
 void io_loop::on_async()
 {
   /* IO thread */
-  std::vector<std::unique_ptr<io_request>> work;
+  io_request_list work(m_pending_requests.exchange(nullptr));
+  work.reverse();
 
-  {
-    std::lock_guard<std::mutex> guard(m_pending_requests_lock);
-    work.swap(m_pending_requests);
-    if (m_pending_requests_state == state::closing)
-      m_pending_requests_state = state::closed;
+  if (m_pending_requests_state == state::closing) {
+    m_pending_requests_state = state::closed;
+
+    /* Producers that observed the loop as open might not yet have completed
+     * their push; wait for them, and collect what they pushed. */
+    while (m_pushers != 0)
+      std::this_thread::yield();
+
+    io_request_list late(m_pending_requests.exchange(nullptr));
+    late.reverse();
+    work.append(late.head);
+    late.head = nullptr;
   }
 
-  for (auto& user_req : work) {
+  while (work.head) {
+    std::unique_ptr<io_request> user_req = work.pop();
     if (user_req->type == io_request::request_type::cancel_handle) {
       auto handle_to_cancel = (uv_handle_t*)user_req->tcp_handle;
       if (!uv_is_closing(handle_to_cancel))
@@ -183,6 +245,15 @@ bool io_loop::this_thread_is_io() const
 }
 
 
+uv_buf_t io_loop::read_buffer(size_t suggested_size)
+{
+  /* IO thread */
+  if (m_read_buffer.size() < suggested_size)
+    m_read_buffer.resize(suggested_size);
+  return uv_buf_init(m_read_buffer.data(), m_read_buffer.size());
+}
+
+
 void io_loop::run_loop()
 {
   while (true) {
@@ -211,23 +282,30 @@ void io_loop::cancel_connect(uv_tcp_t* handle)
 
 void io_loop::push_request(std::unique_ptr<io_request> r)
 {
-  {
-    std::lock_guard<std::mutex> guard(m_pending_requests_lock);
-
-    if (m_pending_requests_state == state::closed)
-      throw io_loop_closed();
+  m_pushers++;
+  scope_guard undo_pushers([this]() { m_pushers--; });
 
-    if (r->type == io_request::request_type::close_loop)
-      m_pending_requests_state = state::closing;
+  if (m_pending_requests_state == state::closed)
+    throw io_loop_closed();
 
-    m_pending_requests.push_back(std::move(r));
+  if (r->type == io_request::request_type::close_loop) {
+    int expected = state::open;
+    m_pending_requests_state.compare_exchange_strong(expected, state::closing);
   }
 
-  uv_async_send(m_async.get()); // wake-up IO thread
+  io_request* node = r.release();
+  io_request* head = m_pending_requests.load(std::memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!m_pending_requests.compare_exchange_weak(
+      head, node, std::memory_order_release, std::memory_order_relaxed));
+
+  if (head == nullptr)
+    uv_async_send(m_async.get()); // wake-up IO thread
 }
 
 
-void io_loop::push_fn(std::function<void()> fn)
+void io_loop::push_fn(task fn)
 {
   std::unique_ptr<io_request> r(
       new io_request(io_request::request_type::function, __logger));
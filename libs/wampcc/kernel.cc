@@ -15,6 +15,7 @@
 #include "config.h"
 
 #include <iostream>
+#include <algorithm>
 
 namespace wampcc
 {
@@ -35,7 +36,9 @@ static long default_socket_max_pending_write_bytes = 0x100000; // 1mb
 
 config::config()
   : socket_max_pending_write_bytes(default_socket_max_pending_write_bytes),
-    ssl(false)
+    ssl(false),
+    io_loop_count(1),
+    event_loop_thread_count(1)
 {
 }
 
@@ -43,28 +46,41 @@ config::config()
 /* Constructor */
 kernel::kernel(config conf, logger nlog)
   : m_config(conf),
-    __logger(nlog)
+    __logger(nlog),
+    m_next_io(0)
 {
   // SSL initialisation can fail, so we start the loops only after it has been
   // set up
   if (conf.ssl.enable)
     m_ssl.reset(new ssl_context(__logger, conf.ssl));
 
-  m_io_loop.reset(new io_loop(*this));
+  const size_t io_loop_count = std::max<size_t>(conf.io_loop_count, 1);
+  for (size_t i = 0; i < io_loop_count; i++)
+    m_io_loops.emplace_back(new io_loop(*this));
   m_evl.reset(new event_loop(this));
 }
 
 /* Destructor */
 kernel::~kernel()
 {
-  /* stop IO loop first, which will include closing all outstanding socket
+  /* stop IO loops first, which will include closing all outstanding socket
    * resources, and as that happens, events are pushed onto the event queue
    * which is still operational */
-  m_io_loop->sync_stop();
+  for (auto& loop : m_io_loops)
+    loop->sync_stop();
   m_evl->sync_stop();
 }
 
-io_loop* kernel::get_io() { return m_io_loop.get(); }
+io_loop* kernel::get_io() { return m_io_loops.front().get(); }
+
+io_loop* kernel::get_io(size_t i) { return m_io_loops.at(i).get(); }
+
+io_loop* kernel::next_io()
+{
+  if (m_io_loops.size() == 1)
+    return m_io_loops.front().get();
+  return m_io_loops[m_next_io++ % m_io_loops.size()].get();
+}
 
 event_loop* kernel::get_event_loop() { return m_evl.get(); }
 
@@ -14,12 +14,23 @@
 #include "wampcc/utils.h"
 #include "wampcc/websocket_protocol.h"
 
+#include <atomic>
+#include <limits>
 #include <stdexcept>
 
 #include <string.h>
 
 namespace wampcc {
 
+  /* Scratch space for arguments transcoded from another serialiser, before
+   * they are spliced into a message. */
+  static std::vector<char>& transcode_buffer()
+  {
+    static thread_local std::vector<char> buf;
+    return buf;
+  }
+
+
   class json_codec : public codec
   {
   public:
@@ -31,12 +42,42 @@ namespace wampcc {
 
     std::vector<char> encode(const json_array& src) override
     {
-      std::string s = wampcc::json_encode(src);
-      std::vector<char> retval(s.size());
-      memcpy(retval.data(), s.c_str(), s.size());
+      std::vector<char> retval;
+      wampcc::json_encode(src, retval);
       return retval;
     }
 
+    void encode_into(const json_array& src, output_sink& sink) override
+    {
+      /* as json_encode, without first copying the array into a json_value */
+      wampcc::json_encode_spliced(src, nullptr, 0, sink.bytes());
+    }
+
+    void encode_into(const json_array& head, const raw_args& args,
+                     output_sink& sink) override
+    {
+      if (args.serialiser == serialiser_type::json)
+        wampcc::json_encode_spliced(head, args.bytes.data(), args.bytes.size(),
+                                    sink.bytes());
+      else if (args.serialiser == serialiser_type::msgpack) {
+        std::vector<char>& text = transcode_buffer();
+        text.clear();
+        wampcc::msgpack_to_json_tail(args.bytes.data(), args.bytes.size(),
+                                     text);
+        wampcc::json_encode_spliced(head, text.data(), text.size(),
+                                    sink.bytes());
+      }
+      else
+        codec::encode_into(head, args, sink);
+    }
+
+    json_array_tail decode_head(json_array& dest, const char* ptr,
+                                size_t msglen,
+                                json_head_size_fn head_size) override
+    {
+      return wampcc::json_decode_head(dest, ptr, msglen, head_size);
+    }
+
     serialiser_type type() const override { return serialiser_type::json;}
     const char* name() const override { return "json"; }
   };
@@ -52,17 +93,149 @@ namespace wampcc {
 
     std::vector<char> encode(const json_array& src) override
     {
-      auto region = wampcc::json_msgpack_encode(src);
-      std::vector<char> retval(region->second);
-      memcpy(retval.data(), region->first, region->second);
+      std::vector<char> retval;
+      wampcc::json_msgpack_encode(src, retval);
       return retval;
     }
 
+    void encode_into(const json_array& src, output_sink& sink) override
+    {
+      /* as json_msgpack_encode, without first copying the array into a
+       * json_value */
+      wampcc::json_msgpack_encode_spliced(src, nullptr, 0, 0, sink.bytes());
+    }
+
+    void encode_into(const json_array& head, const raw_args& args,
+                     output_sink& sink) override
+    {
+      if (args.serialiser == serialiser_type::msgpack)
+        wampcc::json_msgpack_encode_spliced(head, args.bytes.data(),
+                                            args.bytes.size(), args.count,
+                                            sink.bytes());
+      else if (args.serialiser == serialiser_type::json) {
+        std::vector<char>& bytes = transcode_buffer();
+        bytes.clear();
+        wampcc::json_to_msgpack_tail(args.bytes.data(), args.bytes.size(),
+                                     bytes);
+        wampcc::json_msgpack_encode_spliced(head, bytes.data(), bytes.size(),
+                                            args.count, sink.bytes());
+      }
+      else
+        codec::encode_into(head, args, sink);
+    }
+
+    json_array_tail decode_head(json_array& dest, const char* ptr,
+                                size_t msglen,
+                                json_head_size_fn head_size) override
+    {
+      return wampcc::json_msgpack_decode_head(dest, ptr, msglen, head_size);
+    }
+
     serialiser_type type() const override { return serialiser_type::msgpack;}
     const char* name() const override { return "msgpack"; }
   };
 
 
+  void codec::encode_into(const json_array& src, output_sink& sink)
+  {
+    std::vector<char> bytes = encode(src);
+    sink.bytes().insert(sink.bytes().end(), bytes.begin(), bytes.end());
+  }
+
+
+  void codec::encode_into(const json_array& head, const raw_args& args,
+                          output_sink& sink)
+  {
+    if (args.empty()) {
+      encode_into(head, sink);
+      return;
+    }
+
+    wamp_args decoded;
+    decoded.raw = args;
+    decode_args(decoded);
+
+    json_array msg(head);
+    msg.push_back(std::move(decoded.args_list));
+    if (args.count > 1)
+      msg.push_back(std::move(decoded.args_dict));
+    encode_into(msg, sink);
+  }
+
+
+  json_array_tail codec::decode_head(json_array& dest, const char* ptr,
+                                     size_t msglen, json_head_size_fn)
+  {
+    json_value jv = decode(ptr, msglen);
+    dest = std::move(jv.as_array());
+    return {0, 0, 0, eNULL, eNULL};
+  }
+
+
+  std::shared_ptr<std::vector<char>> sink_pool::acquire()
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+      size_t pos = (m_next + i) % m_buffers.size();
+      auto& bytes = m_buffers[pos];
+      if (bytes.use_count() == 1) {
+        /* The last frame referring to the buffer may have been dropped on the
+         * IO thread; order its reads of the buffer before our reuse. */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        m_next = pos + 1;
+        if (bytes->capacity() > max_retained_capacity)
+          std::vector<char>().swap(*bytes);
+        else
+          bytes->clear();
+        return bytes;
+      }
+    }
+
+    auto bytes = std::make_shared<std::vector<char>>();
+    if (m_buffers.size() < max_buffers)
+      m_buffers.push_back(bytes);
+    return bytes;
+  }
+
+
+  size_t sink_pool::size() const
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_buffers.size();
+  }
+
+
+  output_sink::output_sink(size_t headroom, sink_pool* pool)
+    : m_bytes(pool ? pool->acquire()
+                   : std::make_shared<std::vector<char>>()),
+      m_headroom(headroom),
+      m_start(headroom)
+  {
+    m_bytes->resize(headroom);
+  }
+
+
+  char* output_sink::prepend(size_t len)
+  {
+    if (len > m_start)
+      throw std::runtime_error("output_sink headroom exceeded");
+    m_start -= len;
+    return m_bytes->data() + m_start;
+  }
+
+
+  shared_buffer output_sink::release()
+  {
+    shared_buffer frame(
+        std::shared_ptr<const char>(m_bytes, m_bytes->data() + m_start),
+        m_bytes->size() - m_start);
+    m_bytes.reset();
+    m_start = m_headroom = 0;
+    return frame;
+  }
+
+
   buffer::read_pointer::read_pointer(char * p, size_t avail)
     : m_ptr(p),
       m_avail(avail)
@@ -74,7 +247,8 @@ namespace wampcc {
                  size_t max_size)
     : m_mem(initial_size),
       m_max_size(max_size),
-      m_bytes_avail(0)
+      m_bytes_avail(0),
+      m_offset(0)
   {
   }
 
@@ -95,18 +269,34 @@ namespace wampcc {
 
   size_t buffer::consume(const char* src, size_t len)
   {
+    if (src == data() + m_bytes_avail) {
+      /* bytes were read directly into the free region */
+      size_t consume_len = (std::min)(tail_space(), len);
+      m_bytes_avail += consume_len;
+      return consume_len;
+    }
+
+    if (tail_space() < len) compact();
     if (space() < len) grow_by(len-space());
 
-    size_t consume_len = (std::min)(space(), len);
+    size_t consume_len = (std::min)(tail_space(), len);
     if (len && consume_len == 0)
       throw std::runtime_error("buffer full, cannot consume data");
 
-    memcpy(m_mem.data() + m_bytes_avail, src, consume_len);
+    memcpy(data() + m_bytes_avail, src, consume_len);
     m_bytes_avail += consume_len;
 
     return consume_len;
   }
 
+  std::pair<char*, size_t> buffer::prepare(size_t len)
+  {
+    if (tail_space() < len) compact();
+    if (space() < len) grow_by(len-space());
+
+    return {data() + m_bytes_avail, tail_space()};
+  }
+
   void buffer::grow_by(size_t len)
   {
     size_t grow_max  = m_max_size - m_mem.size();
@@ -115,11 +305,19 @@ namespace wampcc {
       m_mem.resize(m_mem.size() + grow_size);
   }
 
+  /* Move the unread data to the front of the buffer.  This is only needed when
+   * there is insufficient space after the data, rather than after every read. */
+  void buffer::compact()
+  {
+    if (m_offset && m_bytes_avail)
+      memmove(m_mem.data(), m_mem.data() + m_offset, m_bytes_avail);
+    m_offset = 0;
+  }
+
   void buffer::discard_read(read_pointer rd)
   {
     m_bytes_avail = rd.avail();
-    if (rd.ptr() != m_mem.data() && rd.avail())
-      memmove(m_mem.data(), rd.ptr(), rd.avail());
+    m_offset = m_bytes_avail ? (rd.ptr() - m_mem.data()) : 0;
   }
 
 
@@ -145,6 +343,7 @@ namespace wampcc {
     m_msg_processor(cb),
     m_callbacks(callbacks),
     m_buf(buf_initial_size, buf_max_size),
+    m_lazy_args(false),
     m_mode(_mode)
 {
 }
@@ -156,9 +355,106 @@ namespace wampcc {
 }
 
 
-std::vector<char> protocol::encode(const json_array& ja)
+const std::vector<shared_buffer>* outbound_message::find(
+    const char* protocol, serialiser_type serialiser) const
+{
+  for (auto& item : m_frames)
+    if (item.protocol == protocol && item.serialiser == serialiser)
+      return &item.bufs;
+  return nullptr;
+}
+
+
+const std::vector<shared_buffer>& outbound_message::store(
+    const char* protocol, serialiser_type serialiser,
+    std::vector<shared_buffer> bufs)
+{
+  m_frames.push_back({protocol, serialiser, std::move(bufs)});
+  return m_frames.back().bufs;
+}
+
+
+void protocol::encode_into(const json_array& ja, output_sink& sink)
+{
+  if (m_codec)
+    m_codec->encode_into(ja, sink);
+}
+
+
+void protocol::encode_into(const json_array& head, const raw_args& args,
+                           output_sink& sink)
 {
-  return m_codec?m_codec->encode(ja):std::vector<char>();
+  if (m_codec)
+    m_codec->encode_into(head, args, sink);
+}
+
+
+void decode_args(wamp_args& args)
+{
+  if (args.raw.empty())
+    return;
+
+  const raw_args& raw = args.raw;
+  json_value jv;
+
+  /* wrap the elements in an array, which is then decoded as normal */
+  switch (raw.serialiser) {
+    case serialiser_type::json: {
+      std::vector<char> text;
+      text.reserve(raw.bytes.size() + 2);
+      text.push_back('[');
+      text.insert(text.end(), raw.bytes.data(),
+                  raw.bytes.data() + raw.bytes.size());
+      text.push_back(']');
+      json_decode(jv, text.data(), text.size());
+      break;
+    }
+    case serialiser_type::msgpack: {
+      std::vector<char> bytes;
+      bytes.reserve(raw.bytes.size() + 1);
+      bytes.push_back(static_cast<char>(0x90 | raw.count)); /* fixarray */
+      bytes.insert(bytes.end(), raw.bytes.data(),
+                   raw.bytes.data() + raw.bytes.size());
+      json_msgpack_decode(jv, bytes.data(), bytes.size());
+      break;
+    }
+    case serialiser_type::none:
+      throw std::runtime_error("raw arguments have no serialiser");
+  }
+
+  json_array& elements = jv.as_array();
+  args.args_list = std::move(elements.at(0).as_array());
+  if (elements.size() > 1)
+    args.args_dict = std::move(elements[1].as_object());
+  args.raw = raw_args();
+}
+
+
+/* Number of elements ahead of the args_list, for messages whose arguments are
+ * forwarded by a router; other messages are decoded in full. */
+static size_t lazy_head_size(const json_value& msg_type)
+{
+  if (msg_type.is_uint())
+    switch (msg_type.as_uint()) {
+      case msg_type::wamp_msg_call: return 4;
+      case msg_type::wamp_msg_yield: return 3;
+      case msg_type::wamp_msg_publish: return 4;
+      case msg_type::wamp_msg_error: return 5;
+    }
+  return std::numeric_limits<size_t>::max();
+}
+
+
+static size_t whole_message(const json_value&)
+{
+  return std::numeric_limits<size_t>::max();
+}
+
+
+std::pair<char*, size_t> protocol::io_alloc_buffer(size_t suggested_size)
+{
+  /* IO thread */
+  return m_buf.prepare(suggested_size);
 }
 
 
@@ -167,11 +463,30 @@ void protocol::decode(const char* ptr, size_t len)
   /* IO thread */
   try
   {
-    json_value jv = m_codec->decode(ptr, len);
-
-    LOG_TRACE("fd: " << fd() << ", json_rx: " << jv);
-
-    json_array& msg = jv.as_array();
+    json_array msg;
+    raw_args args;
+
+    /* decode over an earlier message, to reuse its storage */
+    if (m_callbacks.spare_message)
+      m_callbacks.spare_message(msg);
+
+    if (m_lazy_args) {
+      json_array_tail tail =
+          m_codec->decode_head(msg, ptr, len, lazy_head_size);
+      if (tail.count) {
+        /* check the arguments have the types that peers will expect */
+        if (tail.count > 2 || tail.first_type != eARRAY ||
+            (tail.count == 2 && tail.last_type != eOBJECT))
+          throw protocol_error("arguments must be array and object");
+        args.serialiser = m_codec->type();
+        args.count = tail.count;
+        args.bytes = shared_buffer::copy(ptr + tail.offset, tail.length);
+      }
+    } else
+      m_codec->decode_head(msg, ptr, len, whole_message);
+
+    LOG_TRACE("fd: " << fd() << ", json_rx: " << msg
+              << (args.empty() ? "" : " + raw args"));
 
     if (msg.size() == 0)
       throw protocol_error("json array empty");
@@ -179,7 +494,8 @@ void protocol::decode(const char* ptr, size_t len)
     if (!msg[0].is_uint())
       throw protocol_error("message type must be uint");
 
-    m_msg_processor(msg, msg[0].as_uint());
+    json_uint_t msg_type = msg[0].as_uint();
+    m_msg_processor(std::move(msg), msg_type, std::move(args));
   }
   catch( const json_error& e)
   {
@@ -216,6 +532,7 @@ void selector_protocol::io_on_read(char* src, size_t len)
 
       rawsocket_protocol::options default_opts;
       default_opts.serialisers = m_opts.serialisers;
+      default_opts.lazy_args = m_opts.lazy_args;
       std::unique_ptr<protocol> up (
         new rawsocket_protocol(m_kernel,
                                m_socket,
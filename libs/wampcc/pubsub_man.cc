@@ -12,99 +12,197 @@
 #include "wampcc/log_macros.h"
 #include "wampcc/wamp_session.h"
 #include "wampcc/kernel.h"
+#include "wampcc/uri_trie.h"
 
 #include <list>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace wampcc {
 
-static bool session_equals(const session_handle& p1, const session_handle& p2)
+/* Check a pattern of a pattern-based subscription, which is a URI that may
+ * have empty components, and for prefix matching, a partial last component. */
+static bool is_pattern_uri(const std::string& s)
 {
-  return ( !p1.owner_before(p2) && !p2.owner_before(p1) );
+  if (s.empty())
+    return false;
+
+  for (char c : s)
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '_' || c == '.'))
+      return false;
+  return true;
 }
 
 /*
 Thread safety.
 
-There is a global lock on the pubsub_man instance, m_lock.
-
-This is needed because of possible interaction between the WAMPCC EV thread
-(which conveys actions from remote subscribers and publishers), and from any
-user thread that calls the public publish() method.
+The pubsub_man is accessed from the WAMPCC EV threads (which convey actions
+from remote subscribers and publishers), and from any user thread that calls
+the public publish() method.  When the event loop runs several threads,
+different sessions are processed concurrently.  So that activity on one topic
+does not hold up others, locking is split into levels:
+
+  m_lock                 the realm map, subscription index & topics of each
+                         session, only for lookup
+  realm_topics::lock     the topic map of one realm, only for lookup
+  managed_topic update   serialises the updates to a topic, so that all its
+                         subscribers see the same sequence of events; held
+                         while an update is applied and sent, and while a new
+                         subscriber is sent the initial snapshot
+  managed_topic subscribers
+                         serialises changes to the subscriber list; the send
+                         loop holds a reference to the list, which is then
+                         copied rather than changed, and iterates over it
+                         without holding this lock
+
+Where locks are nested they are taken in the order: update, realm_topics::lock,
+subscribers, m_lock.  Topics are never removed, so a managed_topic pointer
+remains valid once the lookup lock is released.
 */
 
 class managed_topic
 {
 public:
+  struct subscriber
+  {
+    t_session_id id;
+    std::weak_ptr<wamp_session> session;
+  };
+  typedef std::vector<subscriber> subscriber_list;
 
   managed_topic(t_subscription_id __subscription_id)
-  :  m_subscription_id(__subscription_id),
+  :  m_subscribers(std::make_shared<subscriber_list>()),
+     m_subscription_id(__subscription_id),
      m_is_valid(false)
   {
   }
 
   t_subscription_id subscription_id() const { return m_subscription_id; }
 
+  /** Held while an update is applied and sent to the subscribers */
+  std::mutex& update_lock() { return m_update_lock; }
 
   uint64_t next_publication_id() { return m_id_gen.next(); }
 
 
-  /** Add a subscriber to this topic. */
-  void add(std::weak_ptr<wamp_session> wp)
+  /** Add a subscriber to this topic.  Returns false if the session was
+   * already subscribed. */
+  bool add(t_session_id id, std::weak_ptr<wamp_session> wp)
   {
-    auto it = std::find_if(std::begin(m_subscribers),
-                           std::end(m_subscribers),
-                           [wp](std::weak_ptr<wamp_session>& rhs)
-                           {
-                             return session_equals(wp,rhs);
-                           });
+    std::lock_guard<std::mutex> guard(m_subscribers_lock);
 
     /* In WAMP it is not an error for a session to subscribe multiple times. So
      * we dont throw an exception here if the session is already subscribed. */
-    if (it == std::end(m_subscribers))
-      m_subscribers.push_back(wp);
+    if (m_positions.find(id) != m_positions.end())
+      return false;
+
+    subscriber_list& list = writable_subscribers();
+    m_positions[id] = list.size();
+    list.push_back({id, std::move(wp)});
+    return true;
   }
 
 
   /** Remove a subscriber from this topic. */
-  void remove(std::weak_ptr<wamp_session> wp)
+  void remove(t_session_id id)
   {
-    auto it = std::find_if(std::begin(m_subscribers),
-                           std::end(m_subscribers),
-                           [wp](std::weak_ptr<wamp_session>& rhs)
-                           {
-                             return session_equals(wp,rhs);
-                           });
+    std::lock_guard<std::mutex> guard(m_subscribers_lock);
 
     /* In WAMP it is not an error for a session to subscribe multiple times. So
      * we dont throw an exception here if the session is not found. */
-    if (it != std::end(m_subscribers))
-      m_subscribers.erase(it);
+    auto it = m_positions.find(id);
+    if (it == m_positions.end())
+      return;
+
+    size_t pos = it->second;
+    m_positions.erase(it);
+    erase_at(writable_subscribers(), pos);
+  }
+
+
+  /** Remove the subscribers whose sessions have been destroyed.  Sessions are
+   * normally removed when closed, so this is only to tidy up after a session
+   * destroyed before its closure was reported. */
+  void remove_expired()
+  {
+    std::lock_guard<std::mutex> guard(m_subscribers_lock);
+
+    subscriber_list* list = nullptr;
+    for (size_t pos = 0; pos < m_subscribers->size();) {
+      if ((*m_subscribers)[pos].session.expired()) {
+        if (!list)
+          list = &writable_subscribers();
+        m_positions.erase((*list)[pos].id);
+        erase_at(*list, pos);
+      }
+      else
+        ++pos;
+    }
   }
 
   /** Indicate whether an image exists for this topic.  This will be false until
    * the first update arrives from the topic publisher. */
   bool is_valid() const { return m_is_valid;}
 
+  /** The image is kept shared, so copying it into a snapshot is cheap. */
   const json_value& image() const { return m_image; }
 
   /** Accept a json-model update sent by a topic publisher.  This is represented
-   * as a json patch, which is applied to the image. */
+   * as a json patch, which is applied to the image.  Patching detaches only
+   * the parts of the image along the patched paths, so snapshots already taken
+   * are unaffected. */
   void update_image(const json_array& patchset)
   {
     m_image.patch(patchset);
+    m_image.share();
 
     // only set as valid once a patch has successfully been applied.
     m_is_valid = true;
   }
 
-  std::vector< std::weak_ptr<wamp_session> > &  subscribers()  {return m_subscribers;}
-  const std::vector< std::weak_ptr<wamp_session> > &  subscribers() const {return m_subscribers;}
+  /** Current snapshot of the subscribers, which is not modified while the
+   * caller holds it, so can be iterated over without a lock held. */
+  std::shared_ptr<const subscriber_list> subscribers()
+  {
+    std::lock_guard<std::mutex> guard(m_subscribers_lock);
+    return m_subscribers;
+  }
 
 private:
 
-  std::vector< std::weak_ptr<wamp_session> > m_subscribers;
+  /* The subscriber list, for modification under m_subscribers_lock.  The
+   * list is updated in place, unless a snapshot of it is still held by a
+   * publication in progress, in which case that publication keeps the old
+   * list and the topic moves to a copy. */
+  subscriber_list& writable_subscribers()
+  {
+    if (m_subscribers.use_count() > 1)
+      m_subscribers = std::make_shared<subscriber_list>(*m_subscribers);
+    else
+      /* pairs with the release of the last snapshot by the send loop */
+      std::atomic_thread_fence(std::memory_order_acquire);
+    return *m_subscribers;
+  }
+
+  /* Remove the entry at 'pos' by moving the last entry into its place */
+  void erase_at(subscriber_list& list, size_t pos)
+  {
+    if (pos + 1 != list.size()) {
+      list[pos] = std::move(list.back());
+      m_positions[list[pos].id] = pos;
+    }
+    list.pop_back();
+  }
+
+  std::mutex m_update_lock;
+
+  std::mutex m_subscribers_lock;
+  std::shared_ptr<subscriber_list> m_subscribers;
+  std::unordered_map<t_session_id, size_t> m_positions; // in m_subscribers
 
   // current upto date image of the value
   json_value m_image;
@@ -122,6 +220,19 @@ private:
 };
 
 
+/* The topics of one realm */
+struct realm_topics
+{
+  std::mutex lock;
+  std::map<std::string, std::unique_ptr<managed_topic>> topics;
+
+  // pattern-based subscriptions, each a topic of its own, by pattern
+  std::map<std::string, std::unique_ptr<managed_topic>> prefix_topics;
+  std::map<std::string, std::unique_ptr<managed_topic>> wildcard_topics;
+  uri_trie<managed_topic> patterns;
+};
+
+
 /* Constructor */
 pubsub_man::pubsub_man(kernel* k)
   : __logger(k->get_logger()),
@@ -137,109 +248,189 @@ pubsub_man::~pubsub_man()
 }
 
 
-managed_topic* pubsub_man::find_topic(const std::string& topic,
-                                      const std::string& realm,
-                                      bool allow_create)
+realm_topics* pubsub_man::find_realm(const std::string& realm,
+                                     bool allow_create)
 {
-  // first find the realm
+  std::lock_guard<std::mutex> guard(m_lock);
+
   auto realm_iter = m_topics.find( realm );
   if (realm_iter == m_topics.end())
   {
     if (allow_create)
     {
-      auto result = m_topics.insert(std::make_pair(realm, topic_registry()));
+      std::unique_ptr<realm_topics> ptr(new realm_topics());
+      auto result = m_topics.insert(std::make_pair(realm, std::move(ptr)));
       realm_iter = result.first;
     }
     else
       return nullptr;
   }
 
-  // now find the topic
-  auto topic_iter = realm_iter->second.find( topic );
-  if (topic_iter ==  realm_iter->second.end())
+  return realm_iter->second.get();
+}
+
+
+managed_topic* pubsub_man::create_topic(
+    std::map<std::string, std::unique_ptr<managed_topic>>& topics,
+    const std::string& uri)
+{
+  std::unique_ptr<managed_topic> ptr(new managed_topic(m_next_subscription_id++));
   {
-    if (allow_create)
-    {
-      std::unique_ptr<managed_topic> ptr(new managed_topic(m_next_subscription_id++));
-      m_subscription_registry[ptr->subscription_id()] = ptr.get();
-      auto result = realm_iter->second.insert(std::make_pair(topic, std::move(ptr)));
-      topic_iter = result.first;
-    }
-    else return nullptr;
+    std::lock_guard<std::mutex> registry_guard(m_lock);
+    m_subscription_registry[ptr->subscription_id()] = ptr.get();
   }
+  auto result = topics.insert(std::make_pair(uri, std::move(ptr)));
+  return result.first->second.get();
+}
+
+
+/* Find a topic, and optionally also the pattern-based subscriptions which
+ * match it */
+managed_topic* pubsub_man::find_topic(const std::string& topic,
+                                      const std::string& realm,
+                                      bool allow_create,
+                                      std::vector<managed_topic*>* patterns)
+{
+  // first find the realm
+  realm_topics* rt = find_realm(realm, allow_create);
+  if (!rt)
+    return nullptr;
+
+  // now find the topic
+  std::lock_guard<std::mutex> guard(rt->lock);
+  managed_topic* mt = nullptr;
+  auto topic_iter = rt->topics.find( topic );
+  if (topic_iter !=  rt->topics.end())
+    mt = topic_iter->second.get();
+  else if (allow_create)
+    mt = create_topic(rt->topics, topic);
+  else
+    return nullptr;
+
+  if (patterns)
+    rt->patterns.match(topic, [patterns](managed_topic* p) {
+      patterns->push_back(p);
+    });
 
-  return topic_iter->second.get();
+  return mt;
 }
 
 
-t_publication_id pubsub_man::update_topic(const std::string& topic,
-                                          const std::string& realm,
-                                          json_object options,
-                                          wamp_args args)
+managed_topic* pubsub_man::find_pattern_topic(const std::string& pattern,
+                                              const std::string& realm,
+                                              bool wildcard)
 {
-  managed_topic* mt = find_topic(topic, realm, true);
+  realm_topics* rt = find_realm(realm, true);
 
-  if (!mt)
-  {
-    LOG_WARN("Discarding update to non existing topic '" << topic << "'");
-    throw wamp_error(WAMP_RUNTIME_ERROR);
-  }
+  std::lock_guard<std::mutex> guard(rt->lock);
+  auto& topics = wildcard ? rt->wildcard_topics : rt->prefix_topics;
+  auto topic_iter = topics.find(pattern);
+  if (topic_iter != topics.end())
+    return topic_iter->second.get();
 
-  if (options.find(KEY_PATCH) != options.end())
-  {
-    // apply the patch
-    //std::cout << "@" << topic << ", patch\n";
-    //std::cout << "BEFORE: " << mt->image << "\n";
-    //std::cout << "PATCH : " << args.args_list << "\n";
-    mt->update_image(args.args_list[0].as_array());
-    //std::cout << "AFTER : "  << mt->image << "\n";
-    //std::cout << "-------\n";
-  }
+  managed_topic* mt = create_topic(topics, pattern);
+  if (wildcard)
+    rt->patterns.insert_wildcard(pattern, mt);
+  else
+    rt->patterns.insert_prefix(pattern, mt);
+  return mt;
+}
+
+
+/*
+  Broadcast to multiple subscribers.  Instead of using the event() method on
+  each wamp_session, we prepare the message once, and send the same to each
+  subscriber.  The outbound_message retains the serialised and framed bytes,
+  so the message is encoded once per protocol and serialiser in use, rather
+  than once per subscriber.  Arguments still in their received serialised
+  form are spliced into the EVENT without being decoded.
+*/
+void pubsub_man::send_event(managed_topic* mt, t_publication_id publication_id,
+                            json_object details, wamp_args args)
+{
+  auto subscribers = mt->subscribers();
+  if (subscribers->empty())
+    return;
 
-  /*
-    Broadcast to multiple subscribers.  Instead of using the event() method on
-    each wamp_session, we preform that the message and same the same to each
-    subscriber.
-   */
-  auto publication_id = mt->next_publication_id();
   json_array msg;
   msg.reserve(6);
   msg.push_back( msg_type::wamp_msg_event );
   msg.push_back( mt->subscription_id() );
   msg.push_back( publication_id );
-  msg.push_back( std::move(options) );
+  msg.push_back( std::move(details) );
 
-  if (!args.args_list.empty() || !args.args_dict.empty())
+  if (args.raw.empty() &&
+      (!args.args_list.empty() || !args.args_dict.empty()))
   {
-    msg.push_back(args.args_list);
+    msg.push_back(std::move(args.args_list));
     if (!args.args_dict.empty())
-      msg.push_back(args.args_dict);
+      msg.push_back(std::move(args.args_dict));
   }
 
+  outbound_message event(std::move(msg), std::move(args.raw));
+
   size_t num_active = 0;
-  for (auto & item : mt->subscribers())
+  for (auto & item : *subscribers)
   {
-    if (auto sp = item.lock())
+    if (auto sp = item.session.lock())
     {
-      sp->send_msg(msg);
+      sp->send_msg(event);
       num_active++;
     }
   }
 
-  // remove any expired sessions
+  // remove any expired sessions, having released the snapshot so that the
+  // list can be changed in place
+  if (num_active != subscribers->size()) {
+    subscribers.reset();
+    mt->remove_expired();
+  }
+}
+
+
+t_publication_id pubsub_man::update_topic(managed_topic* mt,
+                                          const std::string& topic,
+                                          const std::vector<managed_topic*>& patterns,
+                                          json_object options,
+                                          wamp_args args)
+{
+  std::lock_guard<std::mutex> guard(mt->update_lock());
 
-  if (num_active != mt->subscribers().size())
+  if (options.find(KEY_PATCH) != options.end())
   {
-    std::vector< std::weak_ptr<wamp_session> > temp;
-    temp.resize(num_active);
-    for (auto item : mt->subscribers())
-    {
-      if (!item.expired())
-        temp.push_back( std::move(item) );
-    }
-    mt->subscribers().swap( temp );
+    decode_args(args);
+
+    // apply the patch
+    //std::cout << "@" << topic << ", patch\n";
+    //std::cout << "BEFORE: " << mt->image << "\n";
+    //std::cout << "PATCH : " << args.args_list << "\n";
+    mt->update_image(args.args_list[0].as_array());
+    //std::cout << "AFTER : "  << mt->image << "\n";
+    //std::cout << "-------\n";
+  }
+
+  auto publication_id = mt->next_publication_id();
+
+  if (patterns.empty()) {
+    send_event(mt, publication_id, std::move(options), std::move(args));
+    return publication_id;
   }
 
+  /* Each matching pattern-based subscription has its own subscription ID, so
+   * is sent its own EVENT, with the topic added to the details.  The topic's
+   * update lock is held throughout, so these subscribers also see the events
+   * of each topic in order. */
+  json_object pattern_details = options;
+  pattern_details["topic"] = topic;
+
+  send_event(mt, publication_id, std::move(options), args);
+  for (size_t i = 0; i < patterns.size(); i++)
+    if (i + 1 < patterns.size())
+      send_event(patterns[i], publication_id, pattern_details, args);
+    else
+      send_event(patterns[i], publication_id, std::move(pattern_details),
+                 std::move(args));
+
   return publication_id;
 }
 
@@ -265,8 +456,16 @@ t_publication_id pubsub_man::publish(std::string realm,
   if (is_strict_uri(topic.c_str()) == false)
     throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
 
-  std::lock_guard<std::mutex> guard(m_lock);
-  return update_topic(topic, realm, std::move(options), args);
+  std::vector<managed_topic*> patterns;
+  managed_topic* mt = find_topic(topic, realm, true, &patterns);
+
+  if (!mt)
+  {
+    LOG_WARN("Discarding update to non existing topic '" << topic << "'");
+    throw wamp_error(WAMP_RUNTIME_ERROR);
+  }
+
+  return update_topic(mt, topic, patterns, std::move(options), std::move(args));
 }
 
 
@@ -274,19 +473,23 @@ json_array pubsub_man::get_topics(const std::string& realm) const
 {
   /* ANY thread */
 
-  std::lock_guard<std::mutex> guard(m_lock);
-
-  auto realm_iter = m_topics.find(realm);
+  realm_topics* rt = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto realm_iter = m_topics.find(realm);
+    if (realm_iter != m_topics.end())
+      rt = realm_iter->second.get();
+  }
 
   wampcc::json_array uris;
 
   // Note that it's not an error if the realm is not found in the map; that just
   // means no topics have yet been registered.
 
-  if (realm_iter != m_topics.end()) {
-    const topic_registry& reg = realm_iter->second;
-    uris.reserve(reg.size());
-    for (auto & item : reg)
+  if (rt) {
+    std::lock_guard<std::mutex> guard(rt->lock);
+    uris.reserve(rt->topics.size());
+    for (auto & item : rt->topics)
       uris.push_back(item.first);
   }
 
@@ -295,8 +498,8 @@ json_array pubsub_man::get_topics(const std::string& realm) const
 
 
 /* Add a subscription to a managed topic.  Need to sync the addition of the
-  subscriber, with the series of images and updates it sees. This is done via
-  single threaded access to this class.
+  subscriber, with the series of images and updates it sees. This is done by
+  holding the topic's update lock.
  */
 uint64_t pubsub_man::subscribe(wamp_session* sptr,
                                t_request_id request_id,
@@ -308,18 +511,38 @@ uint64_t pubsub_man::subscribe(wamp_session* sptr,
   if (topic.empty())
     throw wamp_error(WAMP_ERROR_INVALID_URI, "topic has zero length");
 
-  if (is_strict_uri(topic.c_str()) == false)
-    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
+  /* pattern-based subscription, from the WAMP advanced profile */
+  std::string match = "exact";
+  auto match_iter = options.find("match");
+  if (match_iter != options.end() && match_iter->second.is_string())
+    match = match_iter->second.as_string();
 
-  std::lock_guard<std::mutex> guard(m_lock);
+  managed_topic* mt = nullptr;
+  if (match == "exact")
+  {
+    if (is_strict_uri(topic.c_str()) == false)
+      throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
+
+    // find or create a topic
+    mt = find_topic(topic, sptr->realm(), true);
+  }
+  else if (match == "prefix" || match == "wildcard")
+  {
+    if (is_pattern_uri(topic) == false)
+      throw wamp_error(WAMP_ERROR_INVALID_URI, "topic pattern fails check");
 
-  // find or create a topic
-  managed_topic* mt = find_topic(topic, sptr->realm(), true);
+    mt = find_pattern_topic(topic, sptr->realm(), match == "wildcard");
+  }
+  else
+    throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "unknown match policy");
 
   if (!mt)
     throw wamp_error(WAMP_ERROR_INVALID_URI);
 
-  LOG_INFO("session #" << sptr->unique_id() << " subscribed to '"<< topic << "'");
+  std::lock_guard<std::mutex> guard(mt->update_lock());
+
+  LOG_INFO("session #" << sptr->unique_id() << " subscribed to '"<< topic << "'"
+           << (match == "exact" ? "" : ", match " + match));
 
   json_array msg({msg_type::wamp_msg_subscribed, request_id,mt->subscription_id()});
   sptr->send_msg(msg);
@@ -348,11 +571,14 @@ uint64_t pubsub_man::subscribe(wamp_session* sptr,
     snapshot_msg.push_back( mt->subscription_id() );
     snapshot_msg.push_back( 0 ); // publication id
     snapshot_msg.push_back( std::move(event_options) );
-    snapshot_msg.push_back( pub_args.args_list );
+    snapshot_msg.push_back( std::move(pub_args.args_list) );
     sptr->send_msg(snapshot_msg);
   }
 
-  mt->add(sptr->handle());
+  if (mt->add(sptr->unique_id(), sptr->handle())) {
+    std::lock_guard<std::mutex> registry_guard(m_lock);
+    m_session_topics[sptr->unique_id()].insert(mt);
+  }
 
   return mt->subscription_id();
 }
@@ -364,13 +590,25 @@ void pubsub_man::unsubscribe(wamp_session* sptr,
 {
   /* ANY thread */
 
-  std::lock_guard<std::mutex> guard(m_lock);
-
-  auto it = m_subscription_registry.find(sub_id);
+  managed_topic* mt = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto it = m_subscription_registry.find(sub_id);
+    if (it != m_subscription_registry.end()) {
+      mt = it->second;
+
+      auto session_iter = m_session_topics.find(sptr->unique_id());
+      if (session_iter != m_session_topics.end()) {
+        session_iter->second.erase(mt);
+        if (session_iter->second.empty())
+          m_session_topics.erase(session_iter);
+      }
+    }
+  }
 
-  if (it != m_subscription_registry.end())
+  if (mt)
   {
-    it->second->remove(sptr->handle());
+    mt->remove(sptr->unique_id());
 
     json_array msg({msg_type::wamp_msg_unsubscribed, request_id });
     sptr->send_msg(msg);
@@ -382,26 +620,22 @@ void pubsub_man::unsubscribe(wamp_session* sptr,
 }
 
 
-void pubsub_man::session_closed(session_handle /*sh*/)
+void pubsub_man::session_closed(std::shared_ptr<wamp_session>& session)
 {
   /* EV loop */
 
-  // // design of this can be improved, ie, we should track what topics a session
-  // // has subscribed too, rather than searching every topic.
-  // for (auto & realm_iter : m_topics)
-  //   for (auto & item : realm_iter.second)
-  //   {
-
-  //     for (auto it = item.second->m_subscribers.begin();
-  //          it != item.second->m_subscribers.end(); it++)
-  //     {
-  //       if (compare_session( *it, sh))
-  //       {
-  //         item.second->m_subscribers.erase( it );
-  //         break;
-  //       }
-  //     }
-  //   }
+  std::unordered_set<managed_topic*> topics;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto session_iter = m_session_topics.find(session->unique_id());
+    if (session_iter == m_session_topics.end())
+      return;
+    topics.swap(session_iter->second);
+    m_session_topics.erase(session_iter);
+  }
+
+  for (auto mt : topics)
+    mt->remove(session->unique_id());
 }
 
 } // namespace wampcc
@@ -14,6 +14,8 @@
 
 #include <sstream>
 
+#include <string.h>
+
 namespace wampcc {
 
 template<int N>
@@ -61,6 +63,7 @@ rawsocket_protocol::rawsocket_protocol(kernel* k,
     m_peer_max_msg_size(0),
     m_last_pong(std::chrono::system_clock::now())
 {
+  m_lazy_args = m_options.lazy_args;
   m_buf.update_max_size(m_self_max_msg_size);
 
   if (__mode == connect_mode::active && __options.ping_interval.count() > 0)
@@ -250,18 +253,40 @@ void rawsocket_protocol::send_msg(const json_array& ja)
 
   LOG_TRACE("fd: " << fd() << ", json_tx: " << ja);
 
-  auto bytes = encode(ja);
+  shared_buffer frame = encode_frame(ja);
+  m_socket->write(&frame, 1);
+}
+
+
+void rawsocket_protocol::send_shared_msg(outbound_message& msg)
+{
+  if (!have_codec())
+    return;
 
-  std::pair<const char*, size_t> bufs[2];
+  LOG_TRACE("fd: " << fd() << ", json_tx: " << msg.msg());
 
-  uint32_t msglen = htonl(bytes.size());
-  bufs[0].first  = (char*)&msglen;
-  bufs[0].second = sizeof(msglen);
+  auto bufs = msg.find(NAME, m_codec->type());
+  if (!bufs) {
+    std::vector<shared_buffer> framed{encode_frame(msg.msg(), msg.args())};
+    bufs = &msg.store(NAME, m_codec->type(), std::move(framed));
+  }
+
+  m_socket->write(bufs->data(), bufs->size());
+}
+
+
+/* Encode a message directly after space reserved for the length prefix, which
+ * is then filled in, so that the frame is a single buffer. */
+shared_buffer rawsocket_protocol::encode_frame(const json_array& ja,
+                                               const raw_args& args)
+{
+  output_sink sink(FRAME_PREFIX_SIZE, &m_sink_pool);
+  encode_into(ja, args, sink);
 
-  bufs[1].first  = bytes.data();
-  bufs[1].second = bytes.size();
+  uint32_t msglen = htonl(sink.payload_size());
+  memcpy(sink.prepend(FRAME_PREFIX_SIZE), &msglen, FRAME_PREFIX_SIZE);
 
-  m_socket->write(bufs, 2);
+  return sink.release();
 }
 
 
@@ -12,28 +12,248 @@
 #include "wampcc/log_macros.h"
 #include "wampcc/wamp_session.h"
 
+#include <algorithm>
 #include <memory>
+#include <random>
+#include <thread>
+#include <vector>
 
 namespace wampcc {
 
+/* Initial number of buckets in the registry table */
+static const size_t initial_buckets = 64;
+
+
+/* Counts a reader of the registry table for its lifetime, so that nodes it
+ * might see are not deleted under it. */
+class rpc_man::read_guard
+{
+public:
+  explicit read_guard(const rpc_man& rm)
+    : m_count(rm.m_readers[rm.m_epoch.load() & 1]) {
+    m_count++;
+  }
+
+  ~read_guard() { m_count--; }
+
+private:
+  std::atomic<unsigned>& m_count;
+};
+
+
 /* Constructor */
 rpc_man::rpc_man(kernel* k, rpc_added_cb added_cb, rpc_removed_cb removed_cb)
-  : __logger(k->get_logger()), m_rpc_added_cb(added_cb), m_rpc_removed_cb(removed_cb), m_next_regid(1) {}
+  : __logger(k->get_logger()), m_rpc_added_cb(added_cb), m_rpc_removed_cb(removed_cb), m_next_regid(1),
+    m_table(new registry_table(initial_buckets)),
+    m_epoch(0) {
+  m_readers[0] = 0;
+  m_readers[1] = 0;
+}
 
-rpc_details rpc_man::get_rpc_details(const std::string& rpcname,
-                                     const std::string& realm) {
-  std::lock_guard<std::mutex> guard(m_rpc_map_lock);
 
-  auto realm_iter = m_realm_registry.find(realm);
+/* Destructor */
+rpc_man::~rpc_man() {
+  reclaim();
+
+  registry_table* table = m_table.load();
+  for (auto& bucket : table->buckets)
+    for (registry_node* node = bucket.load(); node;) {
+      registry_node* next = node->next.load();
+      delete node;
+      node = next;
+    }
+  delete table;
+}
+
+
+std::shared_ptr<const rpc_details> rpc_man::get_rpc_details(
+    const std::string& rpcname, const std::string& realm,
+    std::shared_ptr<void>* pending) const {
+  read_guard guard(*this);
+
+  const registry_node* node = find_node(*m_table.load(), realm, rpcname);
+  if (!node)
+    return nullptr; // procedure not found
+
+  const procedure& proc = *node->proc;
+  const std::shared_ptr<const callee>& selected = select_callee(proc);
+
+  if (pending && proc.invoke == invoke_policy::least_outstanding) {
+    std::shared_ptr<const callee> c = selected;
+    c->outstanding++;
+    *pending = std::shared_ptr<void>(nullptr, [c](void*) { c->outstanding--; });
+  }
+
+  return selected->rpc;
+}
+
+
+const std::shared_ptr<const rpc_man::callee>& rpc_man::select_callee(
+    const procedure& proc) {
+  const auto& callees = proc.callees;
+  const size_t n = callees.size();
+
+  switch (proc.invoke) {
+    case invoke_policy::single:
+    case invoke_policy::first:
+      return callees.front();
+    case invoke_policy::last:
+      return callees.back();
+    case invoke_policy::roundrobin:
+      return callees[(*proc.next)++ % n];
+    case invoke_policy::random: {
+      static thread_local std::minstd_rand engine(std::random_device{}());
+      return callees[std::uniform_int_distribution<size_t>(0, n - 1)(engine)];
+    }
+    case invoke_policy::least_outstanding: {
+      /* start the search at successive callees, so that ties, such as when
+       * all are idle, are broken in turn */
+      size_t start = (*proc.next)++;
+      size_t best = start % n;
+      for (size_t i = 1; i < n; i++) {
+        size_t j = (start + i) % n;
+        if (callees[j]->outstanding < callees[best]->outstanding)
+          best = j;
+      }
+      return callees[best];
+    }
+  }
+
+  return callees.front();
+}
+
+
+size_t rpc_man::hash_of(const std::string& realm, const std::string& uri) {
+  std::hash<std::string> hasher;
+  return hasher(uri) ^ (hasher(realm) * 31);
+}
+
+
+const rpc_man::registry_node* rpc_man::find_node(const registry_table& table,
+                                                 const std::string& realm,
+                                                 const std::string& uri) const {
+  size_t hash = hash_of(realm, uri);
+  const auto& bucket = table.buckets[hash & (table.buckets.size() - 1)];
+  for (const registry_node* node = bucket.load(); node; node = node->next.load())
+    if (node->hash == hash && node->uri == uri && node->realm == realm)
+      return node;
+  return nullptr;
+}
+
 
-  if (realm_iter == m_realm_registry.end())
-    return rpc_details(); // realm not found
+/* Set the procedure of a URI, replacing any node already holding it.  Caller
+ * must hold m_rpc_map_lock. */
+void rpc_man::put_procedure(const std::string& realm, const std::string& uri,
+                            std::shared_ptr<const procedure> proc) {
+  registry_table* table = m_table.load();
+  size_t hash = hash_of(realm, uri);
+  auto& bucket = table->buckets[hash & (table->buckets.size() - 1)];
+
+  std::atomic<registry_node*>* link = &bucket;
+  while (registry_node* node = link->load()) {
+    if (node->hash == hash && node->uri == uri && node->realm == realm) {
+      link->store(new registry_node(realm, uri, hash, std::move(proc),
+                                    node->next.load()));
+      m_retired_nodes.push_back(node);
+      return;
+    }
+    link = &node->next;
+  }
+
+  bucket.store(new registry_node(realm, uri, hash, std::move(proc),
+                                 bucket.load()));
+  if (++table->size > table->buckets.size())
+    grow_table();
+}
+
+
+/* Remove one callee of a procedure, and the procedure if it was the last.
+ * Caller must hold m_rpc_map_lock. */
+void rpc_man::remove_callee(const std::string& realm, const rpc_details& rpc) {
+  registry_table* table = m_table.load();
+  size_t hash = hash_of(realm, rpc.uri);
+  auto& bucket = table->buckets[hash & (table->buckets.size() - 1)];
 
-  auto rpc_iter = realm_iter->second.find(rpcname);
-  if (rpc_iter == realm_iter->second.end())
-    return rpc_details(); // procedure not found
+  std::atomic<registry_node*>* link = &bucket;
+  while (registry_node* node = link->load()) {
+    if (node->hash != hash || node->uri != rpc.uri || node->realm != realm) {
+      link = &node->next;
+      continue;
+    }
 
-  return *(rpc_iter->second);
+    std::shared_ptr<procedure> proc = std::make_shared<procedure>(*node->proc);
+    proc->callees.erase(
+        std::remove_if(proc->callees.begin(), proc->callees.end(),
+                       [&rpc](const std::shared_ptr<const callee>& c) {
+                         return c->rpc.get() == &rpc;
+                       }),
+        proc->callees.end());
+
+    if (proc->callees.empty()) {
+      link->store(node->next.load());
+      table->size--;
+    }
+    else
+      link->store(new registry_node(realm, rpc.uri, hash, std::move(proc),
+                                    node->next.load()));
+    m_retired_nodes.push_back(node);
+    return;
+  }
+}
+
+
+/* Double the buckets of the table.  Readers may be walking the chains of the
+ * current table, so its nodes are copied rather than relinked.  Caller must
+ * hold m_rpc_map_lock. */
+void rpc_man::grow_table() {
+  registry_table* old_table = m_table.load();
+  registry_table* table = new registry_table(old_table->buckets.size() * 2);
+  size_t mask = table->buckets.size() - 1;
+
+  for (auto& bucket : old_table->buckets)
+    for (registry_node* node = bucket.load(); node; node = node->next.load()) {
+      auto& dest = table->buckets[node->hash & mask];
+      dest.store(new registry_node(node->realm, node->uri, node->hash,
+                                   node->proc, dest.load()));
+      m_retired_nodes.push_back(node);
+    }
+  table->size = old_table->size;
+
+  m_table.store(table);
+  m_retired_tables.push_back(old_table);
+}
+
+
+/* Wait until every reader that might have seen a node or table before it
+ * was retired has finished.  Such a reader counted itself, in one counter or
+ * the other, before the node was unlinked, so each counter is waited on in
+ * turn to reach zero.  Flipping the epoch before each wait sends new readers
+ * to the other counter, so the awaited one drains even under constant
+ * lookups. */
+void rpc_man::synchronize() {
+  for (int i = 0; i < 2; i++) {
+    std::atomic<unsigned>& old_readers = m_readers[m_epoch.fetch_add(1) & 1];
+    while (old_readers.load() != 0)
+      std::this_thread::yield();
+  }
+}
+
+
+/* Delete retired nodes & tables.  Caller must hold m_rpc_map_lock, or be the
+ * destructor. */
+void rpc_man::reclaim() {
+  if (m_retired_nodes.empty() && m_retired_tables.empty())
+    return;
+
+  synchronize();
+
+  for (registry_node* node : m_retired_nodes)
+    delete node;
+  m_retired_nodes.clear();
+
+  for (registry_table* table : m_retired_tables)
+    delete table;
+  m_retired_tables.clear();
 }
 
 
@@ -63,7 +283,7 @@ void rpc_man::handle_inbound_register(wamp_session& ws, t_request_id request_id,
   rpc_details r;
   r.registration_id = 0;
   r.uri = std::move(___uri);
-  r.options = std::move(options);
+  r.options = options;
   r.realm = ws.realm();
   r.session = ws.handle();
   r.type = rpc_details::eRemote;
@@ -85,55 +305,107 @@ void rpc_man::register_rpc(session_handle session, std::string realm,
   if (!is_strict_uri(r.uri.c_str()))
     throw wamp_error(WAMP_ERROR_INVALID_URI, "uri fails strictness check");
 
-  std::lock_guard<std::mutex> guard(m_rpc_map_lock);
+  invoke_policy invoke = invoke_policy::single;
+  auto invoke_iter = r.options.find("invoke");
+  if (invoke_iter != r.options.end()) {
+    const json_value& policy = invoke_iter->second;
+    if (!policy.is_string())
+      throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "invoke option must be a string");
+    else if (policy.as_string() == "single")
+      invoke = invoke_policy::single;
+    else if (policy.as_string() == "roundrobin")
+      invoke = invoke_policy::roundrobin;
+    else if (policy.as_string() == "random")
+      invoke = invoke_policy::random;
+    else if (policy.as_string() == "first")
+      invoke = invoke_policy::first;
+    else if (policy.as_string() == "last")
+      invoke = invoke_policy::last;
+    else if (policy.as_string() == "least_outstanding")
+      invoke = invoke_policy::least_outstanding;
+    else
+      throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT,
+                       "unsupported invoke policy '" + policy.as_string() + "'");
+  }
 
-  map_uri_to_rpc& realm_index = m_realm_registry[realm];
+  std::lock_guard<std::mutex> guard(m_rpc_map_lock);
 
-  auto rpc_iter = realm_index.find(r.uri);
-  if (rpc_iter != realm_index.end()) {
-    LOG_WARN("ignoring duplicate procedure registration for " << realm << ":"
-                                                              << r.uri);
-    throw wamp_error(WAMP_ERROR_PROCEDURE_ALREADY_EXISTS);
+  /* A second registration of a procedure joins the first if both ask for the
+   * same shared invoke policy, and the session is not already a callee. */
+  std::shared_ptr<const procedure> existing;
+  if (const registry_node* node = find_node(*m_table.load(), realm, r.uri)) {
+    existing = node->proc;
+    auto session_iter = m_session_to_rpcs.find(session);
+    bool is_callee = session_iter != m_session_to_rpcs.end() &&
+                     session_iter->second.count(existing->registration_id);
+    if (invoke == invoke_policy::single || existing->invoke != invoke ||
+        is_callee) {
+      LOG_WARN("ignoring duplicate procedure registration for " << realm << ":"
+                                                                << r.uri);
+      throw wamp_error(WAMP_ERROR_PROCEDURE_ALREADY_EXISTS);
+    }
   }
 
-  r.registration_id = m_next_regid++;
-  std::shared_ptr<rpc_details> rpc = std::make_shared<rpc_details>(r);
-  realm_index.insert(std::make_pair(rpc->uri, rpc));
+  r.registration_id = existing ? existing->registration_id : m_next_regid++;
+  std::shared_ptr<const rpc_details> rpc = std::make_shared<rpc_details>(r);
+  std::shared_ptr<const callee> added = std::make_shared<callee>(rpc);
+
+  std::shared_ptr<procedure> proc;
+  if (existing)
+    proc = std::make_shared<procedure>(*existing);
+  else {
+    proc = std::make_shared<procedure>();
+    proc->invoke = invoke;
+    proc->registration_id = r.registration_id;
+    proc->next = std::make_shared<std::atomic<size_t>>(0);
+  }
+  proc->callees.push_back(added);
+  put_procedure(realm, r.uri, std::move(proc));
+  reclaim();
 
   auto& rpcs_for_session = m_session_to_rpcs[session];
   rpcs_for_session[rpc->registration_id] = std::move(rpc);
 
   LOG_INFO("procedure registered, " << r.registration_id << ", " << realm
-                                    << "::" << r.uri);
+                                    << "::" << r.uri
+                                    << (existing ? ", shared" : ""));
 }
 
 
 void rpc_man::session_closed(std::shared_ptr<wamp_session>& session) {
   /* EV thread */
 
-  std::lock_guard<std::mutex> guard(m_rpc_map_lock);
+  /* User callbacks are invoked after the lock is released, since they might
+   * call back into rpc_man, and with a multi-threaded event loop, other
+   * sessions need not wait on them. */
+  std::vector<std::shared_ptr<const rpc_details>> removed;
+
+  {
+    std::lock_guard<std::mutex> guard(m_rpc_map_lock);
 
-  auto realm_iter = m_realm_registry.find(session->realm());
-  if (realm_iter != m_realm_registry.end()) {
-    map_uri_to_rpc& rpcs_for_realm = realm_iter->second;
     auto session_iter = m_session_to_rpcs.find(session);
-    if (session_iter != end(m_session_to_rpcs))
+    if (session_iter != end(m_session_to_rpcs)) {
       for (auto& rpc_item : session_iter->second) {
         LOG_INFO("procedure unregistered, " //
-                 << rpc_item.second->registration_id << ", " << session->realm()
-                 << "::" << rpc_item.second->uri);
+                 << rpc_item.second->registration_id << ", "
+                 << session->realm() << "::" << rpc_item.second->uri);
+        removed.push_back(rpc_item.second);
+      }
 
-        /* Perform user-defined call-back, if present. */
-        if (m_rpc_removed_cb)
-            m_rpc_removed_cb(*(rpc_item.second));
+      /* remove from realm index */
+      for (auto& rpc : removed)
+        remove_callee(session->realm(), *rpc);
+      reclaim();
 
-        /* remove from realm index */
-        rpcs_for_realm.erase(rpc_item.second->uri);
-      }
+      /* remove all rpcs from session index */
+      m_session_to_rpcs.erase(session_iter);
+    }
   }
 
-  /* remove all rpcs from session index */
-  m_session_to_rpcs.erase(session);
+  /* Perform user-defined call-back, if present. */
+  if (m_rpc_removed_cb)
+    for (auto& rpc : removed)
+      m_rpc_removed_cb(*rpc);
 }
 
 
@@ -143,63 +415,69 @@ void rpc_man::handle_inbound_unregister(wamp_session& session,
                                         t_registration_id registration_id) {
   /* EV thread */
 
-  std::lock_guard<std::mutex> guard(m_rpc_map_lock);
-
-  auto session_iter = m_session_to_rpcs.find(session.handle());
-  if (session_iter != m_session_to_rpcs.end()) {
-    auto rpc_iter = session_iter->second.find(registration_id);
-    if (rpc_iter != session_iter->second.end()) {
-      LOG_INFO("procedure unregistered, " //
-               << rpc_iter->second->registration_id << ", " << session.realm()
-               << "::" << rpc_iter->second->uri);
-
-      /* Perform user-defined call-back, if present. */
-      if (m_rpc_removed_cb)
-          m_rpc_removed_cb(*(rpc_iter->second));
+  std::shared_ptr<const rpc_details> removed;
 
-      /* remove from realm index */
-      auto realm_iter = m_realm_registry.find(session.realm());
-      if (realm_iter != m_realm_registry.end())
-        realm_iter->second.erase(rpc_iter->second->uri);
-
-      /* remove from session index */
-      session_iter->second.erase(rpc_iter);
+  {
+    std::lock_guard<std::mutex> guard(m_rpc_map_lock);
 
-      /* reply to client, indicate success */
-      session.unregistered(request_id);
+    auto session_iter = m_session_to_rpcs.find(session.handle());
+    if (session_iter == m_session_to_rpcs.end()) {
+      LOG_WARN("unregister failed, session #" //
+               << session.unique_id() << " not found");
+      throw wamp_error(WAMP_ERROR_NO_SUCH_REGISTRATION);
     }
-    else {
+
+    auto rpc_iter = session_iter->second.find(registration_id);
+    if (rpc_iter == session_iter->second.end()) {
       LOG_WARN("unregister failed, registration_id " //
                << registration_id << " not found");
       throw wamp_error(WAMP_ERROR_NO_SUCH_REGISTRATION);
     }
+
+    LOG_INFO("procedure unregistered, " //
+             << rpc_iter->second->registration_id << ", " << session.realm()
+             << "::" << rpc_iter->second->uri);
+
+    /* remove from session index */
+    removed = std::move(rpc_iter->second);
+    session_iter->second.erase(rpc_iter);
+
+    /* remove from realm index */
+    remove_callee(session.realm(), *removed);
+    reclaim();
   }
-  else {
-    LOG_WARN("unregister failed, session #" //
-             << session.unique_id() << " not found");
-    throw wamp_error(WAMP_ERROR_NO_SUCH_REGISTRATION);
-  }
+
+  /* Perform user-defined call-back, if present. */
+  if (m_rpc_removed_cb)
+    m_rpc_removed_cb(*removed);
+
+  /* reply to client, indicate success */
+  session.unregistered(request_id);
 }
 
 
 json_array rpc_man::get_procedures(const std::string& realm) const
 {
-  std::lock_guard<std::mutex> guard(m_rpc_map_lock);
-
-  auto realm_iter = m_realm_registry.find(realm);
-
   wampcc::json_array uris;
 
-  // Note that it's not an error if the realm is not found in the map; that just
-  // means no procedures have yet been registered.
-
-  if (realm_iter != m_realm_registry.end()) {
-    const map_uri_to_rpc & reg = realm_iter->second;
-    uris.reserve(reg.size());
-    for (auto & item : reg)
-      uris.push_back(item.first);
+  // Note that it's not an error if no procedure is found for the realm; that
+  // just means none have yet been registered.
+  {
+    read_guard guard(*this);
+    const registry_table& table = *m_table.load();
+    for (auto& bucket : table.buckets)
+      for (const registry_node* node = bucket.load(); node;
+           node = node->next.load())
+        if (node->realm == realm)
+          uris.push_back(node->uri);
   }
 
+  // list in uri order, as the index is unordered
+  std::sort(uris.begin(), uris.end(),
+            [](const json_value& a, const json_value& b) {
+              return a.as_string() < b.as_string();
+            });
+
   return uris;
 }
 
@@ -23,16 +23,6 @@
 namespace wampcc
 {
 
-/* Return a new uv_buf_t containg a copy of a sub-region of the source,
-   starting at offset 'pos' */
-static uv_buf_t sub_buf(uv_buf_t& src, size_t pos)
-{
-  uv_buf_t buf = uv_buf_init((char*)new char[src.len - pos], src.len - pos);
-  memcpy(buf.base, src.base + pos, buf.len);
-  return buf;
-}
-
-
 ssl_socket::ssl_socket(kernel* k, uv_tcp_t* h, socket_state ss, tcp_socket::options options)
   : tcp_socket(k, h, ss, options),
     m_ssl(new ssl_session(k->get_ssl(), connect_mode::passive)),
@@ -42,7 +32,13 @@ ssl_socket::ssl_socket(kernel* k, uv_tcp_t* h, socket_state ss, tcp_socket::opti
 
 
 ssl_socket::ssl_socket(kernel* k, tcp_socket::options options)
-  : tcp_socket(k, options),
+  : ssl_socket(k, options, nullptr)
+{
+}
+
+
+ssl_socket::ssl_socket(kernel* k, tcp_socket::options options, io_loop* loop)
+  : tcp_socket(k, options, loop),
     m_ssl(new ssl_session(k->get_ssl(), connect_mode::active)),
     m_handshake_state(t_handshake_state::pending)
 {
@@ -82,10 +78,10 @@ std::future<uverr> ssl_socket::listen(const std::string& node,
  * written to the underlying socket. */
 void ssl_socket::service_pending_write()
 {
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
   // accept all unencrypted bytes that are waiting to be written
-  std::vector<uv_buf_t> bufs;
+  std::vector<shared_buffer> bufs;
   {
     std::lock_guard<std::mutex> guard(m_pending_write_lock);
     if (m_pending_write.empty())
@@ -93,15 +89,10 @@ void ssl_socket::service_pending_write()
     m_pending_write.swap(bufs);
   }
 
-  scope_guard buf_guard([&bufs]() {
-    for (auto& i : bufs)
-      delete[] i.base;
-  });
-
   for (auto it = bufs.begin(); it != bufs.end(); ++it) {
     size_t consumed = 0;
-    while (consumed < it->len) {
-      auto r = do_encrypt_and_write(it->base + consumed, it->len - consumed);
+    while (consumed < it->size()) {
+      auto r = do_encrypt_and_write(it->data() + consumed, it->size() - consumed);
 
       if (r.first == -1) {
         m_io_on_error(uverr(SSL_UV_FAIL));
@@ -114,22 +105,18 @@ void ssl_socket::service_pending_write()
       consumed += r.second;
     }
 
-    if (consumed < it->len) {
+    if (consumed < it->size()) {
       /* SSL_write failed to fully write a buffer, but also, SSL did not report
        * an error.  Seems like some kind of flow control.  We'll keep the
        * unconsumed data, plus other pending buffers, for a later attempt. */
-      std::vector<uv_buf_t> tmp{sub_buf(*it, consumed)};
-      for (++it; it != bufs.end(); ++it) {
-        tmp.push_back(*it);
-        it->base = nullptr; /* prevent scope guard freeing the unused bytes */
-      }
+      std::vector<shared_buffer> tmp{it->slice(consumed, it->size() - consumed)};
+      tmp.insert(tmp.end(), it + 1, bufs.end());
 
       std::lock_guard<std::mutex> guard(m_pending_write_lock);
       tmp.insert(tmp.end(), m_pending_write.begin(), m_pending_write.end());
       m_pending_write.swap(tmp);
 
-      /* break loop, because iterator has been incremented in loop body,
-       * otherwise the it!=end check() can be skipped over */
+      /* remaining buffers have been requeued */
       break;
     }
   }
@@ -139,9 +126,10 @@ void ssl_socket::service_pending_write()
 /* Attempt to encrypt a single block of data, by putting it through the SSL
  * object, and then take the output (representing the encrypted data) and queue
  * for socket write. Returns first==-1 on failure. */
-std::pair<int, size_t> ssl_socket::do_encrypt_and_write(char* src, size_t len)
+std::pair<int, size_t> ssl_socket::do_encrypt_and_write(const char* src,
+                                                         size_t len)
 {
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
   char buf[DEFAULT_BUF_SIZE];
 
@@ -193,7 +181,7 @@ std::future<ssl_socket::t_handshake_state> ssl_socket::handshake()
 
   auto fut = m_prom_handshake.get_future();
 
-  m_kernel->get_io()->push_fn([this]() { this->do_handshake(); });
+  m_io_loop->push_fn([this]() { this->do_handshake(); });
 
   return fut;
 }
@@ -201,7 +189,7 @@ std::future<ssl_socket::t_handshake_state> ssl_socket::handshake()
 
 sslstatus ssl_socket::do_handshake()
 {
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
   char buf[DEFAULT_BUF_SIZE];
 
@@ -239,12 +227,9 @@ sslstatus ssl_socket::do_handshake()
 
 void ssl_socket::write_encrypted_bytes(const char* src, size_t len)
 {
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
-  uv_buf_t buf = uv_buf_init(new char[len], len);
-  memcpy(buf.base, src, len);
-
-  std::vector<uv_buf_t> bufs{buf};
+  std::vector<shared_buffer> bufs{shared_buffer::copy(src, len)};
   do_write(bufs);
 }
 
@@ -255,7 +240,7 @@ void ssl_socket::write_encrypted_bytes(const char* src, size_t len)
  */
 void ssl_socket::handle_read_bytes(ssize_t nread, const uv_buf_t* buf)
 {
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
   if (nread > 0 && ssl_do_read(buf->base, size_t(nread)) == 0)
     return; /* data received and successfully fed into SSL */
@@ -272,10 +257,18 @@ void ssl_socket::handle_read_bytes(ssize_t nread, const uv_buf_t* buf)
 }
 
 
+/* Raw bytes from the socket are encrypted, so are always read into the IO loop
+ * buffer; it is the output of SSL_read that is placed in user memory. */
+void ssl_socket::alloc_read_buffer(size_t suggested_size, uv_buf_t* buf)
+{
+  *buf = m_io_loop->read_buffer(suggested_size);
+}
+
+
 /* Pass raw bytes from the socket into SSL for unencryption. */
 int ssl_socket::ssl_do_read(char* src, size_t len)
 {
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
   char buf[DEFAULT_BUF_SIZE];
 
@@ -304,9 +297,15 @@ int ssl_socket::ssl_do_read(char* src, size_t len)
     /* The encrypted data is now in the input bio so now we can perform actual
      * read of unencrypted data. */
     do {
-      n = SSL_read(m_ssl->ssl, buf, sizeof(buf));
+      std::pair<char*, size_t> dest{buf, sizeof(buf)};
+      if (m_io_on_alloc) {
+        auto region = m_io_on_alloc(sizeof(buf));
+        if (region.first && region.second)
+          dest = region;
+      }
+      n = SSL_read(m_ssl->ssl, dest.first, (int) dest.second);
       if (n > 0 && m_io_on_read)
-        m_io_on_read(buf, (size_t)n);
+        m_io_on_read(dest.first, (size_t)n);
     } while (n > 0);
 
     sslstatus status = get_sslstatus(m_ssl->ssl, n);
@@ -34,7 +34,7 @@ tcp_socket_guard::~tcp_socket_guard()
    * thread. This has to be done because it is not safe to delete an un-closed
    * tcp_socket via the IO thread. */
   if (sock && !sock->is_closed() &&
-      sock->get_kernel()->get_io()->this_thread_is_io()) {
+      sock->get_io_loop()->this_thread_is_io()) {
     tcp_socket* ptr = sock.release();
     ptr->close([ptr]() { delete ptr; });
   }
@@ -59,17 +59,19 @@ struct write_req
 {
   // C style polymorphism. The uv_write_t must be first member.
   uv_write_t req;
-  uv_buf_t* bufs;
-  size_t nbufs;
+  std::vector<uv_buf_t> bufs;
   size_t total_bytes;
-  write_req(size_t n, size_t total)
-    : bufs(new uv_buf_t[n]), nbufs(n), total_bytes(total) {}
 
-  ~write_req()
+  /* Buffers referred to by 'bufs', owned until the write completes. */
+  std::vector<shared_buffer> owners;
+
+  write_req(std::vector<shared_buffer>& src, size_t total)
+    : total_bytes(total)
   {
-    for (size_t i = 0; i < nbufs; i++)
-      delete [] bufs[i].base;
-    delete[] bufs;
+    owners.swap(src);
+    bufs.reserve(owners.size());
+    for (auto& i : owners)
+      bufs.push_back(uv_buf_init(const_cast<char*>(i.data()), i.size()));
   }
 
   write_req(const write_req&) = delete;
@@ -77,18 +79,29 @@ struct write_req
 };
 
 
-static void iohandle_alloc_buffer(uv_handle_t* /* handle */,
-                                  size_t suggested_size, uv_buf_t* buf)
+static uverr enable_reuse_port(uv_tcp_t* h)
 {
-  // improve memory efficiency
-  *buf = uv_buf_init((char*)new char[suggested_size], suggested_size);
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+  uv_os_fd_t fd;
+  uverr ec = uv_fileno((uv_handle_t*)h, &fd);
+  if (ec)
+    return ec;
+
+  int on = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) != 0)
+    return uverr(uv_translate_sys_error(errno));
+  return 0;
+#else
+  return UV_ENOTSUP;
+#endif
 }
 
 
 tcp_socket::options::options()
   : tcp_no_delay_enable(default_tcp_no_delay_enable),
     keep_alive_enable(default_keep_alive_enable),
-    keep_alive_delay(default_keep_alive_delay) {
+    keep_alive_delay(default_keep_alive_delay),
+    reuse_port_enable(default_reuse_port_enable) {
 }
 
 
@@ -96,6 +109,8 @@ tcp_socket::tcp_socket(kernel* k, uv_tcp_t* h, socket_state ss,
                        options opts)
   : m_kernel(k),
     __logger(k->get_logger()),
+    /* an accepted handle already belongs to the loop of its listen socket */
+    m_io_loop(h ? static_cast<io_loop*>(h->loop->data) : nullptr),
     m_sockopts(opts),
     m_state(ss),
     m_uv_tcp(h),
@@ -117,8 +132,15 @@ tcp_socket::tcp_socket(kernel* k, uv_tcp_t* h, socket_state ss,
 
 
 tcp_socket::tcp_socket(kernel* k, options opts)
+  : tcp_socket(k, opts, nullptr)
+{
+}
+
+
+tcp_socket::tcp_socket(kernel* k, options opts, io_loop* loop)
   : tcp_socket(k, nullptr, socket_state::uninitialised, opts)
 {
+  m_io_loop = loop ? loop : k->next_io();
 }
 
 
@@ -135,7 +157,7 @@ tcp_socket::~tcp_socket()
       m_state = socket_state::closing;
 
       try {
-        m_kernel->get_io()->push_fn([this]() { this->begin_close(); });
+        m_io_loop->push_fn([this]() { this->begin_close(); });
       } catch (io_loop_closed&) {
         io_loop_ended = true;
       }
@@ -148,10 +170,10 @@ tcp_socket::~tcp_socket()
     if (io_loop_ended) {
       LOG_ERROR("undefined behaviour calling ~tcp_socket for unclosed socket when IO loop closed");
     }
-    else if (m_kernel->get_io() == nullptr) {
+    else if (m_io_loop == nullptr) {
       LOG_ERROR("undefined behaviour calling ~tcp_socket for unclosed socket when IO loop deleted");
     }
-    else if (m_kernel->get_io()->this_thread_is_io()) {
+    else if (m_io_loop->this_thread_is_io()) {
       LOG_ERROR("undefined behaviour calling ~tcp_socket for unclosed socket on IO thread");
     }
     else
@@ -162,12 +184,6 @@ tcp_socket::~tcp_socket()
     delete (handle_data*)m_uv_tcp->data;;
     delete m_uv_tcp;
   }
-
-  {
-    std::lock_guard<std::mutex> guard(m_pending_write_lock);
-    for (auto& i : m_pending_write)
-      delete[] i.base;
-  }
 }
 
 
@@ -312,7 +328,7 @@ std::shared_future<void> tcp_socket::close()
 
   if (m_state != socket_state::closing && m_state != socket_state::closed) {
     m_state = socket_state::closing;
-    m_kernel->get_io()->push_fn([this]() { this->begin_close(); }); // can throw
+    m_io_loop->push_fn([this]() { this->begin_close(); }); // can throw
   }
 
   return m_io_closed_future;
@@ -326,7 +342,7 @@ std::shared_future<void> tcp_socket::reset()
 
   if (m_state != socket_state::closing && m_state != socket_state::closed) {
     m_state = socket_state::closing;
-    m_kernel->get_io()->push_fn(
+    m_io_loop->push_fn(
         [this]() { this->begin_close(true); }); // can throw
   }
 
@@ -353,7 +369,7 @@ bool tcp_socket::close(on_close_cb user_on_close_fn)
 
   if (m_state != socket_state::closing) {
     m_state = socket_state::closing;
-    m_kernel->get_io()->push_fn([this]() { this->begin_close(); }); // can throw
+    m_io_loop->push_fn([this]() { this->begin_close(); }); // can throw
   }
 
   return true;
@@ -361,7 +377,8 @@ bool tcp_socket::close(on_close_cb user_on_close_fn)
 
 
 std::future<uverr> tcp_socket::start_read(io_on_read on_read,
-                                          io_on_error on_error)
+                                          io_on_error on_error,
+                                          io_on_alloc on_alloc)
 {
   {
     std::lock_guard<std::mutex> guard(m_state_lock);
@@ -373,7 +390,11 @@ std::future<uverr> tcp_socket::start_read(io_on_read on_read,
 
   auto fn = [this, completion_promise]() {
     uverr ec =
-        uv_read_start((uv_stream_t*)this->m_uv_tcp, iohandle_alloc_buffer,
+        uv_read_start((uv_stream_t*)this->m_uv_tcp,
+                      [](uv_handle_t* uvh, size_t suggested_size, uv_buf_t* buf) {
+          handle_data* ptr = (handle_data*)uvh->data;
+          ptr->tcp_socket_ptr()->on_alloc_cb(suggested_size, buf);
+        },
                       [](uv_stream_t* uvh, ssize_t nread, const uv_buf_t* buf) {
           handle_data* ptr = (handle_data*)uvh->data;
           ptr->tcp_socket_ptr()->on_read_cb(nread, buf);
@@ -383,8 +404,9 @@ std::future<uverr> tcp_socket::start_read(io_on_read on_read,
 
   m_io_on_read = std::move(on_read);
   m_io_on_error = std::move(on_error);
+  m_io_on_alloc = std::move(on_alloc);
 
-  m_kernel->get_io()->push_fn(std::move(fn));
+  m_io_loop->push_fn(std::move(fn));
 
   return completion_promise->get_future();
 }
@@ -394,6 +416,7 @@ void tcp_socket::reset_listener()
 {
   m_io_on_read = nullptr;
   m_io_on_error = nullptr;
+  m_io_on_alloc = nullptr;
 }
 
 
@@ -407,7 +430,7 @@ void tcp_socket::close_once_on_io()
   std::lock_guard<std::mutex> guard(m_state_lock);
   if (m_state != socket_state::closing && m_state != socket_state::closed) {
     m_state = socket_state::closing;
-    m_kernel->get_io()->push_fn([this]() { this->begin_close(); });
+    m_io_loop->push_fn([this]() { this->begin_close(); });
   }
 }
 
@@ -423,9 +446,43 @@ void tcp_socket::handle_read_bytes(ssize_t nread, const uv_buf_t* buf)
     m_io_on_error(uverr(nread));
 }
 
+/* Select the memory for the next read: prefer that of the user, so that bytes
+ * land in their final location, else use the IO loop buffer. */
+void tcp_socket::alloc_read_buffer(size_t suggested_size, uv_buf_t* buf)
+{
+  if (m_io_on_alloc) {
+    auto region = m_io_on_alloc(suggested_size);
+    if (region.first && region.second) {
+      *buf = uv_buf_init(region.first, region.second);
+      return;
+    }
+  }
+
+  *buf = m_io_loop->read_buffer(suggested_size);
+}
+
+void tcp_socket::on_alloc_cb(size_t suggested_size, uv_buf_t* buf)
+{
+  /* IO thread */
+  try {
+    alloc_read_buffer(suggested_size, buf);
+  }
+  catch (...) {
+    log_exception(__logger, "IO thread in on_alloc_cb");
+    *buf = m_io_loop->read_buffer(suggested_size);
+  }
+}
+
 void tcp_socket::on_read_cb(ssize_t nread, const uv_buf_t* buf)
 {
   /* IO thread */
+
+  /* libuv reports a read that would block as zero bytes; this is not EOF (that
+   * is UV_EOF).  It is seen when a read fills the supplied buffer exactly,
+   * which is common when reading into the protocol's free region. */
+  if (nread == 0)
+    return;
+
   if (nread > 0)
     m_bytes_read += nread;
 
@@ -435,86 +492,64 @@ void tcp_socket::on_read_cb(ssize_t nread, const uv_buf_t* buf)
   catch (...) {
     log_exception(__logger, "IO thread in on_read_cb");
   }
-
-  delete[] buf -> base;
 }
 
 
 void tcp_socket::write(const char* src, size_t len)
 {
-  uv_buf_t buf;
-
-  scope_guard buf_guard([&buf]() {
-      delete[] buf.base;
-    });
-
-  buf = uv_buf_init(new char[len], len);
-  memcpy(buf.base, src, len);
-
-  {
-    std::lock_guard<std::mutex> guard(m_state_lock);
-    if (m_state == socket_state::closing || m_state == socket_state::closed)
-      throw tcp_socket::error("tcp_socket::write() when closing or closed");
-
-    {
-      std::lock_guard<std::mutex> guard(m_pending_write_lock);
-      m_pending_write.push_back(buf);
-      buf_guard.dismiss();
-    }
-
-    m_kernel->get_io()->push_fn([this]() { service_pending_write(); });
-  }
+  std::vector<shared_buffer> bufs{shared_buffer::copy(src, len)};
+  enqueue_write(bufs);
 }
 
 
 void tcp_socket::write(std::pair<const char*, size_t>* srcbuf, size_t count)
 {
-  // improve memory usage here
-  std::vector<uv_buf_t> bufs;
+  std::vector<shared_buffer> bufs;
+  bufs.reserve(count);
+  for (size_t i = 0; i < count; i++, srcbuf++)
+    bufs.push_back(shared_buffer::copy(srcbuf->first, srcbuf->second));
+  enqueue_write(bufs);
+}
 
-  scope_guard buf_guard([&bufs]() {
-    for (auto& i : bufs)
-      delete[] i.base;
-  });
 
-  bufs.reserve(count);
-  for (size_t i = 0; i < count; i++) {
-    uv_buf_t buf = uv_buf_init(new char[srcbuf->second], srcbuf->second);
-    memcpy(buf.base, srcbuf->first, srcbuf->second);
-    srcbuf++;
-    bufs.push_back(buf);
-  }
+void tcp_socket::write(const shared_buffer* srcbuf, size_t count)
+{
+  std::vector<shared_buffer> bufs(srcbuf, srcbuf + count);
+  enqueue_write(bufs);
+}
 
-  {
-    std::lock_guard<std::mutex> guard(m_state_lock);
-    if (m_state == socket_state::closing || m_state == socket_state::closed)
-      throw tcp_socket::error("tcp_socket::write() when closing or closed");
 
-    {
-      std::lock_guard<std::mutex> guard(m_pending_write_lock);
-      m_pending_write.insert(m_pending_write.end(), bufs.begin(), bufs.end());
-      bufs.clear();
-      buf_guard.dismiss();
-    }
+void tcp_socket::enqueue_write(std::vector<shared_buffer>& bufs)
+{
+  std::lock_guard<std::mutex> guard(m_state_lock);
+  if (m_state == socket_state::closing || m_state == socket_state::closed)
+    throw tcp_socket::error("tcp_socket::write() when closing or closed");
 
-    m_kernel->get_io()->push_fn([this]() {service_pending_write();});
+  {
+    std::lock_guard<std::mutex> guard(m_pending_write_lock);
+    if (m_pending_write.empty())
+      m_pending_write.swap(bufs);
+    else
+      m_pending_write.insert(m_pending_write.end(),
+                             std::make_move_iterator(bufs.begin()),
+                             std::make_move_iterator(bufs.end()));
   }
+
+  m_io_loop->push_fn([this]() { service_pending_write(); });
 }
 
 
-void tcp_socket::do_write(std::vector<uv_buf_t>& bufs)
+/* Pass buffers to libuv for writing.  The buffers are not copied; instead the
+ * write request takes ownership of them, and so they are released only once
+ * libuv has completed the write (in on_write_cb). */
+void tcp_socket::do_write(std::vector<shared_buffer>& bufs)
 {
   /* IO thread */
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
-
-  scope_guard buf_guard([&bufs]() {
-    for (auto& i : bufs)
-      delete[] i.base;
-  });
+  assert(m_io_loop->this_thread_is_io() == true);
 
   size_t bytes_to_send = 0;
   for (size_t i = 0; i < bufs.size(); i++)
-    bytes_to_send += bufs[i].len;
+    bytes_to_send += bufs[i].size();
 
   const size_t pend_max = m_kernel->get_config().socket_max_pending_write_bytes;
 
@@ -526,19 +561,16 @@ void tcp_socket::do_write(std::vector<uv_buf_t>& bufs)
     }
 
     // build the request
-    write_req* wr = new write_req(bufs.size(), bytes_to_send);
+    write_req* wr = new write_req(bufs, bytes_to_send);
     wr->req.data = this;
-    for (size_t i = 0; i < bufs.size(); i++)
-      wr->bufs[i] = bufs[i];
 
     m_bytes_pending_write += bytes_to_send;
 
-    int r = uv_write((uv_write_t*)wr, (uv_stream_t*)m_uv_tcp, wr->bufs,
-                     wr->nbufs, [](uv_write_t* req, int status) {
+    int r = uv_write((uv_write_t*)wr, (uv_stream_t*)m_uv_tcp, wr->bufs.data(),
+                     wr->bufs.size(), [](uv_write_t* req, int status) {
       tcp_socket* the_tcp_socket = (tcp_socket*)req->data;
       the_tcp_socket->on_write_cb(req, status);
     });
-    buf_guard.dismiss();
 
     if( r ) {
       LOG_WARN("uv_write failed, errno " << std::abs(r) << " ("
@@ -554,63 +586,22 @@ void tcp_socket::do_write(std::vector<uv_buf_t>& bufs)
 void tcp_socket::do_write()
 {
   /* IO thread */
-  assert(m_kernel->get_io()->this_thread_is_io() == true);
+  assert(m_io_loop->this_thread_is_io() == true);
 
-  std::vector<uv_buf_t> copy;
+  std::vector<shared_buffer> copy;
   {
     std::lock_guard<std::mutex> guard(m_pending_write_lock);
     m_pending_write.swap(copy);
   }
 
-  scope_guard buf_guard([&copy]() {
-    for (auto& i : copy)
-      delete[] i.base;
-  });
-
-  size_t bytes_to_send = 0;
-  for (size_t i = 0; i < copy.size(); i++)
-    bytes_to_send += copy[i].len;
-
   if (LOG_FOR_LEVEL(logger::eTrace)) {
     for (size_t i = 0; i < copy.size(); i++)
-      LOG_TRACE("fd: " << fd_info().second << ", tcp_tx: len " << copy[i].len
-            << (copy[i].len>0? ", hex ":"")
-            << (copy[i].len>0? to_hex(copy[i].base,copy[i].len):""));
+      LOG_TRACE("fd: " << fd_info().second << ", tcp_tx: len " << copy[i].size()
+            << (copy[i].size()>0? ", hex ":"")
+            << (copy[i].size()>0? to_hex(copy[i].data(),copy[i].size()):""));
   }
 
-  const size_t pend_max = m_kernel->get_config().socket_max_pending_write_bytes;
-
-  if (is_connected() && !copy.empty()) {
-    if (bytes_to_send > (pend_max - m_bytes_pending_write)) {
-      LOG_WARN("pending bytes limit reached; closing connection");
-      close_once_on_io();
-      return;
-    }
-
-    // build the request
-    write_req* wr = new write_req(copy.size(), bytes_to_send);
-    wr->req.data = this;
-    for (size_t i = 0; i < copy.size(); i++)
-      wr->bufs[i] = copy[i];
-
-    m_bytes_pending_write += bytes_to_send;
-
-    int r = uv_write((uv_write_t*)wr, (uv_stream_t*)m_uv_tcp, wr->bufs,
-                     wr->nbufs, [](uv_write_t* req, int status) {
-      tcp_socket* the_tcp_socket = (tcp_socket*)req->data;
-      the_tcp_socket->on_write_cb(req, status);
-    });
-    buf_guard.dismiss();
-
-    if( r ) {
-      LOG_WARN("uv_write failed, errno " << std::abs(r) << " ("
-                                         << uv_strerror(r)
-                                         << "); closing connection");
-      delete wr;
-      close_once_on_io();
-      return;
-    }
-  }
+  do_write(copy);
 }
 
 
@@ -659,7 +650,7 @@ void tcp_socket::on_listen_cb(int status)
 
   uv_tcp_t* client = new uv_tcp_t();
   assert(client->data == 0);
-  uv_tcp_init(m_kernel->get_io()->uv_loop(), client);
+  uv_tcp_init(m_io_loop->uv_loop(), client);
 
   ec = uv_accept((uv_stream_t*)m_uv_tcp, (uv_stream_t*)client);
   if (ec == 0) {
@@ -698,7 +689,7 @@ std::future<uverr> tcp_socket::listen_impl(const std::string& node,
 
   auto completion_promise = std::make_shared<std::promise<uverr>>();
 
-  m_kernel->get_io()->push_fn([this, node, service, af, completion_promise]() {
+  m_io_loop->push_fn([this, node, service, af, completion_promise]() {
     this->do_listen(node, service, af, completion_promise);
   });
 
@@ -787,7 +778,7 @@ void tcp_socket::do_listen(const std::string& node, const std::string& service,
    * later calls to bind or connect */
   uv_getaddrinfo_t req;
   uverr ec = uv_getaddrinfo(
-      m_kernel->get_io()->uv_loop(), &req, nullptr /* no callback */,
+      m_io_loop->uv_loop(), &req, nullptr /* no callback */,
       node.empty() ? nullptr : node.c_str(),
       service.empty() ? nullptr : service.c_str(), &hints);
 
@@ -804,11 +795,22 @@ void tcp_socket::do_listen(const std::string& node, const std::string& service,
 
     h = new uv_tcp_t();
     assert(h->data == 0);
-    if (uv_tcp_init(m_kernel->get_io()->uv_loop(), h) != 0) {
+    if (uv_tcp_init_ex(m_io_loop->uv_loop(), h, ai->ai_family) != 0) {
       delete h;
       continue;
     }
 
+    if (m_sockopts.reuse_port_enable) {
+      /* Must be applied before bind, so the underlying socket is created
+       * early by uv_tcp_init_ex. */
+      ec = enable_reuse_port(h);
+      if (ec) {
+        LOG_WARN("failed to set SO_REUSEPORT, " << ec.message());
+        uv_close((uv_handle_t*)h, free_socket);
+        continue;
+      }
+    }
+
     if (uv_tcp_bind(h, ai->ai_addr, tcp_bind_flags) == 0)
       break; /* success */
 
@@ -867,7 +869,7 @@ std::future<uverr> tcp_socket::connect(const std::string& node,
 
   auto completion_promise = std::make_shared<std::promise<uverr>>();
 
-  m_kernel->get_io()->push_fn(
+  m_io_loop->push_fn(
       [this, node, service, af, resolve_addr, completion_promise]() {
         this->do_connect(node, service, af, resolve_addr, completion_promise);
       });
@@ -921,7 +923,7 @@ void tcp_socket::do_connect(const std::string& node, const std::string& service,
    * later calls to bind or connect */
   uv_getaddrinfo_t req;
   uverr ec = uv_getaddrinfo(
-      m_kernel->get_io()->uv_loop(), &req, nullptr /* no callback */,
+      m_io_loop->uv_loop(), &req, nullptr /* no callback */,
       node.empty() ? nullptr : node.c_str(),
       service.empty() ? nullptr : service.c_str(), &hints);
 
@@ -938,7 +940,7 @@ void tcp_socket::do_connect(const std::string& node, const std::string& service,
 
     h = new uv_tcp_t();
     assert(h->data == 0);
-    if (uv_tcp_init(m_kernel->get_io()->uv_loop(), h) != 0) {
+    if (uv_tcp_init(m_io_loop->uv_loop(), h) != 0) {
       delete h;
       continue;
     }
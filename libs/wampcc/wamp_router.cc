@@ -18,6 +18,8 @@
 #include "wampcc/log_macros.h"
 #include "wampcc/protocol.h"
 
+#include <algorithm>
+
 #include <string.h>
 
 namespace wampcc
@@ -31,6 +33,7 @@ wamp_router::wamp_router(kernel* __svc, on_rpc_registered cb_reg, on_rpc_unregis
         [this](const rpc_details& r) { this->rpc_registered_cb(r); },
         [this](const rpc_details& r) { this->rpc_unregistered_cb(r); })),
     m_pubsub(new pubsub_man(__svc)),
+    m_publish_strand(new strand(__svc->get_event_loop())),
     m_on_rpc_registered(cb_reg),
     m_on_rpc_unregistered(cb_unreg),
     m_on_session_state_change(cb_state_change){};
@@ -108,9 +111,9 @@ void wamp_router::publish(const std::string& realm, const std::string& topic,
   std::weak_ptr<wamp_router> wp = this->shared_from_this();
 
   // TODO: how to use bind here, to pass options in as a move operation?
-  m_kernel->get_event_loop()->dispatch([wp, topic, realm, args, options]() {
+  m_publish_strand->dispatch([wp, topic, realm, args, options]() mutable {
     if (auto sp = wp.lock())
-      sp->m_pubsub->publish(realm, topic, options, args);
+      sp->m_pubsub->publish(realm, topic, options, std::move(args));
   });
 }
 
@@ -178,19 +181,21 @@ void wamp_router::handle_inbound_call(
 
     }
 
-    rpc_details rpc = m_rpcman->get_rpc_details(uri, ws->realm());
-    if (rpc.registration_id) {
-      if (rpc.type == rpc_details::eInternal) {
+    std::shared_ptr<void> pending;
+    auto rpc = m_rpcman->get_rpc_details(uri, ws->realm(), &pending);
+    if (rpc) {
+      if (rpc->type == rpc_details::eInternal) {
         /* CALL request is for an internal procedure */
 
-        if (rpc.user_cb) {
+        if (rpc->user_cb) {
 
+          decode_args(args);
           call_info info { request_id,
-              options, // TODO: should details be passed instead of options?
+              std::move(options), // TODO: should details be passed instead of options?
               std::move(args),
-              rpc.user };
+              rpc->user };
 
-          rpc.user_cb(*this, *ws, std::move(info));
+          rpc->user_cb(*this, *ws, std::move(info));
 
         } else
           throw wamp_error(WAMP_ERROR_NO_ELIGIBLE_CALLEE);
@@ -198,25 +203,30 @@ void wamp_router::handle_inbound_call(
       } else {
         /* CALL request is for an external procedure.  So find the wamp session
          * that registered the procedure, and send it an INVOCATION request.*/
-        if (auto callee = rpc.session.lock())
+        if (auto callee = rpc->session.lock())
         {
           std::weak_ptr<wamp_session> caller_wp = ws->handle();
           auto caller_request_id = request_id;
+          /* 'pending' is held until the invocation is answered, or the callee
+           * session is destroyed; it is released before replying, so that the
+           * callee is no longer counted as busy once the caller can call again */
           on_yield_fn fn =
-            [caller_wp, caller_request_id](wamp_session&, yield_info info)
+            [caller_wp, caller_request_id, pending](wamp_session&, yield_info info) mutable
             {
               /* EV thread */
 
+              pending.reset();
+
               if (auto caller = caller_wp.lock())
               {
                 if (info)
-                  caller->result(caller_request_id, info.args.args_list, info.args.args_dict);
+                  caller->result(caller_request_id, json_object(), std::move(info.args));
                 else
-                  caller->call_error(caller_request_id, info.error_uri, info.additional, info.args.args_list, info.args.args_dict);
+                  caller->call_error(caller_request_id, info.error_uri, std::move(info.additional), std::move(info.args));
               }
             };
 
-          callee->invocation(rpc.registration_id, std::move(details), args, fn);
+          callee->invocation(rpc->registration_id, std::move(details), std::move(args), std::move(fn));
         }
         else
           throw wamp_error(WAMP_ERROR_NO_ELIGIBLE_CALLEE);
@@ -436,6 +446,7 @@ std::future<uverr> wamp_router::listen(auth_provider auth,
       selector_protocol::options selector_opts;
       selector_opts.protocols = listen_opts.protocols;
       selector_opts.serialisers = listen_opts.serialisers;
+      selector_opts.lazy_args = listen_opts.lazy_args;
       std::unique_ptr<protocol> up(
         new selector_protocol(m_kernel, sock, _msg_cb, cb, selector_opts));
       return up;
@@ -462,37 +473,98 @@ std::future<uverr> wamp_router::listen(auth_provider auth,
                          << sp->protocol_name() << ", fd: " << fd);
   };
 
-  /* Create the actual IO server socket */
+  auto on_accept = [on_new_client](std::unique_ptr<tcp_socket>& clt, uverr ec) {
+    /* IO thread */
+    if (!ec)
+      on_new_client(std::move(clt));
+    else {
+      // TODO: need to capture 'this' for this logging line to work, however
+      // first need to make sure wamp_router shutdown is controlled.
+
+//          LOG_WARN("accept() failed: " << ec.os_value() << ", "
+//                   << e.message());
+    }
+  };
+
+  /* Create the actual IO server sockets. When the kernel has several IO loops,
+   * a listen socket is bound on each loop using SO_REUSEPORT, so that each
+   * loop accepts, and then services, its own share of the connections. */
 
-  std::unique_ptr<tcp_socket> sock(
-    listen_opts.ssl? new ssl_socket(m_kernel, listen_opts.sockopts)
-    : new tcp_socket(m_kernel, listen_opts.sockopts));
+  const size_t loop_count = m_kernel->io_loop_count();
 
-  tcp_socket* ptr = sock.get();
+  tcp_socket::options sockopts = listen_opts.sockopts;
+  if (loop_count > 1)
+    sockopts.reuse_port_enable = true;
 
-  {
-    std::lock_guard<std::mutex> guard(m_server_sockets_lock);
-    m_server_sockets.push_back(std::move(sock));
+  std::vector<tcp_socket*> socks;
+  std::vector<std::unique_ptr<tcp_socket>> owned;
+  for (size_t i = 0; i < loop_count; i++) {
+    io_loop* loop = m_kernel->get_io(i);
+    owned.emplace_back(
+      listen_opts.ssl? new ssl_socket(m_kernel, sockopts, loop)
+      : new tcp_socket(m_kernel, sockopts, loop));
+    socks.push_back(owned.back().get());
   }
 
-  auto fut = ptr->listen(
-      listen_opts.node, listen_opts.service,
-      [on_new_client](std::unique_ptr<tcp_socket>& clt, uverr ec) {
-        /* IO thread */
-        if (!ec)
-          on_new_client(std::move(clt));
-        else {
-          // TODO: need to capture 'this' for this logging line to work, however
-          // first need to make sure wamp_router shutdown is controlled.
+  std::lock_guard<std::mutex> guard(m_server_sockets_lock);
+  for (auto & sock : owned)
+    m_server_sockets.push_back(std::move(sock));
 
-//          LOG_WARN("accept() failed: " << ec.os_value() << ", "
-//                   << e.message());
+  if (loop_count == 1)
+    return socks[0]->listen(listen_opts.node, listen_opts.service, on_accept,
+                            listen_opts.af);
+
+  auto completion = std::make_shared<std::promise<uverr>>();
+  listen_sharded(std::move(socks), 0, listen_opts.service, listen_opts,
+                 on_accept, completion);
+  return completion->get_future();
+}
+
+
+/* Start listening on socket i, and once that has succeeded, move on to the next
+ * socket.  The sockets are bound in sequence so that all use the port actually
+ * obtained by the first, which matters if an ephemeral port was requested.
+ * Caller must hold m_server_sockets_lock. */
+void wamp_router::listen_sharded(std::vector<tcp_socket*> socks, size_t i,
+                                 std::string service,
+                                 const listen_options& listen_opts,
+                                 tcp_socket::on_accept_cb accept_fn,
+                                 std::shared_ptr<std::promise<uverr>> completion)
+{
+  auto fut = std::make_shared<std::future<uverr>>(
+    socks[i]->listen(listen_opts.node, service, accept_fn, listen_opts.af));
+
+  /* Requests on an io_loop are serviced in order, so this runs after the listen
+   * attempt has completed, and before any close request made for the socket
+   * later on (e.g. by the router destructor, which waits for socket closure). */
+  socks[i]->get_io_loop()->push_fn(
+    [this, socks, i, service, listen_opts, accept_fn, completion, fut]() {
+      /* IO thread */
+      try {
+        uverr ec = fut->get();
+        if (ec || (i + 1) == socks.size()) {
+          completion->set_value(ec);
+          return;
         }
 
-      },
-      listen_opts.af);
+        std::string next_service =
+          (i == 0) ? std::to_string(socks[0]->get_local_port()) : service;
 
-  return fut;
+        std::lock_guard<std::mutex> guard(m_server_sockets_lock);
+
+        /* router destructor has taken the sockets for closure */
+        if (m_server_sockets.empty()) {
+          completion->set_value(UV_ECANCELED);
+          return;
+        }
+
+        listen_sharded(socks, i + 1, next_service, listen_opts, accept_fn,
+                       completion);
+      }
+      catch (...) {
+        completion->set_exception(std::current_exception());
+      }
+    });
 }
 
 std::vector<socket_address> wamp_router::get_listen_addresses() const
@@ -502,8 +574,12 @@ std::vector<socket_address> wamp_router::get_listen_addresses() const
     std::lock_guard<std::mutex> guard(m_server_sockets_lock);
     for (const auto& s : m_server_sockets)
     {
-      if (s->is_listening())
-        ret.emplace_back(s->get_local_address());
+      if (s->is_listening()) {
+        /* sockets sharded across IO loops share the same address */
+        auto addr = s->get_local_address();
+        if (std::find(ret.begin(), ret.end(), addr) == ret.end())
+          ret.push_back(std::move(addr));
+      }
     }
   }
   return ret;
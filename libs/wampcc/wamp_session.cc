@@ -173,6 +173,23 @@ static void check_size_at_least(size_t msg_len, size_t s)
 }
 
 
+/* Take the args_list & args_dict found at 'index' onwards, or the raw
+ * arguments when the protocol left them serialised. */
+static wamp_args extract_args(json_array & msg, size_t index, raw_args & raw)
+{
+  wamp_args args;
+  if (!raw.empty())
+    args.raw = std::move(raw);
+  else {
+    if (msg.size() > index)
+      args.args_list = std::move(msg[index].as_array());
+    if (msg.size() > index+1)
+      args.args_dict = std::move(msg[index+1].as_object());
+  }
+  return args;
+}
+
+
 server_msg_handler::server_msg_handler()
   : on_call([](wamp_session& ws, t_request_id id, std::string&, json_object&, wamp_args&){
       ws.call_error(id, WAMP_ERROR_UNSUPPORTED_REQUEST_TYPE);
@@ -219,8 +236,10 @@ wamp_session::wamp_session(kernel* __kernel,
     __logger(__kernel->get_logger()),
     m_kernel(__kernel),
     m_socket(std::move(h)),
+    m_strand(new strand(__kernel->get_event_loop())),
     m_session_mode(conn_mode),
     m_shfut_has_closed(m_has_closed.get_future()),
+    m_timers_cancelled(false),
     m_time_create(time(NULL)),
     m_time_last_msg_recv(time(NULL)),
     m_next_request_id(1),
@@ -283,18 +302,38 @@ std::shared_ptr<wamp_session> wamp_session::create_impl(kernel* k,
 
   wamp_session* rawptr = sp.get(); // rawptr, for capture in lambdas
 
-  auto on_msg_cb = [rawptr](json_array msg, json_uint_t msg_type) {
+  auto on_msg_cb = [rawptr](json_array msg, json_uint_t msg_type,
+                            raw_args args) {
     /* IO thread */
     std::weak_ptr<wamp_session> wp = rawptr->handle();
 
     /* receive inbound wamp messages that have been decoded by the
-     * protocol and queue them for processing on the EV thread */
-    auto fn = [wp,msg,msg_type]() mutable
-    {
-      if (auto sp = wp.lock())
-        sp->process_message(msg, msg_type); // TODO: check efficiency here
-    };
-    rawptr->m_kernel->get_event_loop()->dispatch(std::move(fn));
+     * protocol and queue them for processing on the EV thread; the message is
+     * moved into the bound task, which is small enough to avoid allocation
+     * unless it also carries raw arguments */
+    if (args.empty()) {
+      auto fn = [wp](json_array& msg, json_uint_t msg_type)
+      {
+        if (auto sp = wp.lock()) {
+          raw_args none;
+          sp->process_message(msg, msg_type, none);
+          sp->recycle_message(msg);
+        }
+      };
+      rawptr->m_strand->dispatch(
+          std::bind(std::move(fn), std::move(msg), msg_type));
+    }
+    else {
+      auto fn = [wp](json_array& msg, json_uint_t msg_type, raw_args& args)
+      {
+        if (auto sp = wp.lock()) {
+          sp->process_message(msg, msg_type, args);
+          sp->recycle_message(msg);
+        }
+      };
+      rawptr->m_strand->dispatch(std::bind(std::move(fn), std::move(msg),
+                                           msg_type, std::move(args)));
+    }
   };
 
   auto upgrade_cb = [rawptr](std::unique_ptr<protocol>&new_proto) {
@@ -308,16 +347,9 @@ std::shared_ptr<wamp_session> wamp_session::create_impl(kernel* k,
      * protocol. */
     if (interval.count() > 0)
     {
-      std::weak_ptr<wamp_session> wp = rawptr->handle();
-      auto fn = [wp,interval]() -> std::chrono::milliseconds {
-        if (auto sp = wp.lock()) {
-          sp->m_proto->on_timer();
-          return interval;
-        }
-        else
-          return std::chrono::milliseconds(); /* cancel timer */
-      };
-      rawptr->m_kernel->get_event_loop()->dispatch(interval, std::move(fn));
+      rawptr->schedule_timer(interval, interval, [](wamp_session& s) {
+        s.m_proto->on_timer();
+      });
     }
   };
 
@@ -328,17 +360,12 @@ std::shared_ptr<wamp_session> wamp_session::create_impl(kernel* k,
       rawptr->drop_connection_impl("protocol_closed", guard, close_event::protocol_closed);
     }
     else {
-      std::weak_ptr<wamp_session> wp = rawptr->handle();
       /* implement delay before requesting session closure */
-      auto fn = [wp]() mutable -> std::chrono::milliseconds
-      {
-        if (auto sp = wp.lock()) {
-          std::lock_guard<std::mutex> guard(sp->m_state_lock);
-          sp->drop_connection_impl("protocol_closed", guard, close_event::protocol_closed);
-        }
-        return std::chrono::milliseconds(0);
-      };
-      rawptr->m_kernel->get_event_loop()->dispatch(delay, std::move(fn));
+      rawptr->schedule_timer(delay, std::chrono::milliseconds(0),
+                             [](wamp_session& s) {
+        std::lock_guard<std::mutex> guard(s.m_state_lock);
+        s.drop_connection_impl("protocol_closed", guard, close_event::protocol_closed);
+      });
     }
   };
 
@@ -347,36 +374,37 @@ std::shared_ptr<wamp_session> wamp_session::create_impl(kernel* k,
   // were captured by the lambdas), the wamp_session would hold references to
   // itself, and so would be tricky to delete.
 
+  auto spare_message_cb = [rawptr](json_array& msg) {
+    /* IO thread */
+    rawptr->take_spare_message(msg);
+  };
+
   sp->m_proto = protocol_builder(sp->m_socket.get(),
                                  std::move(on_msg_cb),
                                  {
                                    std::move(upgrade_cb),
                                    std::move(request_timer_cb),
-                                   std::move(protocol_closed_fn)
+                                   std::move(protocol_closed_fn),
+                                   std::move(spare_message_cb)
                                   });
 
   // Enable the socket for read events; this can only take place once the
   // session's weak self pointer has been set up.
   sp->m_socket->start_read(
     [rawptr](char* s, size_t n){rawptr->io_on_read(s,n);},
-    [rawptr](uverr ec){rawptr->io_on_error(ec);}
+    [rawptr](uverr ec){rawptr->io_on_error(ec);},
+    [rawptr](size_t n){return rawptr->m_proto->io_alloc_buffer(n);}
     );
 
   // set up a timer to expire this session if it has not been successfully
   // opened within a maximum time duration
   if (sp->m_options.max_pending_open.count()) {
-    std::weak_ptr<wamp_session> wp = sp;
-    k->get_event_loop()->dispatch(
-      sp->m_options.max_pending_open,
-      [wp]()
-      {
-        if (auto sp = wp.lock())
-        {
-          if (sp->is_pending_open())
-            sp->drop_connection("wamp.error.logon_timeout");
-        }
-        return std::chrono::milliseconds(0);
-      });
+    sp->schedule_timer(sp->m_options.max_pending_open,
+                       std::chrono::milliseconds(0),
+                       [](wamp_session& s) {
+                         if (s.is_pending_open())
+                           s.drop_connection("wamp.error.logon_timeout");
+                       });
   }
 
   return sp;
@@ -397,7 +425,7 @@ wamp_session::~wamp_session()
 
   if (!m_socket->is_closed())
   {
-    if (m_kernel->get_io()->this_thread_is_io())
+    if (m_socket->get_io_loop()->this_thread_is_io())
     {
       m_socket->reset_listener();
       tcp_socket * rawptr = m_socket.get();
@@ -579,8 +607,25 @@ void wamp_session::process_inbound_goodbye(json_array &)
 }
 
 
+void wamp_session::recycle_message(json_array& msg)
+{
+  /* EV thread */
+  std::lock_guard<std::mutex> guard(m_spare_msg_lock);
+  m_spare_msg.swap(msg);
+}
+
+
+void wamp_session::take_spare_message(json_array& msg)
+{
+  /* IO thread */
+  std::lock_guard<std::mutex> guard(m_spare_msg_lock);
+  msg.swap(m_spare_msg);
+}
+
+
 void wamp_session::process_message(json_array& ja,
-                                   json_uint_t message_type)
+                                   json_uint_t message_type,
+                                   raw_args& raw)
 {
   /* EV thread */
 
@@ -619,15 +664,15 @@ void wamp_session::process_message(json_array& ja,
       switch (message_type)
       {
         case msg_type::wamp_msg_call :
-          process_inbound_call(ja);
+          process_inbound_call(ja, raw);
           return;
 
         case msg_type::wamp_msg_yield :
-          process_inbound_yield(ja);
+          process_inbound_yield(ja, raw);
           return;
 
         case msg_type::wamp_msg_publish :
-          process_inbound_publish(ja);
+          process_inbound_publish(ja, raw);
           return;
 
         case msg_type::wamp_msg_subscribe :
@@ -647,7 +692,7 @@ void wamp_session::process_message(json_array& ja,
           return;
 
         case msg_type::wamp_msg_error :
-          process_inbound_error(ja);
+          process_inbound_error(ja, raw);
           return;
 
         case msg_type::wamp_msg_heartbeat: return;
@@ -710,7 +755,7 @@ void wamp_session::process_message(json_array& ja,
           return;
 
         case msg_type::wamp_msg_error :
-          process_inbound_error(ja);
+          process_inbound_error(ja, raw);
           return;
 
         case msg_type::wamp_msg_heartbeat: return;
@@ -787,6 +832,38 @@ void wamp_session::send_msg(const json_array& jv)
 }
 
 
+/* Send a message that ends with the args_list & args_dict elements, which are
+ * spliced in without decoding when still held in raw form. */
+void wamp_session::send_msg(json_array msg, wamp_args args)
+{
+  if (args.raw.empty())
+  {
+    msg.push_back(std::move(args.args_list));
+    msg.push_back(std::move(args.args_dict));
+    send_msg(msg);
+  }
+  else
+  {
+    outbound_message om(std::move(msg), std::move(args.raw));
+    send_msg(om);
+  }
+}
+
+
+void wamp_session::send_msg(outbound_message& msg)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_state_lock);
+    if (is_in(m_state, state::closing, state::closed, state::closing_wait))
+      return;
+  }
+
+  update_state_for_outbound(msg.msg());
+
+  m_proto->send_shared_msg(msg);
+}
+
+
 void wamp_session::handle_HELLO(json_array& ja)
 {
   /* EV thread */
@@ -984,7 +1061,7 @@ void wamp_session::handle_CHALLENGE(json_array& ja)
       std::string key = m_client_secret_fn();
 
       auto iter_salt = extra.find("salt");
-      if (iter_salt != end(extra)) {
+      if (iter_salt != extra.end()) {
         int keylen = (int) json_get_ref(extra, "keylen").as_int();
         int iterations = (int) json_get_ref(extra, "iterations").as_int();
         const std::string& salt = iter_salt->second.as_string();
@@ -1114,8 +1191,18 @@ void wamp_session::send_WELCOME()
 {
   json_object details;
   details["roles"] = json_object( {
-      {"broker", json_value::make_object()},
-      {"dealer", json_value::make_object()}} );
+      {"broker", json_object({
+        {"features", json_object({
+          {"pattern_based_subscription", true}
+          })
+        }
+      })},
+      {"dealer", json_object({
+        {"features", json_object({
+          {"shared_registration", true}
+          })
+        }
+      })}} );
 
   json_array msg { msg_type::wamp_msg_welcome,
       m_sid,
@@ -1797,7 +1884,7 @@ void wamp_session::process_inbound_result(json_array & msg)
 }
 
 /* Handles errors for both active & passive sessions */
-void wamp_session::process_inbound_error(json_array & msg)
+void wamp_session::process_inbound_error(json_array & msg, raw_args & raw)
 {
   /* EV thread */
 
@@ -1832,11 +1919,7 @@ void wamp_session::process_inbound_error(json_array & msg)
         }
 
         if (orig_request.yield_cb && user_cb_allowed()) {
-          wamp_args args;
-          if ( msg.size() > 5 )
-            args.args_list = std::move(msg[5].as_array());
-          if ( msg.size() > 6 )
-            args.args_dict = std::move(msg[6].as_object());
+          wamp_args args = extract_args(msg, 5, raw);
 
           try
           {
@@ -2099,7 +2182,7 @@ t_request_id wamp_session::publish(const std::string& uri,
 }
 
 
-void wamp_session::process_inbound_call(json_array & msg)
+void wamp_session::process_inbound_call(json_array & msg, raw_args & raw)
 {
   /* EV thread */
 
@@ -2113,11 +2196,7 @@ void wamp_session::process_inbound_call(json_array & msg)
   if (!msg[3].is_string()) throw protocol_error("procedure uri must be string");
   std::string procedure_uri = std::move(msg[3].as_string());
 
-  wamp_args my_wamp_args;
-  if ( msg.size() > 4 )
-    my_wamp_args.args_list = msg[4].as_array();
-  if ( msg.size() > 5 )
-    my_wamp_args.args_dict = msg[5].as_object();
+  wamp_args my_wamp_args = extract_args(msg, 4, raw);
 
   session_handle wp = this->handle();
   auto reply_fn = [wp, request_id](wamp_args args,
@@ -2168,8 +2247,7 @@ t_request_id wamp_session::invocation(t_registration_id registration_id,
 {
   /* EV & USER thread */
 
-  json_array msg {msg_type::wamp_msg_invocation, 0, registration_id, options,
-      args.args_list, args.args_dict};
+  json_array msg {msg_type::wamp_msg_invocation, 0, registration_id, options};
 
   t_request_id request_id;
   invocation_request request {std::move(fn), user};
@@ -2185,14 +2263,14 @@ t_request_id wamp_session::invocation(t_registration_id registration_id,
       m_pending_invocation[request_id] = std::move(request);
     }
 
-    send_msg( msg );
+    send_msg(std::move(msg), std::move(args));
   }
 
   return  request_id;
 }
 
 
-void wamp_session::process_inbound_yield(json_array & msg)
+void wamp_session::process_inbound_yield(json_array & msg, raw_args & raw)
 {
   /* EV thread */
 
@@ -2221,11 +2299,7 @@ void wamp_session::process_inbound_yield(json_array & msg)
 
   // invoke user callback if permitted, and handle exception
   if (orig_request.yield_cb && user_cb_allowed()) {
-    wamp_args args;
-    if ( msg.size() > 3 )
-      args.args_list = std::move(msg[3].as_array());
-    if ( msg.size() > 4 )
-      args.args_dict = std::move(msg[4].as_object());
+    wamp_args args = extract_args(msg, 3, raw);
 
     try {
       yield_info info (request_id, std::move(options), std::move(args), orig_request.user);
@@ -2238,7 +2312,7 @@ void wamp_session::process_inbound_yield(json_array & msg)
 }
 
 
-void wamp_session::process_inbound_publish(json_array & msg)
+void wamp_session::process_inbound_publish(json_array & msg, raw_args & raw)
 {
   /* EV thread */
 
@@ -2251,11 +2325,7 @@ void wamp_session::process_inbound_publish(json_array & msg)
 
   if (!msg[3].is_string()) throw protocol_error("topic uri must be string");
 
-  wamp_args args;
-  if ( msg.size() > 4 )
-    args.args_list = std::move(msg[4].as_array());
-  if ( msg.size() > 5 )
-    args.args_dict = std::move(msg[5].as_object());
+  wamp_args args = extract_args(msg, 4, raw);
 
   try
   {
@@ -2455,33 +2525,74 @@ void wamp_session::transition_to_closed()
     /* ignore */
   }
 
+  // Timers no longer have any purpose, so release them now rather than waiting
+  // for them to expire.
+  std::vector<timer_handle> timers;
+  {
+    std::lock_guard<std::mutex> guard(m_timers_lock);
+    m_timers_cancelled = true;
+    timers.swap(m_timers);
+  }
+  for (auto& t : timers)
+    t.cancel();
+
   m_has_closed.set_value();
 }
 
 
+void wamp_session::track_timer(timer_handle h)
+{
+  /* ANY thread */
+  std::lock_guard<std::mutex> guard(m_timers_lock);
+  if (m_timers_cancelled)
+    h.cancel();
+  else
+    m_timers.push_back(h);
+}
+
+
+void wamp_session::schedule_timer(std::chrono::milliseconds delay,
+                                  std::chrono::milliseconds interval,
+                                  std::function<void(wamp_session&)> fn)
+{
+  /* ANY thread */
+
+  /* The timer itself fires on whichever EV thread is free, so its work is
+   * posted to the session strand, to run in order with inbound messages and
+   * never concurrently with them. The timer repeats while the session lives. */
+  std::weak_ptr<wamp_session> wp = handle();
+  auto on_timer = [wp, interval, fn]() -> std::chrono::milliseconds {
+    auto sp = wp.lock();
+    if (!sp)
+      return std::chrono::milliseconds(0); /* cancel timer */
+
+    sp->m_strand->dispatch([wp, fn]() {
+      if (auto sp = wp.lock())
+        fn(*sp);
+    });
+    return interval;
+  };
+
+  track_timer(m_kernel->get_event_loop()->dispatch(delay, std::move(on_timer)));
+}
+
+
 void wamp_session::schedule_terminate_on_timeout(std::chrono::milliseconds ms,
                                                  bool include_warning)
 {
   /* Schedule a timeout so that if graceful closure has not been achieved within
    * a reasonable period then we forcefully terminate the session. */
-  std::weak_ptr<wamp_session> wp = shared_from_this();
-
-  event_loop::timer_fn fn = [wp, include_warning]()
-    {
-      if (auto sp = wp.lock()) {
-        std::lock_guard<std::mutex> guard(sp->m_state_lock);
-        if (sp->m_state == state::closing_wait) {
-          if (include_warning) {
-            logger & __logger = sp->__logger;
-            LOG_WARN(sp->m_log_prefix << "timeout waiting for peer");
-          }
-          sp->terminate(guard);
-        }
+  schedule_timer(ms, std::chrono::milliseconds(0),
+                 [include_warning](wamp_session& s) {
+    std::lock_guard<std::mutex> guard(s.m_state_lock);
+    if (s.m_state == state::closing_wait) {
+      if (include_warning) {
+        logger & __logger = s.__logger;
+        LOG_WARN(s.m_log_prefix << "timeout waiting for peer");
       }
-      return std::chrono::milliseconds(0);
-    };
-
-  m_kernel->get_event_loop()->dispatch(ms, std::move(fn));
+      s.terminate(guard);
+    }
+  });
 }
 
 
@@ -2597,7 +2708,7 @@ void wamp_session::terminate(std::lock_guard<std::mutex>&)
   // TODO: what if the EV thread is closed? Have the EV to throw an exception to
   // detect this.
   std::shared_ptr<wamp_session> sp = shared_from_this();
-  m_kernel->get_event_loop()->dispatch([sp](){ sp->transition_to_closed(); });
+  m_strand->dispatch([sp](){ sp->transition_to_closed(); });
 }
 
 
@@ -2644,6 +2755,11 @@ void wamp_session::result(t_request_id id, json_object dt, json_array ja, json_o
   send_msg({msg_type::wamp_msg_result, id, std::move(dt), std::move(ja), std::move(jo)});
 }
 
+void wamp_session::result(t_request_id id, json_object dt, wamp_args args)
+{
+  send_msg({msg_type::wamp_msg_result, id, std::move(dt)}, std::move(args));
+}
+
 void wamp_session::call_error(t_request_id id, std::string uri)
 {
   send_msg({msg_type::wamp_msg_error, msg_type::wamp_msg_call, id, json_value::make_object(), std::move(uri)});
@@ -2674,6 +2790,12 @@ void wamp_session::call_error(t_request_id id, std::string uri, json_object deta
   send_msg({msg_type::wamp_msg_error, msg_type::wamp_msg_call, id, std::move(details), std::move(uri), std::move(ja), std::move(jo)});
 }
 
+void wamp_session::call_error(t_request_id id, std::string uri, json_object details, wamp_args args)
+{
+  send_msg({msg_type::wamp_msg_error, msg_type::wamp_msg_call, id, std::move(details), std::move(uri)},
+           std::move(args));
+}
+
 void wamp_session::yield(t_request_id id)
 {
   send_msg({msg_type::wamp_msg_yield, id, json_value::make_object()});
@@ -2817,12 +2939,8 @@ void wamp_session::publish_error(t_request_id id, std::string uri, json_object d
 
 void wamp_session::event(t_subscription_id sub_id, t_publication_id pub_id, json_object details, wamp_args args)
 {
-  json_array msg {msg_type::wamp_msg_event, sub_id, pub_id,
-      std::move(details),
-      std::move(args.args_list),
-      std::move(args.args_dict)};
-
-  send_msg( std::move(msg) );
+  send_msg({msg_type::wamp_msg_event, sub_id, pub_id, std::move(details)},
+           std::move(args));
 }
 
 
@@ -55,7 +55,7 @@ websocket_protocol::websocket_protocol(kernel* k,
                                        protocol::protocol_callbacks callbacks,
                                        connect_mode mode,
                                        options opts)
-  : protocol(k, h, msg_cb, callbacks, mode),
+  : protocol(k, h, msg_cb, callbacks, mode, 1, BUFFER_MAX_SIZE),
     m_state(mode==connect_mode::passive? state::handling_http_request : state::handling_http_response),
     m_http_parser(new http_parser(mode==connect_mode::passive?
                                   http_parser::e_http_request : http_parser::e_http_response)),
@@ -64,6 +64,8 @@ websocket_protocol::websocket_protocol(kernel* k,
     m_last_pong(std::chrono::steady_clock::now()),
     m_missed_pings(0)
 {
+  m_lazy_args = m_options.lazy_args;
+
   // register to receive heartbeat callbacks
   if (m_options.ping_interval.count() > 0)
     callbacks.request_timer(m_options.ping_interval);
@@ -104,6 +106,23 @@ static bool header_contains(const std::string & source,
 }
 
 
+/* Write a prepared websocket frame.  The header and payload are not copied;
+ * instead the socket shares ownership of the frame until it is written. */
+static void write_frame(tcp_socket* sock,
+                        const websocket_config::message_type::ptr& frame)
+{
+  const std::string& header = frame->get_header();
+  const std::string& payload = frame->get_payload();
+
+  shared_buffer bufs[2];
+  bufs[0] = shared_buffer(std::shared_ptr<const char>(frame, header.data()),
+                          header.size());
+  bufs[1] = shared_buffer(std::shared_ptr<const char>(frame, payload.data()),
+                          payload.size());
+  sock->write(bufs, payload.empty() ? 1 : 2);
+}
+
+
 void websocket_protocol::send_msg(const json_array& ja)
 {
   if (!have_codec())
@@ -111,35 +130,91 @@ void websocket_protocol::send_msg(const json_array& ja)
 
   LOG_TRACE("fd: " << fd() << ", json_tx: " << ja);
 
-  websocketpp::frame::opcode::value op{};
+  shared_buffer frame = encode_frame(ja);
+  if (!frame.empty())
+    m_socket->write(&frame, 1);
+}
+
+
+void websocket_protocol::send_shared_msg(outbound_message& msg)
+{
+  if (!have_codec())
+    return;
+
+  LOG_TRACE("fd: " << fd() << ", json_tx: " << msg.msg());
+
+  /* client frames are masked with a random key, so cannot be shared */
+  if (mode() == connect_mode::active) {
+    shared_buffer frame = encode_frame(msg.msg(), msg.args());
+    if (!frame.empty())
+      m_socket->write(&frame, 1);
+    return;
+  }
+
+  auto bufs = msg.find(NAME, m_codec->type());
+  if (!bufs) {
+    std::vector<shared_buffer> framed;
+    shared_buffer frame = encode_frame(msg.msg(), msg.args());
+    if (!frame.empty())
+      framed.push_back(std::move(frame));
+    bufs = &msg.store(NAME, m_codec->type(), std::move(framed));
+  }
+
+  if (!bufs->empty())
+    m_socket->write(bufs->data(), bufs->size());
+}
+
+
+/* Encode a message as a single data frame.  The payload is encoded after space
+ * reserved for the largest frame header, and is masked in place if required;
+ * the header is then written directly ahead of it.  This is equivalent to the
+ * websocketpp processor's prepare_data_frame, but without copying the payload
+ * into websocketpp message objects. */
+shared_buffer websocket_protocol::encode_frame(const json_array& ja,
+                                               const raw_args& args)
+{
+  namespace frame = websocketpp::frame;
+
+  frame::opcode::value op{};
   switch (m_codec->type())
   {
-    case serialiser_type::none: return;
-    case serialiser_type::json: op = websocketpp::frame::opcode::text; break;
-    case serialiser_type::msgpack: op = websocketpp::frame::opcode::binary; break;
+    case serialiser_type::none: return {};
+    case serialiser_type::json: op = frame::opcode::text; break;
+    case serialiser_type::msgpack: op = frame::opcode::binary; break;
   }
 
-  auto bytes = encode(ja);
+  output_sink sink(frame::MAX_HEADER_LENGTH, &m_sink_pool);
+  encode_into(ja, args, sink);
 
-  auto msg_ptr = m_websock_impl->msg_manager()->get_message(op,bytes.size());
-  msg_ptr->append_payload(bytes.data(), bytes.size());
-  auto out_msg_ptr = m_websock_impl->msg_manager()->get_message();
+  char* payload = sink.payload();
+  const size_t len = sink.payload_size();
 
-  if (out_msg_ptr == nullptr)
-    throw std::runtime_error("failed to obtain msg object");
+  if (op == frame::opcode::text) {
+    websocketpp::utf8_validator::validator utf8;
+    if (!utf8.decode(payload, payload + len) || !utf8.complete())
+      throw std::runtime_error(websocketpp::processor::error::make_error_code(
+          websocketpp::processor::error::invalid_payload).message());
+  }
 
-  auto ec = m_websock_impl->processor()->prepare_data_frame(msg_ptr, out_msg_ptr);
-  if (ec)
-    throw std::runtime_error(ec.message());
+  /* frames sent by a client must be masked */
+  const bool masked = (mode() == connect_mode::active);
 
-  LOG_TRACE("fd: " << fd() << ", frame_tx: " <<
-            websocketpp_impl::frame_to_string(out_msg_ptr));
+  frame::basic_header h(op, len, true, masked);
+  std::string header;
+  if (masked) {
+    frame::masking_key_type key;
+    key.i = m_websock_impl->masking_key();
+    frame::word_mask_exact(reinterpret_cast<uint8_t*>(payload), len, key);
+    header = frame::prepare_header(h, frame::extended_header(len, key.i));
+  } else
+    header = frame::prepare_header(h, frame::extended_header(len));
 
-  std::pair<const char*, size_t> bufs[2] = {
-    { out_msg_ptr->get_header().data(), out_msg_ptr->get_header().size() },
-    { out_msg_ptr->get_payload().data(), out_msg_ptr->get_payload().size()  } };
+  memcpy(sink.prepend(header.size()), header.data(), header.size());
 
-  m_socket->write(bufs, 2);
+  LOG_TRACE("fd: " << fd() << ", frame_tx: fin 1, opcode " << op
+            << ", payload_len " << len);
+
+  return sink.release();
 }
 
 
@@ -361,15 +436,7 @@ void websocket_protocol::send_impl(const websocketpp_msg& msg)
   LOG_TRACE("fd: " << fd() << ", frame_tx: " <<
             websocketpp_impl::frame_to_string(msg.ptr));
 
-  if (msg.ptr->get_payload().empty()) {
-    m_socket->write(msg.ptr->get_header().data(), msg.ptr->get_header().size());
-  }
-  else {
-    std::pair<const char*, size_t> bufs[2] = {
-      { msg.ptr->get_header().data(), msg.ptr->get_header().size() },
-      { msg.ptr->get_payload().data(), msg.ptr->get_payload().size()  } };
-    m_socket->write(bufs, 2);
-  }
+  write_frame(m_socket, msg.ptr);
 }
 
 
@@ -1,7 +1,11 @@
 #include "wampcc/json.h"
+
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <list>
+#include <thread>
+#include <vector>
 
 
 #include "mini_test.h"
@@ -447,6 +451,186 @@ TEST_CASE( "compare_unint_and_int" )
   REQUIRE(wampcc::json_value::make_uint(1) == wampcc::json_value::make_int(1));
 }
 
+//----------------------------------------------------------------------
+TEST_CASE( "encode_strings_and_numbers" )
+{
+  // long enough that escapes fall both inside and after vectorised blocks
+  std::string text = "quote\" backslash\\ solidus/ tab\t newline\n cr\r ";
+  text += std::string("\x01\x1f\b\f", 4);
+  text += "caf\xc3\xa9 and the rest of a long plain tail";
+
+  wampcc::json_array msg;
+  msg.push_back(text);
+  msg.push_back(-9223372036854775807LL - 1);
+  msg.push_back(wampcc::json_value::make_uint(18446744073709551615ULL));
+  msg.push_back(0.1);
+  msg.push_back(-2.0);
+  msg.push_back(1e300);
+  msg.push_back(
+      wampcc::json_object{{"k\"ey", wampcc::json_value()}, {"a", false}});
+
+  std::string enc = wampcc::json_encode(msg);
+  REQUIRE(enc == "[\"quote\\\" backslash\\\\ solidus/ tab\\t newline\\n cr\\r "
+                 "\\u0001\\u001F\\b\\f"
+                 "caf\xc3\xa9 and the rest of a long plain tail\", "
+                 "-9223372036854775808, 18446744073709551615, 0.1, -2.0, "
+                 "1e+300, {\"a\": false, \"k\\\"ey\": null}]");
+
+  // round trip, excluding the uint which the vendor decoder cannot represent
+  msg.erase(msg.begin() + 2);
+  REQUIRE(wampcc::json_decode(wampcc::json_encode(msg).c_str()) ==
+          wampcc::json_value(msg));
+
+  // buffer overloads append to existing content
+  std::vector<char> buf{'x'};
+  wampcc::json_encode(wampcc::json_array({1, "two"}), buf);
+  REQUIRE(std::string(buf.begin(), buf.end()) == "x[1, \"two\"]");
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "encode_rejects_invalid_utf8" )
+{
+  // the decoder would refuse such output, so it must not be produced
+  const char* bad[] = {"\xff", "caf\xc3", "\xc3\x28 tail", "\xed\xa0\x80",
+                       "a long run of plain text before the bad byte \x80"};
+
+  for (auto s : bad) {
+    std::vector<char> buf{'x'};
+    bool thrown = false;
+    try {
+      wampcc::json_encode(wampcc::json_array({s}), buf);
+    } catch (wampcc::json_error&) {
+      thrown = true;
+    }
+    REQUIRE(thrown);
+    REQUIRE(buf.size() == 1); // left as it was
+  }
+
+  // reals with no JSON representation are written as null
+  wampcc::json_array reals{std::numeric_limits<double>::quiet_NaN(),
+                           std::numeric_limits<double>::infinity()};
+  REQUIRE(wampcc::json_encode(reals) == "[null, null]");
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "inline_values_move_and_swap" )
+{
+  // strings and arrays live inside the value, so check they survive being
+  // moved, swapped and reassigned
+  std::string long_str(100, 'x');
+
+  wampcc::json_value s1("op");
+  wampcc::json_value s2(long_str);
+  wampcc::json_value a1(wampcc::json_array{"_p", 1, long_str});
+
+  wampcc::json_value moved(std::move(s1));
+  REQUIRE(moved.as_string() == "op");
+  REQUIRE(s1.is_null());
+
+  s1.swap(a1);
+  REQUIRE(s1.as_array().size() == 3);
+  REQUIRE(s1.as_array()[2].as_string() == long_str);
+  REQUIRE(a1.is_null());
+
+  s2.swap(moved);
+  REQUIRE(s2.as_string() == "op");
+  REQUIRE(moved.as_string() == long_str);
+
+  std::vector<wampcc::json_value> grown;
+  for (int i = 0; i < 100; i++)
+    grown.push_back(std::to_string(i));
+  REQUIRE(grown[99].as_string() == "99");
+
+  // assign a value from within itself
+  wampcc::json_value tree(wampcc::json_array{wampcc::json_array{"inner"}});
+  tree = std::move(tree.as_array()[0]);
+  REQUIRE(tree == wampcc::json_value(wampcc::json_array{"inner"}));
+  tree = tree.as_array()[0];
+  REQUIRE(tree.as_string() == "inner");
+  tree = std::move(tree);
+  REQUIRE(tree.as_string() == "inner");
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "shared_values_copy_on_write" )
+{
+  std::string long_str(100, 'x');
+  wampcc::json_value orig(wampcc::json_array{
+      1, long_str, wampcc::json_object{{"args", wampcc::json_array{"a", "b"}},
+                                       {"key", long_str}}});
+  const wampcc::json_value expected = orig;
+
+  orig.share();
+  REQUIRE(orig.is_shared());
+  REQUIRE(orig == expected);
+  REQUIRE(expected == orig);
+
+  // copies refer to the same data, read through const access
+  const wampcc::json_value copy1 = orig;
+  wampcc::json_value copy2 = orig;
+  REQUIRE(copy1.is_shared());
+  REQUIRE(&copy1.as_array() == &static_cast<const wampcc::json_value&>(orig).as_array());
+  const wampcc::json_value& view2 = copy2;
+  REQUIRE(copy1[1].as_string().data() == view2[1].as_string().data());
+
+  // mutation detaches just the path being altered
+  const wampcc::json_value& inner = copy1[2];
+  copy2[2]["key"] = "changed";
+  REQUIRE(!copy2.is_shared());
+  REQUIRE(copy2[1].is_shared());
+  REQUIRE(copy2[2]["args"].is_shared());
+  REQUIRE(copy1 == expected);
+  REQUIRE(orig == expected);
+  REQUIRE(inner.as_object().at("key").as_string() == long_str);
+  REQUIRE(copy2[2].as_object().at("key").as_string() == "changed");
+  REQUIRE(copy2 != expected);
+
+  // explicit detach, taking the data when the last copy
+  wampcc::json_value last(wampcc::json_array{long_str});
+  last.share();
+  const char* data = static_cast<const wampcc::json_value&>(last)[0].as_string().data();
+  last.make_unique();
+  REQUIRE(!last.is_shared());
+  REQUIRE(last[0].is_shared());
+  last[0].make_unique();
+  REQUIRE(last[0].as_string().data() == data);
+
+  // sharing again only shares what is not already shared
+  copy2.share();
+  REQUIRE(copy2.is_shared());
+  REQUIRE(copy2[0].as_int() == 1);
+
+  // decoding over a shared value leaves the other copies untouched
+  wampcc::json_value decoded = orig;
+  wampcc::json_decode(decoded, "[2, \"y\", {\"key\": \"z\"}]");
+  REQUIRE(decoded == wampcc::json_value(wampcc::json_array{
+                         2, "y", wampcc::json_object{{"key", "z"}}}));
+  REQUIRE(orig == expected);
+
+  std::vector<char> packed;
+  wampcc::json_msgpack_encode(expected, packed);
+  wampcc::json_value unpacked = orig;
+  wampcc::json_msgpack_decode(unpacked, packed.data(), packed.size());
+  REQUIRE(unpacked == expected);
+  REQUIRE(wampcc::json_encode(orig) == wampcc::json_encode(expected));
+
+  // copies can be released from other threads
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++)
+    threads.emplace_back([orig, expected]() {
+      for (int j = 0; j < 1000; j++) {
+        wampcc::json_value local = orig;
+        if (j % 2)
+          local[2]["key"] = j;
+        else if (local != expected)
+          throw std::runtime_error("shared value altered");
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+  REQUIRE(orig == expected);
+}
+
 //----------------------------------------------------------------------
 // TEST_CASE( demo_test )
 // {
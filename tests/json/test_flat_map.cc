@@ -0,0 +1,176 @@
+#include "wampcc/json.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mini_test.h"
+
+using namespace wampcc;
+
+typedef json_flat_map<json_value> flat_object;
+
+/* Check the flat map holds the same entries, in the same order, as the map */
+static bool same_entries(const flat_object& flat,
+                         const std::map<std::string, json_value>& ref)
+{
+  if (flat.size() != ref.size())
+    return false;
+  auto it = ref.begin();
+  for (auto& item : flat) {
+    if (item.first != it->first || item.second != it->second)
+      return false;
+    ++it;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("flat_map_small")
+{
+  flat_object obj{{"receive_progress", true}, {"acknowledge", false}};
+  obj["disclose_me"] = true;
+  obj.insert({"_p", 1});
+  obj.emplace("caller", 42);
+
+  std::vector<std::string> keys;
+  for (auto& item : obj)
+    keys.push_back(item.first);
+  REQUIRE(keys == (std::vector<std::string>{"_p", "acknowledge", "caller",
+                                            "disclose_me",
+                                            "receive_progress"}));
+
+  REQUIRE(obj.find("disclose_me") != obj.end());
+  REQUIRE(obj.find("disclose_me")->second.as_bool());
+  REQUIRE(obj.find("exclude_me") == obj.end());
+  REQUIRE(obj.count("caller") == 1);
+  REQUIRE(obj.at("caller").as_int() == 42);
+
+  /* an existing key is not replaced by insert */
+  auto ins = obj.insert({"caller", 7});
+  REQUIRE(ins.second == false);
+  REQUIRE(ins.first->second.as_int() == 42);
+  REQUIRE(obj.size() == 5);
+
+  REQUIRE(obj.erase("acknowledge") == 1);
+  REQUIRE(obj.erase("acknowledge") == 0);
+  REQUIRE(obj.size() == 4);
+
+  bool threw = false;
+  try {
+    obj.at("acknowledge");
+  } catch (std::out_of_range&) {
+    threw = true;
+  }
+  REQUIRE(threw);
+
+  flat_object other(obj);
+  REQUIRE(other == obj);
+  other["_p"] = 2;
+  REQUIRE(other != obj);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("flat_map_large_matches_std_map")
+{
+  /* enough keys to use the hash index, inserted in random order */
+  std::vector<std::string> keys;
+  for (int i = 0; i < 2000; i++)
+    keys.push_back("key" + std::to_string(i));
+  std::mt19937 rng(7);
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  flat_object flat;
+  std::map<std::string, json_value> ref;
+  for (size_t i = 0; i < keys.size(); i++) {
+    flat[keys[i]] = (int)i;
+    ref[keys[i]] = (int)i;
+  }
+  REQUIRE(same_entries(flat, ref));
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto it = flat.find(keys[i]);
+    REQUIRE(it != flat.end());
+    REQUIRE(it->second.as_int() == (json_int_t)i);
+  }
+  REQUIRE(flat.find("key") == flat.end());
+  REQUIRE(flat.find("key20000") == flat.end());
+
+  /* erase all but a few, crossing back below the hash threshold */
+  for (size_t i = 0; i < keys.size() - 5; i++) {
+    REQUIRE(flat.erase(keys[i]) == 1);
+    ref.erase(keys[i]);
+    if (i % 97 == 0)
+      REQUIRE(same_entries(flat, ref));
+  }
+  REQUIRE(same_entries(flat, ref));
+  for (auto& item : ref)
+    REQUIRE(flat.find(item.first)->second == item.second);
+
+  flat.clear();
+  REQUIRE(flat.empty());
+  REQUIRE(flat.find(keys.back()) == flat.end());
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("flat_map_churn_with_index")
+{
+  /* interleave inserts and erases while the index is in use, so that entries
+   * are moved into the holes left by others */
+  flat_object flat;
+  std::map<std::string, json_value> ref;
+  std::mt19937 rng(11);
+  for (int i = 0; i < 20000; i++) {
+    std::string key = "k" + std::to_string(rng() % 400);
+    if (rng() % 3 == 0) {
+      REQUIRE(flat.erase(key) == ref.erase(key));
+    }
+    else {
+      flat[key] = i;
+      ref[key] = i;
+    }
+    if (i % 501 == 0) {
+      REQUIRE(same_entries(flat, ref));
+      for (auto& item : ref)
+        REQUIRE(flat.at(item.first) == item.second);
+    }
+  }
+  REQUIRE(flat.size() > 16);
+  REQUIRE(same_entries(flat, ref));
+
+  /* erase by iterator, in key order, from the middle */
+  auto it = flat.begin() + flat.size() / 2;
+  auto expect = std::next(ref.begin(), flat.size() / 2);
+  it = flat.erase(it);
+  expect = ref.erase(expect);
+  REQUIRE(it->first == expect->first);
+  REQUIRE(same_entries(flat, ref));
+  REQUIRE(flat.rbegin()->first == ref.rbegin()->first);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("flat_map_in_json_value")
+{
+  /* nested use as for json_object */
+  json_flat_map<json_value> outer;
+  outer["args"] = json_array{1, 2, 3};
+  outer["kwargs"] = json_value::make_object();
+  outer.erase(outer.begin());
+  REQUIRE(outer.size() == 1);
+  REQUIRE(outer.begin()->first == "kwargs");
+  REQUIRE(outer.begin()->second.is_object());
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    int result = minitest::run(argc, argv);
+    return (result < 0xFF ? result : 0xFF );
+  } catch (std::exception& e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,289 @@
+#include "wampcc/json.h"
+#include "json_simd.h"
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "mini_test.h"
+
+using namespace wampcc;
+
+/* Instruction sets usable on this CPU; each must decode identically. */
+std::vector<json_simd> simd_levels()
+{
+  std::vector<json_simd> levels{json_simd::scalar};
+  if (json_simd_available() == json_simd::sse2 ||
+      json_simd_available() == json_simd::avx2)
+    levels.push_back(json_simd::sse2);
+  if (json_simd_available() == json_simd::avx2)
+    levels.push_back(json_simd::avx2);
+  return levels;
+}
+
+json_value decode_with(json_simd level, const std::string& text)
+{
+  json_value v;
+  json_decode(v, text.data(), text.size(), level);
+  return v;
+}
+
+bool fails_to_decode(const std::string& text)
+{
+  for (auto level : simd_levels()) {
+    try {
+      decode_with(level, text);
+      return false;
+    } catch (parse_error&) {
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("decode_values")
+{
+  const std::string text =
+      " { \"a\" : [ 0, -1, 12.5, -0.25e2, 1E3, true, false, null ],\n"
+      "\"b\":{\"c\":\"d\",\"e\":[]},\"f\":{}, \"g\":9223372036854775807,"
+      "\"h\":18446744073709551615, \"i\":-9223372036854775808 } ";
+
+  for (auto level : simd_levels()) {
+    json_value v = decode_with(level, text);
+    json_object& obj = v.as_object();
+    REQUIRE(obj.size() == 6);
+
+    json_array& a = obj["a"].as_array();
+    REQUIRE(a.size() == 8);
+    REQUIRE(a[0].is_int() && a[0].as_int() == 0);
+    REQUIRE(a[1].is_int() && a[1].as_int() == -1);
+    REQUIRE(a[2].is_real() && a[2].as_real() == 12.5);
+    REQUIRE(a[3].is_real() && a[3].as_real() == -25.0);
+    REQUIRE(a[4].is_real() && a[4].as_real() == 1000.0);
+    REQUIRE(a[5].is_true());
+    REQUIRE(a[6].is_false());
+    REQUIRE(a[7].is_null());
+
+    REQUIRE(obj["b"].as_object()["c"].as_string() == "d");
+    REQUIRE(obj["b"].as_object()["e"].as_array().empty());
+    REQUIRE(obj["f"].as_object().empty());
+    REQUIRE(obj["g"].as_int() == 9223372036854775807LL);
+    REQUIRE(obj["h"].is_uint());
+    REQUIRE(obj["h"].as_uint() == 18446744073709551615ULL);
+    REQUIRE(obj["i"].as_int() == -9223372036854775807LL - 1);
+  }
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("decode_strings")
+{
+  const std::string text =
+      "[\"plain\", \"q\\\"b\\\\s\\/\\b\\f\\n\\r\\t\", \"\\u00e9\\u20AC\", "
+      "\"\\ud83d\\ude00\", \"caf\xc3\xa9\", \"{[:,]} \\\\\", \"\"]";
+
+  for (auto level : simd_levels()) {
+    json_array a = decode_with(level, text).as_array();
+    REQUIRE(a.size() == 7);
+    REQUIRE(a[0].as_string() == "plain");
+    REQUIRE(a[1].as_string() == "q\"b\\s/\b\f\n\r\t");
+    REQUIRE(a[2].as_string() == "\xc3\xa9\xe2\x82\xac");
+    REQUIRE(a[3].as_string() == "\xf0\x9f\x98\x80");
+    REQUIRE(a[4].as_string() == "caf\xc3\xa9");
+    REQUIRE(a[5].as_string() == "{[:,]} \\");
+    REQUIRE(a[6].as_string() == "");
+  }
+}
+
+//----------------------------------------------------------------------
+/* Unlike jansson without JSON_ALLOW_NUL, "\u0000" is accepted, so that
+ * strings holding NUL, which the encoder writes as "\u0000", round trip. */
+TEST_CASE("decode_nul_escape")
+{
+  const std::string expected("a\0b", 3);
+
+  for (auto level : simd_levels()) {
+    json_array a = decode_with(level, "[\"a\\u0000b\"]").as_array();
+    REQUIRE(a.size() == 1);
+    REQUIRE(a[0].as_string() == expected);
+  }
+
+  json_value v = json_array({expected});
+  std::string text = json_encode(v);
+  REQUIRE(text == "[\"a\\u0000b\"]");
+  REQUIRE(json_decode(text.data(), text.size()) == v);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("decode_duplicate_key_takes_last")
+{
+  json_value v = json_decode("{\"a\": 1, \"b\": 2, \"a\": 3}");
+  REQUIRE(v.as_object().size() == 2);
+  REQUIRE(v.as_object()["a"] == 3);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("decode_errors")
+{
+  const char* bad[] = {"",          "   ",        "1",
+                       "\"s\"",     "[",          "[1,]",
+                       "[1 2]",     "{\"a\" 1}",  "{\"a\":}",
+                       "{1:2}",     "[tru]",      "[truex]",
+                       "[01]",      "[1.]",       "[-]",
+                       "[1e]",      "[\"abc]",    "[\"a\\x\"]",
+                       "[\"\\ud800\"]", "[\"\x01\"]", "[\"\xc3\"]",
+                       "[\"\xed\xa0\x80\"]", "[1] [2]", "[1]]",
+                       "[18446744073709551616]", "[-9223372036854775809]",
+                       "[1e999]",   "[\"a\"1]",   "[1\"a\"]"};
+
+  for (auto text : bad) {
+    bool failed = fails_to_decode(text);
+    if (!failed)
+      std::cout << "decoded invalid json: " << text << std::endl;
+    REQUIRE(failed);
+  }
+
+  try {
+    json_decode("[1,\n  2,\n  x]");
+    REQUIRE(false);
+  } catch (parse_error& e) {
+    REQUIRE(e.line == 3);
+    REQUIRE(e.column == 3);
+    REQUIRE(e.position == 11);
+  }
+
+  std::string deep(3000, '[');
+  deep += std::string(3000, ']');
+  REQUIRE(fails_to_decode(deep));
+}
+
+//----------------------------------------------------------------------
+TEST_CASE("decode_agrees_across_simd_levels")
+{
+  /* strings dense in backslashes and quotes, so that escape runs and strings
+   * span the 64 byte block boundaries at every alignment */
+  std::mt19937 gen(42);
+  const char alphabet[] = "ab\\\\\\\"{}[],: ";
+
+  for (int round = 0; round < 500; round++) {
+    json_array arr;
+    size_t count = gen() % 20;
+    for (size_t i = 0; i < count; i++) {
+      std::string s(gen() % 90, ' ');
+      for (auto& c : s)
+        c = alphabet[gen() % (sizeof(alphabet) - 1)];
+      arr.push_back(s);
+      arr.push_back(static_cast<int>(gen() % 1000));
+    }
+
+    std::string text = std::string(gen() % 64, ' ') + json_encode(arr);
+    for (auto level : simd_levels())
+      REQUIRE(decode_with(level, text) == json_value(arr));
+  }
+}
+
+//----------------------------------------------------------------------
+size_t head_of_two(const json_value&) { return 2; }
+
+TEST_CASE("decode_head_and_splice")
+{
+  const std::string text = " [ 48, 7 , [1, \"a\"],\n {\"k\": [null]}  ] ";
+
+  json_array head;
+  json_array_tail tail =
+      json_decode_head(head, text.data(), text.size(), head_of_two);
+
+  REQUIRE(head == json_array({48, 7}));
+  REQUIRE(tail.count == 2);
+  REQUIRE(tail.first_type == eARRAY);
+  REQUIRE(tail.last_type == eOBJECT);
+  REQUIRE(std::string(text.data() + tail.offset, tail.length) ==
+          "[1, \"a\"],\n {\"k\": [null]}");
+
+  // splicing onto a new head gives the same result as a full encode
+  std::vector<char> out;
+  json_encode_spliced({50, 9}, text.data() + tail.offset, tail.length, out);
+  json_value full = json_decode(out.data(), out.size());
+  REQUIRE(full == json_value(json_array{
+                      50, 9, json_array{1, "a"},
+                      json_object{{"k", json_array{json_value::make_null()}}}}));
+
+  // a message no longer than the head leaves no tail
+  head.clear();
+  tail = json_decode_head(head, "[48,7]", 6, head_of_two);
+  REQUIRE(head.size() == 2);
+  REQUIRE(tail.count == 0);
+
+  // the tail is validated even though it is not decoded
+  const char* bad[] = {"[48, 7, [1,]]", "[48, 7, \"\\x\"]",
+                       "[48, 7, [1e999]]", "48", "[48, 7, 1"};
+  for (auto text : bad) {
+    head.clear();
+    bool failed = false;
+    try {
+      json_decode_head(head, text, strlen(text), head_of_two);
+    } catch (parse_error&) {
+      failed = true;
+    }
+    REQUIRE(failed);
+  }
+}
+
+TEST_CASE("decode_over_earlier_value")
+{
+  /* decoding over any earlier value gives the same result as decoding into a
+   * new one */
+  const char* texts[] = {
+      "[48, 1, {}, \"com.myapp.user.new\", [\"johnny\"], {\"a\": 1}]",
+      "[48, 2, {\"disclose_me\": true}, \"com.myapp.user.new\"]",
+      "[48, 3, {\"disclose_me\": false, \"_p\": [1, 2]}, \"short\", [], {}]",
+      "{\"k\": {\"x\": 1, \"y\": 2, \"k\": 3}, \"k\": {\"y\": \"s\"}}",
+      "[\"a rather long string, longer than the small buffer\", [[1], [2]]]",
+      "[[1, 2, 3], {\"z\": null, \"a\": [true]}, 1.5, \"x\"]",
+      "{}",
+      "[]"};
+
+  for (auto before : texts)
+    for (auto after : texts) {
+      json_value dest = json_decode(before);
+      json_decode(dest, after);
+      REQUIRE(dest == json_decode(after));
+    }
+
+  /* an object large enough to sort the decoded keys */
+  std::string big = "{";
+  for (int i = 0; i < 40; i++)
+    big += (i ? ", \"" : "\"") + std::to_string(i) + "\": " +
+           std::to_string(i);
+  big += "}";
+  json_value dest = json_decode(big.c_str());
+  json_decode(dest, "{\"7\": 0, \"new\": 1, \"7\": 2, \"31\": 3}");
+  REQUIRE(dest == json_decode("{\"7\": 2, \"new\": 1, \"31\": 3}"));
+
+  /* the storage of strings and arrays is kept */
+  std::string long_str(100, 'x');
+  dest = json_array{long_str, json_array{1, 2, 3}};
+  const char* str_data = dest.as_array()[0].as_string().data();
+  const json_value* elements = dest.as_array()[1].as_array().data();
+  json_decode(dest, "[\"another string\", [4, 5]]");
+  REQUIRE(dest.as_array()[0].as_string().data() == str_data);
+  REQUIRE(dest.as_array()[1].as_array().data() == elements);
+
+  /* including the head of a partially decoded message */
+  json_array head{"old", json_object{{"a", 1}}, 99};
+  json_array_tail tail = json_decode_head(head, "[48, 7, [1], {}]", 16,
+                                          head_of_two);
+  REQUIRE(head == json_array({48, 7}));
+  REQUIRE(tail.count == 2);
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    int result = minitest::run(argc, argv);
+    return (result < 0xFF ? result : 0xFF );
+  } catch (std::exception& e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include "mini_test.h"
+
+#include <random>
+
+using namespace wampcc;
+
+//----------------------------------------------------------------------
+
+/* Check that applying the diff of two values to the first gives the second,
+ * returning the number of operations in the diff. */
+static size_t check_diff(const json_value& before, const json_value& after)
+{
+  json_array patch = json_diff(before, after);
+  json_value result = before;
+  if (!result.patch(patch) || result != after) {
+    std::cout << "before: " << before << std::endl
+              << "after : " << after << std::endl
+              << "patch : " << patch << std::endl
+              << "result: " << result << std::endl;
+    throw std::runtime_error("diff failed");
+  }
+  return patch.size();
+}
+
+//----------------------------------------------------------------------
+
+static json_value op(const char* name, const char* path)
+{
+  return json_object{{"op", name}, {"path", path}};
+}
+
+static json_value op(const char* name, const char* path, json_value value)
+{
+  json_value v = op(name, path);
+  v.as_object()["value"] = std::move(value);
+  return v;
+}
+
+//----------------------------------------------------------------------
+
+TEST_CASE( "diff_equal" )
+{
+  REQUIRE(json_diff(json_value(), json_value()).empty());
+  REQUIRE(json_diff(1, 1).empty());
+  REQUIRE(json_diff("x", "x").empty());
+  json_value doc = json_object{{"a", json_array{1, 2, json_object{{"b", true}}}}};
+  REQUIRE(json_diff(doc, doc).empty());
+}
+
+TEST_CASE( "diff_scalars" )
+{
+  json_array patch = json_diff(1, "x");
+  REQUIRE(patch == json_array{op("replace", "", "x")});
+  REQUIRE(check_diff(1, 2) == 1);
+  REQUIRE(check_diff(json_value(), json_object{}) == 1);
+  REQUIRE(check_diff(json_array{}, json_object{}) == 1);
+  REQUIRE(check_diff(1, 1.0) == 1);
+}
+
+TEST_CASE( "diff_objects" )
+{
+  json_value before = json_object{{"a", 1}, {"b", 2}, {"c", json_object{{"d", 3}, {"e", 4}}},
+                                  {"g", 7}, {"h", 8}};
+  json_value after  = json_object{{"a", 1}, {"c", json_object{{"d", 3}, {"e", 5}}}, {"f", 6},
+                                  {"g", 7}, {"h", 8}};
+
+  json_array patch = json_diff(before, after);
+  REQUIRE(patch.size() == 3);
+  REQUIRE(patch[0] == op("remove", "/b"));
+  REQUIRE(patch[1] == op("replace", "/c/e", 5));
+  REQUIRE(patch[2] == op("add", "/f", 6));
+  check_diff(before, after);
+
+  // most members changed: replaced whole
+  json_value other = json_object{{"a", 2}, {"c", 3}, {"f", 4}};
+  REQUIRE(check_diff(before, other) == 1);
+}
+
+TEST_CASE( "diff_escaped_keys" )
+{
+  json_value before = json_object{{"a/b", 1}, {"m~n", 2}, {"x", 2}};
+  json_value after  = json_object{{"a/b", 3}, {"m~n", 2}, {"x", 2}, {"~/", 4}};
+
+  json_array patch = json_diff(before, after);
+  REQUIRE(patch.size() == 2);
+  REQUIRE(patch[0].as_object().at("path") == json_value("/a~1b"));
+  REQUIRE(patch[1].as_object().at("path") == json_value("/~0~1"));
+  check_diff(before, after);
+}
+
+TEST_CASE( "diff_path_prefix" )
+{
+  json_value doc = json_object{{"body", json_object{{"value", json_array{1, 2}}}}};
+  json_array patch = json_diff(json_array{1, 2}, json_array{1, 2, 3}, "/body/value");
+  REQUIRE(patch == json_array{op("add", "/body/value/2", 3)});
+  REQUIRE(doc.patch(patch));
+  json_value expected = json_array{1, 2, 3};
+  REQUIRE(doc["body"]["value"] == expected);
+}
+
+TEST_CASE( "diff_array_edits" )
+{
+  json_array list;
+  for (int i = 0; i < 1000; i++)
+    list.push_back(json_object{{"id", i}, {"name", "item" + std::to_string(i)}});
+
+  // insert in the middle
+  json_array inserted = list;
+  inserted.insert(inserted.begin() + 500, json_object{{"id", -1}});
+  json_array patch = json_diff(list, inserted);
+  json_value added = op("add", "/500", json_object{{"id", -1}});
+  REQUIRE(patch == json_array{added});
+
+  // remove from the middle
+  json_array removed = list;
+  removed.erase(removed.begin() + 250);
+  patch = json_diff(list, removed);
+  REQUIRE(patch == json_array{op("remove", "/250")});
+
+  // one member of one element changed
+  json_array modified = list;
+  modified[700].as_object()["name"] = "changed";
+  patch = json_diff(list, modified);
+  REQUIRE(patch == json_array{op("replace", "/700/name", "changed")});
+
+  // scattered edits
+  json_array edited = list;
+  edited.erase(edited.begin() + 900);
+  edited.insert(edited.begin() + 600, json_value(42));
+  edited[100].as_object()["id"] = 1000;
+  edited.erase(edited.begin() + 10);
+  REQUIRE(check_diff(list, edited) == 4);
+
+  // most elements changed: replaced whole
+  json_array reversed(list.rbegin(), list.rend());
+  REQUIRE(check_diff(list, reversed) == 1);
+}
+
+TEST_CASE( "diff_shared" )
+{
+  json_value big = json_array{};
+  for (int i = 0; i < 100; i++)
+    big.as_array().push_back(json_object{{"id", i}});
+
+  json_value before = json_object{{"a", big}, {"b", 1}};
+  before.share();
+
+  json_value after = before;
+  after.as_object()["b"] = 2;
+
+  json_array patch = json_diff(before, after);
+  REQUIRE(patch == json_array{op("replace", "/b", 2)});
+}
+
+//----------------------------------------------------------------------
+
+static json_value random_value(std::mt19937& gen, int depth)
+{
+  int kind = std::uniform_int_distribution<int>(0, depth > 0 ? 5 : 3)(gen);
+  switch (kind)
+  {
+    case 0: return json_value();
+    case 1: return std::uniform_int_distribution<int>(0, 3)(gen);
+    case 2: return std::uniform_int_distribution<int>(0, 1)(gen) == 1;
+    case 3: return std::string(1, "ab~/"[std::uniform_int_distribution<int>(0, 3)(gen)]);
+    case 4:
+    {
+      json_value v = json_value::make_array();
+      int n = std::uniform_int_distribution<int>(0, 6)(gen);
+      for (int i = 0; i < n; i++)
+        v.as_array().push_back(random_value(gen, depth - 1));
+      return v;
+    }
+    default:
+    {
+      json_value v = json_value::make_object();
+      int n = std::uniform_int_distribution<int>(0, 6)(gen);
+      for (int i = 0; i < n; i++)
+        v.as_object()[std::string(1, "ab~/"[std::uniform_int_distribution<int>(0, 3)(gen)])] =
+            random_value(gen, depth - 1);
+      return v;
+    }
+  }
+}
+
+/* Make a few random edits to a value */
+static void mutate(json_value& v, std::mt19937& gen, int depth)
+{
+  int action = std::uniform_int_distribution<int>(0, 3)(gen);
+  if (action == 0 || !v.is_container()) {
+    v = random_value(gen, depth);
+    return;
+  }
+
+  if (v.is_array()) {
+    json_array& arr = v.as_array();
+    size_t i = std::uniform_int_distribution<size_t>(0, arr.size())(gen);
+    if (action == 1)
+      arr.insert(arr.begin() + i, random_value(gen, depth - 1));
+    else if (i < arr.size() && action == 2)
+      arr.erase(arr.begin() + i);
+    else if (i < arr.size())
+      mutate(arr[i], gen, depth - 1);
+  }
+  else {
+    json_object& obj = v.as_object();
+    std::string key(1, "ab~/"[std::uniform_int_distribution<int>(0, 3)(gen)]);
+    if (action == 1)
+      obj[key] = random_value(gen, depth - 1);
+    else if (action == 2)
+      obj.erase(key);
+    else if (obj.find(key) != obj.end())
+      mutate(obj[key], gen, depth - 1);
+  }
+}
+
+TEST_CASE( "diff_random" )
+{
+  std::mt19937 gen(1);
+  for (int i = 0; i < 5000; i++)
+  {
+    json_value before = random_value(gen, 4);
+    json_value after = before;
+    int edits = std::uniform_int_distribution<int>(1, 4)(gen);
+    for (int j = 0; j < edits; j++)
+      mutate(after, gen, 4);
+    check_diff(before, after);
+
+    // and between unrelated values
+    check_diff(before, random_value(gen, 4));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    int result = minitest::run(argc, argv);
+    return (result < 0xFF ? result : 0xFF );
+  } catch (std::exception& e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+}
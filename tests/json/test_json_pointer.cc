@@ -162,6 +162,14 @@ bool patch_test(const char* docstr, const char* patchstr, const char * expectstr
 
   if (result == false) return false;
 
+  // the same patch, consumed rather than copied, must give the same result
+  json_value moved_doc = orig;
+  if (!apply_patch(moved_doc, std::move(patch)) || moved_doc != doc)
+  {
+    std::cout << "consumed patch differs: '" << moved_doc << "'\n";
+    return false;
+  }
+
   bool equal = (doc == expect);
 
   if (!equal)
@@ -393,6 +401,79 @@ TEST_CASE( "json_patch_copy" )
     );
 }
 
+//----------------------------------------------------------------------
+
+TEST_CASE( "compiled_pointer" )
+{
+  json_value doc=json_decode(
+    "{ \"foo\": [\"bar\", \"baz\", [10, 20, 30]], \"\": 0, \"a/b\": 1,"
+    "  \"m~n\": 8, \"01\": 9 }");
+  const json_value& cdoc = doc;
+
+  const char* paths[] = {"", "/foo", "/foo/0", "/foo/2/1", "/", "/a~1b",
+                         "/m~0n", "/01", "/missing", "/foo/3", "/foo/-",
+                         "/foo/0/x", "/missing/x"};
+  for (const char* path : paths)
+  {
+    compiled_json_pointer ptr(path);
+    REQUIRE(ptr.str() == path);
+    REQUIRE(ptr.eval(cdoc) == eval_json_pointer(cdoc, path));
+    REQUIRE(ptr.eval(doc) == eval_json_pointer(doc, path));
+  }
+
+  compiled_json_pointer ptr("/foo/2/1");
+  REQUIRE(ptr.size() == 3);
+  REQUIRE(ptr[0].name == "foo");
+  REQUIRE(ptr[0].index == compiled_json_pointer::npos);
+  REQUIRE(ptr[2].index == 1);
+  REQUIRE(ptr.eval(cdoc)->as_int() == 20);
+  REQUIRE(compiled_json_pointer("/a~1b")[0].name == "a/b");
+  REQUIRE(compiled_json_pointer("/foo/-")[1].index == compiled_json_pointer::end_index);
+
+  // the pointer keeps working as the document changes
+  ptr.eval(doc)->as_int() = 21;
+  doc.as_object()["foo"].as_array()[2] = json_array{0, 1};
+  REQUIRE(ptr.eval(cdoc)->as_int() == 1);
+
+  bool threw = false;
+  try { compiled_json_pointer("foo"); } catch (bad_pointer&) { threw = true; }
+  REQUIRE(threw);
+
+  threw = false;
+  try { compiled_json_pointer("/foo/01").eval(cdoc); } catch (bad_pointer& e) {
+    threw = (e.path_index == 2);
+  }
+  REQUIRE(threw);
+}
+
+//----------------------------------------------------------------------
+
+TEST_CASE( "consumed_patch" )
+{
+  std::string long_str(100, 'x');
+  json_value doc = json_object{{"a", 1}};
+  json_array patch{json_object{{"op", "add"}, {"path", "/b"}, {"value", long_str}},
+                   json_object{{"op", "replace"}, {"path", "/a"},
+                               {"value", json_array{long_str}}}};
+  const char* b_data = patch[0].as_object()["value"].as_string().data();
+  const json_value* a_data = patch[1].as_object()["value"].as_array().data();
+
+  REQUIRE(doc.patch(std::move(patch)));
+  REQUIRE(doc == json_value(json_object{{"a", json_array{long_str}}, {"b", long_str}}));
+
+  // the values were moved into the document, not copied
+  const json_value& cdoc = doc;
+  REQUIRE(cdoc.as_object().at("b").as_string().data() == b_data);
+  REQUIRE(cdoc.as_object().at("a").as_array().data() == a_data);
+
+  // a failing patch leaves the document unchanged
+  json_value before = doc;
+  json_array bad{json_object{{"op", "remove"}, {"path", "/b"}},
+                 json_object{{"op", "test"}, {"path", "/a"}, {"value", 0}}};
+  REQUIRE(doc.patch(std::move(bad)) == false);
+  REQUIRE(doc == before);
+}
+
 int main(int argc, char** argv)
 {
   try {
@@ -167,6 +167,233 @@ TEST_CASE( "msgpack_signed_integer_limits" )
   REQUIRE(jin == jout);
 }
 
+std::string hex_bytes(const std::vector<char>& v)
+{
+  static const char hex[] = "0123456789abcdef";
+  std::string s;
+  for (char c : v) {
+    s += hex[(c >> 4) & 0xF];
+    s += hex[c & 0xF];
+  }
+  return s;
+}
+
+TEST_CASE( "msgpack_encode_into_buffer" )
+{
+  wampcc::json_array msg{
+      wampcc::json_value::make_uint(300), wampcc::json_value::make_int(-33),
+      wampcc::json_value::make_int(-40000), 1.5,
+      wampcc::json_object{{"k", "v"}}, wampcc::json_value::make_null(), true};
+
+  // encoding appends to the existing buffer content
+  std::vector<char> buf{'x'};
+  wampcc::json_msgpack_encode(msg, buf);
+  REQUIRE(hex_bytes(buf) == "78"                 // 'x'
+                            "97"                 // fixarray, 7 items
+                            "cd012c"             // uint16 300
+                            "d0df"               // int8 -33
+                            "d2ffff63c0"         // int32 -40000
+                            "cb3ff8000000000000" // float64 1.5
+                            "81a16ba176"         // {"k":"v"}
+                            "c0c3");             // null, true
+
+  wampcc::json_value out;
+  wampcc::json_msgpack_decode(out, buf.data() + 1, buf.size() - 1);
+  REQUIRE(out == wampcc::json_value(msg));
+
+  // a reused buffer is not reallocated for a message of the same size
+  buf.clear();
+  const char* storage = buf.data();
+  wampcc::json_msgpack_encode(msg, buf);
+  REQUIRE(buf.data() == storage);
+}
+
+TEST_CASE( "msgpack_decode_errors" )
+{
+  const std::vector<std::string> bad{
+      "",                   // empty
+      "\x92\x01",           // array missing an item
+      "\xa3" "ab",          // string truncated
+      "\x01\x02",           // trailing bytes
+      "\xd4\x01\x02",       // ext type
+      "\xc1",               // never used
+      "\x81\x01\x02",       // map key not a string
+      "\xdd\xff\xff\xff\xff" // array larger than the input
+  };
+
+  for (auto& bytes : bad) {
+    bool thrown = false;
+    try {
+      wampcc::json_msgpack_decode(bytes.data(), bytes.size());
+    } catch (wampcc::msgpack_error&) {
+      thrown = true;
+    }
+    REQUIRE(thrown);
+  }
+}
+
+size_t head_of_two(const wampcc::json_value&) { return 2; }
+
+TEST_CASE( "msgpack_decode_head_and_splice" )
+{
+  wampcc::json_array msg{48, 7, wampcc::json_array{1, "a"},
+                         wampcc::json_object{{"k", "v"}}};
+  std::vector<char> buf;
+  wampcc::json_msgpack_encode(msg, buf);
+
+  wampcc::json_array head;
+  wampcc::json_array_tail tail =
+      wampcc::json_msgpack_decode_head(head, buf.data(), buf.size(), head_of_two);
+  REQUIRE(head == wampcc::json_array({48, 7}));
+  REQUIRE(tail.count == 2);
+  REQUIRE(tail.first_type == wampcc::eARRAY);
+  REQUIRE(tail.last_type == wampcc::eOBJECT);
+  REQUIRE(tail.offset + tail.length == buf.size());
+
+  std::vector<char> out;
+  wampcc::json_msgpack_encode_spliced({50, 9}, buf.data() + tail.offset,
+                                      tail.length, tail.count, out);
+  wampcc::json_value full;
+  wampcc::json_msgpack_decode(full, out.data(), out.size());
+  msg[0] = 50;
+  msg[1] = 9;
+  REQUIRE(full == wampcc::json_value(msg));
+
+  // the tail is validated even though it is not decoded
+  const std::vector<std::string> bad{
+      "\x93\x01\x02\x92\x01",       // tail array missing an item
+      "\x93\x01\x02\x81\x01\x02",  // tail map key not a string
+      "\x93\x01\x02\xc1",           // never used
+      "\x93\x01\x02\xd4\x01\x02"   // ext type
+  };
+  for (auto& bytes : bad) {
+    head.clear();
+    bool thrown = false;
+    try {
+      wampcc::json_msgpack_decode_head(head, bytes.data(), bytes.size(),
+                                       head_of_two);
+    } catch (wampcc::msgpack_error&) {
+      thrown = true;
+    }
+    REQUIRE(thrown);
+  }
+}
+
+std::vector<char> to_vector(const std::string& s)
+{
+  return std::vector<char>(s.begin(), s.end());
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "msgpack_decode_over_earlier_value" )
+{
+  // decoding over any earlier value gives the same result as decoding into a
+  // new one
+  std::vector<std::vector<char>> packed;
+  for (auto& item : test_inputs()) {
+    packed.emplace_back();
+    wampcc::json_msgpack_encode(item, packed.back());
+  }
+  packed.emplace_back();
+  wampcc::json_msgpack_encode(
+      wampcc::json_object{{"d01", "replaced"}, {"zz", wampcc::json_array{1}}},
+      packed.back());
+
+  for (auto& before : packed)
+    for (auto& after : packed) {
+      wampcc::json_value dest;
+      wampcc::json_msgpack_decode(dest, before.data(), before.size());
+      wampcc::json_msgpack_decode(dest, after.data(), after.size());
+      REQUIRE(dest == wampcc::json_msgpack_decode(after.data(), after.size()));
+    }
+
+  // including the head of a partially decoded message
+  std::vector<char> buf;
+  wampcc::json_msgpack_encode(
+      wampcc::json_array{48, 7, wampcc::json_array{1}, wampcc::json_object{}},
+      buf);
+  wampcc::json_array head{"old", wampcc::json_object{{"a", 1}}, 99};
+  wampcc::json_array_tail tail = wampcc::json_msgpack_decode_head(
+      head, buf.data(), buf.size(), head_of_two);
+  REQUIRE(head == wampcc::json_array({48, 7}));
+  REQUIRE(tail.count == 2);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "msgpack_json_transcode" )
+{
+  /* same output as decoding & encoding again, for which the input has its
+   * object keys in order */
+  for (auto& item : test_inputs()) {
+    std::vector<char> packed;
+    wampcc::json_msgpack_encode(item, packed);
+    std::string text = wampcc::json_encode(item);
+
+    std::vector<char> out;
+    wampcc::msgpack_to_json(packed.data(), packed.size(), out);
+    REQUIRE(out == to_vector(text));
+
+    if (item.is_array() || item.is_object()) {
+      out.clear();
+      wampcc::json_to_msgpack(text.data(), text.size(), out);
+      REQUIRE(out == packed);
+    }
+  }
+
+  // strings are unescaped, and object members keep their order
+  const std::string text =
+      "{\"z\": \"a\\\"b\\u00e9\", \"a\": [-1, 2.5, 18446744073709551615, {}]}";
+  std::vector<char> packed;
+  wampcc::json_to_msgpack(text.data(), text.size(), packed);
+  REQUIRE(wampcc::json_msgpack_decode(packed.data(), packed.size()) ==
+          wampcc::json_decode(text.c_str()));
+
+  std::vector<char> out;
+  wampcc::msgpack_to_json(packed.data(), packed.size(), out);
+  REQUIRE(out == to_vector("{\"z\": \"a\\\"b\xc3\xa9\", "
+                           "\"a\": [-1, 2.5, 18446744073709551615, {}]}"));
+
+  // the elements of an array tail convert without the enclosing array
+  const std::string tail = "[1, \"a\"], {\"k\": null}";
+  packed.clear();
+  wampcc::json_to_msgpack_tail(tail.data(), tail.size(), packed);
+  REQUIRE(hex_bytes(packed) == "9201a161"    // [1, "a"]
+                               "81a16bc0");  // {"k": null}
+  out.clear();
+  wampcc::msgpack_to_json_tail(packed.data(), packed.size(), out);
+  REQUIRE(out == to_vector(tail));
+}
+
+TEST_CASE( "msgpack_json_transcode_errors" )
+{
+  std::vector<char> out{'x'};
+
+  const char* bad_json[] = {"[1,]", "[\"\\x\"]", "1", "[1] 2", "{\"a\" 1}"};
+  for (auto text : bad_json) {
+    bool thrown = false;
+    try {
+      wampcc::json_to_msgpack(text, strlen(text), out);
+    } catch (wampcc::parse_error&) {
+      thrown = true;
+    }
+    REQUIRE(thrown);
+    REQUIRE(out.size() == 1); // output left as it was
+  }
+
+  const std::vector<std::string> bad_msgpack{"", "\x92\x01", "\x81\x01\x02",
+                                             "\xc1", "\x01\x02"};
+  for (auto& bytes : bad_msgpack) {
+    bool thrown = false;
+    try {
+      wampcc::msgpack_to_json(bytes.data(), bytes.size(), out);
+    } catch (wampcc::msgpack_error&) {
+      thrown = true;
+    }
+    REQUIRE(thrown);
+    REQUIRE(out.size() == 1);
+  }
+}
+
 int main(int argc, char** argv)
 {
   try {
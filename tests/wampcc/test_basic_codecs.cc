@@ -43,9 +43,12 @@ std::string serialiser_str(serialiser_type p)
 
 std::shared_ptr<internal_server> create_server(
     int& port, int allowed_protocols = wampcc::all_protocols,
-    int allowed_serialisers = wampcc::all_serialisers)
+    int allowed_serialisers = wampcc::all_serialisers,
+    bool lazy_args = false)
 {
   std::shared_ptr<internal_server> iserver(new internal_server());
+  if (lazy_args)
+    iserver->enable_lazy_args();
 
   port = iserver->start(port, allowed_protocols, allowed_serialisers);
 
@@ -171,6 +174,58 @@ TEST_CASE("basic_generic_server")
     run_rpc_test(generic_server, pt, serialiser_type::msgpack, true);
 }
 
+void run_forwarding_test(std::shared_ptr<internal_server>& server,
+                         protocol_type pt, serialiser_type callee_st,
+                         serialiser_type caller_st)
+{
+  /* The router forwards arguments without decoding them when callee & caller
+   * use the same serialiser, and transcodes them otherwise. */
+  std::unique_ptr<kernel> the_kernel(new kernel());
+
+  auto callee = establish_session(the_kernel, server->port(),
+                                  static_cast<int>(pt),
+                                  static_cast<int>(callee_st));
+  perform_realm_logon(callee);
+
+  std::promise<void> registered;
+  callee->provide("echo", {},
+                  [&registered](wamp_session&, registered_info) {
+                    registered.set_value();
+                  },
+                  [](wamp_session& ws, invocation_info info) {
+                    ws.yield(info.request_id, info.args.args_list,
+                             info.args.args_dict);
+                  });
+  registered.get_future().wait();
+
+  auto caller = establish_session(the_kernel, server->port(),
+                                  static_cast<int>(pt),
+                                  static_cast<int>(caller_st));
+  perform_realm_logon(caller);
+
+  wamp_args call_args;
+  call_args.args_list = json_array({1, "two", 3.5, json_array{4}});
+  call_args.args_dict = json_object({{"k", "v"}, {"n", json_value::make_null()}});
+
+  result_info result = sync_rpc_all(caller, "echo", call_args,
+                                    rpc_result_expect::success);
+  REQUIRE(result.args == call_args);
+
+  caller->close().wait();
+  callee->close().wait();
+}
+
+TEST_CASE("forward_arguments_between_serialisers")
+{
+  auto generic_server = create_server(++global_port, wampcc::all_protocols,
+                                      wampcc::all_serialisers, true);
+
+  for (auto pt : protocols)
+    for (auto callee_st : serialisers)
+      for (auto caller_st : serialisers)
+        run_forwarding_test(generic_server, pt, callee_st, caller_st);
+}
+
 int main(int argc, char** argv)
 {
   try {
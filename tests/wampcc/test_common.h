@@ -67,10 +67,12 @@ enum test_outcome { e_expected, e_unexpected };
 class internal_server
 {
 public:
-  internal_server(logger log = logger::nolog()) // alt: debug_logger()
-    : m_kernel(new kernel({}, log)),
+  internal_server(logger log = logger::nolog(), // alt: debug_logger()
+                  config conf = {})
+    : m_kernel(new kernel(conf, log)),
       m_router(new wamp_router(m_kernel.get(), nullptr)),
       m_port(0),
+      m_lazy_args(false),
       m_user_password("secret2"),
       m_salt{"saltxx",32, 1500}
   {
@@ -107,6 +109,10 @@ public:
     m_derived_key = b64;
   }
 
+  /** Call to have the router forward call and publish arguments without
+   * decoding them.  Should be called before start(). */
+  void enable_lazy_args() { m_lazy_args = true; }
+
   int start(int starting_port_number)
   {
     auth_provider server_auth;
@@ -134,8 +140,12 @@ public:
       };
     }
 
+    wamp_router::listen_options opts;
+    opts.node = "127.0.0.1";
+    opts.lazy_args = m_lazy_args;
     for (int port = starting_port_number; port < 65535; port++) {
-      std::future<uverr> fut_listen_err = m_router->listen(std::string("127.0.0.1"), std::to_string(port), server_auth);
+      opts.service = std::to_string(port);
+      std::future<uverr> fut_listen_err = m_router->listen(server_auth, opts);
       std::future_status status =
           fut_listen_err.wait_for(std::chrono::milliseconds(100));
       if (status == std::future_status::ready) {
@@ -186,6 +196,7 @@ public:
     opts.protocols = allowed_protocols;
     opts.serialisers = allowed_serialisers;
     opts.node = "127.0.0.1";
+    opts.lazy_args = m_lazy_args;
     for (int port = starting_port_number; port < 65535; port++) {
       opts.service = std::to_string(port);
       std::future<uverr> fut_listen_err = m_router->listen(server_auth, opts);
@@ -220,6 +231,7 @@ private:
   std::unique_ptr<kernel> m_kernel;
   std::shared_ptr<wamp_router> m_router;
   int m_port;
+  bool m_lazy_args;
 
   std::string m_user_password;
   auth_provider::cra_salt_params m_salt;
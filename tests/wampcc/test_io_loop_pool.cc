@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "test_common.h"
+#include "mini_test.h"
+
+#include "wampcc/io_loop.h"
+#include "wampcc/socket_address.h"
+
+#include <condition_variable>
+#include <set>
+
+using namespace wampcc;
+using namespace std;
+
+const size_t io_loop_count = 4;
+
+unique_ptr<kernel> create_kernel(size_t loops)
+{
+  config conf;
+  conf.io_loop_count = loops;
+  return unique_ptr<kernel>(new kernel(conf, logger::nolog()));
+}
+
+int global_port;
+
+int start_router(wamp_router& router)
+{
+  wamp_router::listen_options opts;
+  opts.node = "127.0.0.1";
+
+  for (int port = global_port; port < 65535; port++) {
+    opts.service = std::to_string(port);
+    auto fut = router.listen(auth_provider::no_auth_required(), opts);
+    if (fut.wait_for(chrono::seconds(1)) == future_status::ready &&
+        fut.get() == 0)
+      return port;
+  }
+
+  throw runtime_error("failed to find an available port number for listen socket");
+}
+
+
+TEST_CASE("kernel_creates_io_loops")
+{
+  auto the_kernel = create_kernel(io_loop_count);
+
+  REQUIRE(the_kernel->io_loop_count() == io_loop_count);
+  REQUIRE(the_kernel->get_io() == the_kernel->get_io(0));
+
+  set<io_loop*> loops;
+  for (size_t i = 0; i < io_loop_count; i++) {
+    tcp_socket sock(the_kernel.get());
+    loops.insert(sock.get_io_loop());
+  }
+  REQUIRE(loops.size() == io_loop_count);
+
+  tcp_socket pinned(the_kernel.get(), {}, the_kernel->get_io(2));
+  REQUIRE(pinned.get_io_loop() == the_kernel->get_io(2));
+}
+
+
+TEST_CASE("kernel_io_loop_count_defaults_to_one")
+{
+  auto the_kernel = create_kernel(0);
+  REQUIRE(the_kernel->io_loop_count() == 1);
+}
+
+
+/* Move-only function object, to check io_loop accepts such functions. */
+struct sequenced_fn
+{
+  int producer;
+  unique_ptr<int> seq;
+  function<void(int, int)>* on_invoke;
+
+  void operator()() { (*on_invoke)(producer, *seq); }
+};
+
+
+TEST_CASE("io_loop_push_fn_from_many_threads")
+{
+  auto the_kernel = create_kernel(1);
+  io_loop* loop = the_kernel->get_io();
+
+  const int nthreads = 8;
+  const int per_thread = 10000;
+
+  /* each producer's functions must be invoked in the order pushed */
+  vector<int> last_seen(nthreads, -1);
+  bool in_order = true;
+  int invoked = 0;
+  promise<void> done;
+
+  function<void(int, int)> on_invoke = [&](int producer, int seq) {
+    in_order &= (seq == last_seen[producer] + 1);
+    last_seen[producer] = seq;
+    if (++invoked == nthreads * per_thread)
+      done.set_value();
+  };
+
+  vector<thread> producers;
+  for (int t = 0; t < nthreads; t++)
+    producers.emplace_back([&, t]() {
+      for (int i = 0; i < per_thread; i++)
+        loop->push_fn(sequenced_fn{t, unique_ptr<int>(new int(i)), &on_invoke});
+    });
+
+  for (auto& t : producers)
+    t.join();
+
+  REQUIRE(done.get_future().wait_for(chrono::seconds(10)) ==
+          future_status::ready);
+  REQUIRE(in_order);
+}
+
+
+TEST_CASE("router_listen_on_ephemeral_port")
+{
+  auto the_kernel = create_kernel(io_loop_count);
+  wamp_router router(the_kernel.get());
+
+  wamp_router::listen_options opts;
+  opts.node = "127.0.0.1";
+  opts.service = "0";
+
+  auto fut = router.listen(auth_provider::no_auth_required(), opts);
+  REQUIRE(fut.wait_for(chrono::seconds(1)) == future_status::ready);
+  REQUIRE(fut.get() == 0);
+
+  /* all IO loops must have bound to the port obtained by the first */
+  REQUIRE(router.get_listen_addresses().size() == 1);
+}
+
+
+TEST_CASE("router_sessions_spread_over_io_loops")
+{
+  auto server_kernel = create_kernel(io_loop_count);
+
+  mutex server_loops_lock;
+  set<io_loop*> server_loops;
+
+  wamp_router router(server_kernel.get(), nullptr, nullptr,
+                     [&](wamp_session& ws, bool is_open) {
+                       if (is_open) {
+                         lock_guard<mutex> guard(server_loops_lock);
+                         server_loops.insert(ws.socket()->get_io_loop());
+                       }
+                     });
+
+  router.callable("default_realm", "echo",
+                  [](wamp_router&, wamp_session& caller, call_info info) {
+                    caller.result(info.request_id, info.args.args_list);
+                  });
+
+  int port = start_router(router);
+
+  auto client_kernel = create_kernel(2);
+
+  vector<shared_ptr<wamp_session>> sessions;
+  for (int i = 0; i < 32; i++) {
+    sessions.push_back(establish_session(client_kernel, port));
+    perform_realm_logon(sessions.back());
+
+    wamp_args args;
+    args.args_list = json_array({i});
+    auto result = sync_rpc_all(sessions.back(), "echo", args,
+                               rpc_result_expect::success);
+    REQUIRE(result.args.args_list == args.args_list);
+  }
+
+  {
+    lock_guard<mutex> guard(server_loops_lock);
+    for (auto loop : server_loops) {
+      bool found = false;
+      for (size_t i = 0; i < server_kernel->io_loop_count(); i++)
+        found |= (loop == server_kernel->get_io(i));
+      REQUIRE(found);
+    }
+
+    /* accepted sockets remain with the accepting loop, and the kernel spreads
+     * incoming connections across the listen sockets */
+    REQUIRE(server_loops.size() > 1);
+  }
+
+  for (auto& ws : sessions)
+    ws->close().wait();
+}
+
+
+TEST_CASE("router_with_event_loop_pool")
+{
+  config conf;
+  conf.io_loop_count = 2;
+  conf.event_loop_thread_count = 4;
+  unique_ptr<kernel> server_kernel(new kernel(conf, logger::nolog()));
+
+  wamp_router router(server_kernel.get());
+
+  mutex ev_threads_lock;
+  set<thread::id> ev_threads;
+
+  /* the first calls of two sessions wait for each other, so can only both
+   * complete in time if callbacks of different sessions run in parallel */
+  mutex barrier_lock;
+  condition_variable barrier_cv;
+  int barrier_arrived = 0;
+  bool overlapped = false;
+
+  router.callable("default_realm", "echo",
+                  [&](wamp_router&, wamp_session& caller, call_info info) {
+                    {
+                      lock_guard<mutex> guard(ev_threads_lock);
+                      ev_threads.insert(this_thread::get_id());
+                    }
+                    if (info.args.args_list[0].as_int() == 0) {
+                      unique_lock<mutex> lock(barrier_lock);
+                      if (barrier_arrived == 0) {
+                        barrier_arrived++;
+                        overlapped = barrier_cv.wait_for(
+                            lock, chrono::seconds(5),
+                            [&]() { return barrier_arrived == 2; });
+                      }
+                      else if (barrier_arrived == 1) {
+                        barrier_arrived++;
+                        barrier_cv.notify_all();
+                      }
+                    }
+                    caller.result(info.request_id, info.args.args_list);
+                  });
+
+  int port = start_router(router);
+
+  auto client_kernel = create_kernel(2);
+
+  vector<shared_ptr<wamp_session>> sessions;
+  for (int i = 0; i < 16; i++) {
+    sessions.push_back(establish_session(client_kernel, port));
+    perform_realm_logon(sessions.back());
+  }
+
+  /* issue many calls from all sessions without waiting; each session must
+   * receive its results in the order called */
+  const int per_session = 200;
+  vector<vector<int>> results(sessions.size());
+  int outstanding = sessions.size() * per_session; /* client EV thread only */
+  promise<void> done;
+
+  for (int i = 0; i < per_session; i++)
+    for (size_t s = 0; s < sessions.size(); s++) {
+      wamp_args args;
+      args.args_list = json_array({i});
+      sessions[s]->call("echo", {}, args,
+                        [&, s](wamp_session&, result_info r) {
+                          results[s].push_back(
+                              r.was_error ? -1 : r.args.args_list[0].as_int());
+                          if (--outstanding == 0)
+                            done.set_value();
+                        });
+    }
+
+  REQUIRE(done.get_future().wait_for(chrono::seconds(10)) ==
+          future_status::ready);
+
+  for (auto& r : results) {
+    REQUIRE(r.size() == per_session);
+    for (int i = 0; i < per_session; i++)
+      REQUIRE(r[i] == i);
+  }
+
+  {
+    lock_guard<mutex> guard(ev_threads_lock);
+    REQUIRE(ev_threads.size() > 1);
+    REQUIRE(ev_threads.size() <= 4);
+  }
+  {
+    lock_guard<mutex> guard(barrier_lock);
+    REQUIRE(overlapped);
+  }
+
+  for (auto& ws : sessions)
+    ws->close().wait();
+}
+
+
+int main(int argc, char** argv)
+{
+  try {
+    global_port = 29000;
+
+    if (argc > 1)
+      global_port = atoi(argv[1]);
+
+    int result = minitest::run(argc, argv);
+    return result < 0xFF ? result : 0xFF;
+  } catch (exception& e) {
+    cout << e.what() << endl;
+    return 1;
+  }
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "test_common.h"
+#include "mini_test.h"
+
+#include "wampcc/data_model.h"
+
+#include <condition_variable>
+#include <thread>
+
+using namespace wampcc;
+using namespace std;
+
+int global_port;
+
+int start_router(wamp_router& router)
+{
+  wamp_router::listen_options opts;
+  opts.node = "127.0.0.1";
+
+  for (int port = global_port; port < 65535; port++) {
+    opts.service = std::to_string(port);
+    auto fut = router.listen(auth_provider::no_auth_required(), opts);
+    if (fut.wait_for(chrono::seconds(1)) == future_status::ready &&
+        fut.get() == 0) {
+      global_port = port + 1;
+      return port;
+    }
+  }
+
+  throw runtime_error("failed to find an available port number for listen socket");
+}
+
+/* Records what arrives for a model topic: the number of changes seen by a
+ * jmodel_subscription, and each event seen by a plain subscription. */
+struct topic_recorder
+{
+  mutex lock;
+  condition_variable cv;
+  size_t changes = 0;
+  vector<event_info> events;
+
+  void on_change()
+  {
+    lock_guard<mutex> guard(lock);
+    changes++;
+    cv.notify_all();
+  }
+
+  void on_event(event_info info)
+  {
+    lock_guard<mutex> guard(lock);
+    events.push_back(std::move(info));
+    cv.notify_all();
+  }
+
+  /* Wait until both subscriptions have seen 'count' updates */
+  bool wait_for(size_t count)
+  {
+    unique_lock<mutex> guard(lock);
+    return cv.wait_for(guard, chrono::seconds(5), [&]() {
+      return changes >= count && events.size() >= count;
+    });
+  }
+};
+
+/* The model value inside a json_model document, {head:..., body:{value:...}} */
+json_value body_value(const json_value& doc)
+{
+  const json_object& body = json_get_ref(doc.as_object(), "body").as_object();
+  return json_get_ref(body, "value");
+}
+
+/* Check an update event carries only a patch of the model value, and return
+ * its operations */
+json_array patch_ops(const event_info& info)
+{
+  REQUIRE(info.details.find(KEY_PATCH) != info.details.end());
+  REQUIRE(info.details.find(KEY_SNAPSHOT) == info.details.end());
+
+  const json_array& ops = info.args.args_list[0].as_array();
+  for (auto& op : ops) {
+    const std::string& path = json_get_ref(op.as_object(), "path").as_string();
+    REQUIRE(path.compare(0, 12, "/body/value/") == 0);
+  }
+  return ops;
+}
+
+
+TEST_CASE("json_model_followed_through_router")
+{
+  unique_ptr<kernel> server_kernel(new kernel({}, logger::nolog()));
+  auto router = make_shared<wamp_router>(server_kernel.get());
+  int port = start_router(*router);
+
+  json_object initial;
+  initial["name"] = "alpha";
+  initial["rows"] = json_array({1, 2, 3});
+  json_model model{json_value(initial)};
+  model.get_topic("model.doc").add_publisher("default_realm", router);
+
+  topic_recorder rec;
+
+  unique_ptr<kernel> client_kernel(new kernel({}, logger::nolog()));
+  auto follower = establish_session(client_kernel, port);
+  perform_realm_logon(follower);
+  jmodel_subscription sub(follower, "model.doc",
+                          {[&](const jmodel_subscription&) { rec.on_change(); }});
+
+  auto observer = establish_session(client_kernel, port);
+  perform_realm_logon(observer);
+  observer->subscribe("model.doc", {{KEY_PATCH, 1}}, nullptr,
+                      [&](wamp_session&, event_info info) {
+                        rec.on_event(std::move(info));
+                      });
+
+  /* each subscriber is first sent a snapshot of the image held by the router */
+  REQUIRE(rec.wait_for(1));
+  {
+    lock_guard<mutex> guard(rec.lock);
+    REQUIRE(rec.events[0].details.find(KEY_SNAPSHOT) !=
+            rec.events[0].details.end());
+  }
+  REQUIRE(body_value(sub.value()) == model.value());
+
+  /* Wait for the next update, and check the follower has caught up with the
+   * model if no further updates are outstanding */
+  size_t expected = 1;
+  auto next_patch = [&](bool last) -> json_array {
+    expected++;
+    REQUIRE(rec.wait_for(expected));
+    lock_guard<mutex> guard(rec.lock);
+    if (last) {
+      REQUIRE(rec.events.size() == expected);
+      REQUIRE(body_value(sub.value()) == model.value());
+    }
+    return patch_ops(rec.events[expected - 1]);
+  };
+
+  json_object renamed = initial;
+  renamed["name"] = "beta";
+  model.assign(json_value(renamed));
+  REQUIRE(next_patch(true).size() == 1);
+
+  model.modify([](json_value& v) {
+    v.as_object()["rows"].as_array().push_back(4);
+  });
+  json_array ops = next_patch(true);
+  REQUIRE(ops.size() == 1);
+  REQUIRE(json_get_ref(ops[0].as_object(), "path").as_string() ==
+          "/body/value/rows/3");
+
+  model.modify([](json_value& v) {
+    json_object meta;
+    meta["k"] = 1;
+    v.as_object()["meta"] = std::move(meta);
+    v.as_object()["rows"].as_array()[0] = 10;
+  });
+  REQUIRE(next_patch(true).size() == 2);
+
+  /* an unchanged document publishes nothing, so the next event to arrive is
+   * the one following */
+  model.assign(model.value());
+  model.modify([](json_value&) {});
+  model.modify([](json_value& v) { v.as_object().erase("name"); });
+  ops = next_patch(true);
+  REQUIRE(ops.size() == 1);
+  REQUIRE(json_get_ref(ops[0].as_object(), "op").as_string() == "remove");
+
+  /* Modify from one thread while another adds publishers, which take the
+   * snapshot under the topics lock, and reads the value */
+  const int modifications = 200;
+  thread writer([&]() {
+    for (int i = 1; i <= modifications; i++)
+      model.modify([i](json_value& v) { v.as_object()["count"] = i; });
+  });
+  for (int i = 0; i < 10; i++) {
+    model.get_topic("model.doc.mirror" + std::to_string(i))
+        .add_publisher("default_realm", router);
+    model.value();
+  }
+  writer.join();
+
+  for (int i = 1; i <= modifications; i++) {
+    ops = next_patch(i == modifications);
+    REQUIRE(ops.size() == 1);
+    REQUIRE(json_get_ref(ops[0].as_object(), "path").as_string() ==
+            "/body/value/count");
+  }
+  REQUIRE(json_get_ref(model.value().as_object(), "count") == modifications);
+
+  observer->close().wait();
+  follower->close().wait();
+}
+
+
+int main(int argc, char** argv)
+{
+  try {
+    global_port = 28000;
+
+    if (argc > 1)
+      global_port = atoi(argv[1]);
+
+    int result = minitest::run(argc, argv);
+    return result < 0xFF ? result : 0xFF;
+  } catch (exception& e) {
+    cout << e.what() << endl;
+    return 1;
+  }
+}
@@ -11,6 +11,8 @@
 #include "wampcc/platform.h"
 #include "wampcc/wampcc.h"
 #include "wampcc/http_parser.h"
+#include "wampcc/event_loop.h"
+#include "wampcc/uri_trie.h"
 
 #include <sys/socket.h>
 
@@ -313,6 +315,354 @@ TEST_CASE("socket_address")
   REQUIRE(sa10 != sa11);
 }
 
+TEST_CASE("protocol_buffer_read_in_place")
+{
+  buffer buf(1, 64);
+
+  // bytes read into the prepared region are taken without copy
+  auto region = buf.prepare(16);
+  REQUIRE(region.second >= 16);
+  memcpy(region.first, "abcdefgh", 8);
+  REQUIRE(buf.consume(region.first, 8) == 8);
+  REQUIRE(buf.data_size() == 8);
+  REQUIRE(std::string(buf.data(), 8) == "abcdefgh");
+
+  // partially read data is retained, without moving it
+  auto rd = buf.read_ptr();
+  rd.advance(5);
+  buf.discard_read(rd);
+  REQUIRE(buf.data_size() == 3);
+  REQUIRE(std::string(buf.data(), 3) == "fgh");
+
+  // ordinary copy still appends after the retained data
+  REQUIRE(buf.consume("ij", 2) == 2);
+  REQUIRE(std::string(buf.data(), buf.data_size()) == "fghij");
+
+  // requesting more space than is free at the end compacts the buffer
+  region = buf.prepare(59);
+  REQUIRE(region.second == 59);
+  REQUIRE(region.first == buf.data() + 5);
+  REQUIRE(std::string(buf.data(), buf.data_size()) == "fghij");
+  REQUIRE(buf.capacity() == 64);
+}
+
+
+TEST_CASE("output_sink_prepends_header_in_place")
+{
+  output_sink sink(8);
+  REQUIRE(sink.payload_size() == 0);
+
+  const std::string payload = "[1,\"payload\"]";
+  sink.bytes().insert(sink.bytes().end(), payload.begin(), payload.end());
+  REQUIRE(sink.payload_size() == payload.size());
+  const char* start = sink.payload();
+
+  // headers are written directly ahead of the payload, innermost first
+  memcpy(sink.prepend(4), "len:", 4);
+  memcpy(sink.prepend(2), "hd", 2);
+
+  bool thrown = false;
+  try {
+    sink.prepend(3);
+  } catch (std::runtime_error&) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+
+  // the frame is released as one buffer, without copying the payload
+  shared_buffer frame = sink.release();
+  REQUIRE(std::string(frame.data(), frame.size()) == "hdlen:" + payload);
+  REQUIRE(frame.data() + 6 == start);
+}
+
+
+TEST_CASE("sink_pool_reuses_written_buffers")
+{
+  sink_pool pool;
+  const std::string payload = "[36,1,2,{},[\"x\"]]";
+
+  auto encode = [&]() {
+    output_sink sink(4, &pool);
+    sink.bytes().insert(sink.bytes().end(), payload.begin(), payload.end());
+    memcpy(sink.prepend(4), "len:", 4);
+    return sink.release();
+  };
+
+  // a buffer is not reused while a frame taken from it is still held
+  shared_buffer first = encode();
+  shared_buffer second = encode();
+  REQUIRE(first.data() != second.data());
+  REQUIRE(pool.size() == 2);
+
+  // once the frame is dropped, as after its write completes, it is reused
+  const char* first_data = first.data();
+  first = shared_buffer();
+  shared_buffer third = encode();
+  REQUIRE(third.data() == first_data);
+  REQUIRE(std::string(third.data(), third.size()) == "len:" + payload);
+  REQUIRE(std::string(second.data(), second.size()) == "len:" + payload);
+  REQUIRE(pool.size() == 2);
+
+  // buffers beyond the pool's limit are not kept
+  std::vector<shared_buffer> held;
+  for (size_t i = 0; i < sink_pool::max_buffers + 4; i++)
+    held.push_back(encode());
+  REQUIRE(pool.size() == sink_pool::max_buffers);
+}
+
+
+TEST_CASE("task_ring_preserves_order_across_growth")
+{
+  std::vector<int> seen;
+  task_ring ring;
+
+  // interleave pushes and pops so that the ring wraps before it grows
+  int next = 0;
+  for (int i = 0; i < 10; i++)
+    ring.push_back([&seen, i]() { seen.push_back(i); });
+  for (int i = 0; i < 5; i++)
+    ring.pop_front()();
+  for (int i = 10; i < 100; i++)
+    ring.push_back([&seen, i]() { seen.push_back(i); });
+  REQUIRE(ring.size() == 95);
+
+  while (!ring.empty())
+    ring.pop_front()();
+
+  REQUIRE(seen.size() == 100);
+  for (auto i : seen)
+    REQUIRE(i == next++);
+}
+
+
+/* Move-only function object, to check event_loop accepts such functions. */
+struct move_only_fn
+{
+  std::unique_ptr<int> value;
+  std::promise<int>* result;
+
+  void operator()() { result->set_value(*value); }
+};
+
+TEST_CASE("event_loop_dispatch_move_only")
+{
+  kernel the_kernel({}, logger::nolog());
+
+  std::promise<int> result;
+  the_kernel.get_event_loop()->dispatch(
+      move_only_fn{std::unique_ptr<int>(new int(42)), &result});
+
+  auto fut = result.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(1)) == std::future_status::ready);
+  REQUIRE(fut.get() == 42);
+}
+
+
+TEST_CASE("timer_wheel_expires_in_due_order")
+{
+  timer_wheel wheel;
+  std::vector<timer_wheel::timer_id> expired;
+  std::vector<int> fired;
+
+  // delays chosen to land on each level of the wheel, including boundaries
+  std::vector<timer_wheel::tick_type> dues = {1,     5,     255,   256,
+                                              257,   1000,  65535, 65536,
+                                              70000, 16777216};
+  for (size_t i = 0; i < dues.size(); i++)
+    wheel.schedule(dues[i], [&fired, i]() {
+      fired.push_back(i);
+      return std::chrono::milliseconds(0);
+    });
+  REQUIRE(wheel.size() == dues.size());
+
+  size_t checked = 0;
+  for (timer_wheel::tick_type now = 0; now <= dues.back(); ) {
+    now = std::min(wheel.next_wakeup(), dues.back());
+    wheel.advance(now, expired);
+    for (auto& id : expired) {
+      timer_wheel::timer_fn fn;
+      REQUIRE(wheel.begin_run(id, fn));
+      fn();
+      wheel.complete(id);
+    }
+    expired.clear();
+
+    // every timer due by now must have fired, and no others
+    while (checked < dues.size() && dues[checked] <= now)
+      checked++;
+    REQUIRE(fired.size() == checked);
+    if (now == dues.back())
+      break;
+  }
+
+  for (size_t i = 0; i < fired.size(); i++)
+    REQUIRE(fired[i] == (int)i);
+  REQUIRE(wheel.size() == 0);
+}
+
+
+TEST_CASE("timer_wheel_cancel")
+{
+  timer_wheel wheel;
+  std::vector<timer_wheel::timer_id> expired;
+  auto noop = []() { return std::chrono::milliseconds(0); };
+
+  auto t1 = wheel.schedule(10, noop);
+  auto t2 = wheel.schedule(10, noop);
+  auto t3 = wheel.schedule(1000, noop);
+
+  // cancel before expiry, and stale cancel
+  REQUIRE(wheel.cancel(t1));
+  REQUIRE(!wheel.cancel(t1));
+
+  // cancel after expiry, but before the timer is run
+  wheel.advance(10, expired);
+  REQUIRE(expired.size() == 1);
+  REQUIRE(wheel.cancel(t2));
+  timer_wheel::timer_fn fn;
+  REQUIRE(!wheel.begin_run(expired[0], fn));
+  expired.clear();
+
+  // cancel while running prevents reschedule
+  wheel.advance(1000, expired);
+  REQUIRE(expired.size() == 1);
+  REQUIRE(wheel.begin_run(t3, fn));
+  REQUIRE(wheel.cancel(t3));
+  wheel.reschedule(t3, fn, 2000);
+  REQUIRE(wheel.size() == 0);
+
+  // identifiers of released nodes remain stale after slot reuse
+  auto t4 = wheel.schedule(2000, noop);
+  REQUIRE(t4.slot == t3.slot || t4.slot == t2.slot || t4.slot == t1.slot);
+  REQUIRE(!wheel.cancel(t1));
+  REQUIRE(!wheel.cancel(t2));
+  REQUIRE(!wheel.cancel(t3));
+  REQUIRE(wheel.cancel(t4));
+}
+
+
+TEST_CASE("event_loop_timers")
+{
+  kernel the_kernel({}, logger::nolog());
+  event_loop* evl = the_kernel.get_event_loop();
+
+  // a cancelled timer is never invoked
+  std::atomic<bool> cancelled_fired(false);
+  timer_handle h = evl->dispatch(std::chrono::milliseconds(50), [&]() {
+    cancelled_fired = true;
+    return std::chrono::milliseconds(0);
+  });
+  REQUIRE(h.cancel());
+  REQUIRE(!h.cancel());
+
+  // a repeating timer runs until it returns zero
+  std::atomic<int> count(0);
+  std::promise<void> done;
+  evl->dispatch(std::chrono::milliseconds(1), [&]() {
+    if (++count == 5) {
+      done.set_value();
+      return std::chrono::milliseconds(0);
+    }
+    return std::chrono::milliseconds(5);
+  });
+
+  auto fut = done.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  REQUIRE(count == 5);
+  REQUIRE(cancelled_fired == false);
+}
+
+
+TEST_CASE("strand_serialises_tasks_on_event_loop_pool")
+{
+  config conf;
+  conf.event_loop_thread_count = 4;
+  kernel the_kernel(conf, logger::nolog());
+  event_loop* evl = the_kernel.get_event_loop();
+  REQUIRE(evl->thread_count() == 4);
+
+  const int nstrands = 8;
+  const int per_strand = 5000;
+
+  struct strand_record
+  {
+    std::atomic<int> in_flight;
+    int next;
+    bool ok;
+  };
+  std::vector<strand_record> records(nstrands);
+  std::vector<std::unique_ptr<strand>> strands;
+  for (auto& r : records) {
+    r.in_flight = 0;
+    r.next = 0;
+    r.ok = true;
+    strands.emplace_back(new strand(evl));
+  }
+
+  std::atomic<int> remaining(nstrands * per_strand);
+  std::promise<void> done;
+
+  for (int i = 0; i < per_strand; i++)
+    for (int s = 0; s < nstrands; s++) {
+      strand_record* r = &records[s];
+      strands[s]->dispatch([=, &remaining, &done]() {
+        // tasks of one strand must never overlap, and must run in order
+        r->ok &= (r->in_flight++ == 0);
+        r->ok &= (r->next++ == i);
+        r->ok &= evl->this_thread_is_ev();
+        r->in_flight--;
+        if (--remaining == 0)
+          done.set_value();
+      });
+    }
+
+  auto fut = done.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+  for (auto& r : records)
+    REQUIRE(r.ok);
+  REQUIRE(!evl->this_thread_is_ev());
+}
+
+
+TEST_CASE("uri_trie_matches_patterns")
+{
+  uri_trie<int> trie;
+  int p1 = 1, p2 = 2, p3 = 3, p4 = 4, w1 = 5, w2 = 6, w3 = 7;
+
+  REQUIRE(trie.insert_prefix("com.myapp.topic.emergency", &p1));
+  REQUIRE(trie.insert_prefix("com.myapp", &p2));
+  REQUIRE(trie.insert_prefix("com.myapp.", &p3));
+  REQUIRE(trie.insert_prefix("com.my", &p4));
+  REQUIRE(trie.insert_prefix("com.myapp", &p2) == false);
+  REQUIRE(trie.insert_wildcard("com.myapp..userevent", &w1));
+  REQUIRE(trie.insert_wildcard("com..topic.", &w2));
+  REQUIRE(trie.insert_wildcard("..", &w3));
+  REQUIRE(trie.insert_wildcard("com..topic.", &w2) == false);
+  REQUIRE(trie.size() == 7);
+
+  auto matches = [&trie](const std::string& uri) {
+    std::vector<int> found;
+    trie.match(uri, [&found](int* p) { found.push_back(*p); });
+    std::sort(found.begin(), found.end());
+    return found;
+  };
+
+  REQUIRE(matches("com.myapp.topic.emergency.11") == std::vector<int>({1, 2, 3, 4}));
+  REQUIRE(matches("com.myapp.topic.emergency-low") == std::vector<int>({1, 2, 3, 4, 6}));
+  REQUIRE(matches("com.myapp.topic.emergency") == std::vector<int>({1, 2, 3, 4, 6}));
+  REQUIRE(matches("com.myapp.topic.emergenc") == std::vector<int>({2, 3, 4, 6}));
+  REQUIRE(matches("com.myapp") == std::vector<int>({2, 4}));
+  REQUIRE(matches("com.myapp2") == std::vector<int>({2, 4}));
+  REQUIRE(matches("com.myapp.foo.userevent") == std::vector<int>({2, 3, 4, 5}));
+  REQUIRE(matches("com.other.topic.x") == std::vector<int>({6}));
+  REQUIRE(matches("a.b.c") == std::vector<int>({7}));
+  REQUIRE(matches("com") == std::vector<int>());
+  REQUIRE(matches("org.myapp.topic.emergency") == std::vector<int>());
+}
+
+
 int main(int argc, char** argv)
 {
   try {
@@ -179,6 +179,295 @@ TEST_CASE("test_unregister")
 }
 
 
+/* Make a call, returning the result, or throw if none arrives in time */
+static result_info call_and_wait(std::shared_ptr<wamp_session>& session,
+                                 const std::string& uri)
+{
+  auto promised_result_info = std::make_shared<std::promise<result_info>>();
+
+  session->call(uri, {}, {},
+                [promised_result_info](wamp_session&, result_info info){
+                  promised_result_info->set_value(std::move(info));
+                }, nullptr
+    );
+
+  auto fut = promised_result_info->get_future();
+  if (fut.wait_for(std::chrono::seconds(3)) != std::future_status::ready)
+    throw std::runtime_error("timeout waiting for call result");
+  return fut.get();
+}
+
+
+TEST_CASE("test_call_during_registration_changes")
+{
+  const std::string uri = "stable_rpc";
+  const int calls = 200;
+  internal_server iserver(logger::nolog());
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto caller = establish_session(the_kernel, port);
+  perform_realm_logon(caller);
+  auto churner = establish_session(the_kernel, port);
+  perform_realm_logon(churner);
+
+  {
+    std::promise<void> registered;
+    caller->provide(
+      uri, {},
+      [&registered](wamp_session&, registered_info) { registered.set_value(); },
+      [](wamp_session& ws, invocation_info info) { ws.yield(info.request_id); },
+      nullptr);
+    registered.get_future().wait();
+  }
+
+  // issue calls without waiting, while procedures come and go
+  std::atomic<int> results(0), errors(0);
+  std::promise<void> all_results;
+  for (int i = 0; i < calls; i++)
+    caller->call(uri, {}, {},
+                 [&](wamp_session&, result_info info) {
+                   if (info.was_error)
+                     errors++;
+                   if (++results == calls)
+                     all_results.set_value();
+                 }, nullptr);
+
+  for (int i = 0; i < 20; i++) {
+    std::promise<t_registration_id> registered;
+    churner->provide(
+      "churn_rpc_" + std::to_string(i), {},
+      [&registered](wamp_session&, registered_info info) {
+        registered.set_value(info.registration_id);
+      },
+      [](wamp_session& ws, invocation_info info) { ws.yield(info.request_id); },
+      nullptr);
+    auto registration_id = registered.get_future().get();
+
+    std::promise<void> unregistered;
+    churner->unprovide(
+      registration_id,
+      [&unregistered](wamp_session&, unregistered_info) {
+        unregistered.set_value();
+      },
+      nullptr);
+    unregistered.get_future().wait();
+  }
+
+  auto fut = all_results.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+  REQUIRE(errors == 0);
+
+  // enough procedures to grow the registry table
+  const int many = 150;
+  for (int i = 0; i < many; i++) {
+    std::promise<void> registered;
+    churner->provide(
+      "many_rpc_" + std::to_string(i), {},
+      [&registered](wamp_session&, registered_info) { registered.set_value(); },
+      [](wamp_session& ws, invocation_info info) { ws.yield(info.request_id); },
+      nullptr);
+    registered.get_future().wait();
+  }
+  for (int i = 0; i < many; i += 7)
+    REQUIRE(call_and_wait(caller, "many_rpc_" + std::to_string(i)).was_error ==
+            false);
+
+  // procedures of a closed session are removed
+  {
+    std::promise<void> registered;
+    churner->provide(
+      "churn_rpc_last", {},
+      [&registered](wamp_session&, registered_info) { registered.set_value(); },
+      [](wamp_session& ws, invocation_info info) { ws.yield(info.request_id); },
+      nullptr);
+    registered.get_future().wait();
+  }
+  REQUIRE(call_and_wait(caller, "churn_rpc_last").was_error == false);
+
+  churner->close().wait();
+
+  bool removed = false;
+  for (int i = 0; i < 50 && !removed; i++) {
+    result_info info = call_and_wait(caller, "churn_rpc_last");
+    removed = info.was_error && info.error_uri == WAMP_ERROR_NO_SUCH_PROCEDURE;
+    if (!removed)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  REQUIRE(removed);
+  REQUIRE(call_and_wait(caller, "many_rpc_0").error_uri ==
+          WAMP_ERROR_NO_SUCH_PROCEDURE);
+  REQUIRE(call_and_wait(caller, uri).was_error == false);
+}
+
+
+/* Register a procedure, returning the outcome */
+static registered_info provide_and_wait(std::shared_ptr<wamp_session>& session,
+                                        const std::string& uri,
+                                        json_object options,
+                                        on_invocation_fn fn)
+{
+  std::promise<registered_info> promised_info;
+  session->provide(uri, std::move(options),
+                   [&promised_info](wamp_session&, registered_info info) {
+                     promised_info.set_value(info);
+                   },
+                   std::move(fn), nullptr);
+  return promised_info.get_future().get();
+}
+
+
+TEST_CASE("test_shared_registration")
+{
+  const std::string uri = "shared_rpc";
+  const size_t callee_count = 3;
+  internal_server iserver(logger::nolog());
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto caller = establish_session(the_kernel, port);
+  perform_realm_logon(caller);
+
+  // each callee replies with its index
+  std::vector<std::shared_ptr<wamp_session>> callees;
+  std::vector<t_registration_id> registration_ids;
+  for (size_t i = 0; i < callee_count; i++) {
+    callees.push_back(establish_session(the_kernel, port));
+    perform_realm_logon(callees.back());
+    auto info = provide_and_wait(
+      callees.back(), uri, {{"invoke", "roundrobin"}},
+      [i](wamp_session& ws, invocation_info info) {
+        ws.yield(info.request_id, json_array({i}));
+      });
+    REQUIRE(info.was_error == false);
+    registration_ids.push_back(info.registration_id);
+  }
+
+  // callees share the one registration
+  REQUIRE(registration_ids[1] == registration_ids[0]);
+  REQUIRE(registration_ids[2] == registration_ids[0]);
+
+  // a different policy, or a repeat by a callee, is refused
+  auto yield = [](wamp_session& ws, invocation_info info) {
+    ws.yield(info.request_id);
+  };
+  REQUIRE(provide_and_wait(caller, uri, {{"invoke", "random"}}, yield).was_error);
+  REQUIRE(provide_and_wait(caller, uri, {}, yield).was_error);
+  REQUIRE(provide_and_wait(callees[0], uri, {{"invoke", "roundrobin"}}, yield).was_error);
+  REQUIRE(provide_and_wait(caller, "other_rpc", {{"invoke", "fastest"}}, yield).was_error);
+
+  // calls are spread evenly
+  std::vector<int> counts(callee_count, 0);
+  for (size_t i = 0; i < 3 * callee_count; i++) {
+    result_info info = call_and_wait(caller, uri);
+    REQUIRE(info.was_error == false);
+    counts[info.args.args_list[0].as_uint()]++;
+  }
+  REQUIRE(counts == std::vector<int>(callee_count, 3));
+
+  // the registration remains while any callee does
+  {
+    std::promise<unregistered_info> promised_info;
+    callees[0]->unprovide(
+      registration_ids[0],
+      [&promised_info](wamp_session&, unregistered_info info) {
+        promised_info.set_value(info);
+      },
+      nullptr);
+    REQUIRE(promised_info.get_future().get().was_error == false);
+  }
+  callees[1]->close().wait();
+
+  bool only_last = false;
+  for (int i = 0; i < 50 && !only_last; i++) {
+    result_info info = call_and_wait(caller, uri);
+    only_last = !info.was_error && info.args.args_list[0].as_uint() == 2 &&
+                call_and_wait(caller, uri).args.args_list[0].as_uint() == 2;
+    if (!only_last)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  REQUIRE(only_last);
+
+  callees[2]->close().wait();
+  bool removed = false;
+  for (int i = 0; i < 50 && !removed; i++) {
+    result_info info = call_and_wait(caller, uri);
+    removed = info.was_error && info.error_uri == WAMP_ERROR_NO_SUCH_PROCEDURE;
+    if (!removed)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  REQUIRE(removed);
+}
+
+
+TEST_CASE("test_least_outstanding_invocation")
+{
+  const std::string uri = "balanced_rpc";
+  const int calls = 20;
+  internal_server iserver(logger::nolog());
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto caller = establish_session(the_kernel, port);
+  perform_realm_logon(caller);
+  auto slow = establish_session(the_kernel, port);
+  perform_realm_logon(slow);
+  auto fast = establish_session(the_kernel, port);
+  perform_realm_logon(fast);
+
+  // the slow callee holds its invocations until released
+  std::mutex held_lock;
+  std::vector<t_request_id> held;
+  std::atomic<int> fast_count(0);
+
+  json_object options {{"invoke", "least_outstanding"}};
+  REQUIRE(provide_and_wait(slow, uri, options,
+                           [&](wamp_session&, invocation_info info) {
+                             std::lock_guard<std::mutex> guard(held_lock);
+                             held.push_back(info.request_id);
+                           }).was_error == false);
+  REQUIRE(provide_and_wait(fast, uri, options,
+                           [&](wamp_session& ws, invocation_info info) {
+                             fast_count++;
+                             ws.yield(info.request_id);
+                           }).was_error == false);
+
+  std::atomic<int> results(0);
+  std::promise<void> all_results;
+  for (int i = 0; i < calls; i++) {
+    caller->call(uri, {}, {},
+                 [&](wamp_session&, result_info) {
+                   if (++results == calls)
+                     all_results.set_value();
+                 }, nullptr);
+
+    // wait for the call to arrive at a callee
+    for (int j = 0; j < 300; j++) {
+      size_t arrived;
+      {
+        std::lock_guard<std::mutex> guard(held_lock);
+        arrived = held.size() + results;
+      }
+      if (arrived == size_t(i + 1))
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  // once the slow callee is busy, the idle one takes every call
+  {
+    std::lock_guard<std::mutex> guard(held_lock);
+    REQUIRE(held.size() == 1);
+    for (auto request_id : held)
+      slow->yield(request_id);
+  }
+  REQUIRE(fast_count == calls - 1);
+
+  auto fut = all_results.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+}
+
+
 int main(int argc, char** argv)
 {
   try {
@@ -142,6 +142,61 @@ TEST_CASE("test_all")
     all_tests(port);
 }
 
+TEST_CASE("test_write_shared_buffer")
+{
+  kernel the_kernel;
+
+  std::mutex rx_lock;
+  std::string rx;
+  std::promise<void> rx_complete;
+  std::unique_ptr<tcp_socket> accepted;
+
+  const std::string expected = "hello, world";
+
+  tcp_socket server(&the_kernel);
+  auto on_accept = [&](std::unique_ptr<tcp_socket>& client, uverr ec) {
+    if (ec)
+      return;
+    accepted = std::move(client);
+    accepted->start_read(
+        [&](char* src, size_t len) {
+          std::lock_guard<std::mutex> guard(rx_lock);
+          rx.append(src, len);
+          if (rx.size() == expected.size())
+            rx_complete.set_value();
+        },
+        [](uverr) {});
+  };
+
+  int port = global_port++;
+  REQUIRE(server.listen("127.0.0.1", std::to_string(port), on_accept).get() ==
+          0);
+
+  std::unique_ptr<tcp_socket> sock = tcp_connect(the_kernel, port);
+
+  /* write two slices of a single owned buffer, and a separate copy; the
+   * socket must keep the bytes alive after the caller's handles have gone */
+  {
+    std::vector<char> bytes{'h', 'e', 'l', 'l', 'o', ','};
+    shared_buffer owned(std::move(bytes));
+    shared_buffer bufs[3] = {owned.slice(0, 5), owned.slice(5, 1),
+                             shared_buffer::copy(" world", 6)};
+    sock->write(bufs, 3);
+  }
+
+  auto fut = rx_complete.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+
+  {
+    std::lock_guard<std::mutex> guard(rx_lock);
+    REQUIRE(rx == expected);
+  }
+
+  sock->close().wait();
+  accepted->close().wait();
+  server.close().wait();
+}
+
 int main(int argc, char** argv)
 {
   try {
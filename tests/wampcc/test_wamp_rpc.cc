@@ -8,6 +8,11 @@
 #include "test_common.h"
 #include "mini_test.h"
 
+#include "wampcc/pubsub_man.h"
+
+#include <condition_variable>
+#include <mutex>
+
 using namespace wampcc;
 using namespace std;
 
@@ -121,6 +126,14 @@ TEST_CASE("test_all")
   all_tests(port, iserver);
 }
 
+TEST_CASE("test_all_lazy_args")
+{
+  internal_server iserver;
+  iserver.enable_lazy_args();
+  int port = iserver.start(global_port++);
+  all_tests(port, iserver);
+}
+
 TEST_CASE("test_all_bulk")
 {
 
@@ -196,6 +209,395 @@ TEST_CASE("test_unsubscribe")
 }
 
 
+TEST_CASE("test_publish_to_mixed_subscribers")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel());
+
+  /* subscribers for each protocol & serialiser, with more than one of each, so
+   * that the broker reuses each encoding */
+  const int protocols[] = {static_cast<int>(protocol_type::rawsocket),
+                           static_cast<int>(protocol_type::websocket)};
+  const int serialisers[] = {static_cast<int>(serialiser_type::json),
+                             static_cast<int>(serialiser_type::msgpack)};
+
+  const int num_events = 3;
+  std::vector<std::shared_ptr<wamp_session>> sessions;
+  std::vector<std::vector<int>> received;
+  std::mutex received_lock;
+  std::atomic<int> outstanding(0);
+  std::promise<void> all_received;
+
+  for (auto proto : protocols)
+    for (auto ser : serialisers)
+      for (int i = 0; i < 2; i++)
+        sessions.push_back(establish_session(the_kernel, port, proto, ser));
+  received.resize(sessions.size());
+  outstanding = sessions.size() * num_events;
+
+  for (size_t i = 0; i < sessions.size(); i++) {
+    perform_realm_logon(sessions[i]);
+
+    std::promise<void> subscribed;
+    sessions[i]->subscribe(
+        "mixed.topic", {},
+        [&](wamp_session&, subscribed_info) { subscribed.set_value(); },
+        [&, i](wamp_session&, event_info ev) {
+          {
+            std::lock_guard<std::mutex> guard(received_lock);
+            received[i].push_back(ev.args.args_list.at(0).as_int());
+          }
+          if (--outstanding == 0)
+            all_received.set_value();
+        });
+    subscribed.get_future().wait();
+  }
+
+  for (int e = 0; e < num_events; e++) {
+    wamp_args args;
+    args.args_list = json_array({e});
+    iserver.router()->publish("default_realm", "mixed.topic", {}, args);
+  }
+
+  auto fut = all_received.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+
+  for (auto& r : received) {
+    REQUIRE(r.size() == num_events);
+    for (int e = 0; e < num_events; e++)
+      REQUIRE(r[e] == e);
+  }
+
+  for (auto& ws : sessions)
+    ws->close().wait();
+}
+
+
+TEST_CASE("test_concurrent_publish_to_topics")
+{
+  /* The router runs several event threads, and each topic has its own
+   * publishing session, so publishes to different topics reach pubsub_man in
+   * parallel, while subscriptions are made and removed. */
+  config conf;
+  conf.event_loop_thread_count = 4;
+  internal_server iserver(logger::nolog(), conf);
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel());
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  const int num_topics = 4;
+  const int num_events = 200;
+  std::vector<std::vector<int>> received(num_topics);
+  std::mutex received_lock;
+  std::atomic<int> outstanding(num_topics * num_events);
+  std::promise<void> all_received;
+
+  for (int t = 0; t < num_topics; t++) {
+    std::promise<void> subscribed;
+    session->subscribe(
+        "concurrent.topic." + std::to_string(t), {},
+        [&](wamp_session&, subscribed_info) { subscribed.set_value(); },
+        [&, t](wamp_session&, event_info ev) {
+          {
+            std::lock_guard<std::mutex> guard(received_lock);
+            received[t].push_back(ev.args.args_list.at(0).as_int());
+          }
+          if (--outstanding == 0)
+            all_received.set_value();
+        });
+    subscribed.get_future().wait();
+  }
+
+  // subscribe & unsubscribe, to exact and pattern topics, until told to stop
+  auto churner = establish_session(the_kernel, port);
+  perform_realm_logon(churner);
+  std::atomic<bool> churning(true);
+  std::atomic<int> churned(0);
+  std::atomic<bool> churn_failed(false);
+  std::thread churn([&]() {
+    for (int i = 0; churning && !churn_failed; i++) {
+      std::string uri = "concurrent.topic." + std::to_string(i % num_topics);
+      json_object options;
+      if (i % 3 == 2) {
+        uri = "concurrent.topic";
+        options["match"] = "prefix";
+      }
+
+      auto subscribed = std::make_shared<std::promise<subscribed_info>>();
+      churner->subscribe(
+          uri, options,
+          [subscribed](wamp_session&, subscribed_info info) {
+            subscribed->set_value(info);
+          },
+          [](wamp_session&, event_info) {});
+      auto sub_fut = subscribed->get_future();
+      if (sub_fut.wait_for(std::chrono::seconds(3)) != std::future_status::ready) {
+        churn_failed = true;
+        break;
+      }
+      auto info = sub_fut.get();
+      if (info.was_error) {
+        churn_failed = true;
+        break;
+      }
+
+      auto unsubscribed = std::make_shared<std::promise<void>>();
+      churner->unsubscribe(info.subscription_id,
+                           [unsubscribed](wamp_session&, unsubscribed_info) {
+                             unsubscribed->set_value();
+                           });
+      if (unsubscribed->get_future().wait_for(std::chrono::seconds(3)) !=
+          std::future_status::ready)
+        churn_failed = true;
+      churned++;
+    }
+  });
+
+  std::vector<std::shared_ptr<wamp_session>> publishers;
+  for (int t = 0; t < num_topics; t++) {
+    publishers.push_back(establish_session(the_kernel, port));
+    perform_realm_logon(publishers.back());
+  }
+
+  // a publisher thread for each topic
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_topics; t++)
+    threads.emplace_back([&publishers, t]() {
+      for (int e = 0; e < num_events; e++) {
+        wamp_args args;
+        args.args_list = json_array({e});
+        publishers[t]->publish("concurrent.topic." + std::to_string(t), {},
+                               args);
+      }
+    });
+  for (auto& th : threads)
+    th.join();
+
+  auto fut = all_received.get_future();
+  bool all_arrived =
+      fut.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+
+  churning = false;
+  churn.join();
+
+  REQUIRE(all_arrived);
+  REQUIRE(churn_failed == false);
+  REQUIRE(churned > 0);
+
+  // each topic's events arrive complete and in order
+  for (auto& r : received) {
+    REQUIRE(r.size() == num_events);
+    for (int e = 0; e < num_events; e++)
+      REQUIRE(r[e] == e);
+  }
+
+  for (auto& ws : publishers)
+    ws->close().wait();
+  churner->close().wait();
+  session->close().wait();
+}
+
+
+/* Counts the events a client ignores because it did not make the
+ * subscription, which is how it sees events sent on subscriptions made for its
+ * session directly with a pubsub_man */
+struct ignored_events
+{
+  std::mutex lock;
+  int count = 0;
+
+  logger make_logger()
+  {
+    logger log;
+    log.wants_level = [](logger::Level l) { return l == logger::eWarn; };
+    log.write = [this](logger::Level, const std::string& msg, const char*,
+                       int) {
+      if (msg.find("topic event ignored") != std::string::npos) {
+        std::lock_guard<std::mutex> guard(lock);
+        count++;
+      }
+    };
+    return log;
+  }
+
+  int get()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return count;
+  }
+};
+
+
+/* Check session_closed removes a session from every topic and pattern it
+ * subscribed to.  The session stays open throughout, so any event still sent
+ * to it is delivered, and cannot instead be avoided by pruning an expired
+ * session. */
+TEST_CASE("test_session_closed_removes_subscriptions")
+{
+  unique_ptr<kernel> server_kernel(new kernel({}, logger::nolog()));
+
+  std::mutex sessions_lock;
+  std::condition_variable sessions_cv;
+  vector<shared_ptr<wamp_session>> server_sessions;
+
+  wamp_router router(server_kernel.get(), nullptr, nullptr,
+                     [&](wamp_session& ws, bool is_open) {
+                       if (is_open) {
+                         std::lock_guard<std::mutex> guard(sessions_lock);
+                         server_sessions.push_back(ws.shared_from_this());
+                         sessions_cv.notify_all();
+                       }
+                     });
+  router.callable("default_realm", "fence",
+                  [](wamp_router&, wamp_session& caller, call_info info) {
+                    caller.result(info.request_id);
+                  });
+
+  wamp_router::listen_options opts;
+  opts.node = "127.0.0.1";
+  int port = 0;
+  for (int p = global_port++; p < 65535 && !port; p++) {
+    opts.service = std::to_string(p);
+    auto fut = router.listen(auth_provider::no_auth_required(), opts);
+    if (fut.wait_for(std::chrono::seconds(1)) == std::future_status::ready &&
+        fut.get() == 0)
+      port = p;
+  }
+  REQUIRE(port != 0);
+  global_port = port + 1;
+
+  /* Each client has its own kernel, so that the events it ignores are
+   * counted separately. */
+  ignored_events ignored_a, ignored_b;
+  unique_ptr<kernel> kernel_a(new kernel({}, ignored_a.make_logger()));
+  unique_ptr<kernel> kernel_b(new kernel({}, ignored_b.make_logger()));
+  vector<shared_ptr<wamp_session>> clients;
+  for (auto k : {&kernel_a, &kernel_b}) {
+    clients.push_back(establish_session(*k, port));
+    perform_realm_logon(clients.back());
+    std::unique_lock<std::mutex> guard(sessions_lock);
+    REQUIRE(sessions_cv.wait_for(guard, std::chrono::seconds(3), [&]() {
+      return server_sessions.size() == clients.size();
+    }));
+  }
+  shared_ptr<wamp_session> session_a = server_sessions[0];
+  shared_ptr<wamp_session> session_b = server_sessions[1];
+
+  /* Publish to each topic, then wait for a reply to a call made after, so
+   * that any events sent have been received */
+  pubsub_man pubsub(server_kernel.get());
+  auto publish_all = [&](const std::vector<std::string>& topics) {
+    wamp_args args;
+    args.args_list = json_array({1});
+    for (auto& topic : topics)
+      pubsub.publish("default_realm", topic, {}, args);
+    for (auto& client : clients)
+      sync_rpc_all(client, "fence", {}, rpc_result_expect::success);
+  };
+
+  t_request_id request_id = 1;
+  json_object exact;
+  json_object prefix{{"match", "prefix"}};
+  json_object wildcard{{"match", "wildcard"}};
+  for (auto uri : {"close.topic.1", "close.topic.2"})
+    pubsub.subscribe(session_a.get(), request_id++, uri, exact);
+  pubsub.subscribe(session_a.get(), request_id++, "close.topic", prefix);
+  pubsub.subscribe(session_a.get(), request_id++, "close..1", wildcard);
+  pubsub.subscribe(session_b.get(), request_id++, "close.topic.1", exact);
+
+  /* session A gets three events for close.topic.1 and two for close.topic.2 */
+  std::vector<std::string> topics{"close.topic.1", "close.topic.2"};
+  publish_all(topics);
+  REQUIRE(ignored_a.get() == 5);
+  REQUIRE(ignored_b.get() == 1);
+
+  pubsub.session_closed(session_a);
+  publish_all(topics);
+  REQUIRE(ignored_a.get() == 5);
+  REQUIRE(ignored_b.get() == 2);
+
+  /* subscribing again starts a new list of the session's topics */
+  pubsub.subscribe(session_a.get(), request_id++, "close.topic.2", exact);
+  publish_all(topics);
+  REQUIRE(ignored_a.get() == 6);
+  REQUIRE(ignored_b.get() == 3);
+
+  pubsub.session_closed(session_a);
+  publish_all(topics);
+  REQUIRE(ignored_a.get() == 6);
+  REQUIRE(ignored_b.get() == 4);
+
+  for (auto& client : clients)
+    client->close().wait();
+}
+
+
+TEST_CASE("test_pattern_based_subscriptions")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel());
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  // topics received on each subscription
+  std::map<std::string, std::vector<std::string>> received;
+  std::mutex received_lock;
+  std::atomic<int> outstanding(0);
+  std::promise<void> all_received;
+
+  auto subscribe = [&](const std::string& uri, const char* match) {
+    json_object options;
+    if (match)
+      options["match"] = match;
+    std::promise<subscribed_info> subscribed;
+    session->subscribe(
+        uri, options,
+        [&](wamp_session&, subscribed_info info) { subscribed.set_value(info); },
+        [&, uri](wamp_session&, event_info ev) {
+          auto it = ev.details.find("topic");
+          {
+            std::lock_guard<std::mutex> guard(received_lock);
+            received[uri].push_back(it == ev.details.end() ? "" : it->second.as_string());
+          }
+          if (--outstanding == 0)
+            all_received.set_value();
+        });
+    return subscribed.get_future().get();
+  };
+
+  REQUIRE(subscribe("md.quote.AAPL", nullptr).was_error == false);
+  REQUIRE(subscribe("md.quote", "prefix").was_error == false);
+  REQUIRE(subscribe("md..AAPL", "wildcard").was_error == false);
+  REQUIRE(subscribe("md.quote.", "other").was_error == true);
+  REQUIRE(subscribe("md quote", "prefix").was_error == true);
+
+  // events expected: exact 1, prefix 3, wildcard 2
+  outstanding = 6;
+  for (auto topic : {"md.quote.AAPL", "md.quote.MSFT", "md.trade.AAPL",
+                     "md.quotes", "md.trade.MSFT"}) {
+    wamp_args args;
+    args.args_list = json_array({1});
+    iserver.router()->publish("default_realm", topic, {}, args);
+  }
+
+  auto fut = all_received.get_future();
+  REQUIRE(fut.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+
+  typedef std::vector<std::string> topics;
+  REQUIRE(received["md.quote.AAPL"] == topics({""}));
+  REQUIRE(received["md.quote"] == topics({"md.quote.AAPL", "md.quote.MSFT", "md.quotes"}));
+  REQUIRE(received["md..AAPL"] == topics({"md.quote.AAPL", "md.trade.AAPL"}));
+
+  session->close().wait();
+}
+
+
 int main(int argc, char** argv)
 {
   try